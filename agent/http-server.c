@@ -24,9 +24,13 @@
 #include <json-glib/json-glib.h>
 
 #include <hwangsae/common.h>
+#include <hwangsae/metrics.h>
 #include <libsoup/soup-message.h>
 #include <libsoup/soup-server.h>
 #include <errno.h>
+#include <string.h>
+
+#define PLAYLIST_SUFFIX ".m3u8"
 
 struct _HwangsaeHttpServer
 {
@@ -37,6 +41,7 @@ struct _HwangsaeHttpServer
   guint port;
 
   gchar *recording_dir;
+  gchar *archive_dir;
   gchar *external_ip;
 };
 
@@ -48,6 +53,7 @@ enum
 {
   PROP_PORT = 1,
   PROP_RECORDING_DIR,
+  PROP_ARCHIVE_DIR,
   PROP_EXTERNAL_IP,
   PROP_LAST
 };
@@ -72,14 +78,13 @@ get_file_path (gchar * base_path, gchar * file_id, gchar * ext)
   return file_path;
 }
 
-gchar *
-hwangsae_http_server_check_file_path (HwangsaeHttpServer * server,
-    gchar * edge_id, gchar * file_id)
+static gchar *
+find_file_path (gchar * base_path, gchar * edge_id, gchar * file_id)
 {
   g_autofree gchar *recording_edge_dir;
   gchar *file_path;
 
-  recording_edge_dir = g_build_filename (server->recording_dir, edge_id, NULL);
+  recording_edge_dir = g_build_filename (base_path, edge_id, NULL);
 
   file_path = get_file_path (recording_edge_dir, file_id, "ts");
   if (g_file_test (file_path, G_FILE_TEST_EXISTS))
@@ -95,6 +100,79 @@ hwangsae_http_server_check_file_path (HwangsaeHttpServer * server,
   return NULL;
 }
 
+static gchar *
+find_named_file_path (gchar * base_path, gchar * edge_id, gchar * filename)
+{
+  gchar *file_path;
+
+  file_path = g_build_filename (base_path, edge_id, filename, NULL);
+  if (g_file_test (file_path, G_FILE_TEST_EXISTS))
+    return file_path;
+
+  g_free (file_path);
+
+  return NULL;
+}
+
+/* Rejects names that could lead out of the directory they are looked up
+ * in, along with hidden files. */
+static gboolean
+is_valid_name (const gchar * name)
+{
+  return name && name[0] != '\0' && name[0] != '.' && !strchr (name, '/') &&
+      !strchr (name, '\\');
+}
+
+/* Playlists and the files they list are requested by their filenames. */
+static gboolean
+is_filename (const gchar * file_id)
+{
+  return g_str_has_suffix (file_id, PLAYLIST_SUFFIX) ||
+      g_str_has_suffix (file_id, ".ts") || g_str_has_suffix (file_id, ".mp4");
+}
+
+gchar *
+hwangsae_http_server_check_file_path (HwangsaeHttpServer * server,
+    gchar * edge_id, gchar * file_id)
+{
+  gchar *file_path;
+
+  if (!is_valid_name (edge_id) || !is_valid_name (file_id)) {
+    return NULL;
+  }
+
+  if (is_filename (file_id)) {
+    file_path = find_named_file_path (server->recording_dir, edge_id,
+        file_id);
+    if (!file_path && server->archive_dir) {
+      file_path = find_named_file_path (server->archive_dir, edge_id,
+          file_id);
+    }
+    return file_path;
+  }
+
+  file_path = find_file_path (server->recording_dir, edge_id, file_id);
+  if (!file_path && server->archive_dir) {
+    /* Older recordings may have moved to the second storage tier. */
+    file_path = find_file_path (server->archive_dir, edge_id, file_id);
+  }
+
+  return file_path;
+}
+
+static const gchar *
+get_content_type (const gchar * file_path)
+{
+  if (g_str_has_suffix (file_path, PLAYLIST_SUFFIX))
+    return "application/vnd.apple.mpegurl";
+  if (g_str_has_suffix (file_path, ".ts"))
+    return "video/mp2t";
+  if (g_str_has_suffix (file_path, ".mp4"))
+    return "video/mp4";
+
+  return NULL;
+}
+
 gchar *
 hwangsae_http_server_get_url (HwangsaeHttpServer * server, gchar * edge_id,
     gchar * file_id)
@@ -117,6 +195,27 @@ hwangsae_http_server_get_url (HwangsaeHttpServer * server, gchar * edge_id,
       file_id);
 }
 
+static void
+metrics_cb (SoupServer * server, SoupMessage * msg, const char *path,
+    GHashTable * query, SoupClientContext * client, gpointer user_data)
+{
+  g_autoptr (GVariant) metrics = NULL;
+  gchar *json;
+  gsize length;
+
+  if (msg->method != SOUP_METHOD_GET) {
+    soup_message_set_status (msg, SOUP_STATUS_METHOD_NOT_ALLOWED);
+    return;
+  }
+
+  metrics = g_variant_ref_sink (hwangsae_metrics_snapshot ());
+  json = json_gvariant_serialize_data (metrics, &length);
+
+  soup_message_set_response (msg, "application/json", SOUP_MEMORY_TAKE, json,
+      length);
+  soup_message_set_status (msg, SOUP_STATUS_OK);
+}
+
 static void
 http_cb (SoupServer * server, SoupMessage * msg, const char *path,
     GHashTable * query, SoupClientContext * client, gpointer user_data)
@@ -128,6 +227,7 @@ http_cb (SoupServer * server, SoupMessage * msg, const char *path,
   g_autofree gchar *file_path = NULL;
   g_autofree gchar *file_name = NULL;
   g_autoptr (GHashTable) params = NULL;
+  const gchar *content_type;
   GMappedFile *mapping;
   GStatBuf st;
   SoupBuffer *buffer;
@@ -153,7 +253,14 @@ http_cb (SoupServer * server, SoupMessage * msg, const char *path,
   }
 
   edge_id = g_strdup (parts[1]);
-  file_id = g_strdup (parts[2]);
+
+  /* "?iframes" asks for the I-frame only rendition of the file. */
+  if (query && g_hash_table_contains (query, "iframes") &&
+      !is_filename (parts[2])) {
+    file_id = g_strconcat (parts[2], ".iframes", NULL);
+  } else {
+    file_id = g_strdup (parts[2]);
+  }
 
   g_strfreev (parts);
 
@@ -188,6 +295,18 @@ http_cb (SoupServer * server, SoupMessage * msg, const char *path,
       mapping, (GDestroyNotify) g_mapped_file_unref);
   soup_message_body_append_buffer (msg->response_body, buffer);
   soup_buffer_free (buffer);
+
+  content_type = get_content_type (file_path);
+  if (content_type) {
+    soup_message_headers_set_content_type (msg->response_headers,
+        content_type, NULL);
+  }
+  if (g_str_has_suffix (file_path, PLAYLIST_SUFFIX)) {
+    /* Playlists of ongoing recordings keep growing. */
+    soup_message_headers_replace (msg->response_headers, "Cache-Control",
+        "no-cache");
+  }
+
   soup_message_set_status (msg, SOUP_STATUS_OK);
 
   params = g_hash_table_new (g_str_hash, g_str_equal);
@@ -211,10 +330,13 @@ hwangsae_http_server_constructed (GObject * object)
   GError *error = NULL;
 
   self->recording_dir = NULL;
+  self->archive_dir = NULL;
   self->external_ip = NULL;
 
   self->soup_server = soup_server_new (NULL, NULL);
   soup_server_add_handler (self->soup_server, NULL, http_cb, self, NULL);
+  soup_server_add_handler (self->soup_server, "/metrics", metrics_cb, self,
+      NULL);
 
   soup_server_listen_all (self->soup_server, self->port, 0, &error);
   g_assert_no_error (error);
@@ -236,6 +358,15 @@ hwangsae_http_server_set_property (GObject * object, guint property_id,
       g_clear_pointer (&self->recording_dir, g_free);
       self->recording_dir = g_strdup (g_value_get_string (value));
       break;
+    case PROP_ARCHIVE_DIR:
+    {
+      const gchar *dir = g_value_get_string (value);
+      g_clear_pointer (&self->archive_dir, g_free);
+      if (dir && dir[0] != '\0') {
+        self->archive_dir = g_strdup (dir);
+      }
+      break;
+    }
     case PROP_EXTERNAL_IP:
     {
       const gchar *ip = g_value_get_string (value);
@@ -263,6 +394,9 @@ hwangsae_http_server_get_property (GObject * object, guint property_id,
     case PROP_RECORDING_DIR:
       g_value_set_string (value, self->recording_dir);
       break;
+    case PROP_ARCHIVE_DIR:
+      g_value_set_string (value, self->archive_dir);
+      break;
     case PROP_EXTERNAL_IP:
       g_value_set_string (value, self->external_ip);
       break;
@@ -279,6 +413,7 @@ hwangsae_http_server_dispose (GObject * object)
   soup_server_disconnect (self->soup_server);
   g_clear_object (&self->soup_server);
   g_clear_pointer (&self->recording_dir, g_free);
+  g_clear_pointer (&self->archive_dir, g_free);
 }
 
 static void
@@ -301,6 +436,11 @@ hwangsae_http_server_class_init (HwangsaeHttpServerClass * klass)
           "Recording Directory", "",
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_ARCHIVE_DIR,
+      g_param_spec_string ("archive-dir", "Archive Directory",
+          "Second storage tier of recordings", "",
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_property (gobject_class, PROP_EXTERNAL_IP,
       g_param_spec_string ("external-ip", "External IP address",
           "External IP address", "",
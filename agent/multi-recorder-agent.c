@@ -121,8 +121,15 @@ hwangsae_multi_recorder_agent_start_recording (HwangsaeRecorderAgent *
   hwangsae_recorder_set_container (recording_data->recorder,
       HWANGSAE_CONTAINER_TS);
 
+  /* All edges share one set of recording threads. A relay link that drops
+   * briefly keeps the recording session. */
+  g_object_set (recording_data->recorder, "passthrough", TRUE,
+      "shared-engine", TRUE, "reconnect-timeout", 30, NULL);
+
   g_signal_connect (recording_data->recorder, "stream-disconnected",
       (GCallback) stream_disconnected_cb, self);
+  hwangsae_recorder_agent_watch_recorder (recorder_agent,
+      recording_data->recorder);
 
   edge_id_key = g_strdup (edge_id);
   g_hash_table_insert (self->edge_map, edge_id_key, recording_data);
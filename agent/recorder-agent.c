@@ -22,6 +22,8 @@
 #include "http-server.h"
 #include <chamge/chamge.h>
 #include <hwangsae/recorder.h>
+#include <hwangsae/metrics.h>
+#include <hwangsae/retention.h>
 #include <glib/gstdio.h>
 #include <gst/gst.h>
 #include <libsoup/soup.h>
@@ -44,6 +46,7 @@ typedef struct
   Hwangsae1DBusRecorderInterface *recorder_interface;
   GSettings *settings;
   HwangsaeHttpServer *hwangsae_http_server;
+  HwangsaeRetention *retention;
 
   gchar *recording_dir;
   gchar *relay_address;
@@ -192,6 +195,22 @@ hwangsae_recorder_agent_dbus_unregister (GApplication * app,
       (app, connection, object_path);
 }
 
+/* *INDENT-OFF* */
+gboolean
+hwangsae_recorder_agent_manager_handle_get_metrics
+    (Hwangsae1DBusManager * object, GDBusMethodInvocation * invocation,
+    gpointer user_data)
+/* *INDENT-ON* */
+
+{
+  g_debug ("hwangsae_recorder_agent_manager_handle_get_metrics");
+
+  hwangsae1_dbus_manager_complete_get_metrics (object, invocation,
+      hwangsae_metrics_snapshot ());
+
+  return TRUE;
+}
+
 /* *INDENT-OFF* */
 gboolean
 hwangsae_recorder_agent_recorder_interface_handle_start
@@ -264,8 +283,10 @@ parse_filename (const gchar * fn, gchar ** record_id, gint64 * file_start,
   *file_start = 0;
   *file_end = 0;
 
+  /* Skips the keyframe indexes and I-frame renditions next to recordings. */
   parts = g_strsplit (fn, ".", -1);
-  if (!(parts && parts[0] && parts[1]))
+  if (!(parts && parts[0] && parts[1]) || parts[2] ||
+      (g_strcmp0 (parts[1], "ts") && g_strcmp0 (parts[1], "mp4")))
     goto cleanup;
 
   tmp = g_strdup (parts[0]);
@@ -398,6 +419,37 @@ get_records (const gchar * recording_dir, gchar * arg_edge_id,
   return edge_id;
 }
 
+/* Looks for records in both storage tiers. */
+static gchar *
+get_records_all_tiers (HwangsaeRecorderAgent * self, gchar * arg_edge_id,
+    gchar * arg_record_id, gint64 arg_from, gint64 arg_to,
+    GVariantBuilder * builder)
+{
+  HwangsaeRecorderAgentPrivate *priv =
+      hwangsae_recorder_agent_get_instance_private (self);
+  g_autofree gchar *archive_dir = NULL;
+  g_autofree gchar *archived_edge_id = NULL;
+  gchar *edge_id;
+
+  g_object_get (priv->retention, "archive-dir", &archive_dir, NULL);
+
+  /* Archived files are the older ones, list them first. */
+  if (archive_dir) {
+    archived_edge_id = get_records (archive_dir, arg_edge_id, arg_record_id,
+        arg_from, arg_to, builder);
+  }
+
+  edge_id = get_records (priv->recording_dir, arg_edge_id, arg_record_id,
+      arg_from, arg_to, builder);
+
+  if ((!edge_id || edge_id[0] == '\0') && archived_edge_id) {
+    g_free (edge_id);
+    edge_id = g_steal_pointer (&archived_edge_id);
+  }
+
+  return edge_id;
+}
+
 /* *INDENT-OFF* */
 gboolean
 hwangsae_recorder_agent_recorder_interface_handle_lookup_by_record
@@ -411,15 +463,13 @@ hwangsae_recorder_agent_recorder_interface_handle_lookup_by_record
   g_autofree gchar *edge_id = NULL;
   g_autoptr (GVariantBuilder) builder = NULL;
   GVariant *records = NULL;
-  HwangsaeRecorderAgentPrivate *priv =
-      hwangsae_recorder_agent_get_instance_private (self);
 
   g_debug
       ("hwangsae_recorder_agent_recorder_interface_handle_lookup_by_record");
 
   builder = g_variant_builder_new (G_VARIANT_TYPE ("a(sxxx)"));
 
-  edge_id = get_records (priv->recording_dir, NULL, arg_record_id, arg_from,
+  edge_id = get_records_all_tiers (self, NULL, arg_record_id, arg_from,
       arg_to, builder);
 
   records = g_variant_builder_end (builder);
@@ -443,15 +493,13 @@ hwangsae_recorder_agent_recorder_interface_handle_lookup_by_edge
   g_autofree gchar *edge_id = NULL;
   g_autoptr (GVariantBuilder) builder = NULL;
   GVariant *records = NULL;
-  HwangsaeRecorderAgentPrivate *priv =
-      hwangsae_recorder_agent_get_instance_private (self);
 
 
   g_debug ("hwangsae_recorder_agent_recorder_interface_handle_lookup_by_edge");
 
   builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ssxxx)"));
 
-  edge_id = get_records (priv->recording_dir, arg_edge_id, NULL, arg_from,
+  edge_id = get_records_all_tiers (self, arg_edge_id, NULL, arg_from,
       arg_to, builder);
 
   records = g_variant_builder_end (builder);
@@ -510,7 +558,8 @@ hwangsae_recorder_agent_recorder_interface_handle_delete
 
   if (filename) {
     g_debug ("deleting file %s", filename);
-    g_remove (filename);
+    hwangsae_retention_remove_file (priv->retention, filename);
+    hwangsae_retention_unlink_recording (filename);
   } else {
     g_debug ("unable to delete file id %s, not found", arg_file_id);
   }
@@ -520,6 +569,30 @@ hwangsae_recorder_agent_recorder_interface_handle_delete
   return TRUE;
 }
 
+static void
+file_completed_cb (HwangsaeRecorder * recorder, const gchar * file_path,
+    HwangsaeRecorderAgent * self)
+{
+  HwangsaeRecorderAgentPrivate *priv =
+      hwangsae_recorder_agent_get_instance_private (self);
+
+  hwangsae_retention_add_file (priv->retention, file_path);
+}
+
+void
+hwangsae_recorder_agent_watch_recorder (HwangsaeRecorderAgent * self,
+    HwangsaeRecorder * recorder)
+{
+  HwangsaeRecorderAgentPrivate *priv =
+      hwangsae_recorder_agent_get_instance_private (self);
+
+  g_signal_connect (recorder, "file-completed",
+      (GCallback) file_completed_cb, self);
+
+  g_settings_bind (priv->settings, "hls-playlist", recorder, "hls-playlist",
+      G_SETTINGS_BIND_GET);
+}
+
 gchar *
 hwangsae_recorder_agent_get_recorder_id (HwangsaeRecorderAgent * self)
 {
@@ -580,6 +653,10 @@ hwangsae_recorder_agent_set_property (GObject * object, guint property_id,
         g_object_set (priv->hwangsae_http_server, "recording-dir",
             priv->recording_dir, NULL);
       }
+      if (priv->retention) {
+        g_object_set (priv->retention, "recording-dir", priv->recording_dir,
+            NULL);
+      }
       break;
     }
     case PROP_RELAY_ADDRESS:
@@ -641,6 +718,7 @@ hwangsae_recorder_agent_dispose (GObject * object)
   g_clear_object (&priv->manager);
   g_clear_object (&priv->recorder_interface);
   g_clear_object (&priv->hwangsae_http_server);
+  g_clear_object (&priv->retention);
 
   G_OBJECT_CLASS (hwangsae_recorder_agent_parent_class)->dispose (object);
 }
@@ -701,6 +779,8 @@ hwangsae_recorder_agent_init (HwangsaeRecorderAgent * self)
       hwangsae_http_server_new (g_settings_get_uint (priv->settings,
           "http-port"));
 
+  priv->retention = hwangsae_retention_new ();
+
   g_settings_bind (priv->settings, "recording-dir", self, "recording-dir",
       G_SETTINGS_BIND_DEFAULT);
 
@@ -719,6 +799,33 @@ hwangsae_recorder_agent_init (HwangsaeRecorderAgent * self)
   g_settings_bind (priv->settings, "external-ip", priv->hwangsae_http_server,
       "external-ip", G_SETTINGS_BIND_DEFAULT);
 
+  g_settings_bind (priv->settings, "retention-max-age", priv->retention,
+      "max-age", G_SETTINGS_BIND_DEFAULT);
+
+  g_settings_bind (priv->settings, "retention-max-bytes", priv->retention,
+      "max-bytes", G_SETTINGS_BIND_DEFAULT);
+
+  g_settings_bind (priv->settings, "retention-edge-max-age", priv->retention,
+      "edge-max-age", G_SETTINGS_BIND_DEFAULT);
+
+  g_settings_bind (priv->settings, "retention-edge-max-bytes",
+      priv->retention, "edge-max-bytes", G_SETTINGS_BIND_DEFAULT);
+
+  g_settings_bind (priv->settings, "retention-unlink-rate", priv->retention,
+      "unlink-rate", G_SETTINGS_BIND_DEFAULT);
+
+  g_settings_bind (priv->settings, "archive-dir", priv->retention,
+      "archive-dir", G_SETTINGS_BIND_DEFAULT);
+
+  g_settings_bind (priv->settings, "archive-dir", priv->hwangsae_http_server,
+      "archive-dir", G_SETTINGS_BIND_DEFAULT);
+
+  g_settings_bind (priv->settings, "archive-age", priv->retention,
+      "archive-age", G_SETTINGS_BIND_DEFAULT);
+
+  g_settings_bind (priv->settings, "archive-bandwidth", priv->retention,
+      "archive-bandwidth", G_SETTINGS_BIND_DEFAULT);
+
   if (!g_strcmp0 (priv->recorder_id, "randomized-string")
       || strnlen (priv->recorder_id, 64) == 0) {
     g_autofree gchar *uid = g_uuid_string_random ();
@@ -732,6 +839,9 @@ hwangsae_recorder_agent_init (HwangsaeRecorderAgent * self)
 
   hwangsae1_dbus_manager_set_status (priv->manager, 1);
 
+  g_signal_connect (priv->manager, "handle-get-metrics",
+      G_CALLBACK (hwangsae_recorder_agent_manager_handle_get_metrics), self);
+
   priv->recorder_interface = hwangsae1_dbus_recorder_interface_skeleton_new ();
 
   g_signal_connect (priv->recorder_interface, "handle-start",
@@ -21,6 +21,7 @@
 #define __HWANGSAE_RECORDER_AGENT_H__
 
 #include <hwangsaeul/application.h>
+#include <hwangsae/recorder.h>
 
 G_BEGIN_DECLS
 #ifndef _RECORDER_AGENT_EXTERN
@@ -63,6 +64,12 @@ gchar         *hwangsae_recorder_agent_get_relay_address
 guint          hwangsae_recorder_agent_get_relay_stream_port
                                                  (HwangsaeRecorderAgent * self);
 
+/* Accounts the files @recorder completes in the storage retention and
+ * applies the recorder settings to it. */
+void           hwangsae_recorder_agent_watch_recorder
+                                                 (HwangsaeRecorderAgent * self,
+                                                  HwangsaeRecorder * recorder);
+
 void           hwangsae_recorder_agent_send_rest_api
                                                  (HwangsaeRecorderAgent * self,
                                                   RelayMethods method, 
@@ -126,6 +126,8 @@ static void
 hwangsae_simple_recorder_agent_init (HwangsaeSimpleRecorderAgent * self)
 {
   self->recorder = hwangsae_recorder_new ();
+  hwangsae_recorder_agent_watch_recorder (HWANGSAE_RECORDER_AGENT (self),
+      self->recorder);
   self->is_recording = FALSE;
   self->edge_id = NULL;
 }
@@ -0,0 +1,263 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "capture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+
+#define RECORD_ALIGN 8
+
+struct _HwangsaeCapture
+{
+  gint fd;
+  guint8 *map;
+  gsize map_size;
+
+  HwangsaeCaptureHeader *header;
+  guint8 *records;
+
+  gint64 start_monotonic;
+};
+
+struct _HwangsaeCaptureReader
+{
+  GMappedFile *file;
+
+  const HwangsaeCaptureHeader *header;
+  const guint8 *records;
+
+  guint64 offset;
+};
+
+static gsize
+_record_size (gsize payload_size)
+{
+  gsize size = sizeof (HwangsaeCaptureRecord) + payload_size;
+
+  return (size + RECORD_ALIGN - 1) & ~(gsize) (RECORD_ALIGN - 1);
+}
+
+/* Returns the logical offset where the record following the one at @offset
+ * starts. A record never wraps around the end of the record area; when it
+ * doesn't fit, the writer continues from the area start and the leftover
+ * space is skipped. */
+static guint64
+_next_record (const HwangsaeCaptureHeader * header, const guint8 * records,
+    guint64 offset)
+{
+  gsize pos = offset % header->capacity;
+  const HwangsaeCaptureRecord *record;
+
+  if (header->capacity - pos < sizeof (HwangsaeCaptureRecord)) {
+    return offset + (header->capacity - pos);
+  }
+
+  record = (const HwangsaeCaptureRecord *) (records + pos);
+  if (record->type == 0) {
+    /* Padding up to the end of the area. */
+    return offset + (header->capacity - pos);
+  }
+
+  return offset + _record_size (record->size);
+}
+
+HwangsaeCapture *
+hwangsae_capture_new (const gchar * path, gsize capacity, GError ** error)
+{
+  HwangsaeCapture *capture;
+  gint fd;
+  gsize map_size;
+  guint8 *map;
+
+  capacity &= ~(gsize) (RECORD_ALIGN - 1);
+  if (capacity < 64 * 1024) {
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+        "Capture capacity %" G_GSIZE_FORMAT " is too small", capacity);
+    return NULL;
+  }
+
+  fd = g_open (path, O_RDWR | O_CREAT | O_TRUNC, 0640);
+  if (fd < 0) {
+    gint err = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (err),
+        "Can't open %s: %s", path, g_strerror (err));
+    return NULL;
+  }
+
+  map_size = sizeof (HwangsaeCaptureHeader) + capacity;
+
+  if (ftruncate (fd, map_size) != 0 ||
+      (map = mmap (NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                  0)) == MAP_FAILED) {
+    gint err = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (err),
+        "Can't map %s: %s", path, g_strerror (err));
+    close (fd);
+    return NULL;
+  }
+
+  capture = g_new0 (HwangsaeCapture, 1);
+  capture->fd = fd;
+  capture->map = map;
+  capture->map_size = map_size;
+  capture->header = (HwangsaeCaptureHeader *) map;
+  capture->records = map + sizeof (HwangsaeCaptureHeader);
+  capture->start_monotonic = g_get_monotonic_time ();
+
+  memcpy (capture->header->magic, HWANGSAE_CAPTURE_MAGIC,
+      sizeof (capture->header->magic));
+  capture->header->version = HWANGSAE_CAPTURE_VERSION;
+  capture->header->header_size = sizeof (HwangsaeCaptureHeader);
+  capture->header->capacity = capacity;
+  capture->header->start_time = g_get_real_time ();
+
+  return capture;
+}
+
+void
+hwangsae_capture_free (HwangsaeCapture * capture)
+{
+  msync (capture->map, capture->map_size, MS_ASYNC);
+  munmap (capture->map, capture->map_size);
+  close (capture->fd);
+  g_free (capture);
+}
+
+void
+hwangsae_capture_write (HwangsaeCapture * capture,
+    HwangsaeCaptureRecordType type, gint socket, const guint8 * data,
+    gsize size)
+{
+  HwangsaeCaptureHeader *header = capture->header;
+  HwangsaeCaptureRecord *record;
+  gsize record_size = _record_size (size);
+  gsize pos = header->head % header->capacity;
+  guint64 head = header->head;
+
+  if (record_size > header->capacity / 2) {
+    g_warning ("Dropping capture record of %" G_GSIZE_FORMAT " bytes", size);
+    return;
+  }
+
+  if (header->capacity - pos < record_size) {
+    /* Doesn't fit before the end of the area, pad and wrap around. */
+    if (header->capacity - pos >= sizeof (HwangsaeCaptureRecord)) {
+      ((HwangsaeCaptureRecord *) (capture->records + pos))->type = 0;
+    }
+    head += header->capacity - pos;
+    pos = 0;
+  }
+
+  /* Drop the oldest records this one is going to overwrite. */
+  while (head + record_size - header->tail > header->capacity) {
+    header->tail = _next_record (header, capture->records, header->tail);
+  }
+
+  record = (HwangsaeCaptureRecord *) (capture->records + pos);
+  record->size = size;
+  record->type = type;
+  record->reserved = 0;
+  record->timestamp = g_get_monotonic_time () - capture->start_monotonic;
+  record->socket = socket;
+  record->reserved2 = 0;
+  if (size) {
+    memcpy (record + 1, data, size);
+  }
+
+  header->head = head + record_size;
+}
+
+HwangsaeCaptureReader *
+hwangsae_capture_reader_new (const gchar * path, GError ** error)
+{
+  HwangsaeCaptureReader *reader;
+  GMappedFile *file;
+  const HwangsaeCaptureHeader *header;
+  gsize length;
+
+  file = g_mapped_file_new (path, FALSE, error);
+  if (!file) {
+    return NULL;
+  }
+
+  length = g_mapped_file_get_length (file);
+  header = (const HwangsaeCaptureHeader *) g_mapped_file_get_contents (file);
+
+  if (length < sizeof (HwangsaeCaptureHeader) ||
+      memcmp (header->magic, HWANGSAE_CAPTURE_MAGIC,
+          sizeof (header->magic)) != 0 ||
+      header->version != HWANGSAE_CAPTURE_VERSION ||
+      header->header_size != sizeof (HwangsaeCaptureHeader) ||
+      length < header->header_size + header->capacity) {
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+        "%s is not a relay capture file", path);
+    g_mapped_file_unref (file);
+    return NULL;
+  }
+
+  reader = g_new0 (HwangsaeCaptureReader, 1);
+  reader->file = file;
+  reader->header = header;
+  reader->records = (const guint8 *) header + header->header_size;
+  reader->offset = header->tail;
+
+  return reader;
+}
+
+void
+hwangsae_capture_reader_free (HwangsaeCaptureReader * reader)
+{
+  g_mapped_file_unref (reader->file);
+  g_free (reader);
+}
+
+/* Iterates the records from the oldest to the newest. */
+gboolean
+hwangsae_capture_reader_next (HwangsaeCaptureReader * reader,
+    const HwangsaeCaptureRecord ** record, const guint8 ** data)
+{
+  const HwangsaeCaptureHeader *header = reader->header;
+
+  while (reader->offset < header->head) {
+    gsize pos = reader->offset % header->capacity;
+    const HwangsaeCaptureRecord *r =
+        (const HwangsaeCaptureRecord *) (reader->records + pos);
+
+    if (header->capacity - pos < sizeof (HwangsaeCaptureRecord) ||
+        r->type == 0) {
+      reader->offset = _next_record (header, reader->records, reader->offset);
+      continue;
+    }
+
+    reader->offset += _record_size (r->size);
+
+    *record = r;
+    *data = (const guint8 *) (r + 1);
+
+    return TRUE;
+  }
+
+  return FALSE;
+}
@@ -0,0 +1,91 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+#include <glib.h>
+
+/* Binary trace of relay traffic kept in a memory-mapped ring file. Once the
+ * ring is full, the oldest records get overwritten. All integers are stored
+ * in host byte order; traces are meant to be replayed on the machine type
+ * that captured them. */
+
+#define HWANGSAE_CAPTURE_MAGIC   "HWSTRACE"
+#define HWANGSAE_CAPTURE_VERSION 1
+
+typedef enum
+{
+  HWANGSAE_CAPTURE_RECORD_SINK_CONNECTED = 1,
+  HWANGSAE_CAPTURE_RECORD_SINK_DISCONNECTED,
+  HWANGSAE_CAPTURE_RECORD_SOURCE_CONNECTED,
+  HWANGSAE_CAPTURE_RECORD_SOURCE_DISCONNECTED,
+  HWANGSAE_CAPTURE_RECORD_PACKET,
+} HwangsaeCaptureRecordType;
+
+typedef struct
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 header_size;
+  /* Size of the record area following the header. */
+  guint64 capacity;
+  /* Logical offsets into the record area, growing without wrapping. The
+   * oldest record starts at tail, the next one will be written at head. */
+  guint64 head;
+  guint64 tail;
+  /* Wall clock time of the capture start in microseconds. */
+  gint64 start_time;
+} HwangsaeCaptureHeader;
+
+/* Records are 8-byte aligned. CONNECTED records carry the username, sources
+ * followed by a NUL and the requested resource; PACKET records carry the
+ * payload as received from the sink. */
+typedef struct
+{
+  guint32 size;
+  guint16 type;
+  guint16 reserved;
+  /* Microseconds since the capture start. */
+  gint64 timestamp;
+  gint32 socket;
+  guint32 reserved2;
+} HwangsaeCaptureRecord;
+
+typedef struct _HwangsaeCapture HwangsaeCapture;
+
+HwangsaeCapture *hwangsae_capture_new          (const gchar     *path,
+                                                gsize            capacity,
+                                                GError         **error);
+
+void             hwangsae_capture_free         (HwangsaeCapture *capture);
+
+void             hwangsae_capture_write        (HwangsaeCapture *capture,
+                                                HwangsaeCaptureRecordType
+                                                                 type,
+                                                gint             socket,
+                                                const guint8    *data,
+                                                gsize            size);
+
+typedef struct _HwangsaeCaptureReader HwangsaeCaptureReader;
+
+HwangsaeCaptureReader
+                *hwangsae_capture_reader_new   (const gchar     *path,
+                                                GError         **error);
+
+void             hwangsae_capture_reader_free  (HwangsaeCaptureReader *reader);
+
+gboolean         hwangsae_capture_reader_next  (HwangsaeCaptureReader *reader,
+                                                const HwangsaeCaptureRecord
+                                                               **record,
+                                                const guint8   **data);
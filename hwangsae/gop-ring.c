@@ -0,0 +1,241 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "gop-ring.h"
+
+#include <string.h>
+
+typedef struct
+{
+  gint64 arrival_us;
+  gsize len;
+  guint8 data[];
+} Chunk;
+
+struct _HwangsaeGopRing
+{
+  gint64 window_us;
+  gsize max_bytes;
+
+  /* Circular array of chunk pointers; chunks[head] has sequence number
+   * head_seq. */
+  Chunk **chunks;
+  guint capacity;
+  guint head;
+  guint len;
+  guint64 head_seq;
+  gsize bytes;
+
+  /* Ascending sequence numbers of chunks starting with a random access
+   * point. The first one always equals head_seq. */
+  GArray *keyframes;
+};
+
+HwangsaeGopRing *
+hwangsae_gop_ring_new (gint64 window_us, gsize max_bytes)
+{
+  HwangsaeGopRing *ring = g_new0 (HwangsaeGopRing, 1);
+
+  ring->window_us = window_us;
+  ring->max_bytes = max_bytes;
+  ring->capacity = 1024;
+  ring->chunks = g_new0 (Chunk *, ring->capacity);
+  ring->keyframes = g_array_new (FALSE, FALSE, sizeof (guint64));
+
+  return ring;
+}
+
+static Chunk *
+_ring_nth (HwangsaeGopRing * ring, guint n)
+{
+  return ring->chunks[(ring->head + n) % ring->capacity];
+}
+
+static void
+_ring_pop (HwangsaeGopRing * ring)
+{
+  Chunk *chunk = ring->chunks[ring->head];
+
+  ring->chunks[ring->head] = NULL;
+  ring->head = (ring->head + 1) % ring->capacity;
+  ring->bytes -= chunk->len;
+  --ring->len;
+  ++ring->head_seq;
+
+  g_free (chunk);
+}
+
+/* Drops the oldest GOP, so that the ring starts at the next keyframe. */
+static void
+_ring_drop_gop (HwangsaeGopRing * ring)
+{
+  guint64 end;
+
+  g_array_remove_index (ring->keyframes, 0);
+
+  end = (ring->keyframes->len > 0) ?
+      g_array_index (ring->keyframes, guint64, 0) : ring->head_seq + ring->len;
+
+  while (ring->head_seq < end) {
+    _ring_pop (ring);
+  }
+}
+
+static void
+_ring_grow (HwangsaeGopRing * ring)
+{
+  guint new_capacity = ring->capacity * 2;
+  Chunk **chunks = g_new0 (Chunk *, new_capacity);
+  guint i;
+
+  for (i = 0; i != ring->len; ++i) {
+    chunks[i] = _ring_nth (ring, i);
+  }
+
+  g_free (ring->chunks);
+  ring->chunks = chunks;
+  ring->capacity = new_capacity;
+  ring->head = 0;
+}
+
+/* @keyframe tells whether the chunk starts with a random access point,
+ * which is up to the caller to find out. */
+void
+hwangsae_gop_ring_push (HwangsaeGopRing * ring, const guint8 * data,
+    gsize len, gint64 arrival_us, gboolean keyframe)
+{
+  Chunk *chunk;
+
+  if (ring->len == 0 && !keyframe) {
+    /* Nothing to decode from until the first keyframe arrives. */
+    return;
+  }
+
+  if (keyframe) {
+    guint64 seq = ring->head_seq + ring->len;
+
+    g_array_append_val (ring->keyframes, seq);
+  }
+
+  if (ring->len == ring->capacity) {
+    _ring_grow (ring);
+  }
+
+  chunk = g_malloc (sizeof (Chunk) + len);
+  chunk->arrival_us = arrival_us;
+  chunk->len = len;
+  memcpy (chunk->data, data, len);
+
+  ring->chunks[(ring->head + ring->len) % ring->capacity] = chunk;
+  ++ring->len;
+  ring->bytes += len;
+
+  /* Evict whole GOPs while the window stays non-empty, i.e. while there is
+   * a newer keyframe to start from. */
+  while (ring->keyframes->len > 1) {
+    Chunk *first = _ring_nth (ring, 0);
+
+    if (ring->bytes <= ring->max_bytes &&
+        arrival_us - first->arrival_us <= ring->window_us) {
+      break;
+    }
+
+    _ring_drop_gop (ring);
+  }
+}
+
+gboolean
+hwangsae_gop_ring_seek (HwangsaeGopRing * ring, gint64 time_us, guint64 * seq)
+{
+  guint i;
+
+  if (ring->keyframes->len == 0) {
+    return FALSE;
+  }
+
+  *seq = g_array_index (ring->keyframes, guint64, 0);
+
+  for (i = 1; i < ring->keyframes->len; ++i) {
+    guint64 keyframe = g_array_index (ring->keyframes, guint64, i);
+
+    if (_ring_nth (ring, keyframe - ring->head_seq)->arrival_us > time_us) {
+      break;
+    }
+
+    *seq = keyframe;
+  }
+
+  return TRUE;
+}
+
+const guint8 *
+hwangsae_gop_ring_get (HwangsaeGopRing * ring, guint64 seq, gsize * len,
+    gint64 * arrival_us)
+{
+  Chunk *chunk;
+
+  if (seq < ring->head_seq || seq >= ring->head_seq + ring->len) {
+    return NULL;
+  }
+
+  chunk = _ring_nth (ring, seq - ring->head_seq);
+
+  if (len) {
+    *len = chunk->len;
+  }
+  if (arrival_us) {
+    *arrival_us = chunk->arrival_us;
+  }
+
+  return chunk->data;
+}
+
+guint64
+hwangsae_gop_ring_get_head (HwangsaeGopRing * ring)
+{
+  return ring->head_seq;
+}
+
+guint64
+hwangsae_gop_ring_get_tail (HwangsaeGopRing * ring)
+{
+  return ring->head_seq + ring->len;
+}
+
+gsize
+hwangsae_gop_ring_get_size (HwangsaeGopRing * ring)
+{
+  return ring->bytes;
+}
+
+void
+hwangsae_gop_ring_clear (HwangsaeGopRing * ring)
+{
+  while (ring->len > 0) {
+    _ring_pop (ring);
+  }
+  g_array_set_size (ring->keyframes, 0);
+}
+
+void
+hwangsae_gop_ring_free (HwangsaeGopRing * ring)
+{
+  hwangsae_gop_ring_clear (ring);
+  g_array_unref (ring->keyframes);
+  g_free (ring->chunks);
+  g_free (ring);
+}
@@ -0,0 +1,51 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+#include <glib.h>
+
+/* A time and memory bounded window of MPEG-TS chunks that always starts at
+ * a random access point. Chunks are addressed by a monotonically increasing
+ * sequence number, so readers can keep their position across evictions and
+ * detect when they fell out of the window. Not thread-safe. */
+typedef struct _HwangsaeGopRing HwangsaeGopRing;
+
+HwangsaeGopRing *hwangsae_gop_ring_new         (gint64           window_us,
+                                                gsize            max_bytes);
+
+void             hwangsae_gop_ring_free        (HwangsaeGopRing *ring);
+
+void             hwangsae_gop_ring_push        (HwangsaeGopRing *ring,
+                                                const guint8    *data,
+                                                gsize            len,
+                                                gint64           arrival_us,
+                                                gboolean         keyframe);
+
+gboolean         hwangsae_gop_ring_seek        (HwangsaeGopRing *ring,
+                                                gint64           time_us,
+                                                guint64         *seq);
+
+const guint8    *hwangsae_gop_ring_get         (HwangsaeGopRing *ring,
+                                                guint64          seq,
+                                                gsize           *len,
+                                                gint64          *arrival_us);
+
+guint64          hwangsae_gop_ring_get_head    (HwangsaeGopRing *ring);
+
+guint64          hwangsae_gop_ring_get_tail    (HwangsaeGopRing *ring);
+
+gsize            hwangsae_gop_ring_get_size    (HwangsaeGopRing *ring);
+
+void             hwangsae_gop_ring_clear       (HwangsaeGopRing *ring);
@@ -0,0 +1,109 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "histogram.h"
+
+#include <string.h>
+
+guint
+hwangsae_histogram_bucket_index (gint64 value)
+{
+  guint exponent;
+  guint sub;
+  guint index;
+
+  if (value < HWANGSAE_HISTOGRAM_SUB_BUCKETS) {
+    return MAX (value, 0);
+  }
+
+  exponent = g_bit_nth_msf (value, -1);
+  sub = (value >> (exponent - 2)) & (HWANGSAE_HISTOGRAM_SUB_BUCKETS - 1);
+  index = (exponent - 1) * HWANGSAE_HISTOGRAM_SUB_BUCKETS + sub;
+
+  return MIN (index, HWANGSAE_HISTOGRAM_BUCKETS - 1);
+}
+
+/* Largest value that falls into bucket @index. */
+static gint64
+_bucket_upper_bound (guint index)
+{
+  guint exponent;
+  guint sub;
+
+  if (index < HWANGSAE_HISTOGRAM_SUB_BUCKETS) {
+    return index;
+  }
+
+  exponent = index / HWANGSAE_HISTOGRAM_SUB_BUCKETS + 1;
+  sub = index % HWANGSAE_HISTOGRAM_SUB_BUCKETS;
+
+  return ((gint64) (HWANGSAE_HISTOGRAM_SUB_BUCKETS + sub + 1) <<
+      (exponent - 2)) - 1;
+}
+
+void
+hwangsae_histogram_add (HwangsaeHistogram * histogram, gint64 value)
+{
+  ++histogram->counts[hwangsae_histogram_bucket_index (value)];
+  ++histogram->total;
+  histogram->max = MAX (histogram->max, value);
+}
+
+void
+hwangsae_histogram_merge (HwangsaeHistogram * histogram,
+    const HwangsaeHistogram * other)
+{
+  guint i;
+
+  for (i = 0; i != HWANGSAE_HISTOGRAM_BUCKETS; ++i) {
+    histogram->counts[i] += other->counts[i];
+  }
+  histogram->total += other->total;
+  histogram->max = MAX (histogram->max, other->max);
+}
+
+/* Returns the upper bound of the bucket containing @percentile (0-100) of
+ * the values, capped to the largest value seen, or 0 when empty. */
+gint64
+hwangsae_histogram_percentile (const HwangsaeHistogram * histogram,
+    gdouble percentile)
+{
+  guint64 rank;
+  guint64 seen = 0;
+  guint i;
+
+  if (histogram->total == 0) {
+    return 0;
+  }
+
+  rank = MAX (1, (guint64) (histogram->total * percentile / 100 + 0.5));
+
+  for (i = 0; i != HWANGSAE_HISTOGRAM_BUCKETS; ++i) {
+    seen += histogram->counts[i];
+    if (seen >= rank) {
+      return MIN (_bucket_upper_bound (i), histogram->max);
+    }
+  }
+
+  return histogram->max;
+}
+
+void
+hwangsae_histogram_reset (HwangsaeHistogram * histogram)
+{
+  memset (histogram, 0, sizeof (*histogram));
+}
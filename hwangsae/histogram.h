@@ -0,0 +1,48 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+#include <glib.h>
+
+/* Log-linear histogram of microsecond values, 4 buckets per power of two,
+ * so percentiles come out within 25 % of the true value. Plain struct that
+ * can be embedded and copied; not thread-safe. */
+
+#define HWANGSAE_HISTOGRAM_SUB_BUCKETS 4
+#define HWANGSAE_HISTOGRAM_BUCKETS     (40 * HWANGSAE_HISTOGRAM_SUB_BUCKETS)
+
+typedef struct
+{
+  guint64 counts[HWANGSAE_HISTOGRAM_BUCKETS];
+  guint64 total;
+  gint64 max;
+} HwangsaeHistogram;
+
+/* Index of the bucket in HwangsaeHistogram.counts that counts @value. */
+guint            hwangsae_histogram_bucket_index
+                                               (gint64             value);
+
+void             hwangsae_histogram_add        (HwangsaeHistogram *histogram,
+                                                gint64             value);
+
+void             hwangsae_histogram_merge      (HwangsaeHistogram *histogram,
+                                                const HwangsaeHistogram
+                                                                  *other);
+
+gint64           hwangsae_histogram_percentile (const HwangsaeHistogram
+                                                                  *histogram,
+                                                gdouble            percentile);
+
+void             hwangsae_histogram_reset      (HwangsaeHistogram *histogram);
@@ -0,0 +1,195 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "keyframe-index.h"
+
+#include <string.h>
+
+struct _HwangsaeKeyframeIndex
+{
+  HwangsaeKeyframeIndexHeader header;
+  GArray *entries;
+};
+
+HwangsaeKeyframeIndex *
+hwangsae_keyframe_index_new (void)
+{
+  HwangsaeKeyframeIndex *index = g_new0 (HwangsaeKeyframeIndex, 1);
+
+  memcpy (index->header.magic, HWANGSAE_KEYFRAME_INDEX_MAGIC,
+      sizeof (index->header.magic));
+  index->header.version = HWANGSAE_KEYFRAME_INDEX_VERSION;
+  index->header.header_size = sizeof (HwangsaeKeyframeIndexHeader);
+  index->entries = g_array_new (FALSE, FALSE,
+      sizeof (HwangsaeKeyframeIndexEntry));
+
+  return index;
+}
+
+void
+hwangsae_keyframe_index_free (HwangsaeKeyframeIndex * index)
+{
+  g_array_unref (index->entries);
+  g_free (index);
+}
+
+void
+hwangsae_keyframe_index_set_codec (HwangsaeKeyframeIndex * index,
+    const gchar * codec, guint width, guint height)
+{
+  memset (index->header.codec, 0, sizeof (index->header.codec));
+  if (codec) {
+    strncpy (index->header.codec, codec, sizeof (index->header.codec));
+  }
+  index->header.width = width;
+  index->header.height = height;
+}
+
+void
+hwangsae_keyframe_index_add (HwangsaeKeyframeIndex * index, guint64 pts,
+    gint64 time, guint64 offset)
+{
+  HwangsaeKeyframeIndexEntry entry = { pts, time, offset };
+
+  g_array_append_val (index->entries, entry);
+}
+
+/* Moves the entries older than @time to a new index with the same codec
+ * information. */
+HwangsaeKeyframeIndex *
+hwangsae_keyframe_index_split (HwangsaeKeyframeIndex * index, gint64 time)
+{
+  HwangsaeKeyframeIndex *head = hwangsae_keyframe_index_new ();
+  guint n = 0;
+
+  memcpy (head->header.codec, index->header.codec, sizeof (head->header.codec));
+  head->header.width = index->header.width;
+  head->header.height = index->header.height;
+
+  while (n < index->entries->len &&
+      g_array_index (index->entries, HwangsaeKeyframeIndexEntry, n).time <
+      time) {
+    ++n;
+  }
+
+  g_array_append_vals (head->entries, index->entries->data, n);
+  g_array_remove_range (index->entries, 0, n);
+
+  return head;
+}
+
+gboolean
+hwangsae_keyframe_index_save (HwangsaeKeyframeIndex * index,
+    const gchar * path, gint64 start_time, guint64 duration, GError ** error)
+{
+  gsize entries_size =
+      index->entries->len * sizeof (HwangsaeKeyframeIndexEntry);
+  g_autofree guint8 *contents = NULL;
+
+  index->header.n_entries = index->entries->len;
+  index->header.start_time = start_time;
+  index->header.duration = duration;
+
+  contents = g_malloc (sizeof (index->header) + entries_size);
+  memcpy (contents, &index->header, sizeof (index->header));
+  memcpy (contents + sizeof (index->header), index->entries->data,
+      entries_size);
+
+  return g_file_set_contents (path, (const gchar *) contents,
+      sizeof (index->header) + entries_size, error);
+}
+
+HwangsaeKeyframeIndex *
+hwangsae_keyframe_index_load (const gchar * path, GError ** error)
+{
+  g_autofree gchar *contents = NULL;
+  HwangsaeKeyframeIndexHeader header;
+  HwangsaeKeyframeIndex *index;
+  gsize length;
+
+  if (!g_file_get_contents (path, &contents, &length, error)) {
+    return NULL;
+  }
+
+  if (length < sizeof (header)) {
+    goto invalid;
+  }
+
+  memcpy (&header, contents, sizeof (header));
+
+  if (memcmp (header.magic, HWANGSAE_KEYFRAME_INDEX_MAGIC,
+          sizeof (header.magic)) != 0 ||
+      header.version != HWANGSAE_KEYFRAME_INDEX_VERSION ||
+      header.header_size < sizeof (header) || header.header_size > length ||
+      header.n_entries > (length - header.header_size) /
+      sizeof (HwangsaeKeyframeIndexEntry)) {
+    goto invalid;
+  }
+
+  index = hwangsae_keyframe_index_new ();
+  index->header = header;
+  g_array_append_vals (index->entries, contents + header.header_size,
+      header.n_entries);
+
+  return index;
+
+invalid:
+  g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+      "%s is not a valid keyframe index", path);
+
+  return NULL;
+}
+
+const HwangsaeKeyframeIndexHeader *
+hwangsae_keyframe_index_get_header (HwangsaeKeyframeIndex * index)
+{
+  index->header.n_entries = index->entries->len;
+
+  return &index->header;
+}
+
+const HwangsaeKeyframeIndexEntry *
+hwangsae_keyframe_index_get_entries (HwangsaeKeyframeIndex * index,
+    guint * n_entries)
+{
+  *n_entries = index->entries->len;
+
+  return (const HwangsaeKeyframeIndexEntry *) index->entries->data;
+}
+
+/* Returns the last keyframe at or before @time, which is where decoding
+ * has to start to show @time, or NULL if @time precedes all of them. */
+const HwangsaeKeyframeIndexEntry *
+hwangsae_keyframe_index_lookup (HwangsaeKeyframeIndex * index, gint64 time)
+{
+  const HwangsaeKeyframeIndexEntry *entries =
+      (const HwangsaeKeyframeIndexEntry *) index->entries->data;
+  guint low = 0;
+  guint high = index->entries->len;
+
+  while (low < high) {
+    guint mid = low + (high - low) / 2;
+
+    if (entries[mid].time <= time) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return (low > 0) ? &entries[low - 1] : NULL;
+}
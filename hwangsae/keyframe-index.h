@@ -0,0 +1,104 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <glib.h>
+
+/* Sidecar file listing the keyframes of a recorded segment, so that a
+ * position in it can be found by a binary search instead of by parsing the
+ * media. It lives next to the segment, with HWANGSAE_KEYFRAME_INDEX_SUFFIX
+ * appended to its name. All integers are stored in host byte order. */
+
+#define HWANGSAE_KEYFRAME_INDEX_MAGIC   "HWSINDEX"
+#define HWANGSAE_KEYFRAME_INDEX_VERSION 1
+#define HWANGSAE_KEYFRAME_INDEX_SUFFIX  ".idx"
+
+/* Stands for an unknown entry PTS or byte offset. */
+#define HWANGSAE_KEYFRAME_INDEX_NONE    G_MAXUINT64
+
+typedef struct
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 header_size;
+  /* NUL padded, e.g. "h264", or empty if unknown. */
+  gchar codec[8];
+  /* Zero if unknown. */
+  guint32 width;
+  guint32 height;
+  guint64 n_entries;
+  /* Wall clock time of the segment start in microseconds and its duration
+   * in nanoseconds. */
+  gint64 start_time;
+  guint64 duration;
+} HwangsaeKeyframeIndexHeader;
+
+/* Entries follow the header in ascending time order. */
+typedef struct
+{
+  /* Presentation timestamp in nanoseconds. */
+  guint64 pts;
+  /* Wall clock time in microseconds. */
+  gint64 time;
+  /* Of the first byte of the keyframe in the segment file. */
+  guint64 offset;
+} HwangsaeKeyframeIndexEntry;
+
+typedef struct _HwangsaeKeyframeIndex HwangsaeKeyframeIndex;
+
+HwangsaeKeyframeIndex
+                *hwangsae_keyframe_index_new   (void);
+
+void             hwangsae_keyframe_index_free  (HwangsaeKeyframeIndex *index);
+
+void             hwangsae_keyframe_index_set_codec
+                                               (HwangsaeKeyframeIndex *index,
+                                                const gchar           *codec,
+                                                guint                  width,
+                                                guint                  height);
+
+void             hwangsae_keyframe_index_add   (HwangsaeKeyframeIndex *index,
+                                                guint64                pts,
+                                                gint64                 time,
+                                                guint64                offset);
+
+HwangsaeKeyframeIndex
+                *hwangsae_keyframe_index_split (HwangsaeKeyframeIndex *index,
+                                                gint64                 time);
+
+gboolean         hwangsae_keyframe_index_save  (HwangsaeKeyframeIndex *index,
+                                                const gchar           *path,
+                                                gint64                 start_time,
+                                                guint64                duration,
+                                                GError               **error);
+
+HwangsaeKeyframeIndex
+                *hwangsae_keyframe_index_load  (const gchar           *path,
+                                                GError               **error);
+
+const HwangsaeKeyframeIndexHeader
+                *hwangsae_keyframe_index_get_header
+                                               (HwangsaeKeyframeIndex *index);
+
+const HwangsaeKeyframeIndexEntry
+                *hwangsae_keyframe_index_get_entries
+                                               (HwangsaeKeyframeIndex *index,
+                                                guint                 *n_entries);
+
+const HwangsaeKeyframeIndexEntry
+                *hwangsae_keyframe_index_lookup
+                                               (HwangsaeKeyframeIndex *index,
+                                                gint64                 time);
@@ -0,0 +1,252 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "metrics.h"
+
+#include "histogram.h"
+
+/* Must be a power of two. */
+#define METRIC_SHARDS 16
+
+typedef enum
+{
+  METRIC_TYPE_COUNTER,
+  METRIC_TYPE_GAUGE,
+  METRIC_TYPE_HISTOGRAM,
+} MetricType;
+
+/* Padded to a cache line so that threads updating different shards of the
+ * same counter don't contend. */
+typedef struct
+{
+  guint64 value;
+  guint64 padding[7];
+} CounterShard;
+
+struct _HwangsaeMetric
+{
+  gchar *name;
+  MetricType type;
+
+  gint64 gauge;
+  CounterShard *counters;
+  HwangsaeHistogram *histograms;
+};
+
+static GMutex registry_lock;
+static GHashTable *registry;
+
+static GPrivate shard_key;
+static gint next_shard;
+
+static inline guint
+_current_shard (void)
+{
+  guint shard = GPOINTER_TO_UINT (g_private_get (&shard_key));
+
+  if (G_UNLIKELY (shard == 0)) {
+    /* Store the index off by one, so that 0 means "not assigned yet". */
+    shard = (g_atomic_int_add (&next_shard, 1) & (METRIC_SHARDS - 1)) + 1;
+    g_private_set (&shard_key, GUINT_TO_POINTER (shard));
+  }
+
+  return shard - 1;
+}
+
+static HwangsaeMetric *
+hwangsae_metrics_register (const gchar * name, MetricType type)
+{
+  HwangsaeMetric *metric;
+
+  g_return_val_if_fail (name != NULL, NULL);
+
+  g_mutex_lock (&registry_lock);
+
+  if (!registry) {
+    registry = g_hash_table_new (g_str_hash, g_str_equal);
+  }
+
+  metric = g_hash_table_lookup (registry, name);
+  if (!metric) {
+    metric = g_new0 (HwangsaeMetric, 1);
+    metric->name = g_strdup (name);
+    metric->type = type;
+
+    switch (type) {
+      case METRIC_TYPE_COUNTER:
+        metric->counters = g_new0 (CounterShard, METRIC_SHARDS);
+        break;
+      case METRIC_TYPE_HISTOGRAM:
+        metric->histograms = g_new0 (HwangsaeHistogram, METRIC_SHARDS);
+        break;
+      case METRIC_TYPE_GAUGE:
+        break;
+    }
+
+    g_hash_table_insert (registry, metric->name, metric);
+  } else if (metric->type != type) {
+    g_critical ("Metric %s is already registered with a different type",
+        name);
+    metric = NULL;
+  }
+
+  g_mutex_unlock (&registry_lock);
+
+  return metric;
+}
+
+HwangsaeMetric *
+hwangsae_metrics_register_counter (const gchar * name)
+{
+  return hwangsae_metrics_register (name, METRIC_TYPE_COUNTER);
+}
+
+HwangsaeMetric *
+hwangsae_metrics_register_gauge (const gchar * name)
+{
+  return hwangsae_metrics_register (name, METRIC_TYPE_GAUGE);
+}
+
+HwangsaeMetric *
+hwangsae_metrics_register_histogram (const gchar * name)
+{
+  return hwangsae_metrics_register (name, METRIC_TYPE_HISTOGRAM);
+}
+
+void
+hwangsae_metric_counter_add (HwangsaeMetric * metric, guint64 delta)
+{
+  __atomic_fetch_add (&metric->counters[_current_shard ()].value, delta,
+      __ATOMIC_RELAXED);
+}
+
+void
+hwangsae_metric_gauge_add (HwangsaeMetric * metric, gint64 delta)
+{
+  __atomic_fetch_add (&metric->gauge, delta, __ATOMIC_RELAXED);
+}
+
+void
+hwangsae_metric_gauge_set (HwangsaeMetric * metric, gint64 value)
+{
+  __atomic_store_n (&metric->gauge, value, __ATOMIC_RELAXED);
+}
+
+void
+hwangsae_metric_histogram_add (HwangsaeMetric * metric, gint64 value)
+{
+  HwangsaeHistogram *histogram = &metric->histograms[_current_shard ()];
+  gint64 max = __atomic_load_n (&histogram->max, __ATOMIC_RELAXED);
+
+  __atomic_fetch_add (&histogram->counts[hwangsae_histogram_bucket_index
+          (value)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&histogram->total, 1, __ATOMIC_RELAXED);
+
+  while (value > max && !__atomic_compare_exchange_n (&histogram->max, &max,
+          value, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    /* A failed exchange reloads max; retry while value is still larger. */
+  }
+}
+
+static GVariant *
+_snapshot_counter (HwangsaeMetric * metric)
+{
+  guint64 value = 0;
+  guint i;
+
+  for (i = 0; i != METRIC_SHARDS; ++i) {
+    value += __atomic_load_n (&metric->counters[i].value, __ATOMIC_RELAXED);
+  }
+
+  return g_variant_new_uint64 (value);
+}
+
+static GVariant *
+_snapshot_histogram (HwangsaeMetric * metric)
+{
+  HwangsaeHistogram merged;
+  GVariantDict dict;
+  guint i;
+  guint j;
+
+  hwangsae_histogram_reset (&merged);
+
+  /* Shards keep getting updated while being read, so the merged histogram
+   * is only approximately consistent; good enough for monitoring. */
+  for (i = 0; i != METRIC_SHARDS; ++i) {
+    HwangsaeHistogram *shard = &metric->histograms[i];
+
+    for (j = 0; j != HWANGSAE_HISTOGRAM_BUCKETS; ++j) {
+      merged.counts[j] += __atomic_load_n (&shard->counts[j],
+          __ATOMIC_RELAXED);
+    }
+    merged.total += __atomic_load_n (&shard->total, __ATOMIC_RELAXED);
+    merged.max = MAX (merged.max, __atomic_load_n (&shard->max,
+            __ATOMIC_RELAXED));
+  }
+
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "count", "t", merged.total);
+  g_variant_dict_insert (&dict, "p50", "x",
+      hwangsae_histogram_percentile (&merged, 50));
+  g_variant_dict_insert (&dict, "p99", "x",
+      hwangsae_histogram_percentile (&merged, 99));
+  g_variant_dict_insert (&dict, "p999", "x",
+      hwangsae_histogram_percentile (&merged, 99.9));
+  g_variant_dict_insert (&dict, "max", "x", merged.max);
+
+  return g_variant_dict_end (&dict);
+}
+
+GVariant *
+hwangsae_metrics_snapshot (void)
+{
+  GVariantDict dict;
+
+  g_variant_dict_init (&dict, NULL);
+
+  g_mutex_lock (&registry_lock);
+
+  if (registry) {
+    GHashTableIter it;
+    HwangsaeMetric *metric;
+
+    g_hash_table_iter_init (&it, registry);
+    while (g_hash_table_iter_next (&it, NULL, (gpointer *) & metric)) {
+      GVariant *value = NULL;
+
+      switch (metric->type) {
+        case METRIC_TYPE_COUNTER:
+          value = _snapshot_counter (metric);
+          break;
+        case METRIC_TYPE_GAUGE:
+          value = g_variant_new_int64 (__atomic_load_n (&metric->gauge,
+                  __ATOMIC_RELAXED));
+          break;
+        case METRIC_TYPE_HISTOGRAM:
+          value = _snapshot_histogram (metric);
+          break;
+      }
+
+      g_variant_dict_insert_value (&dict, metric->name, value);
+    }
+  }
+
+  g_mutex_unlock (&registry_lock);
+
+  return g_variant_dict_end (&dict);
+}
@@ -0,0 +1,49 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+#include <glib.h>
+
+/* Process-wide registry of named metrics. Counters and histograms are
+ * sharded per thread so that updating them from a hot path costs a relaxed
+ * atomic add on a cache line the thread rarely shares; gauges are a single
+ * atomic value. Metrics are never unregistered, the pointers returned by the
+ * register functions stay valid for the lifetime of the process and can be
+ * cached in static variables. */
+
+typedef struct _HwangsaeMetric HwangsaeMetric;
+
+HwangsaeMetric  *hwangsae_metrics_register_counter   (const gchar    *name);
+
+HwangsaeMetric  *hwangsae_metrics_register_gauge     (const gchar    *name);
+
+HwangsaeMetric  *hwangsae_metrics_register_histogram (const gchar    *name);
+
+void             hwangsae_metric_counter_add         (HwangsaeMetric *metric,
+                                                      guint64         delta);
+
+void             hwangsae_metric_gauge_add           (HwangsaeMetric *metric,
+                                                      gint64          delta);
+
+void             hwangsae_metric_gauge_set           (HwangsaeMetric *metric,
+                                                      gint64          value);
+
+void             hwangsae_metric_histogram_add       (HwangsaeMetric *metric,
+                                                      gint64          value);
+
+/* Returns a floating a{sv} dictionary keyed by metric name. Counters are
+ * "t", gauges "x" and histograms an a{sv} with "count" (t) and "p50", "p99",
+ * "p999", "max" (x). */
+GVariant        *hwangsae_metrics_snapshot           (void);
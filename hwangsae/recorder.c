@@ -20,10 +20,20 @@
 
 #include "common.h"
 #include "enumtypes.h"
+#include "gop-ring.h"
+#include "keyframe-index.h"
+#include "metrics.h"
+#include "recording-engine.h"
+#include "tracepoints.h"
+#include "ts.h"
+#include "ts-segmenter.h"
 
 #include <glib/gstdio.h>
 #include <gio/gio.h>
 #include <gst/gst.h>
+#include <string.h>
+
+#include "relay.h"
 
 /* *INDENT-OFF* */
 #if !GLIB_CHECK_VERSION(2,57,1)
@@ -31,6 +41,32 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(GEnumClass, g_type_class_unref)
 #endif
 /* *INDENT-ON* */
 
+/* Bounds the memory of an armed recorder whatever its pre-roll time. */
+#define MAX_PRE_ROLL_BYTES (64 * 1024 * 1024)
+
+/* Bounds of the delay between reconnection attempts, which doubles after
+ * each failed one. */
+#define RECONNECT_DELAY_MIN_MS 100
+#define RECONNECT_DELAY_MAX_MS 5000
+
+/* Bounds the keyframes kept for the I-frame rendition of the current file;
+ * the rendition of a longer file ends early. */
+#define MAX_TRICK_PLAY_BYTES (64 * 1024 * 1024)
+
+/* Gives up on an I-frame rendition the muxer can't finish by then. */
+#define TRICK_PLAY_TIMEOUT (30 * GST_SECOND)
+
+#define PLAYLIST_SUFFIX ".m3u8"
+
+/* Files end at the first keyframe past max-size-time, so they may run up to
+ * a keyframe interval longer. Covers the intervals of common live encoder
+ * settings. */
+#define PLAYLIST_KEYFRAME_INTERVAL (2 * GST_SECOND)
+
+/* Bounds the data queued by a relay tap when the recorder can't keep up;
+ * anything beyond gets dropped rather than stalling the relay. */
+#define MAX_RELAY_TAP_BYTES (16 * 1024 * 1024)
+
 struct _HwangsaeRecorder
 {
   GObject parent;
@@ -46,10 +82,91 @@ typedef struct
   HwangsaeContainer container;
   guint64 max_size_time;
   guint64 max_size_bytes;
+  guint fragment_duration;
+  gboolean passthrough;
+  gboolean shared_engine;
+  guint pre_roll_time;
+  guint reconnect_timeout;
+  gboolean trick_play;
+  gboolean hls_playlist;
   gboolean is_connected;
+  gint64 start_time_us;
   GQueue fragment_start_times;
+
+  HwangsaeRelay *relay;
+  guint relay_tap_id;
+
+  /* Protects segmenter, pre_roll and keyframe_index, which the streaming
+   * thread uses. */
+  GMutex lock;
+
+  /* Non-NULL while a passthrough recording is running. */
+  HwangsaeTsSegmenter *segmenter;
+
+  /* Non-NULL while armed and not recording yet. */
+  HwangsaeGopRing *pre_roll;
+  /* The pre-roll gets one video PES per chunk, so that the scanner can tell
+   * keyframes apart without the random_access_indicator. */
+  HwangsaeTsKeyframeScanner *pre_roll_scanner;
+  GByteArray *pre_roll_pes;
+  gint64 pre_roll_pes_time;
+  gboolean pre_roll_pes_keyframe;
+  gchar *armed_uri;
+
+  /* Keyframes of remuxed recordings not yet assigned to a file. */
+  HwangsaeKeyframeIndex *keyframe_index;
+  /* TrickPlayFrames of remuxed recordings not yet assigned to a file. */
+  GQueue trick_play_frames;
+  gsize trick_play_bytes;
+  GstCaps *trick_play_caps;
+  /* PendingSignals in the order they are due, held back while I-frame
+   * renditions are being written on a worker thread. */
+  GQueue pending_signals;
+  /* Media playlist entries of the files completed so far. */
+  GString *playlist_segments;
+  guint playlist_target_duration;
+  /* Wall clock time in microseconds at which the source was lost, for the
+   * first file after it to start a discontinuity. */
+  gint64 playlist_discontinuity_us;
+
+  /* Non-zero while recording through the shared engine. */
+  guint engine_stream_id;
+
+  /* Source URI of the recording, NULL when recording from a relay. */
+  gchar *uri;
+  /* The pad urisourcebin links to, which outlives reconnections. */
+  GstPad *src_peer;
+  /* Set once the user or the reconnect policy ends the recording, so that
+   * the end of the source stream is not taken for an outage. */
+  gint stopping;
+  guint reconnect_source;
+  guint reconnect_delay_ms;
+  /* When the current outage began, or 0 while connected. */
+  gint64 outage_start_us;
 } HwangsaeRecorderPrivate;
 
+typedef struct
+{
+  GstBuffer *buffer;
+  /* Wall clock time in nanoseconds. */
+  GstClockTime time;
+} TrickPlayFrame;
+
+typedef struct
+{
+  /* The completed file, or NULL for the end of the recording. */
+  gchar *file;
+  gboolean ready;
+} PendingSignal;
+
+typedef struct
+{
+  gchar *trick_play_file;
+  GQueue frames;
+  GstCaps *caps;
+  HwangsaeContainer container;
+} TrickPlayJob;
+
 /* *INDENT-OFF* */
 G_DEFINE_TYPE_WITH_PRIVATE (HwangsaeRecorder, hwangsae_recorder, G_TYPE_OBJECT)
 /* *INDENT-ON* */
@@ -61,6 +178,13 @@ enum
   PROP_MAX_SIZE_TIME,
   PROP_MAX_SIZE_BYTES,
   PROP_FILENAME_PREFIX,
+  PROP_PASSTHROUGH,
+  PROP_SHARED_ENGINE,
+  PROP_PRE_ROLL_TIME,
+  PROP_FRAGMENT_DURATION,
+  PROP_RECONNECT_TIMEOUT,
+  PROP_TRICK_PLAY,
+  PROP_HLS_PLAYLIST,
   PROP_LAST
 };
 
@@ -75,6 +199,14 @@ enum
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
+/* Process-wide metrics, shared by all recorder instances. */
+static HwangsaeMetric *metric_recordings;
+static HwangsaeMetric *metric_files_completed;
+static HwangsaeMetric *metric_bytes_recorded;
+static HwangsaeMetric *metric_connect_time;
+static HwangsaeMetric *metric_reconnects;
+static HwangsaeMetric *metric_relay_tap_bytes_dropped;
+
 HwangsaeRecorder *
 hwangsae_recorder_new (void)
 {
@@ -165,17 +297,122 @@ hwangsae_recorder_get_filename_prefix (HwangsaeRecorder * self)
   return result;
 }
 
+static void
+_trick_play_frame_free (TrickPlayFrame * frame)
+{
+  gst_buffer_unref (frame->buffer);
+  g_free (frame);
+}
+
+static void
+_trick_play_job_free (TrickPlayJob * job)
+{
+  g_free (job->trick_play_file);
+  g_queue_foreach (&job->frames, (GFunc) _trick_play_frame_free, NULL);
+  g_queue_clear (&job->frames);
+  gst_clear_caps (&job->caps);
+  g_free (job);
+}
+
+/* Emits the signals that are due, in order, up to the first one still
+ * waiting for its I-frame rendition. */
+static void
+hwangsae_recorder_emit_pending_signals (HwangsaeRecorder * self)
+{
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  PendingSignal *pending;
+
+  while ((pending = g_queue_peek_head (&priv->pending_signals)) &&
+      pending->ready) {
+    g_queue_pop_head (&priv->pending_signals);
+
+    if (pending->file) {
+      g_signal_emit (self, signals[FILE_COMPLETED_SIGNAL], 0, pending->file);
+    } else {
+      g_signal_emit (self, signals[STREAM_DISCONNECTED_SIGNAL], 0);
+    }
+
+    g_free (pending->file);
+    g_free (pending);
+  }
+}
+
+static PendingSignal *
+hwangsae_recorder_push_pending_signal (HwangsaeRecorder * self,
+    const gchar * file, gboolean ready)
+{
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  PendingSignal *pending = g_new0 (PendingSignal, 1);
+
+  pending->file = g_strdup (file);
+  pending->ready = ready;
+  g_queue_push_tail (&priv->pending_signals, pending);
+
+  return pending;
+}
+
+static void
+hwangsae_recorder_clear_pre_roll (HwangsaeRecorderPrivate * priv)
+{
+  g_clear_pointer (&priv->pre_roll, hwangsae_gop_ring_free);
+  g_clear_pointer (&priv->pre_roll_scanner,
+      hwangsae_ts_keyframe_scanner_free);
+  g_clear_pointer (&priv->pre_roll_pes, g_byte_array_unref);
+  priv->pre_roll_pes_keyframe = FALSE;
+}
+
+static void hwangsae_recorder_write_playlist (HwangsaeRecorder * self,
+    gboolean ended);
+
 static void
 hwangsae_recorder_stop_recording_internal (HwangsaeRecorder * self)
 {
   HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
 
-  gst_element_set_state (priv->pipeline, GST_STATE_NULL);
+  if (priv->relay) {
+    hwangsae_relay_remove_tap (priv->relay, priv->relay_tap_id);
+    priv->relay_tap_id = 0;
+    g_clear_object (&priv->relay);
+  }
+
+  if (priv->pipeline) {
+    gst_element_set_state (priv->pipeline, GST_STATE_NULL);
+  }
+  /* Before the pipeline goes, as the segmenter may still report fragments on
+   * the appsink. */
+  g_clear_pointer (&priv->segmenter, hwangsae_ts_segmenter_free);
   g_clear_pointer (&priv->pipeline, gst_object_unref);
+  if (priv->playlist_segments) {
+    /* No more files to come, the playlist becomes a VOD one. */
+    hwangsae_recorder_write_playlist (self, TRUE);
+    g_string_free (priv->playlist_segments, TRUE);
+    priv->playlist_segments = NULL;
+  }
+  priv->playlist_target_duration = 0;
+  priv->playlist_discontinuity_us = 0;
+  hwangsae_recorder_clear_pre_roll (priv);
+  g_clear_pointer (&priv->armed_uri, g_free);
+  g_clear_pointer (&priv->keyframe_index, hwangsae_keyframe_index_free);
+  g_queue_foreach (&priv->trick_play_frames, (GFunc) _trick_play_frame_free,
+      NULL);
+  g_queue_clear (&priv->trick_play_frames);
+  priv->trick_play_bytes = 0;
+  gst_clear_caps (&priv->trick_play_caps);
+  g_clear_pointer (&priv->uri, g_free);
+  g_clear_object (&priv->src_peer);
+  if (priv->reconnect_source) {
+    g_source_remove (priv->reconnect_source);
+    priv->reconnect_source = 0;
+  }
+  priv->outage_start_us = 0;
+  g_atomic_int_set (&priv->stopping, FALSE);
+  hwangsae_metric_gauge_add (metric_recordings, -1);
   g_queue_foreach (&priv->fragment_start_times, (GFunc) g_free, NULL);
   g_queue_clear (&priv->fragment_start_times);
 
-  g_signal_emit (self, signals[STREAM_DISCONNECTED_SIGNAL], 0);
+  /* Not before the last file is reported completed. */
+  hwangsae_recorder_push_pending_signal (self, NULL, TRUE);
+  hwangsae_recorder_emit_pending_signals (self);
   priv->is_connected = FALSE;
 
   g_debug ("Recording stopped");
@@ -187,7 +424,19 @@ hwangsae_recorder_on_first_frame (HwangsaeRecorder * recorder)
   HwangsaeRecorderPrivate *priv =
       hwangsae_recorder_get_instance_private (recorder);
 
+  if (priv->is_connected) {
+    if (priv->outage_start_us != 0) {
+      /* Data flows again after an outage. */
+      g_debug ("Reconnected to %s after %" G_GINT64_FORMAT " ms", priv->uri,
+          (g_get_monotonic_time () - priv->outage_start_us) / 1000);
+      priv->outage_start_us = 0;
+    }
+    return;
+  }
+
   priv->is_connected = TRUE;
+  hwangsae_metric_histogram_add (metric_connect_time,
+      g_get_monotonic_time () - priv->start_time_us);
   g_signal_emit (recorder, signals[STREAM_CONNECTED_SIGNAL], 0);
 }
 
@@ -202,11 +451,250 @@ hwangsae_recorder_on_file_opened (HwangsaeRecorder * recorder,
 
   *start_time = running_time;
 
+  HWANGSAE_TRACE2 (recorder_fragment_open, recorder, running_time);
+
   g_queue_push_head (&priv->fragment_start_times, start_time);
 
   g_signal_emit (recorder, signals[FILE_CREATED_SIGNAL], 0);
 }
 
+static const gchar *
+_get_file_extension (HwangsaeContainer container)
+{
+  switch (container) {
+    case HWANGSAE_CONTAINER_MP4:
+    case HWANGSAE_CONTAINER_FMP4:
+      return "mp4";
+    case HWANGSAE_CONTAINER_TS:
+      return "ts";
+    default:
+      g_assert_not_reached ();
+  }
+}
+
+/* Puts the keyframe index of a completed file next to it. The segmenter of
+ * passthrough recordings leaves one next to the temporary file, remuxed
+ * recordings get one from the keyframes seen after h264parse. @start and
+ * @end are wall clock times in nanoseconds. */
+static void
+hwangsae_recorder_write_index (HwangsaeRecorder * recorder,
+    const gchar * file, const gchar * target_file, GstClockTime start,
+    GstClockTime end)
+{
+  HwangsaeRecorderPrivate *priv =
+      hwangsae_recorder_get_instance_private (recorder);
+  g_autofree gchar *index_file = NULL;
+  g_autofree gchar *target_index_file = NULL;
+  g_autoptr (GError) error = NULL;
+  HwangsaeKeyframeIndex *index;
+
+  index_file = g_strconcat (file, HWANGSAE_KEYFRAME_INDEX_SUFFIX, NULL);
+  target_index_file = g_strconcat (target_file,
+      HWANGSAE_KEYFRAME_INDEX_SUFFIX, NULL);
+
+  if (g_rename (index_file, target_index_file) == 0) {
+    return;
+  }
+
+  g_mutex_lock (&priv->lock);
+  if (!priv->keyframe_index) {
+    g_mutex_unlock (&priv->lock);
+    return;
+  }
+  hwangsae_keyframe_index_free (hwangsae_keyframe_index_split
+      (priv->keyframe_index, start / GST_USECOND));
+  index = hwangsae_keyframe_index_split (priv->keyframe_index,
+      end / GST_USECOND);
+  g_mutex_unlock (&priv->lock);
+
+  if (!hwangsae_keyframe_index_save (index, target_index_file,
+          start / GST_USECOND, end - start, &error)) {
+    g_warning ("Failed to write keyframe index: %s", error->message);
+  }
+
+  hwangsae_keyframe_index_free (index);
+}
+
+static void
+hwangsae_recorder_trick_play_thread (GTask * task, gpointer source_object,
+    gpointer task_data, GCancellable * cancellable)
+{
+  TrickPlayJob *job = task_data;
+  g_autoptr (GstElement) pipeline = NULL;
+  g_autoptr (GstElement) element = NULL;
+  g_autoptr (GstBus) bus = NULL;
+  g_autoptr (GstMessage) message = NULL;
+  g_autofree gchar *pipeline_str = NULL;
+  GError *error = NULL;
+  TrickPlayFrame *frame;
+  GstFlowReturn ret;
+
+  pipeline_str = g_strdup_printf ("appsrc name=src format=time ! %s ! "
+      "filesink name=sink", job->container == HWANGSAE_CONTAINER_TS ?
+      "mpegtsmux" : "mp4mux");
+  pipeline = gst_parse_launch (pipeline_str, &error);
+  if (!pipeline) {
+    g_task_return_error (task, error);
+    return;
+  }
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  g_object_set (element, "location", job->trick_play_file, NULL);
+  g_clear_object (&element);
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  g_object_set (element, "caps", job->caps, NULL);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  while ((frame = g_queue_pop_head (&job->frames))) {
+    g_signal_emit_by_name (element, "push-buffer", frame->buffer, &ret);
+    _trick_play_frame_free (frame);
+  }
+  g_signal_emit_by_name (element, "end-of-stream", &ret);
+
+  bus = gst_element_get_bus (pipeline);
+  message = gst_bus_timed_pop_filtered (bus, TRICK_PLAY_TIMEOUT,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  if (!message) {
+    error = g_error_new (G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+        "Timed out writing %s", job->trick_play_file);
+  } else if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ERROR) {
+    gst_message_parse_error (message, &error, NULL);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  if (error) {
+    g_unlink (job->trick_play_file);
+    g_task_return_error (task, error);
+  } else {
+    g_task_return_boolean (task, TRUE);
+  }
+}
+
+static void
+hwangsae_recorder_trick_play_written (GObject * source_object,
+    GAsyncResult * result, gpointer user_data)
+{
+  HwangsaeRecorder *self = HWANGSAE_RECORDER (source_object);
+  PendingSignal *pending = user_data;
+  g_autoptr (GError) error = NULL;
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error)) {
+    g_warning ("Failed to write I-frame rendition: %s", error->message);
+  }
+
+  pending->ready = TRUE;
+  hwangsae_recorder_emit_pending_signals (self);
+}
+
+/* Muxes the keyframes of a completed file into an I-frame only rendition
+ * next to it on a worker thread, without decoding anything. @pending gets
+ * ready once the rendition is written. @start and @end are wall clock times
+ * in nanoseconds. */
+static void
+hwangsae_recorder_write_trick_play (HwangsaeRecorder * recorder,
+    const gchar * trick_play_file, GstClockTime start, GstClockTime end,
+    PendingSignal * pending)
+{
+  HwangsaeRecorderPrivate *priv =
+      hwangsae_recorder_get_instance_private (recorder);
+  g_autoptr (GTask) task = NULL;
+  TrickPlayJob *job = g_new0 (TrickPlayJob, 1);
+  TrickPlayFrame *frame;
+
+  job->trick_play_file = g_strdup (trick_play_file);
+  job->container = priv->container;
+  g_queue_init (&job->frames);
+
+  g_mutex_lock (&priv->lock);
+  while ((frame = g_queue_peek_head (&priv->trick_play_frames)) &&
+      frame->time < end) {
+    g_queue_pop_head (&priv->trick_play_frames);
+    priv->trick_play_bytes -= gst_buffer_get_size (frame->buffer);
+    if (frame->time < start) {
+      _trick_play_frame_free (frame);
+    } else {
+      g_queue_push_tail (&job->frames, frame);
+    }
+  }
+  if (priv->trick_play_caps) {
+    job->caps = gst_caps_ref (priv->trick_play_caps);
+  }
+  g_mutex_unlock (&priv->lock);
+
+  if (g_queue_is_empty (&job->frames)) {
+    _trick_play_job_free (job);
+    pending->ready = TRUE;
+    return;
+  }
+
+  task = g_task_new (recorder, NULL, hwangsae_recorder_trick_play_written,
+      pending);
+  g_task_set_task_data (task, job, (GDestroyNotify) _trick_play_job_free);
+  g_task_run_in_thread (task, hwangsae_recorder_trick_play_thread);
+}
+
+static void
+hwangsae_recorder_write_playlist (HwangsaeRecorder * self, gboolean ended)
+{
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  g_autofree gchar *filename = NULL;
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *contents = NULL;
+  g_autoptr (GError) error = NULL;
+
+  contents = g_strdup_printf ("#EXTM3U\n"
+      "#EXT-X-VERSION:3\n"
+      "#EXT-X-TARGETDURATION:%u\n"
+      "#EXT-X-MEDIA-SEQUENCE:0\n"
+      "#EXT-X-PLAYLIST-TYPE:%s\n"
+      "%s%s", priv->playlist_target_duration, ended ? "VOD" : "EVENT",
+      priv->playlist_segments->str, ended ? "#EXT-X-ENDLIST\n" : "");
+
+  filename = g_strconcat (priv->filename_prefix, PLAYLIST_SUFFIX, NULL);
+  path = g_build_filename (priv->recording_dir, filename, NULL);
+
+  /* Replaces the file atomically, as players may be reading it. */
+  if (!g_file_set_contents (path, contents, -1, &error)) {
+    g_warning ("Failed to write %s: %s", path, error->message);
+  }
+}
+
+/* Appends a completed file to the HLS media playlist of the recording.
+ * @start and @end are wall clock times in nanoseconds. */
+static void
+hwangsae_recorder_add_to_playlist (HwangsaeRecorder * self,
+    const gchar * file, GstClockTime start, GstClockTime end)
+{
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  g_autofree gchar *basename = g_path_get_basename (file);
+  gchar duration[G_ASCII_DTOSTR_BUF_SIZE];
+  gdouble seconds = (gdouble) (end - start) / GST_SECOND;
+
+  if (!priv->playlist_segments) {
+    priv->playlist_segments = g_string_new (NULL);
+    /* An EVENT playlist must not change its target duration, so it is fixed
+     * to the longest file max-size-time allows. */
+    priv->playlist_target_duration = (priv->max_size_time +
+        PLAYLIST_KEYFRAME_INTERVAL + GST_SECOND - 1) / GST_SECOND;
+  }
+
+  if (priv->playlist_discontinuity_us != 0 &&
+      start / GST_USECOND >= priv->playlist_discontinuity_us) {
+    /* Timestamps start over after a reconnection. */
+    g_string_append (priv->playlist_segments, "#EXT-X-DISCONTINUITY\n");
+    priv->playlist_discontinuity_us = 0;
+  }
+
+  g_string_append_printf (priv->playlist_segments, "#EXTINF:%s,\n%s\n",
+      g_ascii_formatd (duration, sizeof (duration), "%.3f", seconds),
+      basename);
+
+  hwangsae_recorder_write_playlist (self, FALSE);
+}
+
 static void
 hwangsae_recorder_on_file_completed (HwangsaeRecorder * recorder,
     const gchar * file, GstClockTime running_time)
@@ -216,31 +704,68 @@ hwangsae_recorder_on_file_completed (HwangsaeRecorder * recorder,
   g_autofree GstClockTime *start_time = NULL;
   GstClockTime base_time;
   g_autofree gchar *target_file = NULL;
-  GEnumValue *container;
+  PendingSignal *pending;
+  GStatBuf st;
+
+  HWANGSAE_TRACE3 (recorder_fragment_close, recorder, file, running_time);
 
   start_time = g_queue_pop_tail (&priv->fragment_start_times);
   g_assert_nonnull (start_time);
 
-  base_time = gst_element_get_base_time (priv->pipeline);
-
-  container = g_enum_get_value
-      (g_type_class_peek (HWANGSAE_TYPE_CONTAINER), priv->container);
+  /* Without a pipeline, running times are already in real time. */
+  base_time = priv->pipeline ? gst_element_get_base_time (priv->pipeline) : 0;
 
   target_file = g_build_filename (priv->recording_dir, "%s-%ld-%ld.%s", NULL);
   target_file = g_strdup_printf (target_file,
       priv->filename_prefix,
       (base_time + *start_time) / GST_USECOND,
-      (base_time + running_time) / GST_USECOND, container->value_nick);
+      (base_time + running_time) / GST_USECOND,
+      _get_file_extension (priv->container));
 
+  HWANGSAE_TRACE3 (recorder_rename_start, recorder, file, target_file);
   g_rename (file, target_file);
+  HWANGSAE_TRACE3 (recorder_rename_end, recorder, file, target_file);
+
+  hwangsae_recorder_write_index (recorder, file, target_file,
+      base_time + *start_time, base_time + running_time);
+
+  pending = hwangsae_recorder_push_pending_signal (recorder, target_file,
+      !priv->trick_play);
+
+  if (priv->trick_play) {
+    g_autofree gchar *stem = NULL;
+    g_autofree gchar *trick_play_file = NULL;
+
+    stem = g_strndup (target_file, strrchr (target_file, '.') - target_file);
+    trick_play_file = g_strconcat (stem, ".iframes.",
+        _get_file_extension (priv->container), NULL);
+
+    hwangsae_recorder_write_trick_play (recorder, trick_play_file,
+        base_time + *start_time, base_time + running_time, pending);
+  }
+
+  if (priv->hls_playlist && priv->container == HWANGSAE_CONTAINER_TS &&
+      priv->max_size_time != 0) {
+    hwangsae_recorder_add_to_playlist (recorder, target_file,
+        base_time + *start_time, base_time + running_time);
+  }
 
-  g_signal_emit (recorder, signals[FILE_COMPLETED_SIGNAL], 0, target_file);
+  hwangsae_metric_counter_add (metric_files_completed, 1);
+  if (g_stat (target_file, &st) == 0) {
+    hwangsae_metric_counter_add (metric_bytes_recorded, st.st_size);
+  }
+
+  hwangsae_recorder_emit_pending_signals (recorder);
 }
 
+static void hwangsae_recorder_on_source_lost (HwangsaeRecorder * self);
+
 static gboolean
 gst_bus_cb (GstBus * bus, GstMessage * message, gpointer data)
 {
   HwangsaeRecorder *recorder = HWANGSAE_RECORDER (data);
+  HwangsaeRecorderPrivate *priv =
+      hwangsae_recorder_get_instance_private (recorder);
 
   switch (message->type) {
     case GST_MESSAGE_APPLICATION:{
@@ -249,6 +774,23 @@ gst_bus_cb (GstBus * bus, GstMessage * message, gpointer data)
 
       if (g_str_equal (name, "hwangsae-recorder-first-frame")) {
         hwangsae_recorder_on_first_frame (recorder);
+      } else if (g_str_equal (name, "hwangsae-recorder-source-lost")) {
+        hwangsae_recorder_on_source_lost (recorder);
+      }
+      break;
+    }
+    case GST_MESSAGE_ERROR:{
+      g_autoptr (GstElement) srcbin = NULL;
+
+      if (priv->reconnect_timeout == 0 || !priv->uri || !priv->pipeline) {
+        break;
+      }
+
+      /* Errors of an earlier source, already removed, don't count. */
+      srcbin = gst_bin_get_by_name (GST_BIN (priv->pipeline), "srcbin");
+      if (srcbin && gst_object_has_as_ancestor (GST_MESSAGE_SRC (message),
+              GST_OBJECT (srcbin))) {
+        hwangsae_recorder_on_source_lost (recorder);
       }
       break;
     }
@@ -270,7 +812,9 @@ gst_bus_cb (GstBus * bus, GstMessage * message, gpointer data)
       break;
     }
     case GST_MESSAGE_EOS:
+      HWANGSAE_TRACE1 (recorder_eos_start, recorder);
       hwangsae_recorder_stop_recording_internal (recorder);
+      HWANGSAE_TRACE1 (recorder_eos_end, recorder);
       break;
     default:
       break;
@@ -292,31 +836,263 @@ first_buffer_cb (GstPad * pad, GstPadProbeInfo * info, gpointer data)
   return GST_PAD_PROBE_REMOVE;
 }
 
-void
-hwangsae_recorder_start_recording (HwangsaeRecorder * self, const gchar * uri)
+/* Keeps the end of the source stream away from the rest of the pipeline when
+ * the recorder is to reconnect to it. */
+static GstPadProbeReturn
+source_eos_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer data)
 {
+  HwangsaeRecorder *self = HWANGSAE_RECORDER (data);
   HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
 
-  g_autoptr (GstBus) bus = NULL;
-  g_autoptr (GstElement) element = NULL;
-  g_autoptr (GstPad) parse_src = NULL;
-  g_autofree gchar *recording_file_tmp = NULL;
-  g_autofree gchar *recording_file = NULL;
-  g_autofree gchar *pipeline_str = NULL;
-  const gchar *mux_name;
+  if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) != GST_EVENT_EOS ||
+      priv->reconnect_timeout == 0 || !priv->uri ||
+      g_atomic_int_get (&priv->stopping)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  gst_element_post_message (GST_PAD_PARENT (pad),
+      gst_message_new_application (NULL,
+          gst_structure_new_empty ("hwangsae-recorder-source-lost")));
+
+  return GST_PAD_PROBE_DROP;
+}
+
+static GstPadProbeReturn
+keyframe_index_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  HwangsaeRecorder *self = HWANGSAE_RECORDER (data);
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  g_autoptr (GstEvent) event = NULL;
+  const GstSegment *segment;
+  GstClockTime running_time;
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT) ||
+      !GST_BUFFER_PTS_IS_VALID (buffer)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+  if (!event) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  gst_event_parse_segment (event, &segment);
+  running_time = gst_segment_to_running_time (segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (buffer));
+
+  g_mutex_lock (&priv->lock);
+
+  if (hwangsae_keyframe_index_get_header (priv->keyframe_index)->codec[0] ==
+      '\0') {
+    g_autoptr (GstCaps) caps = gst_pad_get_current_caps (pad);
+    gint width = 0;
+    gint height = 0;
+
+    if (caps) {
+      GstStructure *s = gst_caps_get_structure (caps, 0);
+
+      gst_structure_get_int (s, "width", &width);
+      gst_structure_get_int (s, "height", &height);
+    }
+    hwangsae_keyframe_index_set_codec (priv->keyframe_index, "h264", width,
+        height);
+  }
+
+  /* The file bytes of a keyframe are only known after the muxer. */
+  hwangsae_keyframe_index_add (priv->keyframe_index, GST_BUFFER_PTS (buffer),
+      (gst_element_get_base_time (priv->pipeline) + running_time) /
+      GST_USECOND, HWANGSAE_KEYFRAME_INDEX_NONE);
+
+  if (priv->trick_play &&
+      priv->trick_play_bytes + gst_buffer_get_size (buffer) <=
+      MAX_TRICK_PLAY_BYTES) {
+    TrickPlayFrame *frame = g_new (TrickPlayFrame, 1);
+
+    if (!priv->trick_play_caps) {
+      priv->trick_play_caps = gst_pad_get_current_caps (pad);
+    }
+
+    /* splitmuxsink splits files by the running time of DTS. */
+    frame->buffer = gst_buffer_ref (buffer);
+    frame->time = gst_element_get_base_time (priv->pipeline) +
+        gst_segment_to_running_time (segment, GST_FORMAT_TIME,
+        GST_BUFFER_DTS_OR_PTS (buffer));
+    g_queue_push_tail (&priv->trick_play_frames, frame);
+    priv->trick_play_bytes += gst_buffer_get_size (buffer);
+  }
+
+  g_mutex_unlock (&priv->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstClockTime
+_get_running_time (GstElement * element)
+{
+  g_autoptr (GstClock) clock = gst_element_get_clock (element);
+
+  if (!clock) {
+    return 0;
+  }
+
+  return gst_clock_get_time (clock) - gst_element_get_base_time (element);
+}
+
+static void
+hwangsae_recorder_flush_pre_roll_pes (HwangsaeRecorderPrivate * priv)
+{
+  if (priv->pre_roll_pes->len > 0) {
+    hwangsae_gop_ring_push (priv->pre_roll, priv->pre_roll_pes->data,
+        priv->pre_roll_pes->len, priv->pre_roll_pes_time,
+        priv->pre_roll_pes_keyframe);
+  }
+
+  g_byte_array_set_size (priv->pre_roll_pes, 0);
+  priv->pre_roll_pes_keyframe = FALSE;
+}
+
+/* Expects @data aligned to TS packets, which SRT payloads are. A keyframe
+ * may only be recognized a few packets into its PES, so each PES is held
+ * back until the next one starts. */
+static void
+hwangsae_recorder_push_pre_roll (HwangsaeRecorderPrivate * priv,
+    const guint8 * data, gsize size, gint64 arrival_us)
+{
+  const guint8 *end = data + size;
+
+  for (; data + HWANGSAE_TS_PACKET_SIZE <= end;
+      data += HWANGSAE_TS_PACKET_SIZE) {
+    HwangsaeTsScanResult result = HWANGSAE_TS_SCAN_NONE;
+
+    if (data[0] == HWANGSAE_TS_SYNC_BYTE) {
+      result = hwangsae_ts_keyframe_scanner_push (priv->pre_roll_scanner,
+          data);
+    }
+
+    if (result != HWANGSAE_TS_SCAN_NONE && (data[1] & 0x40)) {
+      hwangsae_recorder_flush_pre_roll_pes (priv);
+      priv->pre_roll_pes_time = arrival_us;
+    }
+    if (result == HWANGSAE_TS_SCAN_KEYFRAME) {
+      priv->pre_roll_pes_keyframe = TRUE;
+    }
+
+    g_byte_array_append (priv->pre_roll_pes, data, HWANGSAE_TS_PACKET_SIZE);
+  }
+}
+
+/* Reports fragments of passthrough recordings the same way splitmuxsink
+ * does, so that the bus handler treats both modes alike. */
+static void
+segmenter_cb (HwangsaeTsSegmenterEvent event, const gchar * location,
+    guint64 running_time, gpointer user_data)
+{
+  GstElement *sink = user_data;
+  const gchar *name = (event == HWANGSAE_TS_SEGMENTER_FRAGMENT_OPENED) ?
+      "splitmuxsink-fragment-opened" : "splitmuxsink-fragment-closed";
+
+  gst_element_post_message (sink, gst_message_new_element (GST_OBJECT (sink),
+          gst_structure_new (name, "location", G_TYPE_STRING, location,
+              "running-time", GST_TYPE_CLOCK_TIME, running_time, NULL)));
+}
+
+static GstFlowReturn
+passthrough_new_sample_cb (GstElement * sink, gpointer user_data)
+{
+  HwangsaeRecorder *self = HWANGSAE_RECORDER (user_data);
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  g_autoptr (GstSample) sample = NULL;
   g_autoptr (GError) error = NULL;
+  GstClockTime running_time;
+  GstMapInfo map;
+  gboolean ret = TRUE;
 
-  g_return_if_fail (!priv->pipeline);
+  g_signal_emit_by_name (sink, "pull-sample", &sample);
+  if (!sample) {
+    return GST_FLOW_EOS;
+  }
+
+  running_time = _get_running_time (sink);
+
+  gst_buffer_map (gst_sample_get_buffer (sample), &map, GST_MAP_READ);
+  g_mutex_lock (&priv->lock);
+  if (priv->segmenter) {
+    ret = hwangsae_ts_segmenter_push (priv->segmenter, map.data, map.size,
+        running_time, &error);
+  } else if (priv->pre_roll) {
+    hwangsae_recorder_push_pre_roll (priv, map.data, map.size,
+        running_time / GST_USECOND);
+  }
+  g_mutex_unlock (&priv->lock);
+  gst_buffer_unmap (gst_sample_get_buffer (sample), &map);
+
+  if (!ret) {
+    GST_ELEMENT_ERROR (sink, RESOURCE, WRITE, ("%s", error->message), (NULL));
+    return GST_FLOW_ERROR;
+  }
+
+  return GST_FLOW_OK;
+}
+
+static void
+passthrough_eos_cb (GstElement * sink, gpointer user_data)
+{
+  HwangsaeRecorder *self = HWANGSAE_RECORDER (user_data);
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&priv->lock);
+
+  if (!priv->segmenter) {
+    /* Armed but never started. */
+    return;
+  }
+
+  /* Called before the EOS message gets posted, so the last fragment is
+   * reported before the recording stops. */
+  if (!hwangsae_ts_segmenter_finish (priv->segmenter,
+          _get_running_time (sink), &error)) {
+    g_warning ("Failed to finish recording: %s", error->message);
+  }
+}
+
+/* Returns the location pattern of temporary recording files, creating the
+ * recording directory if needed. */
+static gchar *
+hwangsae_recorder_make_recording_file (HwangsaeRecorder * self)
+{
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  g_autofree gchar *recording_file_tmp = NULL;
 
   g_mkdir_with_parents (priv->recording_dir, 0750);
 
   recording_file_tmp = g_build_filename (priv->recording_dir,
       "%s-%ld-%%05d.tmp", NULL);
-  recording_file = g_strdup_printf (recording_file_tmp, priv->filename_prefix,
+
+  return g_strdup_printf (recording_file_tmp, priv->filename_prefix,
       g_get_real_time ());
+}
+
+static void
+hwangsae_recorder_start_pipeline (HwangsaeRecorder * self,
+    const gchar * src_description, gboolean armed)
+{
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+
+  g_autoptr (GstBus) bus = NULL;
+  g_autoptr (GstElement) element = NULL;
+  g_autoptr (GstPad) first_buffer_pad = NULL;
+  g_autofree gchar *recording_file = NULL;
+  g_autofree gchar *pipeline_str = NULL;
+  const gchar *mux_name;
+  gboolean passthrough;
+  g_autoptr (GError) error = NULL;
+
+  recording_file = hwangsae_recorder_make_recording_file (self);
 
   switch (priv->container) {
     case HWANGSAE_CONTAINER_MP4:
+    case HWANGSAE_CONTAINER_FMP4:
       mux_name = "mp4mux";
       break;
     case HWANGSAE_CONTAINER_TS:
@@ -327,40 +1103,493 @@ hwangsae_recorder_start_recording (HwangsaeRecorder * self, const gchar * uri)
           g_enum_to_string (HWANGSAE_TYPE_CONTAINER, priv->container));
   }
 
-  pipeline_str =
-      g_strdup_printf
-      ("urisourcebin uri=%s name=srcbin ! tsdemux ! h264parse name=parse ! "
-      "splitmuxsink name=sink async-finalize=true muxer-factory=%s",
-      uri, mux_name);
+  passthrough = armed ||
+      (priv->passthrough && priv->container == HWANGSAE_CONTAINER_TS);
+
+  if (passthrough) {
+    /* Received packets go to files unchanged, without demuxing and
+     * remuxing them. */
+    pipeline_str = g_strdup_printf ("%s ! appsink name=sink sync=false "
+        "emit-signals=true", src_description);
+  } else {
+    pipeline_str =
+        g_strdup_printf
+        ("%s ! tsdemux name=demux ! h264parse name=parse ! "
+        "splitmuxsink name=sink async-finalize=true muxer-factory=%s",
+        src_description, mux_name);
+  }
 
   priv->pipeline = gst_parse_launch (pipeline_str, &error);
+  priv->start_time_us = g_get_monotonic_time ();
+  hwangsae_metric_gauge_add (metric_recordings, 1);
 
   bus = gst_element_get_bus (priv->pipeline);
   gst_bus_add_watch (bus, gst_bus_cb, self);
 
-  element = gst_bin_get_by_name (GST_BIN (priv->pipeline), "parse");
-  parse_src = gst_element_get_static_pad (element, "src");
-  gst_pad_add_probe (parse_src,
+  element = gst_bin_get_by_name (GST_BIN (priv->pipeline),
+      passthrough ? "sink" : "demux");
+  priv->src_peer = gst_element_get_static_pad (element, "sink");
+  gst_pad_add_probe (priv->src_peer, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      source_eos_probe_cb, self, NULL);
+  g_clear_object (&element);
+
+  if (passthrough) {
+    element = gst_bin_get_by_name (GST_BIN (priv->pipeline), "sink");
+    first_buffer_pad = gst_element_get_static_pad (element, "sink");
+  } else {
+    element = gst_bin_get_by_name (GST_BIN (priv->pipeline), "parse");
+    first_buffer_pad = gst_element_get_static_pad (element, "src");
+  }
+  gst_pad_add_probe (first_buffer_pad,
       GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
       first_buffer_cb, bus, NULL);
 
+  if (!passthrough) {
+    if (priv->trick_play) {
+      /* Each keyframe of the I-frame rendition must be decodable alone. */
+      g_object_set (element, "config-interval", -1, NULL);
+    }
+
+    priv->keyframe_index = hwangsae_keyframe_index_new ();
+    gst_pad_add_probe (first_buffer_pad, GST_PAD_PROBE_TYPE_BUFFER,
+        keyframe_index_probe_cb, self, NULL);
+  }
+
+  g_clear_object (&element);
   element = gst_bin_get_by_name (GST_BIN (priv->pipeline), "sink");
-  g_object_set (element,
-      "location", recording_file,
-      "max-size-time", priv->max_size_time,
-      "max-size-bytes", priv->max_size_bytes, NULL);
+
+  if (passthrough) {
+    if (armed) {
+      priv->pre_roll = hwangsae_gop_ring_new (priv->pre_roll_time *
+          G_USEC_PER_SEC, MAX_PRE_ROLL_BYTES);
+      priv->pre_roll_scanner = hwangsae_ts_keyframe_scanner_new ();
+      priv->pre_roll_pes = g_byte_array_new ();
+    } else {
+      priv->segmenter = hwangsae_ts_segmenter_new (recording_file,
+          priv->max_size_time, priv->max_size_bytes, segmenter_cb, element);
+    }
+    g_signal_connect (element, "new-sample",
+        G_CALLBACK (passthrough_new_sample_cb), self);
+    g_signal_connect (element, "eos", G_CALLBACK (passthrough_eos_cb), self);
+  } else {
+    g_object_set (element,
+        "location", recording_file,
+        "max-size-time", priv->max_size_time,
+        "max-size-bytes", priv->max_size_bytes, NULL);
+
+    if (priv->container == HWANGSAE_CONTAINER_FMP4) {
+      /* Makes mp4mux write a moof and mdat per fragment instead of keeping
+       * the sample tables of the whole file until it gets finalized. */
+      g_autoptr (GstStructure) muxer_properties =
+          gst_structure_new ("properties",
+          "fragment-duration", G_TYPE_UINT, priv->fragment_duration, NULL);
+
+      g_object_set (element, "muxer-properties", muxer_properties, NULL);
+    }
+  }
+}
+
+static void
+engine_cb (HwangsaeRecordingEngineEvent event, const gchar * location,
+    guint64 running_time, gpointer user_data)
+{
+  HwangsaeRecorder *self = HWANGSAE_RECORDER (user_data);
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+
+  switch (event) {
+    case HWANGSAE_RECORDING_ENGINE_CONNECTED:
+      hwangsae_recorder_on_first_frame (self);
+      break;
+    case HWANGSAE_RECORDING_ENGINE_FRAGMENT_OPENED:
+      hwangsae_recorder_on_file_opened (self, running_time);
+      break;
+    case HWANGSAE_RECORDING_ENGINE_FRAGMENT_CLOSED:
+      hwangsae_recorder_on_file_completed (self, location, running_time);
+      break;
+    case HWANGSAE_RECORDING_ENGINE_DISCONNECTED:
+      priv->engine_stream_id = 0;
+      hwangsae_recorder_on_source_lost (self);
+      break;
+  }
+}
+
+static gboolean
+hwangsae_recorder_add_engine_stream (HwangsaeRecorder * self, GError ** error)
+{
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  g_autofree gchar *recording_file = NULL;
+
+  recording_file = hwangsae_recorder_make_recording_file (self);
+
+  priv->engine_stream_id =
+      hwangsae_recording_engine_add_stream
+      (hwangsae_recording_engine_get_default (), priv->uri, recording_file,
+      priv->max_size_time, priv->max_size_bytes, engine_cb, self, error);
+
+  return priv->engine_stream_id != 0;
+}
+
+static void
+hwangsae_recorder_start_engine (HwangsaeRecorder * self)
+{
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  g_autoptr (GError) error = NULL;
+
+  if (!hwangsae_recorder_add_engine_stream (self, &error)) {
+    g_warning ("Failed to start recording %s: %s", priv->uri, error->message);
+    return;
+  }
+
+  priv->start_time_us = g_get_monotonic_time ();
+  hwangsae_metric_gauge_add (metric_recordings, 1);
+}
+
+static void
+srcbin_pad_added_cb (GstElement * srcbin, GstPad * pad, gpointer user_data)
+{
+  GstPad *src_peer = user_data;
+
+  if (!gst_pad_is_linked (src_peer)) {
+    gst_pad_link (pad, src_peer);
+  }
+}
+
+/* Replaces the urisourcebin of the pipeline with a new one, or asks the
+ * shared engine for a new stream. The rest of the pipeline keeps running. */
+static gboolean
+reconnect_cb (gpointer user_data)
+{
+  HwangsaeRecorder *self = HWANGSAE_RECORDER (user_data);
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  g_autoptr (GstElement) old_srcbin = NULL;
+  g_autoptr (GstBus) bus = NULL;
+  GstElement *srcbin;
+
+  priv->reconnect_source = 0;
+
+  g_debug ("Reconnecting to %s", priv->uri);
+  hwangsae_metric_counter_add (metric_reconnects, 1);
+
+  if (!priv->pipeline) {
+    g_autoptr (GError) error = NULL;
+
+    if (!hwangsae_recorder_add_engine_stream (self, &error)) {
+      g_debug ("Failed to reconnect to %s: %s", priv->uri, error->message);
+      /* Tries again later, unless the reconnect timeout has run out. */
+      hwangsae_recorder_on_source_lost (self);
+    }
+    return G_SOURCE_REMOVE;
+  }
+
+  old_srcbin = gst_bin_get_by_name (GST_BIN (priv->pipeline), "srcbin");
+  if (old_srcbin) {
+    gst_element_set_state (old_srcbin, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (priv->pipeline), old_srcbin);
+  }
+
+  srcbin = gst_element_factory_make ("urisourcebin", "srcbin");
+  g_object_set (srcbin, "uri", priv->uri, NULL);
+  g_signal_connect (srcbin, "pad-added", G_CALLBACK (srcbin_pad_added_cb),
+      priv->src_peer);
+  gst_bin_add (GST_BIN (priv->pipeline), srcbin);
+
+  /* Tells on_first_frame when data flows again. */
+  bus = gst_element_get_bus (priv->pipeline);
+  gst_pad_add_probe (priv->src_peer,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      first_buffer_cb, bus, NULL);
+
+  if (!gst_element_sync_state_with_parent (srcbin)) {
+    hwangsae_recorder_on_source_lost (self);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Ends the current file of a pipeline recording at the outage, so that the
+ * next one starts with the first keyframe received after reconnecting. */
+static void
+hwangsae_recorder_split (HwangsaeRecorder * self)
+{
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  g_autoptr (GstElement) sink = NULL;
+  g_autoptr (GMutexLocker) locker = NULL;
+  g_autofree gchar *recording_file = NULL;
+  g_autoptr (GError) error = NULL;
+
+  sink = gst_bin_get_by_name (GST_BIN (priv->pipeline), "sink");
+
+  if (priv->keyframe_index) {
+    /* Remuxed recording. */
+    g_signal_emit_by_name (sink, "split-now");
+    return;
+  }
+
+  locker = g_mutex_locker_new (&priv->lock);
+
+  if (!priv->segmenter) {
+    return;
+  }
+
+  if (!hwangsae_ts_segmenter_finish (priv->segmenter,
+          _get_running_time (sink), &error)) {
+    g_warning ("Failed to finish recording: %s", error->message);
+  }
+  hwangsae_ts_segmenter_free (priv->segmenter);
+
+  recording_file = hwangsae_recorder_make_recording_file (self);
+  priv->segmenter = hwangsae_ts_segmenter_new (recording_file,
+      priv->max_size_time, priv->max_size_bytes, segmenter_cb, sink);
+}
+
+/* Retries the source with an exponential backoff until "reconnect-timeout"
+ * runs out. Returns FALSE when the recording should end instead. */
+static gboolean
+hwangsae_recorder_schedule_reconnect (HwangsaeRecorder * self)
+{
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  gint64 now = g_get_monotonic_time ();
+
+  if (priv->reconnect_source) {
+    return TRUE;
+  }
+
+  if (priv->reconnect_timeout == 0 || !priv->uri ||
+      g_atomic_int_get (&priv->stopping)) {
+    return FALSE;
+  }
+
+  if (priv->outage_start_us == 0) {
+    g_debug ("Lost connection to %s", priv->uri);
+    priv->outage_start_us = now;
+    if (priv->playlist_discontinuity_us == 0) {
+      priv->playlist_discontinuity_us = g_get_real_time ();
+    }
+    priv->reconnect_delay_ms = RECONNECT_DELAY_MIN_MS;
+  } else if (now - priv->outage_start_us >
+      priv->reconnect_timeout * G_USEC_PER_SEC) {
+    g_debug ("Giving up reconnecting to %s", priv->uri);
+    return FALSE;
+  } else {
+    priv->reconnect_delay_ms =
+        MIN (priv->reconnect_delay_ms * 2, RECONNECT_DELAY_MAX_MS);
+  }
+
+  priv->reconnect_source =
+      g_timeout_add (priv->reconnect_delay_ms, reconnect_cb, self);
+
+  return TRUE;
+}
+
+static void
+hwangsae_recorder_on_source_lost (HwangsaeRecorder * self)
+{
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  gboolean new_outage = priv->outage_start_us == 0;
+
+  if (hwangsae_recorder_schedule_reconnect (self)) {
+    if (new_outage && priv->pipeline) {
+      hwangsae_recorder_split (self);
+    }
+    return;
+  }
+
+  if (!priv->pipeline) {
+    hwangsae_recorder_stop_recording_internal (self);
+    return;
+  }
+
+  /* Ends the recording as if the source stream had ended. */
+  g_atomic_int_set (&priv->stopping, TRUE);
+  gst_pad_send_event (priv->src_peer, gst_event_new_eos ());
+}
+
+/* Starts recording of an armed pipeline, with what the pre-roll has as the
+ * beginning of the first file. */
+static void
+hwangsae_recorder_start_armed (HwangsaeRecorder * self)
+{
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  g_autoptr (GstElement) sink = NULL;
+  g_autoptr (GMutexLocker) locker = NULL;
+  g_autofree gchar *recording_file = NULL;
+  g_autoptr (GError) error = NULL;
+  const guint8 *psi;
+  gsize psi_size;
+  guint64 seq;
+
+  sink = gst_bin_get_by_name (GST_BIN (priv->pipeline), "sink");
+  recording_file = hwangsae_recorder_make_recording_file (self);
+
+  locker = g_mutex_locker_new (&priv->lock);
+
+  priv->segmenter = hwangsae_ts_segmenter_new (recording_file,
+      priv->max_size_time, priv->max_size_bytes, segmenter_cb, sink);
+  /* The pre-roll isn't live, so the first push can't tell the base. */
+  hwangsae_ts_segmenter_set_base_time (priv->segmenter,
+      g_get_real_time () - _get_running_time (sink) / GST_USECOND);
+
+  hwangsae_recorder_flush_pre_roll_pes (priv);
+
+  /* The PAT and PMT most likely went with an evicted GOP, but the segmenter
+   * needs them to find the keyframes. */
+  psi = hwangsae_ts_keyframe_scanner_get_psi (priv->pre_roll_scanner,
+      &psi_size);
+  if (psi && hwangsae_gop_ring_get_size (priv->pre_roll) > 0) {
+    gint64 arrival_us;
+
+    hwangsae_gop_ring_get (priv->pre_roll,
+        hwangsae_gop_ring_get_head (priv->pre_roll), NULL, &arrival_us);
+    hwangsae_ts_segmenter_push (priv->segmenter, psi, psi_size,
+        arrival_us * GST_USECOND, NULL);
+  }
+
+  for (seq = hwangsae_gop_ring_get_head (priv->pre_roll);
+      seq != hwangsae_gop_ring_get_tail (priv->pre_roll); ++seq) {
+    const guint8 *data;
+    gint64 arrival_us;
+    gsize len;
+
+    data = hwangsae_gop_ring_get (priv->pre_roll, seq, &len, &arrival_us);
+    if (!hwangsae_ts_segmenter_push (priv->segmenter, data, len,
+            arrival_us * GST_USECOND, &error)) {
+      g_warning ("Failed to record the pre-roll: %s", error->message);
+      break;
+    }
+  }
+
+  hwangsae_recorder_clear_pre_roll (priv);
+}
+
+void
+hwangsae_recorder_start_recording (HwangsaeRecorder * self, const gchar * uri)
+{
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  g_autofree gchar *src_description = NULL;
+
+  if (priv->pre_roll) {
+    g_return_if_fail (g_strcmp0 (uri, priv->armed_uri) == 0);
+
+    hwangsae_recorder_start_armed (self);
+    return;
+  }
+
+  g_return_if_fail (!priv->pipeline && priv->engine_stream_id == 0);
+
+  g_free (priv->uri);
+  priv->uri = g_strdup (uri);
+
+  if (priv->shared_engine && priv->passthrough &&
+      priv->container == HWANGSAE_CONTAINER_TS &&
+      g_str_has_prefix (uri, "srt://")) {
+    hwangsae_recorder_start_engine (self);
+    return;
+  }
+
+  src_description = g_strdup_printf ("urisourcebin uri=%s name=srcbin", uri);
+
+  hwangsae_recorder_start_pipeline (self, src_description, FALSE);
 
   gst_element_set_state (priv->pipeline, GST_STATE_PLAYING);
 }
 
+void
+hwangsae_recorder_arm (HwangsaeRecorder * self, const gchar * uri)
+{
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  g_autofree gchar *src_description = NULL;
+
+  g_return_if_fail (!priv->pipeline && priv->engine_stream_id == 0);
+  g_return_if_fail (priv->container == HWANGSAE_CONTAINER_TS);
+
+  g_free (priv->uri);
+  priv->uri = g_strdup (uri);
+
+  src_description = g_strdup_printf ("urisourcebin uri=%s name=srcbin", uri);
+
+  hwangsae_recorder_start_pipeline (self, src_description, TRUE);
+  priv->armed_uri = g_strdup (uri);
+
+  gst_element_set_state (priv->pipeline, GST_STATE_PLAYING);
+}
+
+static void
+relay_tap_cb (const guint8 * data, gsize size, gpointer user_data)
+{
+  GstElement *appsrc = user_data;
+  g_autoptr (GstBuffer) buffer = NULL;
+  GstFlowReturn ret;
+  guint64 level;
+
+  if (!data) {
+    /* The sink has left the relay. */
+    g_signal_emit_by_name (appsrc, "end-of-stream", &ret);
+    return;
+  }
+
+  /* appsrc only blocks when full, which would stall the relay thread. */
+  g_object_get (appsrc, "current-level-bytes", &level, NULL);
+  if (level + size > MAX_RELAY_TAP_BYTES) {
+    hwangsae_metric_counter_add (metric_relay_tap_bytes_dropped, size);
+    return;
+  }
+
+  buffer = gst_buffer_new_allocate (NULL, size, NULL);
+  gst_buffer_fill (buffer, 0, data, size);
+  g_signal_emit_by_name (appsrc, "push-buffer", buffer, &ret);
+}
+
+void
+hwangsae_recorder_start_recording_from_relay (HwangsaeRecorder * self,
+    HwangsaeRelay * relay, const gchar * resource)
+{
+  HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
+  g_autoptr (GstElement) appsrc = NULL;
+
+  g_return_if_fail (!priv->pipeline && priv->engine_stream_id == 0);
+  g_return_if_fail (HWANGSAE_IS_RELAY (relay));
+  g_return_if_fail (resource != NULL);
+
+  hwangsae_recorder_start_pipeline (self,
+      "appsrc name=srcbin is-live=true do-timestamp=true format=time "
+      "caps=video/mpegts,systemstream=true,packetsize=188", FALSE);
+
+  gst_element_set_state (priv->pipeline, GST_STATE_PLAYING);
+
+  appsrc = gst_bin_get_by_name (GST_BIN (priv->pipeline), "srcbin");
+  g_object_set (appsrc, "max-bytes", (guint64) MAX_RELAY_TAP_BYTES, NULL);
+
+  priv->relay = g_object_ref (relay);
+  priv->relay_tap_id = hwangsae_relay_add_tap (relay, resource, relay_tap_cb,
+      gst_object_ref (appsrc), gst_object_unref);
+}
+
 void
 hwangsae_recorder_stop_recording (HwangsaeRecorder * self)
 {
   HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
 
-  g_return_if_fail (priv->pipeline);
+  g_return_if_fail (priv->pipeline || priv->engine_stream_id != 0 ||
+      priv->reconnect_source != 0);
 
-  if (priv->is_connected) {
+  g_atomic_int_set (&priv->stopping, TRUE);
+
+  if (!priv->pipeline && priv->engine_stream_id == 0) {
+    /* Between two connections to the shared engine. */
+    hwangsae_recorder_stop_recording_internal (self);
+  } else if (priv->engine_stream_id != 0) {
+    /* The engine finishes the last file and then reports the
+     * disconnection. */
+    hwangsae_recording_engine_remove_stream
+        (hwangsae_recording_engine_get_default (), priv->engine_stream_id);
+  } else if (priv->is_connected && priv->outage_start_us != 0) {
+    /* No source to send EOS from while reconnecting. */
+    if (priv->reconnect_source) {
+      g_source_remove (priv->reconnect_source);
+      priv->reconnect_source = 0;
+    }
+    gst_pad_send_event (priv->src_peer, gst_event_new_eos ());
+  } else if (priv->is_connected) {
     g_autoptr (GstElement) srcbin = NULL;
 
     srcbin = gst_bin_get_by_name (GST_BIN (priv->pipeline), "srcbin");
@@ -397,6 +1626,27 @@ hwangsae_recorder_set_property (GObject * object, guint property_id,
       g_clear_pointer (&priv->filename_prefix, g_free);
       priv->filename_prefix = g_strdup (g_value_get_string (value));
       break;
+    case PROP_PASSTHROUGH:
+      priv->passthrough = g_value_get_boolean (value);
+      break;
+    case PROP_SHARED_ENGINE:
+      priv->shared_engine = g_value_get_boolean (value);
+      break;
+    case PROP_PRE_ROLL_TIME:
+      priv->pre_roll_time = g_value_get_uint (value);
+      break;
+    case PROP_FRAGMENT_DURATION:
+      priv->fragment_duration = g_value_get_uint (value);
+      break;
+    case PROP_RECONNECT_TIMEOUT:
+      priv->reconnect_timeout = g_value_get_uint (value);
+      break;
+    case PROP_TRICK_PLAY:
+      priv->trick_play = g_value_get_boolean (value);
+      break;
+    case PROP_HLS_PLAYLIST:
+      priv->hls_playlist = g_value_get_boolean (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
   }
@@ -425,6 +1675,27 @@ hwangsae_recorder_get_property (GObject * object, guint property_id,
     case PROP_FILENAME_PREFIX:
       g_value_set_string (value, priv->filename_prefix);
       break;
+    case PROP_PASSTHROUGH:
+      g_value_set_boolean (value, priv->passthrough);
+      break;
+    case PROP_SHARED_ENGINE:
+      g_value_set_boolean (value, priv->shared_engine);
+      break;
+    case PROP_PRE_ROLL_TIME:
+      g_value_set_uint (value, priv->pre_roll_time);
+      break;
+    case PROP_FRAGMENT_DURATION:
+      g_value_set_uint (value, priv->fragment_duration);
+      break;
+    case PROP_RECONNECT_TIMEOUT:
+      g_value_set_uint (value, priv->reconnect_timeout);
+      break;
+    case PROP_TRICK_PLAY:
+      g_value_set_boolean (value, priv->trick_play);
+      break;
+    case PROP_HLS_PLAYLIST:
+      g_value_set_boolean (value, priv->hls_playlist);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
   }
@@ -464,6 +1735,49 @@ hwangsae_recorder_class_init (HwangsaeRecorderClass * klass)
           "Recording file prefix", "hwangsae-recording",
           G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_PASSTHROUGH,
+      g_param_spec_boolean ("passthrough", "Passthrough",
+          "Write received MPEG-TS packets to ts container recordings "
+          "unchanged, splitting files at keyframes, instead of remuxing "
+          "them", FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SHARED_ENGINE,
+      g_param_spec_boolean ("shared-engine", "Shared engine",
+          "Record passthrough recordings of srt:// URIs in the recording "
+          "engine shared by the whole process instead of in a pipeline of "
+          "their own", FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PRE_ROLL_TIME,
+      g_param_spec_uint ("pre-roll-time", "Pre-roll time",
+          "Seconds of stream an armed recorder keeps in memory to begin "
+          "the recording with", 0, 3600, 5,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_FRAGMENT_DURATION,
+      g_param_spec_uint ("fragment-duration", "Fragment duration",
+          "Duration of the fragments of fmp4 container recordings (in ms)",
+          1, G_MAXUINT, 1000,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_RECONNECT_TIMEOUT,
+      g_param_spec_uint ("reconnect-timeout", "Reconnect timeout",
+          "Seconds to keep reconnecting to a lost source before ending the "
+          "recording (0 = end it right away)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_TRICK_PLAY,
+      g_param_spec_boolean ("trick-play", "Trick play",
+          "Write an I-frame only rendition next to each file of recordings "
+          "that are not in passthrough mode", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_HLS_PLAYLIST,
+      g_param_spec_boolean ("hls-playlist", "HLS playlist",
+          "Keep an HLS media playlist of the files of MPEG-TS recordings "
+          "next to them, named after the filename prefix. Requires a "
+          "max-size-time, which sets the target duration", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   signals[STREAM_CONNECTED_SIGNAL] =
       g_signal_new ("stream-connected", G_TYPE_FROM_CLASS (klass),
       G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 0);
@@ -487,6 +1801,17 @@ hwangsae_recorder_class_init (HwangsaeRecorderClass * klass)
     g_autoptr (GstClock) clock = gst_system_clock_obtain ();
     g_object_set (clock, "clock-type", GST_CLOCK_TYPE_REALTIME, NULL);
   }
+
+  metric_recordings = hwangsae_metrics_register_gauge ("recorder.recordings");
+  metric_files_completed =
+      hwangsae_metrics_register_counter ("recorder.files-completed");
+  metric_bytes_recorded =
+      hwangsae_metrics_register_counter ("recorder.bytes-recorded");
+  metric_connect_time =
+      hwangsae_metrics_register_histogram ("recorder.connect-time");
+  metric_reconnects = hwangsae_metrics_register_counter ("recorder.reconnects");
+  metric_relay_tap_bytes_dropped =
+      hwangsae_metrics_register_counter ("recorder.relay-tap-bytes-dropped");
 }
 
 static void
@@ -495,6 +1820,8 @@ hwangsae_recorder_init (HwangsaeRecorder * self)
   HwangsaeRecorderPrivate *priv = hwangsae_recorder_get_instance_private (self);
   g_autofree gchar *dir = NULL;
 
+  g_mutex_init (&priv->lock);
+
   priv->settings =
       hwangsae_common_gsettings_new ("org.hwangsaeul.hwangsae.recorder");
 
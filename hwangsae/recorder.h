@@ -26,6 +26,7 @@
 #include <glib-object.h>
 
 #include "types.h"
+#include "relay.h"
 
 /**
  * SECTION: recorder
@@ -164,12 +165,42 @@ void                    hwangsae_recorder_set_max_size_bytes
  * @self: a pointer to a HwangsaeRecorder object
  * @uri: source streaming URI
  *
- * Starts a new recording using using the provided source URI
+ * Starts a new recording using using the provided source URI. If @self is
+ * armed, the recording starts right away with the pre-roll.
  */
  void                    hwangsae_recorder_start_recording
                                                        (HwangsaeRecorder * self,
                                                         const gchar * uri);
 
+/**
+ * hwangsae_recorder_arm:
+ * @self: a pointer to a HwangsaeRecorder object
+ * @uri: source streaming URI
+ *
+ * Connects to @uri and keeps the last #HwangsaeRecorder:pre-roll-time seconds
+ * of the stream in memory, starting at a keyframe, without writing any file.
+ * A later hwangsae_recorder_start_recording() with the same @uri begins the
+ * recording with them. Armed recorders need the ts container and always
+ * record in passthrough mode.
+ */
+ void                    hwangsae_recorder_arm          (HwangsaeRecorder * self,
+                                                        const gchar * uri);
+
+/**
+ * hwangsae_recorder_start_recording_from_relay:
+ * @self: a pointer to a HwangsaeRecorder object
+ * @relay: a HwangsaeRelay running in the same process
+ * @resource: username of the relay sink to record
+ *
+ * Starts a new recording of a stream that @relay receives from @resource.
+ * The packets are taken directly from the relay, without an SRT connection
+ * in between. The recording stops when the sink disconnects.
+ */
+ void                    hwangsae_recorder_start_recording_from_relay
+                                                       (HwangsaeRecorder * self,
+                                                        HwangsaeRelay    * relay,
+                                                        const gchar * resource);
+
 /**
  * hwangsae_recorder_stop_recording:
  * @self: a pointer to a HwangsaeRecorder object
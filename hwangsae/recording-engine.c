@@ -0,0 +1,550 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "recording-engine.h"
+
+#include "common.h"
+#include "metrics.h"
+#include "ts-segmenter.h"
+
+#include <gio/gio.h>
+#include <srt/srt.h>
+#include <string.h>
+
+#define RECV_BUFFER_SIZE 1500
+#define MAX_EPOLL_EVENTS 64
+#define EPOLL_WAIT_TIMEOUT_MS 100
+
+/* Received data a stream may have waiting for a worker. Past that, new data
+ * of the stream is dropped, so that a stalled disk can't exhaust memory. */
+#define MAX_QUEUED_BYTES (32 * 1024 * 1024)
+
+struct _HwangsaeRecordingEngine
+{
+  GMutex lock;
+
+  gint poll_id;
+  GThread *io_thread;
+  GThreadPool *workers;
+
+  guint next_stream_id;
+  GHashTable *streams;
+  GHashTable *srtsocket_stream_map;
+};
+
+typedef struct
+{
+  gint refcount;
+
+  guint id;
+  SRTSOCKET socket;
+
+  GMainContext *context;
+  HwangsaeRecordingEngineFunc func;
+  gpointer user_data;
+
+  /* Used only by the worker that has the stream scheduled. */
+  HwangsaeTsSegmenter *segmenter;
+
+  /* Protected by the engine lock. */
+  GQueue chunks;
+  gsize queued_bytes;
+  gboolean scheduled;
+  gboolean connected;
+  gboolean closed;
+} RecordingStream;
+
+typedef struct
+{
+  GByteArray *data;
+  guint64 running_time;
+} RecordingChunk;
+
+typedef struct
+{
+  RecordingStream *stream;
+  HwangsaeRecordingEngineEvent event;
+  gchar *location;
+  guint64 running_time;
+} RecordingEvent;
+
+static const gint SRT_POLL_EVENTS = SRT_EPOLL_IN | SRT_EPOLL_ERR;
+
+static HwangsaeMetric *metric_streams;
+static HwangsaeMetric *metric_bytes_dropped;
+
+static guint64
+_get_running_time (void)
+{
+  return g_get_real_time () * 1000;
+}
+
+static void
+_recording_chunk_free (RecordingChunk * chunk)
+{
+  g_byte_array_unref (chunk->data);
+  g_free (chunk);
+}
+
+static RecordingStream *
+_recording_stream_ref (RecordingStream * stream)
+{
+  g_atomic_int_inc (&stream->refcount);
+
+  return stream;
+}
+
+static void
+_recording_stream_unref (RecordingStream * stream)
+{
+  if (!g_atomic_int_dec_and_test (&stream->refcount)) {
+    return;
+  }
+
+  g_clear_pointer (&stream->segmenter, hwangsae_ts_segmenter_free);
+  g_queue_foreach (&stream->chunks, (GFunc) _recording_chunk_free, NULL);
+  g_queue_clear (&stream->chunks);
+  g_main_context_unref (stream->context);
+  g_free (stream);
+
+  hwangsae_metric_gauge_add (metric_streams, -1);
+}
+
+static gboolean
+_recording_event_dispatch (RecordingEvent * event)
+{
+  RecordingStream *stream = event->stream;
+
+  stream->func (event->event, event->location, event->running_time,
+      stream->user_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+_recording_event_free (RecordingEvent * event)
+{
+  _recording_stream_unref (event->stream);
+  g_free (event->location);
+  g_free (event);
+}
+
+/* Events of a stream are dispatched in the order they are posted, since
+ * idle sources of the same priority run in the order they were attached. */
+static void
+_recording_stream_post (RecordingStream * stream,
+    HwangsaeRecordingEngineEvent type, const gchar * location,
+    guint64 running_time)
+{
+  g_autoptr (GSource) source = g_idle_source_new ();
+  RecordingEvent *event = g_new0 (RecordingEvent, 1);
+
+  event->stream = _recording_stream_ref (stream);
+  event->event = type;
+  event->location = g_strdup (location);
+  event->running_time = running_time;
+
+  g_source_set_priority (source, G_PRIORITY_DEFAULT);
+  g_source_set_callback (source, (GSourceFunc) _recording_event_dispatch,
+      event, (GDestroyNotify) _recording_event_free);
+  g_source_attach (source, stream->context);
+}
+
+static void
+_segmenter_cb (HwangsaeTsSegmenterEvent event, const gchar * location,
+    guint64 running_time, gpointer user_data)
+{
+  _recording_stream_post (user_data,
+      (event == HWANGSAE_TS_SEGMENTER_FRAGMENT_OPENED) ?
+      HWANGSAE_RECORDING_ENGINE_FRAGMENT_OPENED :
+      HWANGSAE_RECORDING_ENGINE_FRAGMENT_CLOSED, location, running_time);
+}
+
+static void
+hwangsae_recording_engine_schedule_locked (HwangsaeRecordingEngine * self,
+    RecordingStream * stream)
+{
+  if (stream->scheduled) {
+    return;
+  }
+
+  stream->scheduled = TRUE;
+  g_thread_pool_push (self->workers, _recording_stream_ref (stream), NULL);
+}
+
+static void
+hwangsae_recording_engine_close_stream_locked (HwangsaeRecordingEngine * self,
+    RecordingStream * stream)
+{
+  if (stream->closed) {
+    return;
+  }
+
+  stream->closed = TRUE;
+
+  srt_epoll_remove_usock (self->poll_id, stream->socket);
+  g_hash_table_remove (self->srtsocket_stream_map, &stream->socket);
+  srt_close (stream->socket);
+
+  /* The worker finishes the last file and reports the disconnection. */
+  hwangsae_recording_engine_schedule_locked (self, stream);
+
+  g_hash_table_remove (self->streams, GUINT_TO_POINTER (stream->id));
+}
+
+static void
+hwangsae_recording_engine_worker (RecordingStream * stream,
+    HwangsaeRecordingEngine * self)
+{
+  gboolean failed = FALSE;
+
+  for (;;) {
+    g_autoptr (GError) error = NULL;
+    RecordingChunk *chunk;
+    gboolean closed;
+
+    g_mutex_lock (&self->lock);
+    chunk = g_queue_pop_head (&stream->chunks);
+    if (chunk) {
+      stream->queued_bytes -= chunk->data->len;
+    }
+    closed = stream->closed;
+    if (!chunk && !closed) {
+      stream->scheduled = FALSE;
+    }
+    g_mutex_unlock (&self->lock);
+
+    if (chunk) {
+      if (!failed && !hwangsae_ts_segmenter_push (stream->segmenter,
+              chunk->data->data, chunk->data->len, chunk->running_time,
+              &error)) {
+        g_warning ("Recording of stream %u failed: %s", stream->id,
+            error->message);
+        failed = TRUE;
+
+        g_mutex_lock (&self->lock);
+        hwangsae_recording_engine_close_stream_locked (self, stream);
+        g_mutex_unlock (&self->lock);
+      }
+      _recording_chunk_free (chunk);
+      continue;
+    }
+
+    if (closed) {
+      /* Stays scheduled, so that no other worker picks the stream up. */
+      if (!hwangsae_ts_segmenter_finish (stream->segmenter,
+              _get_running_time (), &error)) {
+        g_warning ("Failed to finish recording of stream %u: %s", stream->id,
+            error->message);
+      }
+      _recording_stream_post (stream, HWANGSAE_RECORDING_ENGINE_DISCONNECTED,
+          NULL, 0);
+    }
+    break;
+  }
+
+  _recording_stream_unref (stream);
+}
+
+static void
+hwangsae_recording_engine_read_locked (HwangsaeRecordingEngine * self,
+    RecordingStream * stream)
+{
+  g_autoptr (GByteArray) data = g_byte_array_new ();
+  gchar buf[RECV_BUFFER_SIZE];
+  gboolean disconnected = FALSE;
+
+  for (;;) {
+    gint recv = srt_recvmsg (stream->socket, buf, sizeof (buf));
+
+    if (recv > 0) {
+      g_byte_array_append (data, (const guint8 *) buf, recv);
+      continue;
+    }
+
+    if (recv < 0 && srt_getlasterror (NULL) != SRT_EASYNCRCV) {
+      disconnected = TRUE;
+    }
+    break;
+  }
+
+  if (data->len > 0) {
+    if (!stream->connected) {
+      stream->connected = TRUE;
+      _recording_stream_post (stream, HWANGSAE_RECORDING_ENGINE_CONNECTED,
+          NULL, 0);
+    }
+
+    if (stream->queued_bytes + data->len > MAX_QUEUED_BYTES) {
+      hwangsae_metric_counter_add (metric_bytes_dropped, data->len);
+    } else {
+      RecordingChunk *chunk = g_new0 (RecordingChunk, 1);
+
+      chunk->running_time = _get_running_time ();
+      chunk->data = g_steal_pointer (&data);
+      stream->queued_bytes += chunk->data->len;
+      g_queue_push_tail (&stream->chunks, chunk);
+
+      hwangsae_recording_engine_schedule_locked (self, stream);
+    }
+  }
+
+  if (disconnected) {
+    g_debug ("Recording stream %u disconnected: %s", stream->id,
+        srt_getlasterror_str ());
+    hwangsae_recording_engine_close_stream_locked (self, stream);
+  }
+}
+
+static gpointer
+hwangsae_recording_engine_io_thread (HwangsaeRecordingEngine * self)
+{
+  SRTSOCKET readfds[MAX_EPOLL_EVENTS];
+
+  for (;;) {
+    gint rnum = G_N_ELEMENTS (readfds);
+
+    if (srt_epoll_wait (self->poll_id, readfds, &rnum, 0, 0,
+            EPOLL_WAIT_TIMEOUT_MS, NULL, 0, NULL, 0) <= 0) {
+      if (srt_getlasterror (NULL) != SRT_ETIMEOUT) {
+        /* No streams to wait for. */
+        g_usleep (EPOLL_WAIT_TIMEOUT_MS * 1000);
+      }
+      continue;
+    }
+
+    while (rnum != 0) {
+      SRTSOCKET rsocket = readfds[--rnum];
+      RecordingStream *stream;
+
+      g_mutex_lock (&self->lock);
+
+      stream = g_hash_table_lookup (self->srtsocket_stream_map, &rsocket);
+      if (stream) {
+        /* A stream may get closed in the middle of reading. */
+        _recording_stream_ref (stream);
+        hwangsae_recording_engine_read_locked (self, stream);
+        _recording_stream_unref (stream);
+      }
+
+      g_mutex_unlock (&self->lock);
+    }
+  }
+
+  return NULL;
+}
+
+static HwangsaeRecordingEngine *
+hwangsae_recording_engine_new (void)
+{
+  HwangsaeRecordingEngine *self = g_new0 (HwangsaeRecordingEngine, 1);
+
+  if (srt_startup () == -1) {
+    g_error ("%s", srt_getlasterror_str ());
+  }
+
+  g_mutex_init (&self->lock);
+
+  self->poll_id = srt_epoll_create ();
+  self->next_stream_id = 1;
+  self->streams = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      NULL, (GDestroyNotify) _recording_stream_unref);
+  self->srtsocket_stream_map = g_hash_table_new (g_int_hash, g_int_equal);
+
+  /* Streams are spread over as many workers as there are CPUs, however
+   * many of them are being recorded. */
+  self->workers = g_thread_pool_new ((GFunc) hwangsae_recording_engine_worker,
+      self, g_get_num_processors (), FALSE, NULL);
+  self->io_thread = g_thread_new ("HwangsaeRecordingEngine",
+      (GThreadFunc) hwangsae_recording_engine_io_thread, self);
+
+  metric_streams =
+      hwangsae_metrics_register_gauge ("recording-engine.streams");
+  metric_bytes_dropped =
+      hwangsae_metrics_register_counter ("recording-engine.bytes-dropped");
+
+  return self;
+}
+
+HwangsaeRecordingEngine *
+hwangsae_recording_engine_get_default (void)
+{
+  static gsize engine = 0;
+
+  if (g_once_init_enter (&engine)) {
+    g_once_init_leave (&engine, (gsize) hwangsae_recording_engine_new ());
+  }
+
+  return (HwangsaeRecordingEngine *) engine;
+}
+
+static gchar *
+_get_uri_param (const gchar * uri, const gchar * name)
+{
+  const gchar *query = strchr (uri, '?');
+  g_auto (GStrv) params = NULL;
+  gsize name_len = strlen (name);
+  gchar **it;
+
+  if (!query) {
+    return NULL;
+  }
+
+  params = g_strsplit (query + 1, "&", -1);
+  for (it = params; *it; ++it) {
+    if (g_str_has_prefix (*it, name) && (*it)[name_len] == '=') {
+      return g_uri_unescape_string (*it + name_len + 1, NULL);
+    }
+  }
+
+  return NULL;
+}
+
+static GSocketAddress *
+_resolve_address (const gchar * host, guint port, GError ** error)
+{
+  g_autoptr (GInetAddress) address = g_inet_address_new_from_string (host);
+
+  if (!address) {
+    g_autoptr (GResolver) resolver = g_resolver_get_default ();
+    GList *addresses;
+
+    addresses = g_resolver_lookup_by_name (resolver, host, NULL, error);
+    if (!addresses) {
+      return NULL;
+    }
+
+    address = g_object_ref (addresses->data);
+    g_resolver_free_addresses (addresses);
+  }
+
+  return g_inet_socket_address_new (address, port);
+}
+
+static SRTSOCKET
+_srt_connect (const gchar * uri, GError ** error)
+{
+  g_autoptr (GSocketAddress) address = NULL;
+  g_autofree gchar *host = NULL;
+  g_autofree gchar *streamid = NULL;
+  guint port = 0;
+  SRTSOCKET sock;
+  gpointer sa;
+  gsize sa_len;
+  gint val = 0;
+
+  if (!hwangsae_common_parse_srt_uri (uri, &host, &port)) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+        "Invalid SRT URI %s", uri);
+    return SRT_INVALID_SOCK;
+  }
+
+  address = _resolve_address (host, port, error);
+  if (!address) {
+    return SRT_INVALID_SOCK;
+  }
+
+  sa_len = g_socket_address_get_native_size (address);
+  sa = g_alloca (sa_len);
+
+  if (!g_socket_address_to_native (address, sa, sa_len, error)) {
+    return SRT_INVALID_SOCK;
+  }
+
+  sock = srt_create_socket ();
+
+  /* Connects in the background; failures show up as errors on epoll. */
+  srt_setsockflag (sock, SRTO_RCVSYN, &val, sizeof (gint));
+  srt_setsockflag (sock, SRTO_SNDSYN, &val, sizeof (gint));
+
+  streamid = _get_uri_param (uri, "streamid");
+  if (streamid) {
+    srt_setsockflag (sock, SRTO_STREAMID, streamid, strlen (streamid));
+  }
+
+  if (srt_connect (sock, sa, sa_len) == SRT_ERROR) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+        "Failed to connect to %s: %s", uri, srt_getlasterror_str ());
+    srt_close (sock);
+    return SRT_INVALID_SOCK;
+  }
+
+  return sock;
+}
+
+guint
+hwangsae_recording_engine_add_stream (HwangsaeRecordingEngine * self,
+    const gchar * uri, const gchar * location, guint64 max_size_time,
+    guint64 max_size_bytes, HwangsaeRecordingEngineFunc func,
+    gpointer user_data, GError ** error)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RecordingStream *stream;
+  SRTSOCKET sock;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (uri != NULL, 0);
+  g_return_val_if_fail (location != NULL, 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  sock = _srt_connect (uri, error);
+  if (sock == SRT_INVALID_SOCK) {
+    return 0;
+  }
+
+  stream = g_new0 (RecordingStream, 1);
+  stream->refcount = 1;
+  stream->socket = sock;
+  stream->context = g_main_context_ref_thread_default ();
+  stream->func = func;
+  stream->user_data = user_data;
+  stream->segmenter = hwangsae_ts_segmenter_new (location, max_size_time,
+      max_size_bytes, _segmenter_cb, stream);
+  /* Running times here are wall clock times already. */
+  hwangsae_ts_segmenter_set_base_time (stream->segmenter, 0);
+  g_queue_init (&stream->chunks);
+
+  hwangsae_metric_gauge_add (metric_streams, 1);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  stream->id = self->next_stream_id++;
+  g_hash_table_insert (self->streams, GUINT_TO_POINTER (stream->id), stream);
+  g_hash_table_insert (self->srtsocket_stream_map, &stream->socket, stream);
+  srt_epoll_add_usock (self->poll_id, sock, &SRT_POLL_EVENTS);
+
+  g_debug ("Recording stream %u from %s", stream->id, uri);
+
+  return stream->id;
+}
+
+void
+hwangsae_recording_engine_remove_stream (HwangsaeRecordingEngine * self,
+    guint stream_id)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  RecordingStream *stream;
+
+  g_return_if_fail (self != NULL);
+
+  locker = g_mutex_locker_new (&self->lock);
+
+  stream = g_hash_table_lookup (self->streams, GUINT_TO_POINTER (stream_id));
+  if (stream) {
+    hwangsae_recording_engine_close_stream_locked (self, stream);
+  }
+}
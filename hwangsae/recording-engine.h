@@ -0,0 +1,64 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <glib.h>
+
+/* Records many MPEG-TS streams received over SRT, unchanged, using one
+ * thread that reads all sockets and a fixed pool of threads that write the
+ * files. Each stream has a HwangsaeTsSegmenter of its own; one worker at a
+ * time handles a given stream. There is one engine per process. */
+typedef struct _HwangsaeRecordingEngine HwangsaeRecordingEngine;
+
+typedef enum
+{
+  HWANGSAE_RECORDING_ENGINE_CONNECTED,
+  HWANGSAE_RECORDING_ENGINE_FRAGMENT_OPENED,
+  HWANGSAE_RECORDING_ENGINE_FRAGMENT_CLOSED,
+  HWANGSAE_RECORDING_ENGINE_DISCONNECTED,
+} HwangsaeRecordingEngineEvent;
+
+/* Called in the thread-default main context of the caller of add_stream.
+ * @location is set for fragment events only, @running_time is the real
+ * time in nanoseconds. DISCONNECTED is always the last event of a stream. */
+typedef void (*HwangsaeRecordingEngineFunc) (HwangsaeRecordingEngineEvent
+                                             event,
+                                             const gchar *location,
+                                             guint64      running_time,
+                                             gpointer     user_data);
+
+HwangsaeRecordingEngine
+                *hwangsae_recording_engine_get_default
+                                               (void);
+
+/* Connects to the SRT listener at @uri and records into files named after
+ * the printf pattern @location as HwangsaeTsSegmenter does. Returns an id
+ * for hwangsae_recording_engine_remove_stream(), or 0 on error. */
+guint            hwangsae_recording_engine_add_stream
+                                               (HwangsaeRecordingEngine *engine,
+                                                const gchar             *uri,
+                                                const gchar             *location,
+                                                guint64                  max_size_time,
+                                                guint64                  max_size_bytes,
+                                                HwangsaeRecordingEngineFunc
+                                                                         func,
+                                                gpointer                 user_data,
+                                                GError                 **error);
+
+/* Closes the connection and finishes the current file. */
+void             hwangsae_recording_engine_remove_stream
+                                               (HwangsaeRecordingEngine *engine,
+                                                guint                    stream_id);
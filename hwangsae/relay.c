@@ -19,7 +19,13 @@
 
 #include "relay.h"
 #include "common.h"
+#include "capture.h"
 #include "enumtypes.h"
+#include "gop-ring.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "tracepoints.h"
+#include "ts.h"
 
 #include <gaeguli/gaeguli.h>
 
@@ -30,35 +36,221 @@
 const guint32 SRT_BACKLOG_LEN = 100;
 const gint MAX_EPOLL_SRT_SOCKETS = 4000;
 const int64_t MAX_EPOLL_WAIT_TIMEOUT_MS = 100;
+/* Used while some source replays from a timeshift window to keep pacing
+ * reasonably smooth. */
+const int64_t REPLAY_EPOLL_WAIT_TIMEOUT_MS = 10;
 const gint SRT_POLL_EVENTS = SRT_EPOLL_IN | SRT_EPOLL_ERR;
 
+/* Rendition selection for adaptive sources. Link statistics are sampled once
+ * per STATS_INTERVAL_US; a source steps one rendition down as soon as its
+ * link looks congested and one rendition up only after it has been healthy
+ * for RENDITION_UPGRADE_INTERVALS samples in a row and the estimated link
+ * bandwidth leaves enough headroom for the higher bitrate. */
+const gint64 STATS_INTERVAL_US = G_USEC_PER_SEC;
+const gdouble RENDITION_MAX_LOSS_RATIO = 0.02;
+const gdouble RENDITION_MAX_RTT_MS = 300;
+const gint RENDITION_MAX_SNDBUF_MS = 500;
+const guint RENDITION_UPGRADE_INTERVALS = 5;
+const gdouble RENDITION_UPGRADE_HEADROOM = 1.5;
+
+/* Sink bitrate control. The uplink is considered congested when receive loss
+ * or queueing delay (RTT above the lowest RTT seen on the link) exceed the
+ * HIGH thresholds, and healthy when both stay below the LOW ones. The
+ * suggested bitrate is cut multiplicatively after BITRATE_DECREASE_INTERVALS
+ * congested samples in a row and raised additively after
+ * BITRATE_INCREASE_INTERVALS healthy ones; anything in between resets both
+ * counters. */
+const gdouble BITRATE_LOSS_HIGH = 0.05;
+const gdouble BITRATE_LOSS_LOW = 0.01;
+const gdouble BITRATE_QUEUE_DELAY_HIGH_MS = 100;
+const gdouble BITRATE_QUEUE_DELAY_LOW_MS = 30;
+const guint BITRATE_DECREASE_INTERVALS = 2;
+const guint BITRATE_INCREASE_INTERVALS = 10;
+const gdouble BITRATE_DECREASE_FACTOR = 0.7;
+const gdouble BITRATE_INCREASE_STEP = 0.1;
+const guint BITRATE_MIN = 256000;
+
+/* Sources other than HWANGSAE_QOS_CLASS_PRIORITY get disconnected when their
+ * send buffer holds more than SLOW_CONSUMER_MAX_SNDBUF_MS of data. When the
+ * relay can't keep up with reading a sink, i.e. its receive buffer holds
+ * more than OVERLOAD_MAX_RCV_BACKLOG_MS above the configured latency, the
+ * lowest class source of that sink is shed on every stats interval. */
+const gint SLOW_CONSUMER_MAX_SNDBUF_MS = 3000;
+const gint OVERLOAD_MAX_RCV_BACKLOG_MS = 500;
+
+#define QOS_CLASS_COUNT (HWANGSAE_QOS_CLASS_BEST_EFFORT + 1)
+
+/* Per-username egress limiter. Tokens are bytes; the bucket holds at most
+ * one second worth of the configured rate. */
 typedef struct
+{
+  gdouble tokens;
+  gint64 last_refill;
+} TokenBucket;
+
+/* Sink statistics sampled once per STATS_INTERVAL_US into the stream
+ * history. */
+typedef struct
+{
+  gint64 timestamp;
+  guint64 bitrate;
+  gdouble loss_ratio;
+  gdouble rtt_ms;
+  guint sources;
+} HistorySample;
+
+/* Ring of the last history-window samples of one sink username. Kept across
+ * sink reconnections until all samples have aged out. */
+typedef struct
+{
+  HistorySample *samples;
+  guint capacity;
+  /* Index of the slot the next sample goes to. */
+  guint head;
+  guint length;
+} StreamHistory;
+
+typedef struct
+{
+  guint id;
+  gchar *resource;
+  HwangsaeRelayTapFunc func;
+  gpointer user_data;
+  GDestroyNotify destroy;
+} Tap;
+
+typedef struct
+{
+  guint64 packets_sent;
+  guint64 bytes_sent;
+  guint64 packets_dropped;
+  guint64 sources_shed;
+} QosClassStats;
+
+typedef struct _SinkConnection SinkConnection;
+
+struct _SinkConnection
 {
   SRTSOCKET socket;
   gchar *username;
   HwangsaeRelay *relay;
   GSList *sources;
-} SinkConnection;
+
+  /* Rendition group this sink publishes into, e.g. "edge1" for "edge1/hi". */
+  gchar *rendition_group;
+  gdouble recv_rate_mbps;
+  gdouble recv_loss_ratio;
+  gdouble rtt_ms;
+  gdouble min_rtt_ms;
+  gint rcv_backlog_ms;
+
+  /* Bitrate controller state, in bits per second. */
+  guint bitrate;
+  guint max_bitrate;
+  guint congested_intervals;
+  guint healthy_intervals;
+  /* Adaptive sources waiting for a random access point of this sink. */
+  GSList *switching_sources;
+  HwangsaeTsRandomAccessFinder *random_access;
+
+  /* Recent stream history sources can start from, NULL when disabled. */
+  HwangsaeGopRing *timeshift;
+
+  /* NULL unless stream-analysis is enabled. */
+  HwangsaeTsAnalyzer *analyzer;
+  GVariant *analysis;
+
+  /* Latency of the last hop towards this relay, as measured by probes
+   * in the stream; NULL unless latency-probes is enabled. */
+  HwangsaeHistogram *probe_latency;
+};
 
 typedef struct
 {
   SRTSOCKET socket;
   gchar *username;
   HwangsaeRelay *relay;
+
+  SinkConnection *sink;
+  /* Non-NULL when the source subscribed to a rendition group rather than to
+   * a particular sink. */
+  gchar *rendition_group;
+  SinkConnection *pending_sink;
+  guint healthy_intervals;
+
+  HwangsaeQosClass qos_class;
+
+  /* Timeshift replay state. The chunk at replay_seq is due when the time
+   * elapsed since replay_origin_us, multiplied by replay_speed, reaches its
+   * arrival time minus replay_origin_arrival_us. */
+  gboolean replaying;
+  guint64 replay_seq;
+  gint64 replay_origin_us;
+  gint64 replay_origin_arrival_us;
+  gdouble replay_speed;
 } SourceConnection;
 
+/* Process-wide metrics, shared by all relay instances. */
+static HwangsaeMetric *metric_sinks;
+static HwangsaeMetric *metric_sources;
+static HwangsaeMetric *metric_callers_rejected;
+static HwangsaeMetric *metric_packets_received;
+static HwangsaeMetric *metric_bytes_received;
+static HwangsaeMetric *metric_packets_sent;
+static HwangsaeMetric *metric_bytes_sent;
+static HwangsaeMetric *metric_packets_dropped;
+static HwangsaeMetric *metric_probe_latency;
+
 static gchar *_make_stream_id (const gchar * username, const gchar * resource);
+static void _source_connection_stop_replay (SourceConnection * source);
+static void hwangsae_relay_call_taps (HwangsaeRelay * self,
+    const gchar * resource, const guint8 * data, gsize size);
+static void hwangsae_relay_capture (HwangsaeRelay * self,
+    HwangsaeCaptureRecordType type, SRTSOCKET socket, const guint8 * data,
+    gsize size);
 
 static void
 _source_connection_free (SourceConnection * source)
 {
+  hwangsae_relay_capture (source->relay,
+      HWANGSAE_CAPTURE_RECORD_SOURCE_DISCONNECTED, source->socket, NULL, 0);
+
+  hwangsae_metric_gauge_add (metric_sources, -1);
+
   g_debug ("Closing source connection %d", source->socket);
   g_signal_emit_by_name (source->relay, "caller-closed", source->socket);
   srt_close (source->socket);
+  if (source->pending_sink) {
+    source->pending_sink->switching_sources =
+        g_slist_remove (source->pending_sink->switching_sources, source);
+  }
+  _source_connection_stop_replay (source);
   g_clear_pointer (&source->username, g_free);
+  g_clear_pointer (&source->rendition_group, g_free);
   g_free (source);
 }
 
+static gint
+_compare_source_qos_class (gconstpointer a, gconstpointer b)
+{
+  const SourceConnection *source_a = a;
+  const SourceConnection *source_b = b;
+
+  /* Never returning 0 puts a new source after the existing ones of its
+   * class, so sources of one class are served in the order they came. */
+  return source_a->qos_class < source_b->qos_class ? -1 : 1;
+}
+
+static void
+_sink_connection_add_source (SinkConnection * sink, SourceConnection * source)
+{
+  /* Keep sources ordered by their class so that higher priority sources are
+   * served first in every fan-out round. */
+  sink->sources = g_slist_insert_sorted (sink->sources, source,
+      _compare_source_qos_class);
+  source->sink = sink;
+}
+
 static void
 _sink_connection_remove_source (SinkConnection * sink,
     SourceConnection * source)
@@ -70,12 +262,35 @@ _sink_connection_remove_source (SinkConnection * sink,
 static void
 _sink_connection_free (SinkConnection * sink)
 {
+  GSList *it;
+
+  for (it = sink->switching_sources; it; it = it->next) {
+    ((SourceConnection *) it->data)->pending_sink = NULL;
+  }
+  g_clear_pointer (&sink->switching_sources, g_slist_free);
+
   g_clear_slist (&sink->sources, (GDestroyNotify) _source_connection_free);
 
+  if (sink->username) {
+    hwangsae_relay_call_taps (sink->relay, sink->username, NULL, 0);
+  }
+
+  hwangsae_relay_capture (sink->relay,
+      HWANGSAE_CAPTURE_RECORD_SINK_DISCONNECTED, sink->socket, NULL, 0);
+
+  hwangsae_metric_gauge_add (metric_sinks, -1);
+
   g_debug ("Closing sink connection %d", sink->socket);
   g_signal_emit_by_name (sink->relay, "caller-closed", sink->socket);
   srt_close (sink->socket);
   g_clear_pointer (&sink->username, g_free);
+  g_clear_pointer (&sink->rendition_group, g_free);
+  g_clear_pointer (&sink->timeshift, hwangsae_gop_ring_free);
+  g_clear_pointer (&sink->random_access,
+      hwangsae_ts_random_access_finder_free);
+  g_clear_pointer (&sink->analyzer, hwangsae_ts_analyzer_free);
+  g_clear_pointer (&sink->analysis, g_variant_unref);
+  g_clear_pointer (&sink->probe_latency, g_free);
   g_free (sink);
 }
 
@@ -96,14 +311,44 @@ struct _HwangsaeRelay
   SRTSOCKET source_listen_sock;
 
   gboolean authentication;
+  gboolean bitrate_control;
+
+  guint64 max_egress_bitrate;
+  guint max_sources;
+  guint64 source_rate_limit;
+  GHashTable *username_bucket_map;
+  GHashTable *username_rate_limited_map;
+
+  guint timeshift_window;
+  guint64 timeshift_max_bytes;
+  GSList *replaying_sources;
+
+  gboolean stream_analysis;
+  gboolean latency_probes;
+
+  guint history_window;
+  GHashTable *username_history_map;
+
+  gchar *capture_file;
+  guint64 capture_size;
+  HwangsaeCapture *capture;
+
+  GSList *taps;
+  guint next_tap_id;
 
   GInetSocketAddress *master_address;
   gchar *master_username;
+  /* Sources of these users get HWANGSAE_QOS_CLASS_PRIORITY by default. */
+  gchar **priority_usernames;
 
   GHashTable *srtsocket_sink_map;
   GHashTable *username_sink_map;
+  GHashTable *rendition_map;
   int poll_id;
 
+  gint64 next_stats_time;
+  QosClassStats qos_stats[QOS_CLASS_COUNT];
+
   GThread *relay_thread;
   gboolean run_relay_thread;
 
@@ -117,8 +362,45 @@ static guint hwangsae_relay_init_refcnt = 0;
 G_DEFINE_TYPE (HwangsaeRelay, hwangsae_relay, G_TYPE_OBJECT);
 /* *INDENT-ON* */
 
+/* Like GMutexLocker, with tracepoints that allow measuring how long the relay
+ * lock is waited for and held. */
+typedef GMutex RelayLocker;
+
+static inline RelayLocker *
+_relay_locker_new (GMutex * mutex)
+{
+  HWANGSAE_TRACE1 (relay_lock_wait, mutex);
+  g_mutex_lock (mutex);
+  HWANGSAE_TRACE1 (relay_lock_acquired, mutex);
+
+  return mutex;
+}
+
+static inline void
+_relay_locker_free (RelayLocker * mutex)
+{
+  g_mutex_unlock (mutex);
+  HWANGSAE_TRACE1 (relay_lock_released, mutex);
+}
+
+/* *INDENT-OFF* */
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (RelayLocker, _relay_locker_free)
+/* *INDENT-ON* */
+
 #define LOCK_RELAY \
-  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock)
+  g_autoptr (RelayLocker) locker = _relay_locker_new (&self->lock)
+
+static inline gint
+_srt_send_traced (SRTSOCKET socket, const gchar * buf, gint len)
+{
+  gint result;
+
+  HWANGSAE_TRACE2 (relay_send_start, socket, len);
+  result = srt_send (socket, buf, len);
+  HWANGSAE_TRACE3 (relay_send_end, socket, len, result);
+
+  return result;
+}
 
 enum
 {
@@ -128,6 +410,18 @@ enum
   PROP_AUTHENTICATION,
   PROP_MASTER_URI,
   PROP_MASTER_USERNAME,
+  PROP_BITRATE_CONTROL,
+  PROP_MAX_EGRESS_BITRATE,
+  PROP_MAX_SOURCES,
+  PROP_SOURCE_RATE_LIMIT,
+  PROP_TIMESHIFT_WINDOW,
+  PROP_TIMESHIFT_MAX_BYTES,
+  PROP_STREAM_ANALYSIS,
+  PROP_CAPTURE_FILE,
+  PROP_CAPTURE_SIZE,
+  PROP_LATENCY_PROBES,
+  PROP_HISTORY_WINDOW,
+  PROP_PRIORITY_USERNAMES,
   PROP_LAST
 };
 
@@ -140,6 +434,8 @@ enum
   SIG_AUTHENTICATE,
   SIG_ON_PASSPHRASE_ASKED,
   SIG_ON_PBKEYLEN_ASKED,
+  SIG_BITRATE_SUGGESTED,
+  SIG_ON_QOS_CLASS_ASKED,
   LAST_SIGNAL
 };
 
@@ -162,12 +458,83 @@ static SrtParam srt_params[] = {
 static void
 hwangsae_relay_remove_sink (HwangsaeRelay * self, SinkConnection * sink)
 {
+  if (sink->rendition_group) {
+    GPtrArray *renditions =
+        g_hash_table_lookup (self->rendition_map, sink->rendition_group);
+
+    g_ptr_array_remove (renditions, sink);
+
+    if (renditions->len == 0) {
+      g_hash_table_remove (self->rendition_map, sink->rendition_group);
+    } else {
+      /* Move adaptive viewers over to the lowest remaining rendition right
+       * away instead of dropping them with the sink. */
+      SinkConnection *fallback = g_ptr_array_index (renditions, 0);
+      GSList *it = sink->sources;
+
+      while (it) {
+        SourceConnection *source = it->data;
+
+        it = it->next;
+
+        if (!source->rendition_group) {
+          continue;
+        }
+
+        if (source->pending_sink) {
+          source->pending_sink->switching_sources =
+              g_slist_remove (source->pending_sink->switching_sources, source);
+          source->pending_sink = NULL;
+        }
+
+        _source_connection_stop_replay (source);
+        sink->sources = g_slist_remove (sink->sources, source);
+        _sink_connection_add_source (fallback, source);
+        source->healthy_intervals = 0;
+      }
+    }
+  }
+
   if (sink->username) {
     g_hash_table_remove (self->username_sink_map, sink->username);
   }
   g_hash_table_remove (self->srtsocket_sink_map, &sink->socket);
 }
 
+static void
+_tap_free (Tap * tap)
+{
+  if (tap->destroy) {
+    tap->destroy (tap->user_data);
+  }
+  g_free (tap->resource);
+  g_free (tap);
+}
+
+static void
+hwangsae_relay_call_taps (HwangsaeRelay * self, const gchar * resource,
+    const guint8 * data, gsize size)
+{
+  GSList *it;
+
+  for (it = self->taps; it; it = it->next) {
+    Tap *tap = it->data;
+
+    if (g_str_equal (tap->resource, resource)) {
+      tap->func (data, size, tap->user_data);
+    }
+  }
+}
+
+static void
+hwangsae_relay_capture (HwangsaeRelay * self, HwangsaeCaptureRecordType type,
+    SRTSOCKET socket, const guint8 * data, gsize size)
+{
+  if (self->capture) {
+    hwangsae_capture_write (self->capture, type, socket, data, size);
+  }
+}
+
 static void
 hwangsae_relay_dispose (GObject * object)
 {
@@ -186,9 +553,17 @@ hwangsae_relay_dispose (GObject * object)
 
   g_clear_object (&self->master_address);
   g_clear_pointer (&self->master_username, g_free);
+  g_clear_pointer (&self->priority_usernames, g_strfreev);
 
   g_hash_table_destroy (self->srtsocket_sink_map);
   g_hash_table_destroy (self->username_sink_map);
+  g_hash_table_destroy (self->rendition_map);
+  g_hash_table_destroy (self->username_bucket_map);
+  g_hash_table_destroy (self->username_rate_limited_map);
+  g_hash_table_destroy (self->username_history_map);
+  g_clear_slist (&self->taps, (GDestroyNotify) _tap_free);
+  g_clear_pointer (&self->capture, hwangsae_capture_free);
+  g_clear_pointer (&self->capture_file, g_free);
 
   g_clear_handle_id (&self->poll_id, srt_epoll_release);
 
@@ -244,6 +619,44 @@ hwangsae_relay_set_property (GObject * object, guint prop_id,
       g_clear_pointer (&self->master_username, g_free);
       self->master_username = g_value_dup_string (value);
       break;
+    case PROP_BITRATE_CONTROL:
+      self->bitrate_control = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_EGRESS_BITRATE:
+      self->max_egress_bitrate = g_value_get_uint64 (value);
+      break;
+    case PROP_MAX_SOURCES:
+      self->max_sources = g_value_get_uint (value);
+      break;
+    case PROP_SOURCE_RATE_LIMIT:
+      self->source_rate_limit = g_value_get_uint64 (value);
+      break;
+    case PROP_TIMESHIFT_WINDOW:
+      self->timeshift_window = g_value_get_uint (value);
+      break;
+    case PROP_TIMESHIFT_MAX_BYTES:
+      self->timeshift_max_bytes = g_value_get_uint64 (value);
+      break;
+    case PROP_STREAM_ANALYSIS:
+      self->stream_analysis = g_value_get_boolean (value);
+      break;
+    case PROP_CAPTURE_FILE:
+      g_free (self->capture_file);
+      self->capture_file = g_value_dup_string (value);
+      break;
+    case PROP_CAPTURE_SIZE:
+      self->capture_size = g_value_get_uint64 (value);
+      break;
+    case PROP_LATENCY_PROBES:
+      self->latency_probes = g_value_get_boolean (value);
+      break;
+    case PROP_HISTORY_WINDOW:
+      self->history_window = g_value_get_uint (value);
+      break;
+    case PROP_PRIORITY_USERNAMES:
+      g_strfreev (self->priority_usernames);
+      self->priority_usernames = g_value_dup_boxed (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -267,6 +680,42 @@ hwangsae_relay_get_property (GObject * object, guint prop_id,
     case PROP_AUTHENTICATION:
       g_value_set_boolean (value, self->authentication);
       break;
+    case PROP_BITRATE_CONTROL:
+      g_value_set_boolean (value, self->bitrate_control);
+      break;
+    case PROP_MAX_EGRESS_BITRATE:
+      g_value_set_uint64 (value, self->max_egress_bitrate);
+      break;
+    case PROP_MAX_SOURCES:
+      g_value_set_uint (value, self->max_sources);
+      break;
+    case PROP_SOURCE_RATE_LIMIT:
+      g_value_set_uint64 (value, self->source_rate_limit);
+      break;
+    case PROP_TIMESHIFT_WINDOW:
+      g_value_set_uint (value, self->timeshift_window);
+      break;
+    case PROP_TIMESHIFT_MAX_BYTES:
+      g_value_set_uint64 (value, self->timeshift_max_bytes);
+      break;
+    case PROP_STREAM_ANALYSIS:
+      g_value_set_boolean (value, self->stream_analysis);
+      break;
+    case PROP_CAPTURE_FILE:
+      g_value_set_string (value, self->capture_file);
+      break;
+    case PROP_CAPTURE_SIZE:
+      g_value_set_uint64 (value, self->capture_size);
+      break;
+    case PROP_LATENCY_PROBES:
+      g_value_set_boolean (value, self->latency_probes);
+      break;
+    case PROP_HISTORY_WINDOW:
+      g_value_set_uint (value, self->history_window);
+      break;
+    case PROP_PRIORITY_USERNAMES:
+      g_value_set_boxed (value, self->priority_usernames);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -408,6 +857,19 @@ hwangsae_relay_default_authenticate (HwangsaeRelay * self,
   return TRUE;
 }
 
+static HwangsaeQosClass
+hwangsae_relay_default_qos_class (HwangsaeRelay * self, GSocketAddress * addr,
+    const gchar * username, const gchar * resource)
+{
+  if (username && self->priority_usernames &&
+      g_strv_contains ((const gchar * const *) self->priority_usernames,
+          username)) {
+    return HWANGSAE_QOS_CLASS_PRIORITY;
+  }
+
+  return HWANGSAE_QOS_CLASS_STANDARD;
+}
+
 gboolean
 _authentication_accumulator (GSignalInvocationHint * ihint,
     GValue * return_accu, const GValue * handler_return, gpointer data)
@@ -459,6 +921,84 @@ hwangsae_relay_class_init (HwangsaeRelayClass * klass)
           "Username this relay should use to authenticate with the master",
           NULL, G_PARAM_WRITABLE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_BITRATE_CONTROL,
+      g_param_spec_boolean ("bitrate-control", "Enable sink bitrate control",
+          "Watch receive loss and RTT of sink connections and emit "
+          "\"bitrate-suggested\" when the sender should adapt its bitrate",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_EGRESS_BITRATE,
+      g_param_spec_uint64 ("max-egress-bitrate", "Maximum egress bitrate",
+          "Aggregate bitrate in bits per second the relay may send to its "
+          "sources. New sources that would exceed it are rejected "
+          "(0 = unlimited)", 0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_SOURCES,
+      g_param_spec_uint ("max-sources", "Maximum number of sources",
+          "Maximum number of simultaneously connected sources "
+          "(0 = unlimited)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SOURCE_RATE_LIMIT,
+      g_param_spec_uint64 ("source-rate-limit", "Per-user rate limit",
+          "Bitrate in bits per second that all sources sharing one username "
+          "may receive together. Excess packets are dropped regardless of "
+          "PES boundaries, which corrupts the stream rather than lowering its "
+          "bitrate; drops are counted per username in the \"rate-limited\" "
+          "statistics (0 = unlimited)",
+          0, G_MAXUINT64, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_TIMESHIFT_WINDOW,
+      g_param_spec_uint ("timeshift-window", "Timeshift window",
+          "Seconds of recent stream each sink keeps in memory so that sources "
+          "can start in the past using 'start' key in their Stream ID "
+          "(0 = disabled)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_TIMESHIFT_MAX_BYTES,
+      g_param_spec_uint64 ("timeshift-max-bytes", "Timeshift memory limit",
+          "Maximum number of bytes kept in the timeshift window of one sink",
+          0, G_MAXUINT64, 64 * 1024 * 1024,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STREAM_ANALYSIS,
+      g_param_spec_boolean ("stream-analysis", "Stream analysis",
+          "Check MPEG-TS health of sinks that connect after this is enabled "
+          "and report it in relay statistics", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CAPTURE_FILE,
+      g_param_spec_string ("capture-file", "Capture file",
+          "Path of a ring file the relay traces all sink packets and "
+          "connections into once started (NULL = disabled)", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CAPTURE_SIZE,
+      g_param_spec_uint64 ("capture-size", "Capture size",
+          "Size of the capture ring in bytes", 64 * 1024, G_MAXUINT64,
+          256 * 1024 * 1024,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LATENCY_PROBES,
+      g_param_spec_boolean ("latency-probes", "Latency probes",
+          "Time stamp latency probe packets of sinks that connect after this "
+          "is enabled and report the latency in relay statistics", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_HISTORY_WINDOW,
+      g_param_spec_uint ("history-window", "History window",
+          "Seconds of per-second sink statistics kept for "
+          "hwangsae_relay_get_history() (0 = disabled)", 0, 24 * 60 * 60, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PRIORITY_USERNAMES,
+      g_param_spec_boxed ("priority-usernames", "Priority usernames",
+          "Usernames, such as those of recorders, whose sources get the "
+          "priority QoS class unless \"on-qos-class-asked\" decides "
+          "otherwise", G_TYPE_STRV,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   signals[SIG_CALLER_ACCEPTED] =
       g_signal_new ("caller-accepted", G_TYPE_FROM_CLASS (klass),
       G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 5,
@@ -498,6 +1038,34 @@ hwangsae_relay_class_init (HwangsaeRelayClass * klass)
       G_SIGNAL_RUN_LAST, 0, g_signal_accumulator_first_wins, NULL, NULL,
       GAEGULI_TYPE_SRT_KEY_LENGTH, 4, HWANGSAE_TYPE_CALLER_DIRECTION,
       G_TYPE_SOCKET_ADDRESS, G_TYPE_STRING, G_TYPE_STRING);
+
+  signals[SIG_BITRATE_SUGGESTED] =
+      g_signal_new ("bitrate-suggested", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 3,
+      G_TYPE_INT, G_TYPE_STRING, G_TYPE_UINT);
+
+  signals[SIG_ON_QOS_CLASS_ASKED] =
+      g_signal_new_class_handler ("on-qos-class-asked",
+      G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+      G_CALLBACK (hwangsae_relay_default_qos_class),
+      g_signal_accumulator_first_wins, NULL, NULL,
+      HWANGSAE_TYPE_QOS_CLASS, 3, G_TYPE_SOCKET_ADDRESS, G_TYPE_STRING,
+      G_TYPE_STRING);
+
+  metric_sinks = hwangsae_metrics_register_gauge ("relay.sinks");
+  metric_sources = hwangsae_metrics_register_gauge ("relay.sources");
+  metric_callers_rejected =
+      hwangsae_metrics_register_counter ("relay.callers-rejected");
+  metric_packets_received =
+      hwangsae_metrics_register_counter ("relay.packets-received");
+  metric_bytes_received =
+      hwangsae_metrics_register_counter ("relay.bytes-received");
+  metric_packets_sent = hwangsae_metrics_register_counter ("relay.packets-sent");
+  metric_bytes_sent = hwangsae_metrics_register_counter ("relay.bytes-sent");
+  metric_packets_dropped =
+      hwangsae_metrics_register_counter ("relay.packets-dropped");
+  metric_probe_latency =
+      hwangsae_metrics_register_histogram ("relay.probe-latency");
 }
 
 const gchar STREAM_ID_PREFIX[] = "#!::";
@@ -520,7 +1088,8 @@ _parse_stream_id (const gchar * stream_id)
     keyval = g_strsplit (*it, "=", 2);
 
     if (keyval && keyval[0] && keyval[1]) {
-      if (g_str_equal (keyval[0], "h8l_bufsize")) {
+      if (g_str_equal (keyval[0], "h8l_bufsize") ||
+          g_str_equal (keyval[0], "h8l_bitrate")) {
         g_variant_dict_insert (dict, keyval[0], "i", atoi (keyval[1]));
       } else {
         g_variant_dict_insert (dict, keyval[0], "s", keyval[1]);
@@ -667,6 +1236,8 @@ hwangsae_relay_authenticate_sink (HwangsaeRelay * self, SRTSOCKET sock,
   return 0;
 
 reject:
+  hwangsae_metric_counter_add (metric_callers_rejected, 1);
+  HWANGSAE_TRACE3 (relay_reject, sock, HWANGSAE_CALLER_DIRECTION_SINK, reason);
   g_signal_emit (self, signals[SIG_CALLER_REJECTED], 0, sock,
       HWANGSAE_CALLER_DIRECTION_SINK, addr, username, resource, reason);
 
@@ -675,7 +1246,7 @@ reject:
 
 static SRTSOCKET
 _srt_accept (SRTSOCKET listen_socket, GSocketAddress ** peeraddr,
-    gchar ** username, gchar ** resource)
+    gchar ** username, gchar ** resource, GVariantDict ** parsed_id_out)
 {
   union
   {
@@ -703,27 +1274,80 @@ _srt_accept (SRTSOCKET listen_socket, GSocketAddress ** peeraddr,
     *peeraddr = _peeraddr_to_g_socket_address (&peer_sa.sa);
   }
 
+  if (parsed_id_out) {
+    *parsed_id_out = g_steal_pointer (&parsed_id);
+  }
+
   return sock;
 }
 
+static SinkConnection *
+hwangsae_relay_add_sink (HwangsaeRelay * self, SRTSOCKET sock,
+    gchar * username)
+{
+  SinkConnection *sink;
+
+  sink = g_new0 (SinkConnection, 1);
+  sink->socket = sock;
+  sink->username = username;
+  sink->relay = self;
+  sink->random_access = hwangsae_ts_random_access_finder_new ();
+
+  if (self->timeshift_window > 0) {
+    sink->timeshift =
+        hwangsae_gop_ring_new (self->timeshift_window * G_USEC_PER_SEC,
+        self->timeshift_max_bytes);
+  }
+
+  if (self->stream_analysis) {
+    sink->analyzer = hwangsae_ts_analyzer_new ();
+  }
+
+  if (self->latency_probes) {
+    sink->probe_latency = g_new0 (HwangsaeHistogram, 1);
+  }
+
+  hwangsae_relay_capture (self, HWANGSAE_CAPTURE_RECORD_SINK_CONNECTED, sock,
+      (const guint8 *) username, username ? strlen (username) : 0);
+
+  hwangsae_metric_gauge_add (metric_sinks, 1);
+
+  g_hash_table_insert (self->srtsocket_sink_map, &sink->socket, sink);
+  if (sink->username) {
+    g_hash_table_insert (self->username_sink_map, sink->username, sink);
+  }
+
+  srt_epoll_add_usock (self->poll_id, sock, &SRT_POLL_EVENTS);
+
+  return sink;
+}
+
 static void
 hwangsae_relay_accept_sink (HwangsaeRelay * self)
 {
   g_autoptr (GSocketAddress) addr = NULL;
   g_autofree gchar *username = NULL;
   g_autofree gchar *resource = NULL;
+  g_autoptr (GVariantDict) parsed_id = NULL;
   SinkConnection *sink;
   SRTSOCKET sock;
+  gint bitrate = 0;
 
-  sock = _srt_accept (self->sink_listen_sock, &addr, &username, &resource);
+  sock = _srt_accept (self->sink_listen_sock, &addr, &username, &resource,
+      &parsed_id);
   if (sock == SRT_INVALID_SOCK) {
     return;
   }
 
-  sink = g_new0 (SinkConnection, 1);
-  sink->socket = sock;
-  sink->username = g_steal_pointer (&username);
-  sink->relay = self;
+  sink = hwangsae_relay_add_sink (self, sock, g_steal_pointer (&username));
+
+  /* The sender may announce its nominal bitrate, which then becomes the
+   * ceiling of the bitrate controller. Otherwise the ceiling is learned from
+   * the first receive rate sample. */
+  if (g_variant_dict_lookup (parsed_id, "h8l_bitrate", "i", &bitrate) &&
+      bitrate > 0) {
+    sink->bitrate = sink->max_bitrate = bitrate;
+  }
 
   {
     g_autofree gchar *ip =
@@ -734,18 +1358,101 @@ hwangsae_relay_accept_sink (HwangsaeRelay * self)
         ip);
   }
 
-  g_hash_table_insert (self->srtsocket_sink_map, &sink->socket, sink);
   if (sink->username) {
-    g_hash_table_insert (self->username_sink_map, sink->username, sink);
-  }
+    const gchar *separator = strrchr (sink->username, '/');
 
-  srt_epoll_add_usock (self->poll_id, sock, &SRT_POLL_EVENTS);
+    if (separator && separator != sink->username) {
+      GPtrArray *renditions;
+
+      sink->rendition_group = g_strndup (sink->username,
+          separator - sink->username);
+
+      renditions =
+          g_hash_table_lookup (self->rendition_map, sink->rendition_group);
+      if (!renditions) {
+        renditions = g_ptr_array_new ();
+        g_hash_table_insert (self->rendition_map,
+            g_strdup (sink->rendition_group), renditions);
+      }
+      g_ptr_array_add (renditions, sink);
+    }
+  }
 
+  HWANGSAE_TRACE2 (relay_accept, sink->socket,
+      HWANGSAE_CALLER_DIRECTION_SINK);
   g_signal_emit (self, signals[SIG_CALLER_ACCEPTED],
       0, sink->socket, HWANGSAE_CALLER_DIRECTION_SINK, addr, sink->username,
       resource);
 }
 
+/* Sinks get their rate from the periodic statistics pass, so during the first
+ * interval after connecting it is measured on the spot to keep the egress
+ * budget from admitting sources for free. */
+static gdouble
+_sink_connection_get_recv_rate_mbps (SinkConnection * sink)
+{
+  SRT_TRACEBSTATS stats;
+
+  if (sink->recv_rate_mbps > 0 || srt_bstats (sink->socket, &stats, 0) != 0) {
+    return sink->recv_rate_mbps;
+  }
+
+  return stats.mbpsRecvRate;
+}
+
+static gdouble
+hwangsae_relay_get_egress_mbps (HwangsaeRelay * self, guint * num_sources)
+{
+  GHashTableIter it;
+  SinkConnection *sink;
+  gdouble egress = 0;
+
+  *num_sources = 0;
+
+  g_hash_table_iter_init (&it, self->srtsocket_sink_map);
+  while (g_hash_table_iter_next (&it, NULL, (gpointer *) & sink)) {
+    guint len = g_slist_length (sink->sources);
+
+    if (len > 0) {
+      egress += _sink_connection_get_recv_rate_mbps (sink) * len;
+    }
+    *num_sources += len;
+  }
+
+  return egress;
+}
+
+static gboolean
+hwangsae_relay_check_egress_budget (HwangsaeRelay * self, SinkConnection * sink)
+{
+  guint num_sources;
+  gdouble egress_mbps;
+
+  if (self->max_sources == 0 && self->max_egress_bitrate == 0) {
+    return TRUE;
+  }
+
+  egress_mbps = hwangsae_relay_get_egress_mbps (self, &num_sources);
+
+  if (self->max_sources != 0 && num_sources >= self->max_sources) {
+    return FALSE;
+  }
+
+  /* A new source costs as much as its sink is currently receiving. In slave
+   * mode the sink may not be open yet, in which case only the current egress
+   * is checked. */
+  if (sink) {
+    egress_mbps += _sink_connection_get_recv_rate_mbps (sink);
+  }
+
+  if (self->max_egress_bitrate != 0 &&
+      egress_mbps * 1000000 > self->max_egress_bitrate) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
 static gint
 hwangsae_relay_authenticate_source (HwangsaeRelay * self, SRTSOCKET sock,
     gint hs_version, const struct sockaddr *peeraddr, const gchar * stream_id)
@@ -779,6 +1486,14 @@ hwangsae_relay_authenticate_source (HwangsaeRelay * self, SRTSOCKET sock,
       }
 
       sink = g_hash_table_lookup (self->username_sink_map, resource);
+      if (!sink) {
+        GPtrArray *renditions =
+            g_hash_table_lookup (self->rendition_map, resource);
+
+        if (renditions) {
+          sink = g_ptr_array_index (renditions, 0);
+        }
+      }
     } else if (g_hash_table_size (self->srtsocket_sink_map) != 0) {
       /* In unauthenticated mode pick the first (and likely only) sink. When
        * the relay doesn't have any connected sink, the source gets rejected. */
@@ -794,6 +1509,12 @@ hwangsae_relay_authenticate_source (HwangsaeRelay * self, SRTSOCKET sock,
       goto reject;
     }
 
+    if (!hwangsae_relay_check_egress_budget (self, sink)) {
+      g_debug ("Rejecting source %d. Egress limit reached.", sock);
+      reason = HWANGSAE_REJECT_REASON_EGRESS_LIMIT;
+      goto reject;
+    }
+
     if (self->authentication) {
       g_signal_emit (self, signals[SIG_AUTHENTICATE], 0,
           HWANGSAE_CALLER_DIRECTION_SRC, addr, username, resource,
@@ -817,23 +1538,88 @@ hwangsae_relay_authenticate_source (HwangsaeRelay * self, SRTSOCKET sock,
   return 0;
 
 reject:
+  hwangsae_metric_counter_add (metric_callers_rejected, 1);
+  HWANGSAE_TRACE3 (relay_reject, sock, HWANGSAE_CALLER_DIRECTION_SRC, reason);
   g_signal_emit (self, signals[SIG_CALLER_REJECTED], 0, sock,
       HWANGSAE_CALLER_DIRECTION_SRC, addr, username, resource, reason);
   return -1;
 }
 
+static gint64
+_parse_timeshift_offset (const gchar * str)
+{
+  gchar *unit;
+  gdouble value = g_ascii_strtod (str, &unit);
+
+  if (g_str_equal (unit, "ms")) {
+    value *= 1000;
+  } else if (g_str_equal (unit, "m")) {
+    value *= 60 * G_USEC_PER_SEC;
+  } else if (unit[0] == '\0' || g_str_equal (unit, "s")) {
+    value *= G_USEC_PER_SEC;
+  } else {
+    g_warning ("Invalid timeshift offset '%s'", str);
+    return 0;
+  }
+
+  return value;
+}
+
+static void
+hwangsae_relay_start_replay (HwangsaeRelay * self, SinkConnection * sink,
+    SourceConnection * source, const gchar * start, const gchar * speed)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint64 offset = _parse_timeshift_offset (start);
+
+  if (offset >= 0 ||
+      !hwangsae_gop_ring_seek (sink->timeshift, now + offset,
+          &source->replay_seq)) {
+    return;
+  }
+
+  hwangsae_gop_ring_get (sink->timeshift, source->replay_seq, NULL,
+      &source->replay_origin_arrival_us);
+  source->replay_origin_us = now;
+  source->replay_speed = speed ? g_ascii_strtod (speed, NULL) : 1.0;
+  if (source->replay_speed <= 0) {
+    source->replay_speed = 1.0;
+  }
+  source->replaying = TRUE;
+
+  self->replaying_sources = g_slist_prepend (self->replaying_sources, source);
+
+  g_debug ("Source %d replaying %s from %" G_GINT64_FORMAT " ms ago at %.2fx",
+      source->socket, sink->username,
+      (now - source->replay_origin_arrival_us) / 1000, source->replay_speed);
+}
+
+static void
+_source_connection_stop_replay (SourceConnection * source)
+{
+  if (source->replaying) {
+    source->relay->replaying_sources =
+        g_slist_remove (source->relay->replaying_sources, source);
+    source->replaying = FALSE;
+  }
+}
+
 static void
 hwangsae_relay_accept_source (HwangsaeRelay * self)
 {
   g_autoptr (GSocketAddress) addr = NULL;
   g_autofree gchar *username = NULL;
   g_autofree gchar *resource = NULL;
-  SinkConnection *sink;
+  g_autoptr (GVariantDict) parsed_id = NULL;
+  SinkConnection *sink = NULL;
   SourceConnection *source;
+  GPtrArray *renditions = NULL;
   SRTSOCKET sock;
   HwangsaeRejectReason reason;
+  const gchar *start = NULL;
 
-  sock = _srt_accept (self->source_listen_sock, &addr, &username, &resource);
+  sock = _srt_accept (self->source_listen_sock, &addr, &username, &resource,
+      &parsed_id);
   if (sock == SRT_INVALID_SOCK) {
     return;
   }
@@ -841,7 +1627,15 @@ hwangsae_relay_accept_source (HwangsaeRelay * self)
   if (self->authentication) {
     sink = g_hash_table_lookup (self->username_sink_map, resource);
 
-    if (!sink && self->master_address) {
+    if (!sink) {
+      renditions = g_hash_table_lookup (self->rendition_map, resource);
+    }
+
+    if (renditions) {
+      /* Adaptive viewers start on the lowest rendition and get upgraded
+       * once their link proves to have enough capacity. */
+      sink = g_ptr_array_index (renditions, 0);
+    } else if (!sink && self->master_address) {
       /* In slave mode, open sink connection to the master relay. */
       SRTSOCKET master_sock;
 
@@ -852,15 +1646,8 @@ hwangsae_relay_accept_source (HwangsaeRelay * self)
         goto reject;
       }
 
-      sink = g_new0 (SinkConnection, 1);
-      sink->socket = master_sock;
-      sink->username = g_steal_pointer (&resource);
-      sink->relay = self;
-
-      g_hash_table_insert (self->srtsocket_sink_map, &sink->socket, sink);
-      g_hash_table_insert (self->username_sink_map, sink->username, sink);
-
-      srt_epoll_add_usock (self->poll_id, sink->socket, &SRT_POLL_EVENTS);
+      sink = hwangsae_relay_add_sink (self, master_sock,
+          g_steal_pointer (&resource));
     }
   } else if (g_hash_table_size (self->srtsocket_sink_map) != 0) {
     /* In unauthenticated mode pick the first (and likely only) sink. When
@@ -888,9 +1675,43 @@ hwangsae_relay_accept_source (HwangsaeRelay * self)
   source->socket = sock;
   source->username = g_strdup (username);
   source->relay = self;
+  source->qos_class = HWANGSAE_QOS_CLASS_STANDARD;
+  if (renditions) {
+    source->rendition_group = g_strdup (resource);
+  }
 
-  sink->sources = g_slist_append (sink->sources, source);
+  g_signal_emit (self, signals[SIG_ON_QOS_CLASS_ASKED], 0, addr, username,
+      resource, &source->qos_class);
+  source->qos_class = CLAMP (source->qos_class, HWANGSAE_QOS_CLASS_PRIORITY,
+      HWANGSAE_QOS_CLASS_BEST_EFFORT);
 
+  if (sink->timeshift &&
+      g_variant_dict_lookup (parsed_id, "start", "&s", &start)) {
+    const gchar *speed = NULL;
+
+    g_variant_dict_lookup (parsed_id, "speed", "&s", &speed);
+    hwangsae_relay_start_replay (self, sink, source, start, speed);
+  }
+
+  _sink_connection_add_source (sink, source);
+  hwangsae_metric_gauge_add (metric_sources, 1);
+
+  if (self->capture) {
+    g_autoptr (GString) ids = g_string_new (username);
+    /* Resource has been stolen when the sink connection is to a master. */
+    const gchar *sink_id = resource ? resource : sink->username;
+
+    g_string_append_len (ids, "", 1);
+    if (sink_id) {
+      g_string_append (ids, sink_id);
+    }
+
+    hwangsae_relay_capture (self, HWANGSAE_CAPTURE_RECORD_SOURCE_CONNECTED,
+        sock, (const guint8 *) ids->str, ids->len);
+  }
+
+  HWANGSAE_TRACE2 (relay_accept, source->socket,
+      HWANGSAE_CALLER_DIRECTION_SRC);
   g_signal_emit (self, signals[SIG_CALLER_ACCEPTED], 0, source->socket,
       HWANGSAE_CALLER_DIRECTION_SRC, addr, username, resource);
 
@@ -898,6 +1719,8 @@ hwangsae_relay_accept_source (HwangsaeRelay * self)
 
 reject:
   srt_close (sock);
+  hwangsae_metric_counter_add (metric_callers_rejected, 1);
+  HWANGSAE_TRACE3 (relay_reject, sock, HWANGSAE_CALLER_DIRECTION_SRC, reason);
   g_signal_emit (self, signals[SIG_CALLER_REJECTED], 0, sock,
       HWANGSAE_CALLER_DIRECTION_SRC, addr, username, resource, reason);
 }
@@ -931,6 +1754,559 @@ hwangsae_relay_emit_io_error_locked (HwangsaeRelay * self, SRTSOCKET srtsocket,
   g_mutex_lock (&self->lock);
 }
 
+/* Sends the chunks of every replaying source that are due and returns them
+ * to the live fan-out once they catch up with the sink. */
+static void
+hwangsae_relay_replay (HwangsaeRelay * self)
+{
+  gint64 now = g_get_monotonic_time ();
+  GSList *it = self->replaying_sources;
+
+  while (it) {
+    SourceConnection *source = it->data;
+    HwangsaeGopRing *ring = source->sink->timeshift;
+    gint64 due = source->replay_origin_arrival_us +
+        (now - source->replay_origin_us) * source->replay_speed;
+
+    it = it->next;
+
+    if (source->replay_seq < hwangsae_gop_ring_get_head (ring)) {
+      /* The source fell out of the window. Continue from its beginning,
+       * which is always a keyframe. */
+      source->replay_seq = hwangsae_gop_ring_get_head (ring);
+      hwangsae_gop_ring_get (ring, source->replay_seq, NULL,
+          &source->replay_origin_arrival_us);
+      source->replay_origin_us = now;
+      due = source->replay_origin_arrival_us;
+    }
+
+    while (TRUE) {
+      const guint8 *data;
+      gsize len;
+      gint64 arrival;
+
+      if (source->replay_seq == hwangsae_gop_ring_get_tail (ring)) {
+        g_debug ("Source %d caught up with the live stream", source->socket);
+        _source_connection_stop_replay (source);
+        break;
+      }
+
+      data = hwangsae_gop_ring_get (ring, source->replay_seq, &len, &arrival);
+      if (arrival > due) {
+        break;
+      }
+
+      if (_srt_send_traced (source->socket, (const gchar *) data, len) < 0) {
+        gint error = srt_getlasterror (NULL);
+
+        if (error != SRT_EASYNCSND) {
+          hwangsae_relay_emit_io_error_locked (self, source->socket,
+              HWANGSAE_RELAY_ERROR_WRITE, "srt_send failed: %s",
+              srt_strerror (error, 0));
+          _sink_connection_remove_source (source->sink, source);
+        }
+        break;
+      }
+
+      ++source->replay_seq;
+    }
+  }
+}
+
+static void
+_token_bucket_refill (TokenBucket * bucket, guint64 rate, gint64 now)
+{
+  gdouble burst = rate / 8.0;
+
+  bucket->tokens = MIN (burst, bucket->tokens +
+      (now - bucket->last_refill) * burst / G_USEC_PER_SEC);
+  bucket->last_refill = now;
+}
+
+static gboolean
+hwangsae_relay_consume_tokens (HwangsaeRelay * self, const gchar * username,
+    gint len, gint64 now)
+{
+  TokenBucket *bucket;
+
+  if (self->source_rate_limit == 0 || !username) {
+    return TRUE;
+  }
+
+  bucket = g_hash_table_lookup (self->username_bucket_map, username);
+  if (!bucket) {
+    bucket = g_new0 (TokenBucket, 1);
+    bucket->tokens = self->source_rate_limit / 8.0;
+    bucket->last_refill = now;
+    g_hash_table_insert (self->username_bucket_map, g_strdup (username),
+        bucket);
+  } else {
+    _token_bucket_refill (bucket, self->source_rate_limit, now);
+  }
+
+  if (bucket->tokens < len) {
+    guint64 *dropped;
+
+    dropped = g_hash_table_lookup (self->username_rate_limited_map, username);
+    if (!dropped) {
+      dropped = g_new0 (guint64, 1);
+      g_hash_table_insert (self->username_rate_limited_map,
+          g_strdup (username), dropped);
+    }
+    ++*dropped;
+
+    return FALSE;
+  }
+
+  bucket->tokens -= len;
+
+  return TRUE;
+}
+
+static void
+hwangsae_relay_prune_token_buckets (HwangsaeRelay * self)
+{
+  GHashTableIter it;
+  TokenBucket *bucket;
+  gint64 now = g_get_monotonic_time ();
+
+  g_hash_table_iter_init (&it, self->username_bucket_map);
+
+  while (g_hash_table_iter_next (&it, NULL, (gpointer *) & bucket)) {
+    /* A full bucket is no different from a freshly created one. */
+    _token_bucket_refill (bucket, self->source_rate_limit, now);
+    if (bucket->tokens >= self->source_rate_limit / 8.0) {
+      g_hash_table_iter_remove (&it);
+    }
+  }
+}
+
+static StreamHistory *
+_stream_history_new (guint capacity)
+{
+  StreamHistory *history = g_new0 (StreamHistory, 1);
+
+  history->samples = g_new (HistorySample, capacity);
+  history->capacity = capacity;
+
+  return history;
+}
+
+static void
+_stream_history_free (StreamHistory * history)
+{
+  g_free (history->samples);
+  g_free (history);
+}
+
+static HistorySample *
+_stream_history_get (StreamHistory * history, guint index)
+{
+  /* Index 0 is the oldest sample. */
+  return &history->samples[(history->head + history->capacity -
+          history->length + index) % history->capacity];
+}
+
+static void
+hwangsae_relay_record_history (HwangsaeRelay * self)
+{
+  GHashTableIter it;
+  SinkConnection *sink;
+  StreamHistory *history;
+  gint64 now = g_get_real_time ();
+
+  if (self->history_window == 0) {
+    g_hash_table_remove_all (self->username_history_map);
+    return;
+  }
+
+  g_hash_table_iter_init (&it, self->username_sink_map);
+  while (g_hash_table_iter_next (&it, NULL, (gpointer *) & sink)) {
+    HistorySample *sample;
+
+    history = g_hash_table_lookup (self->username_history_map,
+        sink->username);
+    if (!history || history->capacity != self->history_window) {
+      /* The window has changed, start over. */
+      history = _stream_history_new (self->history_window);
+      g_hash_table_insert (self->username_history_map,
+          g_strdup (sink->username), history);
+    }
+
+    sample = &history->samples[history->head];
+    sample->timestamp = now;
+    sample->bitrate = sink->recv_rate_mbps * 1000000;
+    sample->loss_ratio = sink->recv_loss_ratio;
+    sample->rtt_ms = sink->rtt_ms;
+    sample->sources = g_slist_length (sink->sources);
+
+    history->head = (history->head + 1) % history->capacity;
+    history->length = MIN (history->length + 1, history->capacity);
+  }
+
+  /* Forget streams that have been gone for the whole window. */
+  g_hash_table_iter_init (&it, self->username_history_map);
+  while (g_hash_table_iter_next (&it, NULL, (gpointer *) & history)) {
+    HistorySample *newest = _stream_history_get (history, history->length - 1);
+
+    if (now - newest->timestamp >
+        (gint64) self->history_window * G_USEC_PER_SEC) {
+      g_hash_table_iter_remove (&it);
+    }
+  }
+}
+
+/* Sends data of @sink to one of its sources through the egress limiter,
+ * accounting it in the QoS class of the source. */
+static void
+hwangsae_relay_send_to_source (HwangsaeRelay * self, SinkConnection * sink,
+    SourceConnection * source, const gchar * buf, gint len, gint64 now)
+{
+  QosClassStats *qos_stats = &self->qos_stats[source->qos_class];
+
+  if (!hwangsae_relay_consume_tokens (self, source->username, len, now)) {
+    ++qos_stats->packets_dropped;
+    hwangsae_metric_counter_add (metric_packets_dropped, 1);
+    return;
+  }
+
+  if (_srt_send_traced (source->socket, buf, len) < 0) {
+    gint error = srt_getlasterror (NULL);
+
+    ++qos_stats->packets_dropped;
+    hwangsae_metric_counter_add (metric_packets_dropped, 1);
+
+    if (error == SRT_EASYNCSND &&
+        source->qos_class == HWANGSAE_QOS_CLASS_PRIORITY) {
+      /* Priority sources survive a full send buffer. */
+      return;
+    }
+
+    hwangsae_relay_emit_io_error_locked (self, source->socket,
+        HWANGSAE_RELAY_ERROR_WRITE, "srt_send failed: %s",
+        srt_strerror (error, 0));
+    _sink_connection_remove_source (sink, source);
+  } else {
+    ++qos_stats->packets_sent;
+    qos_stats->bytes_sent += len;
+    hwangsae_metric_counter_add (metric_packets_sent, 1);
+    hwangsae_metric_counter_add (metric_bytes_sent, len);
+  }
+}
+
+static void
+hwangsae_relay_complete_switches (HwangsaeRelay * self, SinkConnection * sink,
+    const gchar * buf, gint len, gssize offset, gint64 now)
+{
+  while (sink->switching_sources) {
+    SourceConnection *source = sink->switching_sources->data;
+
+    sink->switching_sources = g_slist_delete_link (sink->switching_sources,
+        sink->switching_sources);
+    source->pending_sink = NULL;
+
+    g_debug ("Switching source %d from %s to %s", source->socket,
+        source->sink->username, sink->username);
+
+    source->sink->sources = g_slist_remove (source->sink->sources, source);
+    _sink_connection_add_source (sink, source);
+
+    hwangsae_relay_send_to_source (self, sink, source, buf + offset,
+        len - offset, now);
+  }
+}
+
+static gint
+_compare_sink_recv_rate (gconstpointer a, gconstpointer b)
+{
+  const SinkConnection *sink_a = *(SinkConnection **) a;
+  const SinkConnection *sink_b = *(SinkConnection **) b;
+
+  return (sink_a->recv_rate_mbps > sink_b->recv_rate_mbps) -
+      (sink_a->recv_rate_mbps < sink_b->recv_rate_mbps);
+}
+
+static void
+_source_connection_schedule_switch (SourceConnection * source,
+    SinkConnection * target)
+{
+  g_debug ("Source %d will switch from %s to %s on the next keyframe",
+      source->socket, source->sink->username, target->username);
+
+  source->pending_sink = target;
+  source->healthy_intervals = 0;
+  target->switching_sources =
+      g_slist_append (target->switching_sources, source);
+}
+
+typedef struct
+{
+  SRTSOCKET socket;
+  gchar *username;
+  guint bitrate;
+} BitrateSuggestion;
+
+static void
+_bitrate_suggestion_clear (BitrateSuggestion * suggestion)
+{
+  g_free (suggestion->username);
+}
+
+/* Emits "bitrate-suggested" without the lock, so that handlers may call
+ * back into the relay. */
+static void
+hwangsae_relay_emit_bitrate_suggestions_locked (HwangsaeRelay * self,
+    GArray * suggestions)
+{
+  guint i;
+
+  if (suggestions->len == 0) {
+    return;
+  }
+
+  g_mutex_unlock (&self->lock);
+  for (i = 0; i != suggestions->len; ++i) {
+    BitrateSuggestion *suggestion =
+        &g_array_index (suggestions, BitrateSuggestion, i);
+
+    g_signal_emit (self, signals[SIG_BITRATE_SUGGESTED], 0,
+        suggestion->socket, suggestion->username, suggestion->bitrate);
+  }
+  g_mutex_lock (&self->lock);
+}
+
+static void
+hwangsae_relay_update_sink_bitrate (HwangsaeRelay * self,
+    SinkConnection * sink, GArray * suggestions)
+{
+  gdouble queue_delay_ms = sink->rtt_ms - sink->min_rtt_ms;
+  guint bitrate = sink->bitrate;
+
+  if (sink->max_bitrate == 0) {
+    if (sink->recv_rate_mbps <= 0) {
+      return;
+    }
+    sink->bitrate = sink->max_bitrate = sink->recv_rate_mbps * 1000000;
+  }
+
+  if (sink->recv_loss_ratio > BITRATE_LOSS_HIGH ||
+      queue_delay_ms > BITRATE_QUEUE_DELAY_HIGH_MS) {
+    sink->healthy_intervals = 0;
+    if (++sink->congested_intervals >= BITRATE_DECREASE_INTERVALS) {
+      bitrate = MAX (sink->bitrate * BITRATE_DECREASE_FACTOR, BITRATE_MIN);
+      sink->congested_intervals = 0;
+    }
+  } else if (sink->recv_loss_ratio < BITRATE_LOSS_LOW &&
+      queue_delay_ms < BITRATE_QUEUE_DELAY_LOW_MS) {
+    sink->congested_intervals = 0;
+    if (++sink->healthy_intervals >= BITRATE_INCREASE_INTERVALS) {
+      bitrate = MIN (sink->bitrate +
+          sink->max_bitrate * BITRATE_INCREASE_STEP, sink->max_bitrate);
+      sink->healthy_intervals = 0;
+    }
+  } else {
+    sink->congested_intervals = sink->healthy_intervals = 0;
+  }
+
+  if (bitrate != sink->bitrate) {
+    BitrateSuggestion suggestion = { sink->socket, g_strdup (sink->username),
+      bitrate
+    };
+
+    g_debug ("Suggesting bitrate %u for sink %d (loss %.3f, RTT %.0f ms)",
+        bitrate, sink->socket, sink->recv_loss_ratio, sink->rtt_ms);
+
+    sink->bitrate = bitrate;
+    g_array_append_val (suggestions, suggestion);
+  }
+}
+
+static void
+hwangsae_relay_update_sink_stats (HwangsaeRelay * self)
+{
+  g_autoptr (GArray) suggestions = NULL;
+  GHashTableIter it;
+  SinkConnection *sink;
+  gint64 now = g_get_monotonic_time ();
+
+  suggestions = g_array_new (FALSE, FALSE, sizeof (BitrateSuggestion));
+  g_array_set_clear_func (suggestions,
+      (GDestroyNotify) _bitrate_suggestion_clear);
+
+  g_hash_table_iter_init (&it, self->srtsocket_sink_map);
+
+  while (g_hash_table_iter_next (&it, NULL, (gpointer *) & sink)) {
+    SRT_TRACEBSTATS stats;
+    gint64 packets;
+
+    if (sink->analyzer) {
+      g_clear_pointer (&sink->analysis, g_variant_unref);
+      sink->analysis = g_variant_ref_sink (hwangsae_ts_analyzer_get_stats
+          (sink->analyzer, now));
+    }
+
+    if (srt_bstats (sink->socket, &stats, 1) != 0) {
+      continue;
+    }
+
+    packets = stats.pktRecv + stats.pktRcvLoss;
+
+    sink->recv_rate_mbps = stats.mbpsRecvRate;
+    sink->recv_loss_ratio = (packets > 0) ?
+        (gdouble) stats.pktRcvLoss / packets : 0;
+    sink->rtt_ms = stats.msRTT;
+    if (sink->min_rtt_ms == 0 || stats.msRTT < sink->min_rtt_ms) {
+      sink->min_rtt_ms = stats.msRTT;
+    }
+
+    {
+      gint latency = 0;
+      gint optlen = sizeof (latency);
+
+      srt_getsockflag (sink->socket, SRTO_RCVLATENCY, &latency, &optlen);
+      sink->rcv_backlog_ms = stats.msRcvBuf - latency;
+    }
+
+    if (self->bitrate_control) {
+      hwangsae_relay_update_sink_bitrate (self, sink, suggestions);
+    }
+  }
+
+  hwangsae_relay_emit_bitrate_suggestions_locked (self, suggestions);
+}
+
+static void
+hwangsae_relay_shed_source (HwangsaeRelay * self, SinkConnection * sink,
+    SourceConnection * source, const gchar * reason)
+{
+  g_debug ("Shedding source %d of %s: %s", source->socket, sink->username,
+      reason);
+
+  ++self->qos_stats[source->qos_class].sources_shed;
+  _sink_connection_remove_source (sink, source);
+}
+
+static void
+hwangsae_relay_enforce_qos (HwangsaeRelay * self)
+{
+  GHashTableIter it;
+  SinkConnection *sink;
+
+  g_hash_table_iter_init (&it, self->srtsocket_sink_map);
+
+  while (g_hash_table_iter_next (&it, NULL, (gpointer *) & sink)) {
+    GSList *l = sink->sources;
+    SourceConnection *lowest = NULL;
+
+    while (l) {
+      SourceConnection *source = l->data;
+      SRT_TRACEBSTATS stats;
+
+      l = l->next;
+
+      if (source->qos_class == HWANGSAE_QOS_CLASS_PRIORITY) {
+        continue;
+      }
+
+      if (srt_bstats (source->socket, &stats, 0) == 0 &&
+          stats.msSndBuf > SLOW_CONSUMER_MAX_SNDBUF_MS) {
+        hwangsae_relay_shed_source (self, sink, source, "slow consumer");
+        continue;
+      }
+
+      lowest = source;
+    }
+
+    if (lowest && sink->rcv_backlog_ms > OVERLOAD_MAX_RCV_BACKLOG_MS) {
+      hwangsae_relay_shed_source (self, sink, lowest, "relay overloaded");
+    }
+  }
+}
+
+static void
+hwangsae_relay_update_renditions (HwangsaeRelay * self)
+{
+  GHashTableIter it;
+  GPtrArray *renditions;
+
+  g_hash_table_iter_init (&it, self->rendition_map);
+
+  while (g_hash_table_iter_next (&it, NULL, (gpointer *) & renditions)) {
+    guint i;
+
+    /* Keep renditions ordered from the lowest to the highest bitrate. */
+    g_ptr_array_sort (renditions, _compare_sink_recv_rate);
+
+    for (i = 0; i != renditions->len; ++i) {
+      SinkConnection *sink = g_ptr_array_index (renditions, i);
+      GSList *l;
+
+      for (l = sink->sources; l; l = l->next) {
+        SourceConnection *source = l->data;
+        SRT_TRACEBSTATS stats;
+        gdouble loss_ratio;
+
+        if (!source->rendition_group || source->pending_sink ||
+            source->replaying) {
+          continue;
+        }
+
+        if (srt_bstats (source->socket, &stats, 1) != 0) {
+          continue;
+        }
+
+        loss_ratio = (stats.pktSent > 0) ?
+            (gdouble) stats.pktSndLoss / stats.pktSent : 0;
+
+        if (loss_ratio > RENDITION_MAX_LOSS_RATIO ||
+            stats.msRTT > RENDITION_MAX_RTT_MS ||
+            stats.msSndBuf > RENDITION_MAX_SNDBUF_MS) {
+          source->healthy_intervals = 0;
+          if (i > 0) {
+            _source_connection_schedule_switch (source,
+                g_ptr_array_index (renditions, i - 1));
+          }
+        } else if (++source->healthy_intervals >= RENDITION_UPGRADE_INTERVALS
+            && i + 1 < renditions->len) {
+          SinkConnection *higher = g_ptr_array_index (renditions, i + 1);
+
+          if (stats.mbpsBandwidth >=
+              higher->recv_rate_mbps * RENDITION_UPGRADE_HEADROOM) {
+            _source_connection_schedule_switch (source, higher);
+          }
+        }
+      }
+    }
+  }
+}
+
+/* Stamps latency probes in place before the data gets fanned out, so that
+ * the next hop can tell how long the packet has spent in this relay. */
+static void
+_sink_connection_stamp_probes (SinkConnection * sink, guint8 * data,
+    gsize size)
+{
+  gint64 now = g_get_real_time ();
+  gsize offset;
+
+  for (offset = 0; offset + HWANGSAE_TS_PACKET_SIZE <= size;
+      offset += HWANGSAE_TS_PACKET_SIZE) {
+    guint8 *p = data + offset;
+    gint64 previous;
+
+    if ((((p[1] & 0x1F) << 8) | p[2]) != HWANGSAE_TS_PROBE_PID) {
+      continue;
+    }
+
+    previous = hwangsae_ts_probe_stamp (p, now);
+    if (previous >= 0) {
+      hwangsae_histogram_add (sink->probe_latency, MAX (now - previous, 0));
+      hwangsae_metric_histogram_add (metric_probe_latency,
+          MAX (now - previous, 0));
+    }
+  }
+}
+
 static gpointer
 _relay_main (gpointer data)
 {
@@ -968,7 +2344,9 @@ _relay_main (gpointer data)
     gint num_ready_sockets;
 
     num_ready_sockets = srt_epoll_wait (self->poll_id, readfds, &rnum, 0, 0,
+        self->replaying_sources ? REPLAY_EPOLL_WAIT_TIMEOUT_MS :
         MAX_EPOLL_WAIT_TIMEOUT_MS, NULL, 0, NULL, 0);
+    HWANGSAE_TRACE1 (relay_epoll_wake, num_ready_sockets);
 
     if (!self->run_relay_thread) {
       break;
@@ -996,9 +2374,42 @@ _relay_main (gpointer data)
 
           do {
             recv = srt_recv (rsocket, buf, sizeof (buf));
+            HWANGSAE_TRACE2 (relay_recv, rsocket, recv);
 
             if (recv > 0) {
               GSList *it = sink->sources;
+              gint64 now = g_get_monotonic_time ();
+              gssize random_access;
+
+              hwangsae_metric_counter_add (metric_packets_received, 1);
+              hwangsae_metric_counter_add (metric_bytes_received, recv);
+
+              if (sink->probe_latency) {
+                _sink_connection_stamp_probes (sink, (guint8 *) buf, recv);
+              }
+
+              /* Always looked for, to keep up with the PMT. */
+              random_access =
+                  hwangsae_ts_find_random_access (sink->random_access,
+                  (const guint8 *) buf, recv);
+
+              if (sink->timeshift) {
+                hwangsae_gop_ring_push (sink->timeshift, (const guint8 *) buf,
+                    recv, now, random_access >= 0);
+              }
+
+              hwangsae_relay_capture (self, HWANGSAE_CAPTURE_RECORD_PACKET,
+                  sink->socket, (const guint8 *) buf, recv);
+
+              if (sink->analyzer) {
+                hwangsae_ts_analyzer_push (sink->analyzer,
+                    (const guint8 *) buf, recv, now);
+              }
+
+              if (sink->username) {
+                hwangsae_relay_call_taps (self, sink->username,
+                    (const guint8 *) buf, recv);
+              }
 
               while (it) {
                 SourceConnection *source = it->data;
@@ -1010,12 +2421,17 @@ _relay_main (gpointer data)
                   continue;
                 }
 
-                if (srt_send (source->socket, buf, recv) < 0) {
-                  hwangsae_relay_emit_io_error_locked (self, source->socket,
-                      HWANGSAE_RELAY_ERROR_WRITE, "srt_send failed: %s",
-                      srt_strerror (srt_getlasterror (NULL), 0));
-                  _sink_connection_remove_source (sink, source);
+                if (source->replaying) {
+                  continue;
                 }
+
+                hwangsae_relay_send_to_source (self, sink, source, buf, recv,
+                    now);
+              }
+
+              if (sink->switching_sources && random_access >= 0) {
+                hwangsae_relay_complete_switches (self, sink, buf, recv,
+                    random_access, now);
               }
             } else if (recv < 0) {
               gint error = srt_getlasterror (NULL);
@@ -1037,6 +2453,23 @@ _relay_main (gpointer data)
         }
       }
     }
+
+    if (self->replaying_sources) {
+      LOCK_RELAY;
+
+      hwangsae_relay_replay (self);
+    }
+
+    if (g_get_monotonic_time () >= self->next_stats_time) {
+      LOCK_RELAY;
+
+      hwangsae_relay_update_sink_stats (self);
+      hwangsae_relay_enforce_qos (self);
+      hwangsae_relay_update_renditions (self);
+      hwangsae_relay_prune_token_buckets (self);
+      hwangsae_relay_record_history (self);
+      self->next_stats_time = g_get_monotonic_time () + STATS_INTERVAL_US;
+    }
   }
 
   return NULL;
@@ -1058,6 +2491,14 @@ hwangsae_relay_init (HwangsaeRelay * self)
   self->srtsocket_sink_map = g_hash_table_new_full (g_int_hash, g_int_equal,
       NULL, (GDestroyNotify) _sink_connection_free);
   self->username_sink_map = g_hash_table_new (g_str_hash, g_str_equal);
+  self->rendition_map = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) g_ptr_array_unref);
+  self->username_bucket_map = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, g_free);
+  self->username_rate_limited_map = g_hash_table_new_full (g_str_hash,
+      g_str_equal, g_free, g_free);
+  self->username_history_map = g_hash_table_new_full (g_str_hash,
+      g_str_equal, g_free, (GDestroyNotify) _stream_history_free);
 }
 
 void
@@ -1065,6 +2506,16 @@ hwangsae_relay_start (HwangsaeRelay * self)
 {
   LOCK_RELAY;
 
+  if (self->capture_file && !self->capture) {
+    g_autoptr (GError) error = NULL;
+
+    self->capture = hwangsae_capture_new (self->capture_file,
+        self->capture_size, &error);
+    if (!self->capture) {
+      g_warning ("Packet capture disabled: %s", error->message);
+    }
+  }
+
   self->run_relay_thread = TRUE;
   self->relay_thread = g_thread_new ("HwangsaeRelay", _relay_main, self);
 }
@@ -1368,3 +2819,199 @@ hwangsae_relay_disconnect_source (HwangsaeRelay * self, const gchar * username,
     }
   }
 }
+
+GVariant *
+hwangsae_relay_get_stats (HwangsaeRelay * self)
+{
+  g_autoptr (GEnumClass) qos_class_enum = NULL;
+  GVariantDict dict;
+  GVariantDict classes;
+  GVariantDict streams;
+  GVariantDict latency;
+  GVariantDict rate_limited;
+  GHashTableIter it;
+  SinkConnection *sink;
+  const gchar *username;
+  guint64 *dropped;
+  guint sources[QOS_CLASS_COUNT] = { 0 };
+  guint num_sources = 0;
+  guint i;
+
+  g_return_val_if_fail (HWANGSAE_IS_RELAY (self), NULL);
+
+  LOCK_RELAY;
+
+  qos_class_enum = g_type_class_ref (HWANGSAE_TYPE_QOS_CLASS);
+
+  g_variant_dict_init (&streams, NULL);
+  g_variant_dict_init (&latency, NULL);
+
+  g_hash_table_iter_init (&it, self->srtsocket_sink_map);
+  while (g_hash_table_iter_next (&it, NULL, (gpointer *) & sink)) {
+    GSList *l;
+
+    for (l = sink->sources; l; l = l->next) {
+      ++sources[((SourceConnection *) l->data)->qos_class];
+    }
+
+    if (sink->analysis && sink->username) {
+      g_variant_dict_insert_value (&streams, sink->username, sink->analysis);
+    }
+
+    if (sink->probe_latency && sink->username) {
+      GVariantDict sink_latency;
+
+      g_variant_dict_init (&sink_latency, NULL);
+      g_variant_dict_insert (&sink_latency, "probes", "t",
+          sink->probe_latency->total);
+      g_variant_dict_insert (&sink_latency, "p50", "x",
+          hwangsae_histogram_percentile (sink->probe_latency, 50));
+      g_variant_dict_insert (&sink_latency, "p99", "x",
+          hwangsae_histogram_percentile (sink->probe_latency, 99));
+      g_variant_dict_insert (&sink_latency, "p999", "x",
+          hwangsae_histogram_percentile (sink->probe_latency, 99.9));
+      g_variant_dict_insert (&sink_latency, "max", "x",
+          sink->probe_latency->max);
+
+      g_variant_dict_insert_value (&latency, sink->username,
+          g_variant_dict_end (&sink_latency));
+    }
+  }
+
+  g_variant_dict_init (&classes, NULL);
+
+  for (i = 0; i != QOS_CLASS_COUNT; ++i) {
+    QosClassStats *qos_stats = &self->qos_stats[i];
+    GVariantDict class_dict;
+
+    g_variant_dict_init (&class_dict, NULL);
+    g_variant_dict_insert (&class_dict, "sources", "u", sources[i]);
+    g_variant_dict_insert (&class_dict, "packets-sent", "t",
+        qos_stats->packets_sent);
+    g_variant_dict_insert (&class_dict, "bytes-sent", "t",
+        qos_stats->bytes_sent);
+    g_variant_dict_insert (&class_dict, "packets-dropped", "t",
+        qos_stats->packets_dropped);
+    g_variant_dict_insert (&class_dict, "sources-shed", "t",
+        qos_stats->sources_shed);
+
+    g_variant_dict_insert_value (&classes,
+        g_enum_get_value (qos_class_enum, i)->value_nick,
+        g_variant_dict_end (&class_dict));
+  }
+
+  g_variant_dict_init (&rate_limited, NULL);
+  g_hash_table_iter_init (&it, self->username_rate_limited_map);
+  while (g_hash_table_iter_next (&it, (gpointer *) & username,
+          (gpointer *) & dropped)) {
+    g_variant_dict_insert (&rate_limited, username, "t", *dropped);
+  }
+
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "sinks", "u",
+      g_hash_table_size (self->srtsocket_sink_map));
+  g_variant_dict_insert (&dict, "egress-bitrate", "t",
+      (guint64) (hwangsae_relay_get_egress_mbps (self, &num_sources) *
+          1000000));
+  g_variant_dict_insert (&dict, "sources", "u", num_sources);
+  g_variant_dict_insert_value (&dict, "qos-classes",
+      g_variant_dict_end (&classes));
+  g_variant_dict_insert_value (&dict, "rate-limited",
+      g_variant_dict_end (&rate_limited));
+  g_variant_dict_insert_value (&dict, "streams",
+      g_variant_dict_end (&streams));
+  g_variant_dict_insert_value (&dict, "latency",
+      g_variant_dict_end (&latency));
+
+  return g_variant_dict_end (&dict);
+}
+
+GVariant *
+hwangsae_relay_get_history (HwangsaeRelay * self, const gchar * username,
+    gint64 since)
+{
+  GVariantBuilder builder;
+  StreamHistory *history;
+
+  g_return_val_if_fail (HWANGSAE_IS_RELAY (self), NULL);
+  g_return_val_if_fail (username != NULL, NULL);
+
+  LOCK_RELAY;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(xtddu)"));
+
+  history = g_hash_table_lookup (self->username_history_map, username);
+  if (history) {
+    guint i;
+
+    for (i = 0; i != history->length; ++i) {
+      HistorySample *sample = _stream_history_get (history, i);
+
+      if (sample->timestamp < since) {
+        continue;
+      }
+
+      g_variant_builder_add (&builder, "(xtddu)", sample->timestamp,
+          sample->bitrate, sample->loss_ratio, sample->rtt_ms,
+          sample->sources);
+    }
+  }
+
+  return g_variant_builder_end (&builder);
+}
+
+guint
+hwangsae_relay_add_tap (HwangsaeRelay * self, const gchar * resource,
+    HwangsaeRelayTapFunc func, gpointer user_data, GDestroyNotify destroy)
+{
+  Tap *tap;
+
+  g_return_val_if_fail (HWANGSAE_IS_RELAY (self), 0);
+  g_return_val_if_fail (resource != NULL, 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  LOCK_RELAY;
+
+  tap = g_new0 (Tap, 1);
+  tap->id = ++self->next_tap_id;
+  tap->resource = g_strdup (resource);
+  tap->func = func;
+  tap->user_data = user_data;
+  tap->destroy = destroy;
+
+  self->taps = g_slist_append (self->taps, tap);
+
+  g_debug ("Added tap %u on %s", tap->id, resource);
+
+  return tap->id;
+}
+
+void
+hwangsae_relay_remove_tap (HwangsaeRelay * self, guint tap_id)
+{
+  GSList *it;
+  Tap *tap = NULL;
+
+  g_return_if_fail (HWANGSAE_IS_RELAY (self));
+
+  {
+    LOCK_RELAY;
+
+    for (it = self->taps; it; it = it->next) {
+      if (((Tap *) it->data)->id == tap_id) {
+        tap = it->data;
+        self->taps = g_slist_delete_link (self->taps, it);
+        break;
+      }
+    }
+  }
+
+  if (!tap) {
+    g_warning ("No tap with ID %u", tap_id);
+    return;
+  }
+
+  g_debug ("Removed tap %u on %s", tap->id, tap->resource);
+
+  _tap_free (tap);
+}
@@ -33,6 +33,14 @@
  * @Short_description: Object to handle SRT streaming relay
  *
  * A #HwangsaeRelay is object capable of handinling SRT streaming relay, allowing one stream to be shared by N different clients.
+ *
+ * Sinks whose username has the form "group/rendition" (e.g. "edge1/hi" and
+ * "edge1/lo") publish renditions of the same stream. A source requesting
+ * resource "group" is served adaptively: it starts on the lowest bitrate
+ * rendition and is moved between renditions according to its SRT link
+ * statistics. Switches happen only at random access points of the target
+ * rendition, so all renditions of a group should share PIDs and keyframe
+ * interval.
  */
 
 G_BEGIN_DECLS
@@ -40,6 +48,21 @@ G_BEGIN_DECLS
 #define HWANGSAE_TYPE_RELAY     (hwangsae_relay_get_type ())
 G_DECLARE_FINAL_TYPE            (HwangsaeRelay, hwangsae_relay, HWANGSAE, RELAY, GObject)
 
+/**
+ * HwangsaeRelayTapFunc:
+ * @data: (nullable): MPEG-TS data received from the sink, or %NULL when the
+ *   sink has disconnected
+ * @size: size of @data in bytes
+ * @user_data: user data passed to hwangsae_relay_add_tap()
+ *
+ * Receives packets of a tapped sink. Called from the relay thread while the
+ * relay is locked; @data is only valid for the duration of the call and the
+ * function must not call back into the relay.
+ */
+typedef void (*HwangsaeRelayTapFunc) (const guint8 *data,
+                                      gsize         size,
+                                      gpointer      user_data);
+
 /**
  * hwangsae_relay_new:
  * @external_ip: an external ip address
@@ -143,6 +166,86 @@ void                    hwangsae_relay_disconnect_source(HwangsaeRelay *relay,
                                                          const gchar   *username,
                                                          const gchar   *resource);
 
+/**
+ * hwangsae_relay_add_tap:
+ * @relay: a HwangsaeRelay object
+ * @resource: username of the sink to tap
+ * @func: function receiving the sink packets
+ * @user_data: data to pass to @func
+ * @destroy: (nullable): function to free @user_data when the tap is removed
+ *
+ * Lets an in-process consumer receive packets of the sink @resource directly,
+ * without opening an SRT source connection. The tap stays registered across
+ * sink reconnections until it is removed.
+ *
+ * Returns: ID of the tap, to be passed to hwangsae_relay_remove_tap()
+ */
+guint                   hwangsae_relay_add_tap          (HwangsaeRelay *relay,
+                                                         const gchar   *resource,
+                                                         HwangsaeRelayTapFunc
+                                                                        func,
+                                                         gpointer       user_data,
+                                                         GDestroyNotify destroy);
+
+/**
+ * hwangsae_relay_remove_tap:
+ * @relay: a HwangsaeRelay object
+ * @tap_id: ID returned by hwangsae_relay_add_tap()
+ *
+ * Removes the tap. Once this returns, its function won't be called anymore.
+ */
+void                    hwangsae_relay_remove_tap       (HwangsaeRelay *relay,
+                                                         guint          tap_id);
+
+/**
+ * hwangsae_relay_get_stats:
+ * @relay: a HwangsaeRelay object
+ *
+ * Takes a snapshot of @relay statistics. The dictionary contains "sinks" and
+ * "sources" counts (u), the estimated "egress-bitrate" in bits per second (t)
+ * and "qos-classes", a dictionary keyed by
+ * #HwangsaeQosClass nick whose values hold "sources" (u), "packets-sent",
+ * "bytes-sent", "packets-dropped" and "sources-shed" (t) of that class.
+ * "rate-limited" maps usernames to the number of packets (t)
+ * #HwangsaeRelay:source-rate-limit has dropped for their sources.
+ *
+ * With #HwangsaeRelay:stream-analysis enabled, "streams" maps sink usernames
+ * to their MPEG-TS health as of the last statistics interval: "sync-errors"
+ * and "cc-errors" (t) counted since the sink connected, smoothed
+ * "pcr-jitter" in microseconds (u), last "keyframe-interval" in milliseconds
+ * (u) and "video-bitrate" in bits per second (t).
+ *
+ * With #HwangsaeRelay:latency-probes enabled, "latency" maps sink usernames
+ * to the latency of the hop into this relay measured by probe packets since
+ * the sink connected: "probes" count (t) and "p50", "p99", "p999" and "max"
+ * in microseconds (x). Hops between machines need synchronized clocks.
+ *
+ * Returns: (transfer full): a floating GVariant of type a{sv}
+ */
+GVariant               *hwangsae_relay_get_stats        (HwangsaeRelay *relay);
+
+/**
+ * hwangsae_relay_get_history:
+ * @relay: a HwangsaeRelay object
+ * @username: username of a sink
+ * @since: oldest sample to return, in microseconds since Jan 01 1970
+ *
+ * Reads the recent statistics of the sink @username, sampled every second
+ * for the last #HwangsaeRelay:history-window seconds. The history of a sink
+ * outlives its connection until all its samples have aged out.
+ *
+ * Each array item holds, in this order, the sample timestamp in
+ * microseconds since Jan 01 1970, the receive bitrate in bits per second,
+ * the packet loss ratio, the round-trip time in milliseconds and the number
+ * of connected sources. Items are ordered from the oldest.
+ *
+ * Returns: (transfer full): a floating GVariant of type a(xtddu), empty when
+ *   there is no history of @username
+ */
+GVariant               *hwangsae_relay_get_history      (HwangsaeRelay *relay,
+                                                         const gchar   *username,
+                                                         gint64         since);
+
 G_END_DECLS
 
 #endif // __HWANGSAE_RELAY_H__
@@ -0,0 +1,1079 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "retention.h"
+
+#include "metrics.h"
+
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include <errno.h>
+#include <string.h>
+
+/* How often age limits get checked when nothing else happens. */
+#define CHECK_INTERVAL_US (10 * G_USEC_PER_SEC)
+
+/* Keyframe index the recorder writes next to each file. */
+#define INDEX_SUFFIX ".idx"
+#define TRICK_PLAY_INFIX ".iframes"
+/* HLS media playlist the recorder keeps for the files of a recording. */
+#define PLAYLIST_SUFFIX ".m3u8"
+
+#define COPY_CHUNK_SIZE (1024 * 1024)
+
+typedef struct _RetentionEdge RetentionEdge;
+
+typedef struct
+{
+  gchar *path;
+  RetentionEdge *edge;
+  gint64 time_us;
+  guint64 size;
+  gboolean archived;
+
+  /* In the files of the edge, oldest first. */
+  GList *link;
+  /* In the files waiting to be archived, NULL when not waiting. */
+  GList *archive_link;
+} RetentionFile;
+
+struct _RetentionEdge
+{
+  GQueue files;
+  guint64 bytes;
+};
+
+struct _HwangsaeRetention
+{
+  GObject parent;
+
+  gchar *recording_dir;
+  guint max_age;
+  guint64 max_bytes;
+  guint edge_max_age;
+  guint64 edge_max_bytes;
+  guint unlink_rate;
+  gchar *archive_dir;
+  guint archive_age;
+  guint64 archive_bandwidth;
+
+  GThread *thread;
+  /* Protects everything below and the limits above, which the thread
+   * reads. */
+  GMutex lock;
+  GCond cond;
+  gboolean stopping;
+  gboolean needs_scan;
+
+  /* Path to RetentionFile. */
+  GHashTable *files;
+  /* Edge directory name to RetentionEdge. */
+  GHashTable *edges;
+  guint64 bytes;
+  /* Files in the recording directory, oldest first. */
+  GQueue to_archive;
+};
+
+/* *INDENT-OFF* */
+G_DEFINE_TYPE (HwangsaeRetention, hwangsae_retention, G_TYPE_OBJECT)
+/* *INDENT-ON* */
+
+enum
+{
+  PROP_RECORDING_DIR = 1,
+  PROP_MAX_AGE,
+  PROP_MAX_BYTES,
+  PROP_EDGE_MAX_AGE,
+  PROP_EDGE_MAX_BYTES,
+  PROP_UNLINK_RATE,
+  PROP_ARCHIVE_DIR,
+  PROP_ARCHIVE_AGE,
+  PROP_ARCHIVE_BANDWIDTH,
+  PROP_LAST
+};
+
+static HwangsaeMetric *metric_bytes;
+static HwangsaeMetric *metric_files_deleted;
+static HwangsaeMetric *metric_files_archived;
+static HwangsaeMetric *metric_bytes_archived;
+
+HwangsaeRetention *
+hwangsae_retention_new (void)
+{
+  return HWANGSAE_RETENTION (g_object_new (HWANGSAE_TYPE_RETENTION, NULL));
+}
+
+static void
+_retention_file_free (RetentionFile * file)
+{
+  g_free (file->path);
+  g_free (file);
+}
+
+static void
+_retention_edge_free (RetentionEdge * edge)
+{
+  g_queue_clear (&edge->files);
+  g_free (edge);
+}
+
+/* The keyframe index and the I-frame rendition the recorder may have
+ * written next to the recording at @path. */
+static gchar **
+_get_sidecar_paths (const gchar * path)
+{
+  const gchar *ext = strrchr (path, '.');
+  gchar **paths = g_new0 (gchar *, 3);
+
+  if (!ext || strchr (ext, G_DIR_SEPARATOR)) {
+    ext = path + strlen (path);
+  }
+
+  paths[0] = g_strconcat (path, INDEX_SUFFIX, NULL);
+  paths[1] = g_strdup_printf ("%.*s" TRICK_PLAY_INFIX "%s",
+      (gint) (ext - path), path, ext);
+
+  return paths;
+}
+
+static RetentionFile *
+_retention_file_new (const gchar * path)
+{
+  g_auto (GStrv) sidecar_paths = NULL;
+  RetentionFile *file;
+  GStatBuf st;
+  gchar **p;
+
+  if (g_stat (path, &st) != 0) {
+    return NULL;
+  }
+
+  file = g_new0 (RetentionFile, 1);
+  file->path = g_strdup (path);
+  file->time_us = (gint64) st.st_mtime * G_USEC_PER_SEC;
+  file->size = st.st_size;
+
+  sidecar_paths = _get_sidecar_paths (path);
+  for (p = sidecar_paths; *p; ++p) {
+    if (g_stat (*p, &st) == 0) {
+      file->size += st.st_size;
+    }
+  }
+
+  return file;
+}
+
+/* Inserts @file into @queue, which is sorted oldest first, and returns its
+ * link. The place is looked for forwards from @after, an older link, or
+ * from the head when @from_head is set, and backwards from the tail
+ * otherwise. */
+static GList *
+_queue_insert_sorted (GQueue * queue, RetentionFile * file, GList * after,
+    gboolean from_head)
+{
+  GList *l = after;
+
+  if (after || from_head) {
+    GList *next;
+
+    for (next = l ? l->next : queue->head; next; next = next->next) {
+      if (((RetentionFile *) next->data)->time_us > file->time_us) {
+        break;
+      }
+      l = next;
+    }
+  } else {
+    for (l = queue->tail; l; l = l->prev) {
+      if (((RetentionFile *) l->data)->time_us <= file->time_us) {
+        break;
+      }
+    }
+  }
+
+  if (l) {
+    g_queue_insert_after (queue, l, file);
+    return l->next;
+  }
+
+  g_queue_push_head (queue, file);
+  return queue->head;
+}
+
+/* Must be called with the lock held. Takes @file unless a file of the same
+ * path is known already. Scanned files come oldest first, @prev being the
+ * one inserted before @file; completed files are mostly the newest. */
+static gboolean
+_insert_file (HwangsaeRetention * self, RetentionFile * file,
+    RetentionFile * prev, gboolean scanned)
+{
+  g_autofree gchar *dir = NULL;
+  g_autofree gchar *edge_id = NULL;
+  RetentionEdge *edge;
+
+  if (g_hash_table_contains (self->files, file->path)) {
+    return FALSE;
+  }
+
+  dir = g_path_get_dirname (file->path);
+  edge_id = g_path_get_basename (dir);
+
+  edge = g_hash_table_lookup (self->edges, edge_id);
+  if (!edge) {
+    edge = g_new0 (RetentionEdge, 1);
+    g_hash_table_insert (self->edges, g_steal_pointer (&edge_id), edge);
+  }
+
+  file->link = _queue_insert_sorted (&edge->files, file,
+      prev ? prev->link : NULL, scanned);
+  if (!file->archived) {
+    file->archive_link = _queue_insert_sorted (&self->to_archive, file,
+        prev ? prev->archive_link : NULL, scanned);
+  }
+
+  file->edge = edge;
+  edge->bytes += file->size;
+  self->bytes += file->size;
+  g_hash_table_insert (self->files, file->path, file);
+
+  return TRUE;
+}
+
+/* Must be called with the lock held. The caller owns @file afterwards. */
+static void
+_remove_file (HwangsaeRetention * self, RetentionFile * file)
+{
+  g_queue_delete_link (&file->edge->files, file->link);
+  if (file->archive_link) {
+    g_queue_delete_link (&self->to_archive, file->archive_link);
+    file->archive_link = NULL;
+  }
+  file->edge->bytes -= file->size;
+  self->bytes -= file->size;
+  g_hash_table_steal (self->files, file->path);
+}
+
+static gint
+_compare_file_time (gconstpointer a, gconstpointer b)
+{
+  const RetentionFile *file_a = *(RetentionFile **) a;
+  const RetentionFile *file_b = *(RetentionFile **) b;
+
+  return (file_a->time_us > file_b->time_us) -
+      (file_a->time_us < file_b->time_us);
+}
+
+static gboolean
+_is_recording (const gchar * filename)
+{
+  return g_str_has_prefix (filename, "hwangsae-recording-") &&
+      (g_str_has_suffix (filename, ".ts") ||
+      g_str_has_suffix (filename, ".mp4")) &&
+      !strstr (filename, TRICK_PLAY_INFIX ".");
+}
+
+/* Reads the usage of one edge directory without the lock, as that is the
+ * slow part, and then merges it with what is already known. */
+static void
+_scan_edge (HwangsaeRetention * self, const gchar * root,
+    const gchar * edge_dir, gboolean archived)
+{
+  g_autoptr (GDir) dir = NULL;
+  g_autoptr (GPtrArray) scanned = NULL;
+  const gchar *filename;
+  RetentionFile *prev = NULL;
+  guint i;
+
+  dir = g_dir_open (edge_dir, 0, NULL);
+  if (!dir) {
+    return;
+  }
+
+  scanned = g_ptr_array_new ();
+
+  while ((filename = g_dir_read_name (dir))) {
+    g_autofree gchar *path = NULL;
+    RetentionFile *file;
+
+    if (!_is_recording (filename)) {
+      continue;
+    }
+
+    path = g_build_filename (edge_dir, filename, NULL);
+    file = _retention_file_new (path);
+    if (file) {
+      file->archived = archived;
+      g_ptr_array_add (scanned, file);
+    }
+  }
+
+  g_ptr_array_sort (scanned, _compare_file_time);
+
+  g_mutex_lock (&self->lock);
+  for (i = 0; i < scanned->len; ++i) {
+    RetentionFile *file = g_ptr_array_index (scanned, i);
+
+    /* The directories may have changed during the scan. */
+    if (g_strcmp0 (root, archived ? self->archive_dir :
+            self->recording_dir) == 0 &&
+        _insert_file (self, file, prev, TRUE)) {
+      prev = file;
+    } else {
+      _retention_file_free (file);
+    }
+  }
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+_scan (HwangsaeRetention * self, const gchar * root, gboolean archived)
+{
+  g_autoptr (GDir) dir = NULL;
+  const gchar *filename;
+
+  if (!root) {
+    return;
+  }
+
+  dir = g_dir_open (root, 0, NULL);
+  if (!dir) {
+    return;
+  }
+
+  while ((filename = g_dir_read_name (dir))) {
+    g_autofree gchar *edge_dir = g_build_filename (root, filename, NULL);
+
+    if (g_file_test (edge_dir, G_FILE_TEST_IS_DIR)) {
+      _scan_edge (self, root, edge_dir, archived);
+    }
+  }
+}
+
+/* Must be called with the lock held. Forgets all files, to scan the
+ * directories again. */
+static void
+_reset (HwangsaeRetention * self)
+{
+  g_queue_clear (&self->to_archive);
+  g_hash_table_remove_all (self->files);
+  g_hash_table_remove_all (self->edges);
+  self->bytes = 0;
+  self->needs_scan = TRUE;
+}
+
+/* Must be called with the lock held. Returns the file to delete next, if
+ * any limit is exceeded. */
+static RetentionFile *
+_pick_file (HwangsaeRetention * self)
+{
+  gint64 now = g_get_real_time ();
+  RetentionFile *oldest = NULL;
+  GHashTableIter iter;
+  RetentionEdge *edge;
+
+  g_hash_table_iter_init (&iter, self->edges);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & edge)) {
+    RetentionFile *head = g_queue_peek_head (&edge->files);
+
+    if (!head) {
+      continue;
+    }
+
+    if ((self->edge_max_bytes && edge->bytes > self->edge_max_bytes) ||
+        (self->edge_max_age && now - head->time_us >
+            (gint64) self->edge_max_age * G_USEC_PER_SEC)) {
+      return head;
+    }
+
+    if (!oldest || head->time_us < oldest->time_us) {
+      oldest = head;
+    }
+  }
+
+  if (oldest && ((self->max_bytes && self->bytes > self->max_bytes) ||
+          (self->max_age && now - oldest->time_us >
+              (gint64) self->max_age * G_USEC_PER_SEC))) {
+    return oldest;
+  }
+
+  return NULL;
+}
+
+/* Must be called with the lock held. Returns the file to archive next, if
+ * any is old enough. */
+static RetentionFile *
+_pick_file_to_archive (HwangsaeRetention * self)
+{
+  RetentionFile *head = g_queue_peek_head (&self->to_archive);
+
+  if (!self->archive_dir || !head ||
+      g_get_real_time () - head->time_us <
+      (gint64) self->archive_age * G_USEC_PER_SEC) {
+    return NULL;
+  }
+
+  return head;
+}
+
+static gboolean
+_verify_copy (const gchar * path, const gchar * expected_checksum,
+    GError ** error)
+{
+  g_autoptr (GFile) file = g_file_new_for_path (path);
+  g_autoptr (GFileInputStream) in = NULL;
+  g_autoptr (GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  g_autofree guint8 *buf = g_malloc (COPY_CHUNK_SIZE);
+  gssize n;
+
+  in = g_file_read (file, NULL, error);
+  if (!in) {
+    return FALSE;
+  }
+
+  while ((n = g_input_stream_read (G_INPUT_STREAM (in), buf, COPY_CHUNK_SIZE,
+              NULL, error)) > 0) {
+    g_checksum_update (checksum, buf, n);
+  }
+
+  if (n < 0) {
+    return FALSE;
+  }
+
+  if (g_strcmp0 (g_checksum_get_string (checksum), expected_checksum) != 0) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+        "Copy %s differs from the original", path);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Copies @src to @dest at no more than @bandwidth bytes per second (0 =
+ * unlimited) and reads the copy back to check it. @dest only appears once
+ * complete and keeps the modification time of @src, which is the age of the
+ * recording. */
+static gboolean
+_copy_file (HwangsaeRetention * self, const gchar * src, const gchar * dest,
+    guint64 bandwidth, GError ** error)
+{
+  g_autofree gchar *tmp = g_strconcat (dest, ".part", NULL);
+  g_autoptr (GFile) src_file = g_file_new_for_path (src);
+  g_autoptr (GFile) tmp_file = g_file_new_for_path (tmp);
+  g_autoptr (GFileInputStream) in = NULL;
+  g_autoptr (GFileOutputStream) out = NULL;
+  g_autoptr (GFileInfo) info = NULL;
+  g_autoptr (GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  g_autofree guint8 *buf = g_malloc (COPY_CHUNK_SIZE);
+  gint64 start = g_get_monotonic_time ();
+  guint64 copied = 0;
+  gssize n;
+
+  in = g_file_read (src_file, NULL, error);
+  if (!in) {
+    return FALSE;
+  }
+
+  out = g_file_replace (tmp_file, NULL, FALSE, G_FILE_CREATE_NONE, NULL,
+      error);
+  if (!out) {
+    return FALSE;
+  }
+
+  while ((n = g_input_stream_read (G_INPUT_STREAM (in), buf, COPY_CHUNK_SIZE,
+              NULL, error)) > 0) {
+    if (!g_output_stream_write_all (G_OUTPUT_STREAM (out), buf, n, NULL, NULL,
+            error)) {
+      goto fail;
+    }
+    g_checksum_update (checksum, buf, n);
+    copied += n;
+
+    if (g_atomic_int_get (&self->stopping)) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+          "Copy of %s cancelled", src);
+      goto fail;
+    }
+
+    if (bandwidth) {
+      gint64 due = start + copied * G_USEC_PER_SEC / bandwidth;
+      gint64 now = g_get_monotonic_time ();
+
+      if (due > now) {
+        g_usleep (due - now);
+      }
+    }
+  }
+
+  if (n < 0 || !g_output_stream_close (G_OUTPUT_STREAM (out), NULL, error) ||
+      !_verify_copy (tmp, g_checksum_get_string (checksum), error)) {
+    goto fail;
+  }
+
+  info = g_file_query_info (src_file, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+      G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  if (info) {
+    g_file_set_attribute_uint64 (tmp_file, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+        g_file_info_get_attribute_uint64 (info,
+            G_FILE_ATTRIBUTE_TIME_MODIFIED), G_FILE_QUERY_INFO_NONE, NULL,
+        NULL);
+  }
+
+  if (g_rename (tmp, dest) != 0) {
+    gint errsv = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+        "Failed to rename %s: %s", tmp, g_strerror (errsv));
+    goto fail;
+  }
+
+  return TRUE;
+
+fail:
+  g_unlink (tmp);
+
+  return FALSE;
+}
+
+/* Copies @path and its keyframe index into the directory of the same edge
+ * under @archive_dir. Returns the path of the copy, or NULL on error. */
+static gchar *
+_archive_file (HwangsaeRetention * self, const gchar * path,
+    const gchar * archive_dir, guint64 bandwidth, GError ** error)
+{
+  g_autofree gchar *dir = g_path_get_dirname (path);
+  g_autofree gchar *edge_id = g_path_get_basename (dir);
+  g_autofree gchar *filename = g_path_get_basename (path);
+  g_autofree gchar *archive_edge_dir = NULL;
+  g_autofree gchar *archive_path = NULL;
+  g_auto (GStrv) sidecar_paths = NULL;
+  g_auto (GStrv) archive_sidecar_paths = NULL;
+  guint i;
+
+  archive_edge_dir = g_build_filename (archive_dir, edge_id, NULL);
+  if (g_mkdir_with_parents (archive_edge_dir, 0750) != 0) {
+    gint errsv = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+        "Failed to create %s: %s", archive_edge_dir, g_strerror (errsv));
+    return NULL;
+  }
+
+  archive_path = g_build_filename (archive_edge_dir, filename, NULL);
+  sidecar_paths = _get_sidecar_paths (path);
+  archive_sidecar_paths = _get_sidecar_paths (archive_path);
+
+  /* The sidecars go first, so that no archived recording lacks one. */
+  for (i = 0; sidecar_paths[i]; ++i) {
+    if (g_file_test (sidecar_paths[i], G_FILE_TEST_EXISTS) &&
+        !_copy_file (self, sidecar_paths[i], archive_sidecar_paths[i],
+            bandwidth, error)) {
+      goto fail;
+    }
+  }
+
+  if (!_copy_file (self, path, archive_path, bandwidth, error)) {
+    goto fail;
+  }
+
+  return g_steal_pointer (&archive_path);
+
+fail:
+  for (i = 0; archive_sidecar_paths[i]; ++i) {
+    g_unlink (archive_sidecar_paths[i]);
+  }
+  return NULL;
+}
+
+/* Returns the filename prefix of the recording @filename is a file of, that
+ * is, what comes before "-<start>-<end>.<ext>", or NULL if it isn't one. */
+static gchar *
+_get_recording_prefix (const gchar * filename)
+{
+  const gchar *p;
+  guint i;
+
+  if (!_is_recording (filename)) {
+    return NULL;
+  }
+
+  p = strrchr (filename, '.');
+
+  for (i = 0; i < 2; ++i) {
+    const gchar *digits_end = p;
+
+    while (p > filename && g_ascii_isdigit (p[-1])) {
+      --p;
+    }
+    if (p == digits_end || p == filename || p[-1] != '-') {
+      return NULL;
+    }
+    --p;
+  }
+
+  return g_strndup (filename, p - filename);
+}
+
+/* Returns the path of the playlist of the recording @filename was a file of,
+ * or NULL if any other file of it is left in @dir. */
+static gchar *
+_get_orphaned_playlist_path (const gchar * dir, const gchar * filename)
+{
+  g_autofree gchar *prefix = _get_recording_prefix (filename);
+  g_autofree gchar *playlist_filename = NULL;
+  g_autoptr (GDir) d = NULL;
+  const gchar *name;
+
+  if (!prefix) {
+    return NULL;
+  }
+
+  d = g_dir_open (dir, 0, NULL);
+  if (!d) {
+    return NULL;
+  }
+
+  while ((name = g_dir_read_name (d))) {
+    g_autofree gchar *other_prefix = _get_recording_prefix (name);
+
+    if (g_strcmp0 (prefix, other_prefix) == 0) {
+      return NULL;
+    }
+  }
+
+  playlist_filename = g_strconcat (prefix, PLAYLIST_SUFFIX, NULL);
+
+  return g_build_filename (dir, playlist_filename, NULL);
+}
+
+/* Deletes the recording file at @path and its sidecars. */
+static void
+_unlink_file (const gchar * path)
+{
+  g_auto (GStrv) sidecar_paths = _get_sidecar_paths (path);
+  gchar **p;
+
+  g_unlink (path);
+  for (p = sidecar_paths; *p; ++p) {
+    g_unlink (*p);
+  }
+}
+
+void
+hwangsae_retention_unlink_recording (const gchar * path)
+{
+  g_autofree gchar *dir = g_path_get_dirname (path);
+  g_autofree gchar *filename = g_path_get_basename (path);
+  g_autofree gchar *playlist_path = NULL;
+
+  _unlink_file (path);
+
+  playlist_path = _get_orphaned_playlist_path (dir, filename);
+  if (playlist_path) {
+    g_unlink (playlist_path);
+  }
+}
+
+/* Moves the playlist of the recording @path was a file of next to
+ * @archive_path, the copy of that file, once no other file of it is left.
+ * Playlist entries are bare filenames, so they resolve to the copies. */
+static void
+_archive_playlist (HwangsaeRetention * self, const gchar * path,
+    const gchar * archive_path)
+{
+  g_autofree gchar *dir = g_path_get_dirname (path);
+  g_autofree gchar *filename = g_path_get_basename (path);
+  g_autofree gchar *playlist_path = NULL;
+  g_autofree gchar *playlist_filename = NULL;
+  g_autofree gchar *archive_edge_dir = NULL;
+  g_autofree gchar *archive_playlist_path = NULL;
+  g_autoptr (GError) error = NULL;
+
+  playlist_path = _get_orphaned_playlist_path (dir, filename);
+  if (!playlist_path || !g_file_test (playlist_path, G_FILE_TEST_EXISTS)) {
+    return;
+  }
+
+  playlist_filename = g_path_get_basename (playlist_path);
+  archive_edge_dir = g_path_get_dirname (archive_path);
+  archive_playlist_path = g_build_filename (archive_edge_dir,
+      playlist_filename, NULL);
+
+  if (!_copy_file (self, playlist_path, archive_playlist_path, 0, &error)) {
+    g_warning ("Failed to archive %s: %s", playlist_path, error->message);
+    return;
+  }
+
+  g_unlink (playlist_path);
+}
+
+/* Must be called with the lock held, which gets released during the copy.
+ * Once archived, the file is only known by its new path. */
+static void
+_archive (HwangsaeRetention * self, RetentionFile * file)
+{
+  g_autofree gchar *path = g_strdup (file->path);
+  g_autofree gchar *archive_dir = g_strdup (self->archive_dir);
+  g_autofree gchar *archive_path = NULL;
+  g_autoptr (GError) error = NULL;
+  guint64 bandwidth = self->archive_bandwidth;
+  guint64 size = file->size;
+
+  /* Not tried again until the next scan if this fails. */
+  g_queue_delete_link (&self->to_archive, file->archive_link);
+  file->archive_link = NULL;
+
+  g_mutex_unlock (&self->lock);
+
+  g_debug ("Archiving %s", path);
+  archive_path = _archive_file (self, path, archive_dir, bandwidth, &error);
+  if (!archive_path) {
+    g_warning ("Failed to archive %s: %s", path, error->message);
+    g_mutex_lock (&self->lock);
+    return;
+  }
+
+  g_mutex_lock (&self->lock);
+
+  file = g_hash_table_lookup (self->files, path);
+  if (!file || g_strcmp0 (archive_dir, self->archive_dir) != 0) {
+    /* Deleted or moved away during the copy. */
+    g_mutex_unlock (&self->lock);
+    _unlink_file (archive_path);
+    g_mutex_lock (&self->lock);
+    return;
+  }
+
+  g_hash_table_steal (self->files, file->path);
+  g_free (file->path);
+  file->path = g_strdup (archive_path);
+  file->archived = TRUE;
+  g_hash_table_insert (self->files, file->path, file);
+
+  g_mutex_unlock (&self->lock);
+  /* The playlist stays with the files still in the recording directory. */
+  _unlink_file (path);
+  _archive_playlist (self, path, archive_path);
+  hwangsae_metric_counter_add (metric_files_archived, 1);
+  hwangsae_metric_counter_add (metric_bytes_archived, size);
+  g_mutex_lock (&self->lock);
+}
+
+static gpointer
+_retention_thread_func (gpointer data)
+{
+  HwangsaeRetention *self = data;
+
+  g_mutex_lock (&self->lock);
+
+  while (!self->stopping) {
+    RetentionFile *file;
+    gint64 deadline;
+
+    if (self->needs_scan) {
+      g_autofree gchar *recording_dir = g_strdup (self->recording_dir);
+      g_autofree gchar *archive_dir = g_strdup (self->archive_dir);
+
+      self->needs_scan = FALSE;
+      g_mutex_unlock (&self->lock);
+      _scan (self, archive_dir, TRUE);
+      _scan (self, recording_dir, FALSE);
+      g_mutex_lock (&self->lock);
+      continue;
+    }
+
+    hwangsae_metric_gauge_set (metric_bytes, self->bytes);
+
+    file = _pick_file (self);
+    if (!file && (file = _pick_file_to_archive (self))) {
+      _archive (self, file);
+      continue;
+    }
+
+    if (!file) {
+      g_cond_wait_until (&self->cond, &self->lock,
+          g_get_monotonic_time () + CHECK_INTERVAL_US);
+      continue;
+    }
+
+    _remove_file (self, file);
+    g_mutex_unlock (&self->lock);
+
+    g_debug ("Deleting %s", file->path);
+    hwangsae_retention_unlink_recording (file->path);
+    hwangsae_metric_counter_add (metric_files_deleted, 1);
+    _retention_file_free (file);
+
+    g_mutex_lock (&self->lock);
+
+    if (self->unlink_rate == 0) {
+      continue;
+    }
+
+    /* Spreads deletions out so that they don't starve recording of disk
+     * bandwidth. */
+    deadline = g_get_monotonic_time () + G_USEC_PER_SEC / self->unlink_rate;
+    while (!self->stopping &&
+        g_cond_wait_until (&self->cond, &self->lock, deadline));
+  }
+
+  g_mutex_unlock (&self->lock);
+
+  return NULL;
+}
+
+void
+hwangsae_retention_add_file (HwangsaeRetention * self, const gchar * path)
+{
+  RetentionFile *file;
+
+  g_return_if_fail (HWANGSAE_IS_RETENTION (self));
+  g_return_if_fail (path != NULL);
+
+  file = _retention_file_new (path);
+  if (!file) {
+    return;
+  }
+
+  g_mutex_lock (&self->lock);
+  if (_insert_file (self, file, NULL, FALSE)) {
+    g_cond_signal (&self->cond);
+  } else {
+    _retention_file_free (file);
+  }
+  g_mutex_unlock (&self->lock);
+}
+
+void
+hwangsae_retention_remove_file (HwangsaeRetention * self, const gchar * path)
+{
+  RetentionFile *file;
+
+  g_return_if_fail (HWANGSAE_IS_RETENTION (self));
+  g_return_if_fail (path != NULL);
+
+  g_mutex_lock (&self->lock);
+  file = g_hash_table_lookup (self->files, path);
+  if (file) {
+    _remove_file (self, file);
+    _retention_file_free (file);
+  }
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+hwangsae_retention_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  HwangsaeRetention *self = HWANGSAE_RETENTION (object);
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+
+  switch (property_id) {
+    case PROP_RECORDING_DIR:
+      if (g_strcmp0 (self->recording_dir, g_value_get_string (value)) == 0) {
+        return;
+      }
+      g_clear_pointer (&self->recording_dir, g_free);
+      self->recording_dir = g_value_dup_string (value);
+      /* Files of the former directory are none of our business anymore. */
+      _reset (self);
+      break;
+    case PROP_ARCHIVE_DIR:{
+      const gchar *str = g_value_get_string (value);
+
+      if (str && str[0] == '\0') {
+        str = NULL;
+      }
+      if (g_strcmp0 (self->archive_dir, str) == 0) {
+        return;
+      }
+      g_clear_pointer (&self->archive_dir, g_free);
+      self->archive_dir = g_strdup (str);
+      _reset (self);
+      break;
+    }
+    case PROP_ARCHIVE_AGE:
+      self->archive_age = g_value_get_uint (value);
+      break;
+    case PROP_ARCHIVE_BANDWIDTH:
+      self->archive_bandwidth = g_value_get_uint64 (value);
+      break;
+    case PROP_MAX_AGE:
+      self->max_age = g_value_get_uint (value);
+      break;
+    case PROP_MAX_BYTES:
+      self->max_bytes = g_value_get_uint64 (value);
+      break;
+    case PROP_EDGE_MAX_AGE:
+      self->edge_max_age = g_value_get_uint (value);
+      break;
+    case PROP_EDGE_MAX_BYTES:
+      self->edge_max_bytes = g_value_get_uint64 (value);
+      break;
+    case PROP_UNLINK_RATE:
+      self->unlink_rate = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      return;
+  }
+
+  g_cond_signal (&self->cond);
+}
+
+static void
+hwangsae_retention_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  HwangsaeRetention *self = HWANGSAE_RETENTION (object);
+  g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->lock);
+
+  switch (property_id) {
+    case PROP_RECORDING_DIR:
+      g_value_set_string (value, self->recording_dir);
+      break;
+    case PROP_MAX_AGE:
+      g_value_set_uint (value, self->max_age);
+      break;
+    case PROP_MAX_BYTES:
+      g_value_set_uint64 (value, self->max_bytes);
+      break;
+    case PROP_EDGE_MAX_AGE:
+      g_value_set_uint (value, self->edge_max_age);
+      break;
+    case PROP_EDGE_MAX_BYTES:
+      g_value_set_uint64 (value, self->edge_max_bytes);
+      break;
+    case PROP_UNLINK_RATE:
+      g_value_set_uint (value, self->unlink_rate);
+      break;
+    case PROP_ARCHIVE_DIR:
+      g_value_set_string (value, self->archive_dir);
+      break;
+    case PROP_ARCHIVE_AGE:
+      g_value_set_uint (value, self->archive_age);
+      break;
+    case PROP_ARCHIVE_BANDWIDTH:
+      g_value_set_uint64 (value, self->archive_bandwidth);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
+
+static void
+hwangsae_retention_finalize (GObject * object)
+{
+  HwangsaeRetention *self = HWANGSAE_RETENTION (object);
+
+  g_mutex_lock (&self->lock);
+  self->stopping = TRUE;
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->lock);
+
+  g_thread_join (self->thread);
+
+  g_queue_clear (&self->to_archive);
+  g_clear_pointer (&self->files, g_hash_table_unref);
+  g_clear_pointer (&self->edges, g_hash_table_unref);
+  g_clear_pointer (&self->recording_dir, g_free);
+  g_clear_pointer (&self->archive_dir, g_free);
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+
+  G_OBJECT_CLASS (hwangsae_retention_parent_class)->finalize (object);
+}
+
+static void
+hwangsae_retention_class_init (HwangsaeRetentionClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->set_property = hwangsae_retention_set_property;
+  gobject_class->get_property = hwangsae_retention_get_property;
+  gobject_class->finalize = hwangsae_retention_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_RECORDING_DIR,
+      g_param_spec_string ("recording-dir", "Recording directory",
+          "Directory with a subdirectory of recordings per edge", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_AGE,
+      g_param_spec_uint ("max-age", "Max age",
+          "Max age of any recording (in seconds, 0 = unlimited)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_BYTES,
+      g_param_spec_uint64 ("max-bytes", "Max bytes",
+          "Max size of all recordings (0 = unlimited)",
+          0, G_MAXUINT64, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_EDGE_MAX_AGE,
+      g_param_spec_uint ("edge-max-age", "Max age per edge",
+          "Max age of the recordings of an edge (in seconds, 0 = unlimited)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_EDGE_MAX_BYTES,
+      g_param_spec_uint64 ("edge-max-bytes", "Max bytes per edge",
+          "Max size of the recordings of an edge (0 = unlimited)",
+          0, G_MAXUINT64, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_UNLINK_RATE,
+      g_param_spec_uint ("unlink-rate", "Unlink rate",
+          "Max number of recordings deleted per second (0 = unlimited)",
+          0, G_MAXUINT, 100, G_PARAM_READWRITE | G_PARAM_CONSTRUCT |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ARCHIVE_DIR,
+      g_param_spec_string ("archive-dir", "Archive directory",
+          "Directory of the second storage tier, with the same layout as the "
+          "recording directory (NULL = no second tier)", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ARCHIVE_AGE,
+      g_param_spec_uint ("archive-age", "Archive age",
+          "Age at which recordings move to the archive directory "
+          "(in seconds)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ARCHIVE_BANDWIDTH,
+      g_param_spec_uint64 ("archive-bandwidth", "Archive bandwidth",
+          "Max bytes per second copied to the archive directory "
+          "(0 = unlimited)", 0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  metric_bytes = hwangsae_metrics_register_gauge ("retention.bytes");
+  metric_files_deleted =
+      hwangsae_metrics_register_counter ("retention.files-deleted");
+  metric_files_archived =
+      hwangsae_metrics_register_counter ("retention.files-archived");
+  metric_bytes_archived =
+      hwangsae_metrics_register_counter ("retention.bytes-archived");
+}
+
+static void
+hwangsae_retention_init (HwangsaeRetention * self)
+{
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+
+  self->files = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+      (GDestroyNotify) _retention_file_free);
+  self->edges = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) _retention_edge_free);
+
+  self->thread = g_thread_new ("retention", _retention_thread_func, self);
+}
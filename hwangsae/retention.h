@@ -0,0 +1,52 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __HWANGSAE_RETENTION_H__
+#define __HWANGSAE_RETENTION_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/* Keeps the recordings under "recording-dir" within limits of age and size,
+ * per edge and in total. Usage is scanned once when the directory is set and
+ * then kept up to date from the files reported by the recorders; the oldest
+ * files get deleted from a thread of its own, at most "unlink-rate" per
+ * second. A limit of 0 disables it. With "archive-dir" set, files older than
+ * "archive-age" move there through a throttled and verified copy; limits
+ * count the files of both directories. */
+#define HWANGSAE_TYPE_RETENTION     (hwangsae_retention_get_type())
+G_DECLARE_FINAL_TYPE                (HwangsaeRetention, hwangsae_retention, HWANGSAE, RETENTION, GObject)
+
+HwangsaeRetention      *hwangsae_retention_new          (void);
+
+/* @path is a completed recording in the directory of its edge. */
+void                    hwangsae_retention_add_file     (HwangsaeRetention  *retention,
+                                                         const gchar        *path);
+
+void                    hwangsae_retention_remove_file  (HwangsaeRetention  *retention,
+                                                         const gchar        *path);
+
+/* Deletes the recording at @path together with the files the recorder wrote
+ * next to it, and the playlist of the recording once none of its files is
+ * left. */
+void                    hwangsae_retention_unlink_recording
+                                                        (const gchar        *path);
+
+G_END_DECLS
+
+#endif /* __HWANGSAE_RETENTION_H__ */
@@ -0,0 +1,390 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+/* For fallocate (). */
+#define _GNU_SOURCE
+
+#include "segment-writer.h"
+
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+
+/* Files are written in blocks this large, each at an offset that is a
+ * multiple of the block size, rather than once per SRT packet. */
+#define BLOCK_SIZE (1024 * 1024)
+#define BLOCK_ALIGN 4096
+
+/* Completed files wait at most this long to be synced in a batch. */
+#define SYNC_INTERVAL_US (100 * G_TIME_SPAN_MILLISECOND)
+
+/* Writers block once this much data waits for the disk, which bounds
+ * the memory a stalled disk can take. */
+#define MAX_QUEUED_BYTES (256 * 1024 * 1024)
+
+struct _HwangsaeSegmentFile
+{
+  gint fd;
+  gchar *location;
+
+  /* Owned by the thread that writes to the file. */
+  guint8 *block;
+  gsize block_len;
+
+  /* Owned by the writer thread. */
+  guint64 offset;
+  GError *error;
+  gint64 close_time;
+
+  HwangsaeSegmentFileFunc func;
+  gpointer user_data;
+};
+
+typedef enum
+{
+  WRITER_OP_PREALLOCATE,
+  WRITER_OP_WRITE,
+  WRITER_OP_CLOSE,
+} WriterOpType;
+
+typedef struct
+{
+  WriterOpType type;
+  HwangsaeSegmentFile *file;
+  guint8 *data;
+  gsize len;
+} WriterOp;
+
+typedef struct
+{
+  GMutex lock;
+  GCond op_cond;
+  GCond space_cond;
+  GQueue ops;
+  gsize queued_bytes;
+
+  GThread *thread;
+} SegmentWriter;
+
+static HwangsaeMetric *metric_queued_bytes;
+static HwangsaeMetric *metric_write_latency;
+static HwangsaeMetric *metric_sync_latency;
+static HwangsaeMetric *metric_close_latency;
+
+static void
+_writer_op_free (WriterOp * op)
+{
+  free (op->data);
+  g_free (op);
+}
+
+static void
+_segment_file_set_error (HwangsaeSegmentFile * file, const gchar * what)
+{
+  gint err = errno;
+
+  if (file->error) {
+    return;
+  }
+
+  g_set_error (&file->error, G_FILE_ERROR, g_file_error_from_errno (err),
+      "Failed to %s %s: %s", what, file->location, g_strerror (err));
+}
+
+static void
+_segment_file_free (HwangsaeSegmentFile * file)
+{
+  g_clear_error (&file->error);
+  free (file->block);
+  g_free (file->location);
+  g_free (file);
+}
+
+static void
+_segment_writer_write (HwangsaeSegmentFile * file, const guint8 * data,
+    gsize len)
+{
+  gint64 start = g_get_monotonic_time ();
+
+  while (len > 0 && !file->error) {
+    gssize written = pwrite (file->fd, data, len, file->offset);
+
+    if (written < 0) {
+      if (errno != EINTR) {
+        _segment_file_set_error (file, "write");
+      }
+      continue;
+    }
+
+    data += written;
+    len -= written;
+    file->offset += written;
+  }
+
+  hwangsae_metric_histogram_add (metric_write_latency,
+      g_get_monotonic_time () - start);
+}
+
+/* Returns TRUE when @op completed its file, which now needs a sync. */
+static gboolean
+_segment_writer_process (WriterOp * op)
+{
+  HwangsaeSegmentFile *file = op->file;
+
+  switch (op->type) {
+    case WRITER_OP_PREALLOCATE:
+      /* Keeps the file size, so readers never see the unwritten part. Not
+       * all file systems support it, which is fine. */
+      if (fallocate (file->fd, FALLOC_FL_KEEP_SIZE, 0, op->len) != 0) {
+        g_debug ("Can't preallocate %s: %s", file->location,
+            g_strerror (errno));
+      }
+      return FALSE;
+    case WRITER_OP_WRITE:
+      _segment_writer_write (file, op->data, op->len);
+      return FALSE;
+    case WRITER_OP_CLOSE:
+      /* Gives back what was preallocated beyond the end. */
+      if (!file->error && ftruncate (file->fd, file->offset) != 0) {
+        _segment_file_set_error (file, "truncate");
+      }
+      return TRUE;
+  }
+
+  g_assert_not_reached ();
+}
+
+static void
+_segment_writer_sync (GPtrArray * files)
+{
+  gint64 start = g_get_monotonic_time ();
+  guint i;
+
+  for (i = 0; i < files->len; ++i) {
+    HwangsaeSegmentFile *file = g_ptr_array_index (files, i);
+
+    if (!file->error && fdatasync (file->fd) != 0) {
+      _segment_file_set_error (file, "sync");
+    }
+    if (close (file->fd) != 0) {
+      _segment_file_set_error (file, "close");
+    }
+  }
+
+  hwangsae_metric_histogram_add (metric_sync_latency,
+      g_get_monotonic_time () - start);
+
+  for (i = 0; i < files->len; ++i) {
+    HwangsaeSegmentFile *file = g_ptr_array_index (files, i);
+
+    hwangsae_metric_histogram_add (metric_close_latency,
+        g_get_monotonic_time () - file->close_time);
+
+    if (file->func) {
+      file->func (file->location, file->error, file->user_data);
+    } else if (file->error) {
+      g_warning ("%s", file->error->message);
+    }
+    _segment_file_free (file);
+  }
+
+  g_ptr_array_set_size (files, 0);
+}
+
+static gpointer
+_segment_writer_thread (SegmentWriter * writer)
+{
+  g_autoptr (GPtrArray) to_sync = g_ptr_array_new ();
+  gint64 sync_deadline = 0;
+
+  for (;;) {
+    WriterOp *op;
+
+    g_mutex_lock (&writer->lock);
+    while (!(op = g_queue_pop_head (&writer->ops))) {
+      if (to_sync->len == 0) {
+        g_cond_wait (&writer->op_cond, &writer->lock);
+      } else if (!g_cond_wait_until (&writer->op_cond, &writer->lock,
+              sync_deadline)) {
+        break;
+      }
+    }
+    if (op && op->type == WRITER_OP_WRITE) {
+      writer->queued_bytes -= op->len;
+      hwangsae_metric_gauge_set (metric_queued_bytes, writer->queued_bytes);
+      g_cond_broadcast (&writer->space_cond);
+    }
+    g_mutex_unlock (&writer->lock);
+
+    if (op) {
+      if (_segment_writer_process (op)) {
+        if (to_sync->len == 0) {
+          sync_deadline = g_get_monotonic_time () + SYNC_INTERVAL_US;
+        }
+        g_ptr_array_add (to_sync, op->file);
+      }
+      _writer_op_free (op);
+    }
+
+    if (to_sync->len > 0 && g_get_monotonic_time () >= sync_deadline) {
+      _segment_writer_sync (to_sync);
+    }
+  }
+
+  return NULL;
+}
+
+static SegmentWriter *
+_segment_writer_get (void)
+{
+  static gsize writer_ptr = 0;
+
+  if (g_once_init_enter (&writer_ptr)) {
+    SegmentWriter *writer = g_new0 (SegmentWriter, 1);
+
+    g_mutex_init (&writer->lock);
+    g_cond_init (&writer->op_cond);
+    g_cond_init (&writer->space_cond);
+    g_queue_init (&writer->ops);
+
+    metric_queued_bytes =
+        hwangsae_metrics_register_gauge ("segment-writer.queued-bytes");
+    metric_write_latency =
+        hwangsae_metrics_register_histogram ("segment-writer.write-latency");
+    metric_sync_latency =
+        hwangsae_metrics_register_histogram ("segment-writer.sync-latency");
+    metric_close_latency =
+        hwangsae_metrics_register_histogram ("segment-writer.close-latency");
+
+    writer->thread = g_thread_new ("HwangsaeSegmentWriter",
+        (GThreadFunc) _segment_writer_thread, writer);
+
+    g_once_init_leave (&writer_ptr, (gsize) writer);
+  }
+
+  return (SegmentWriter *) writer_ptr;
+}
+
+static void
+_segment_writer_push (HwangsaeSegmentFile * file, WriterOpType type,
+    guint8 * data, gsize len)
+{
+  SegmentWriter *writer = _segment_writer_get ();
+  WriterOp *op = g_new0 (WriterOp, 1);
+
+  op->type = type;
+  op->file = file;
+  op->data = data;
+  op->len = len;
+
+  g_mutex_lock (&writer->lock);
+  if (type == WRITER_OP_WRITE) {
+    while (writer->queued_bytes >= MAX_QUEUED_BYTES) {
+      g_cond_wait (&writer->space_cond, &writer->lock);
+    }
+    writer->queued_bytes += len;
+    hwangsae_metric_gauge_set (metric_queued_bytes, writer->queued_bytes);
+  }
+  g_queue_push_tail (&writer->ops, op);
+  g_cond_signal (&writer->op_cond);
+  g_mutex_unlock (&writer->lock);
+}
+
+static void
+_segment_file_flush_block (HwangsaeSegmentFile * file)
+{
+  if (file->block_len == 0) {
+    return;
+  }
+
+  _segment_writer_push (file, WRITER_OP_WRITE, file->block, file->block_len);
+  file->block = NULL;
+  file->block_len = 0;
+}
+
+HwangsaeSegmentFile *
+hwangsae_segment_file_open (const gchar * location, gsize preallocate,
+    GError ** error)
+{
+  HwangsaeSegmentFile *file;
+  gint fd;
+
+  fd = g_open (location, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+  if (fd < 0) {
+    gint err = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (err),
+        "Failed to open %s: %s", location, g_strerror (err));
+    return NULL;
+  }
+
+  file = g_new0 (HwangsaeSegmentFile, 1);
+  file->fd = fd;
+  file->location = g_strdup (location);
+
+  if (preallocate > 0) {
+    _segment_writer_push (file, WRITER_OP_PREALLOCATE, NULL,
+        (preallocate + BLOCK_ALIGN - 1) & ~(gsize) (BLOCK_ALIGN - 1));
+  }
+
+  return file;
+}
+
+void
+hwangsae_segment_file_write (HwangsaeSegmentFile * file, const guint8 * data,
+    gsize size)
+{
+  while (size > 0) {
+    gsize len;
+
+    if (!file->block) {
+      if (posix_memalign ((gpointer *) & file->block, BLOCK_ALIGN,
+              BLOCK_SIZE) != 0) {
+        g_error ("Failed to allocate a write block");
+      }
+    }
+
+    len = MIN (size, BLOCK_SIZE - file->block_len);
+    memcpy (file->block + file->block_len, data, len);
+    file->block_len += len;
+    data += len;
+    size -= len;
+
+    if (file->block_len == BLOCK_SIZE) {
+      _segment_file_flush_block (file);
+    }
+  }
+}
+
+void
+hwangsae_segment_file_close (HwangsaeSegmentFile * file,
+    HwangsaeSegmentFileFunc func, gpointer user_data)
+{
+  _segment_file_flush_block (file);
+
+  file->func = func;
+  file->user_data = user_data;
+  file->close_time = g_get_monotonic_time ();
+
+  _segment_writer_push (file, WRITER_OP_CLOSE, NULL, 0);
+}
@@ -0,0 +1,47 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <glib.h>
+
+/* Writes recording files on a thread shared by the whole process, so that
+ * a slow disk doesn't hold up the threads that receive streams. Data goes
+ * to disk in large blocks at block aligned offsets, files get preallocated
+ * and the files completed within a short interval are synced together. */
+typedef struct _HwangsaeSegmentFile HwangsaeSegmentFile;
+
+/* Called on the writer thread once @location is synced and closed, or
+ * failed with @error. */
+typedef void (*HwangsaeSegmentFileFunc) (const gchar  *location,
+                                         const GError *error,
+                                         gpointer      user_data);
+
+/* @preallocate is the expected size of the file in bytes, or 0. */
+HwangsaeSegmentFile
+                *hwangsae_segment_file_open    (const gchar         *location,
+                                                gsize                preallocate,
+                                                GError             **error);
+
+/* Blocks only when the writer is too far behind. */
+void             hwangsae_segment_file_write   (HwangsaeSegmentFile *file,
+                                                const guint8        *data,
+                                                gsize                size);
+
+/* Consumes @file. @func may be NULL. */
+void             hwangsae_segment_file_close   (HwangsaeSegmentFile *file,
+                                                HwangsaeSegmentFileFunc
+                                                                     func,
+                                                gpointer             user_data);
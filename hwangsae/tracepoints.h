@@ -0,0 +1,48 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+#include <glib.h>
+
+/* Static tracepoints in the "hwangsae" provider. They expand to USDT probes
+ * when the library is configured with -Dtracing=true and to nothing
+ * otherwise; the arguments are not evaluated then. An inactive probe costs a
+ * single nop, so they can stay enabled in production builds and be attached
+ * to with e.g.
+ *
+ *   bpftrace -e 'usdt:libhwangsae-2.0.so:hwangsae:relay_recv { ... }'
+ */
+
+#ifdef HWANGSAE_TRACING
+
+#include <sys/sdt.h>
+
+#define HWANGSAE_TRACE(name) \
+  DTRACE_PROBE (hwangsae, name)
+#define HWANGSAE_TRACE1(name, a) \
+  DTRACE_PROBE1 (hwangsae, name, a)
+#define HWANGSAE_TRACE2(name, a, b) \
+  DTRACE_PROBE2 (hwangsae, name, a, b)
+#define HWANGSAE_TRACE3(name, a, b, c) \
+  DTRACE_PROBE3 (hwangsae, name, a, b, c)
+
+#else
+
+#define HWANGSAE_TRACE(name) G_STMT_START { } G_STMT_END
+#define HWANGSAE_TRACE1(name, a) G_STMT_START { } G_STMT_END
+#define HWANGSAE_TRACE2(name, a, b) G_STMT_START { } G_STMT_END
+#define HWANGSAE_TRACE3(name, a, b, c) G_STMT_START { } G_STMT_END
+
+#endif
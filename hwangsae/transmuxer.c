@@ -19,6 +19,7 @@
 #include "transmuxer.h"
 
 #include "common.h"
+#include "metrics.h"
 
 #include "types.h"
 
@@ -70,6 +71,11 @@ enum
   PROP_LAST
 };
 
+/* Process-wide metrics, shared by all transmuxer instances. */
+static HwangsaeMetric *metric_merges;
+static HwangsaeMetric *metric_merges_failed;
+static HwangsaeMetric *metric_merge_time;
+
 static void
 _free_segment (Segment * segment)
 {
@@ -399,6 +405,7 @@ hwangsae_transmuxer_merge (HwangsaeTransmuxer * self, GSList * input_files,
   g_autoptr (GError) parse_error = NULL;
   g_autofree gchar *output_tmp = NULL;
   GstElement *parse = NULL;
+  gint64 start_time = g_get_monotonic_time ();
 
   g_return_if_fail (input_files != NULL);
   g_return_if_fail (output != NULL);
@@ -407,6 +414,7 @@ hwangsae_transmuxer_merge (HwangsaeTransmuxer * self, GSList * input_files,
     g_warning ("There are missing files");
     g_set_error (error, HWANGSAE_TRANSMUXER_ERROR,
         HWANGSAE_TRANSMUXER_ERROR_MISSING_FILE, "Missing input file");
+    hwangsae_metric_counter_add (metric_merges_failed, 1);
     return;
   }
 
@@ -416,6 +424,7 @@ hwangsae_transmuxer_merge (HwangsaeTransmuxer * self, GSList * input_files,
     g_warning ("There are overlapping segments");
     g_set_error (error, HWANGSAE_TRANSMUXER_ERROR,
         HWANGSAE_TRANSMUXER_ERROR_OVERLAP, "Overlapping segments");
+    hwangsae_metric_counter_add (metric_merges_failed, 1);
     return;
   }
 
@@ -457,6 +466,10 @@ hwangsae_transmuxer_merge (HwangsaeTransmuxer * self, GSList * input_files,
   }
 
   hwangsae_transmuxer_clear (self);
+
+  hwangsae_metric_counter_add (metric_merges, 1);
+  hwangsae_metric_histogram_add (metric_merge_time,
+      g_get_monotonic_time () - start_time);
 }
 
 void
@@ -540,4 +553,10 @@ hwangsae_transmuxer_class_init (HwangsaeTransmuxerClass * klass)
       g_param_spec_uint64 ("max-size-bytes", "Max recording file size in bytes",
           "Max amount of bytes per file (0 = disable)",
           0, G_MAXUINT64, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  metric_merges = hwangsae_metrics_register_counter ("transmuxer.merges");
+  metric_merges_failed =
+      hwangsae_metrics_register_counter ("transmuxer.merges-failed");
+  metric_merge_time =
+      hwangsae_metrics_register_histogram ("transmuxer.merge-time");
 }
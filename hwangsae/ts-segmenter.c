@@ -0,0 +1,469 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "ts-segmenter.h"
+
+#include "keyframe-index.h"
+#include "segment-writer.h"
+#include "ts.h"
+
+#include <string.h>
+
+/* Files get preallocated this much beyond their expected size, so that
+ * a bitrate a bit above the estimate doesn't make them grow. */
+#define PREALLOCATE_MARGIN 1.1
+
+/* Bounds how long the start of a video PES is held back while waiting for
+ * its picture type. Past that, the PES is taken as not being a keyframe. */
+#define MAX_PENDING_SIZE  (256 * HWANGSAE_TS_PACKET_SIZE)
+
+struct _HwangsaeTsSegmenter
+{
+  gchar *location_pattern;
+  guint64 max_size_time;
+  guint64 max_size_bytes;
+  HwangsaeTsSegmenterFunc func;
+  gpointer user_data;
+
+  /* Wall clock time in microseconds at running time 0, or -1 until the
+   * first push. */
+  gint64 base_time;
+
+  HwangsaeTsKeyframeScanner *scanner;
+
+  /* Incomplete TS packet left over from the previous push. */
+  guint8 partial[HWANGSAE_TS_PACKET_SIZE];
+  gsize partial_len;
+
+  /* Packets since the start of a video PES of yet unknown picture type. */
+  GByteArray *pending;
+  gboolean pending_active;
+
+  HwangsaeSegmentFile *file;
+  gchar *location;
+  guint fragment_index;
+  guint64 fragment_start;
+  gint64 fragment_start_time;
+  guint64 fragment_bytes;
+  HwangsaeKeyframeIndex *index;
+
+  /* Of the last complete fragment, in bytes per nanosecond. */
+  gdouble byte_rate;
+
+  /* Fragments being closed by the segment writer. */
+  GMutex lock;
+  GCond cond;
+  guint n_closing;
+  GError *error;
+};
+
+typedef struct
+{
+  HwangsaeTsSegmenter *segmenter;
+  guint64 running_time;
+  gboolean report;
+} ClosingFragment;
+
+HwangsaeTsSegmenter *
+hwangsae_ts_segmenter_new (const gchar * location, guint64 max_size_time,
+    guint64 max_size_bytes, HwangsaeTsSegmenterFunc func, gpointer user_data)
+{
+  HwangsaeTsSegmenter *segmenter = g_new0 (HwangsaeTsSegmenter, 1);
+
+  segmenter->location_pattern = g_strdup (location);
+  segmenter->max_size_time = max_size_time;
+  segmenter->max_size_bytes = max_size_bytes;
+  segmenter->func = func;
+  segmenter->user_data = user_data;
+  segmenter->base_time = -1;
+  segmenter->scanner = hwangsae_ts_keyframe_scanner_new ();
+  segmenter->pending = g_byte_array_sized_new (MAX_PENDING_SIZE);
+  g_mutex_init (&segmenter->lock);
+  g_cond_init (&segmenter->cond);
+
+  return segmenter;
+}
+
+static void
+_fragment_closed_cb (const gchar * location, const GError * error,
+    gpointer user_data)
+{
+  ClosingFragment *closing = user_data;
+  HwangsaeTsSegmenter *segmenter = closing->segmenter;
+
+  if (closing->report) {
+    segmenter->func (HWANGSAE_TS_SEGMENTER_FRAGMENT_CLOSED, location,
+        closing->running_time, segmenter->user_data);
+  }
+
+  g_mutex_lock (&segmenter->lock);
+  if (error && !segmenter->error) {
+    segmenter->error = g_error_copy (error);
+  }
+  --segmenter->n_closing;
+  g_cond_broadcast (&segmenter->cond);
+  g_mutex_unlock (&segmenter->lock);
+
+  g_free (closing);
+}
+
+void
+hwangsae_ts_segmenter_set_base_time (HwangsaeTsSegmenter * segmenter,
+    gint64 base_time)
+{
+  segmenter->base_time = base_time;
+}
+
+/* In microseconds, from @running_time in nanoseconds. */
+static gint64
+hwangsae_ts_segmenter_get_wall_clock (HwangsaeTsSegmenter * segmenter,
+    guint64 running_time)
+{
+  return segmenter->base_time + running_time / 1000;
+}
+
+static void
+hwangsae_ts_segmenter_close_file (HwangsaeTsSegmenter * segmenter,
+    guint64 running_time, gboolean report)
+{
+  ClosingFragment *closing = g_new0 (ClosingFragment, 1);
+
+  closing->segmenter = segmenter;
+  closing->running_time = running_time;
+  closing->report = report;
+
+  g_mutex_lock (&segmenter->lock);
+  ++segmenter->n_closing;
+  g_mutex_unlock (&segmenter->lock);
+
+  hwangsae_segment_file_close (g_steal_pointer (&segmenter->file),
+      _fragment_closed_cb, closing);
+}
+
+static void
+hwangsae_ts_segmenter_wait_closed (HwangsaeTsSegmenter * segmenter)
+{
+  g_mutex_lock (&segmenter->lock);
+  while (segmenter->n_closing > 0) {
+    g_cond_wait (&segmenter->cond, &segmenter->lock);
+  }
+  g_mutex_unlock (&segmenter->lock);
+}
+
+void
+hwangsae_ts_segmenter_free (HwangsaeTsSegmenter * segmenter)
+{
+  if (segmenter->file) {
+    /* Not finished properly; leave the file as it is without reporting. */
+    hwangsae_ts_segmenter_close_file (segmenter, 0, FALSE);
+  }
+  g_clear_pointer (&segmenter->index, hwangsae_keyframe_index_free);
+  hwangsae_ts_segmenter_wait_closed (segmenter);
+
+  g_clear_error (&segmenter->error);
+  g_mutex_clear (&segmenter->lock);
+  g_cond_clear (&segmenter->cond);
+  hwangsae_ts_keyframe_scanner_free (segmenter->scanner);
+  g_byte_array_unref (segmenter->pending);
+  g_free (segmenter->location);
+  g_free (segmenter->location_pattern);
+  g_free (segmenter);
+}
+
+static void
+hwangsae_ts_segmenter_write (HwangsaeTsSegmenter * segmenter,
+    const guint8 * data, gsize size)
+{
+  if (!segmenter->file) {
+    /* Waiting for the first keyframe. */
+    return;
+  }
+
+  hwangsae_segment_file_write (segmenter->file, data, size);
+  segmenter->fragment_bytes += size;
+}
+
+static void
+hwangsae_ts_segmenter_flush_pending (HwangsaeTsSegmenter * segmenter)
+{
+  hwangsae_ts_segmenter_write (segmenter, segmenter->pending->data,
+      segmenter->pending->len);
+
+  g_byte_array_set_size (segmenter->pending, 0);
+  segmenter->pending_active = FALSE;
+}
+
+/* Written before the fragment gets closed, so that it is there by the time
+ * the fragment is reported. */
+static void
+hwangsae_ts_segmenter_save_index (HwangsaeTsSegmenter * segmenter,
+    guint64 running_time)
+{
+  g_autofree gchar *path = NULL;
+  g_autoptr (GError) error = NULL;
+
+  path = g_strconcat (segmenter->location, HWANGSAE_KEYFRAME_INDEX_SUFFIX,
+      NULL);
+
+  if (!hwangsae_keyframe_index_save (segmenter->index, path,
+          segmenter->fragment_start_time,
+          running_time - segmenter->fragment_start, &error)) {
+    g_warning ("Failed to write keyframe index: %s", error->message);
+  }
+
+  g_clear_pointer (&segmenter->index, hwangsae_keyframe_index_free);
+}
+
+/* The fragment is reported closed once the segment writer has it on
+ * disk. */
+static void
+hwangsae_ts_segmenter_close_fragment (HwangsaeTsSegmenter * segmenter,
+    guint64 running_time)
+{
+  if (!segmenter->file) {
+    return;
+  }
+
+  if (running_time > segmenter->fragment_start) {
+    segmenter->byte_rate = (gdouble) segmenter->fragment_bytes /
+        (running_time - segmenter->fragment_start);
+  }
+
+  hwangsae_ts_segmenter_save_index (segmenter, running_time);
+
+  hwangsae_ts_segmenter_close_file (segmenter, running_time, TRUE);
+}
+
+/* Expected size of the next fragment, from the limits and the bitrate so
+ * far, or 0 if unknown. */
+static gsize
+hwangsae_ts_segmenter_estimate_size (HwangsaeTsSegmenter * segmenter)
+{
+  guint64 size = segmenter->max_size_bytes;
+
+  if (segmenter->max_size_time != 0 && segmenter->byte_rate > 0) {
+    guint64 estimate = segmenter->byte_rate * segmenter->max_size_time *
+        PREALLOCATE_MARGIN;
+
+    if (size == 0 || estimate < size) {
+      size = estimate;
+    }
+  }
+
+  return size;
+}
+
+static gboolean
+hwangsae_ts_segmenter_open_fragment (HwangsaeTsSegmenter * segmenter,
+    guint64 running_time, GError ** error)
+{
+  const guint8 *psi;
+  gsize psi_size;
+
+  g_free (segmenter->location);
+  segmenter->location = g_strdup_printf (segmenter->location_pattern,
+      segmenter->fragment_index++);
+
+  segmenter->file = hwangsae_segment_file_open (segmenter->location,
+      hwangsae_ts_segmenter_estimate_size (segmenter), error);
+  if (!segmenter->file) {
+    return FALSE;
+  }
+
+  segmenter->fragment_start = running_time;
+  segmenter->fragment_start_time =
+      hwangsae_ts_segmenter_get_wall_clock (segmenter, running_time);
+  segmenter->fragment_bytes = 0;
+
+  segmenter->index = hwangsae_keyframe_index_new ();
+  hwangsae_keyframe_index_set_codec (segmenter->index,
+      hwangsae_ts_keyframe_scanner_get_codec (segmenter->scanner), 0, 0);
+
+  segmenter->func (HWANGSAE_TS_SEGMENTER_FRAGMENT_OPENED, segmenter->location,
+      running_time, segmenter->user_data);
+
+  psi = hwangsae_ts_keyframe_scanner_get_psi (segmenter->scanner, &psi_size);
+  if (psi) {
+    hwangsae_ts_segmenter_write (segmenter, psi, psi_size);
+  }
+
+  return TRUE;
+}
+
+static gboolean
+hwangsae_ts_segmenter_split_due (HwangsaeTsSegmenter * segmenter,
+    guint64 running_time)
+{
+  if (!segmenter->file) {
+    return TRUE;
+  }
+
+  if (segmenter->max_size_time != 0 &&
+      running_time - segmenter->fragment_start >= segmenter->max_size_time) {
+    return TRUE;
+  }
+
+  return segmenter->max_size_bytes != 0 &&
+      segmenter->fragment_bytes >= segmenter->max_size_bytes;
+}
+
+/* @pes_start is the packet the keyframe PES starts in, which is the next
+ * one to be written. */
+static void
+hwangsae_ts_segmenter_index_keyframe (HwangsaeTsSegmenter * segmenter,
+    const guint8 * pes_start, guint64 running_time)
+{
+  guint64 pts;
+
+  if (hwangsae_ts_get_pes_pts (pes_start, &pts)) {
+    /* From 90 kHz. */
+    pts = pts * 100000 / 9;
+  } else {
+    pts = HWANGSAE_KEYFRAME_INDEX_NONE;
+  }
+
+  hwangsae_keyframe_index_add (segmenter->index, pts,
+      hwangsae_ts_segmenter_get_wall_clock (segmenter, running_time),
+      segmenter->fragment_bytes);
+}
+
+static gboolean
+hwangsae_ts_segmenter_push_packet (HwangsaeTsSegmenter * segmenter,
+    const guint8 * p, guint64 running_time, GError ** error)
+{
+  switch (hwangsae_ts_keyframe_scanner_push (segmenter->scanner, p)) {
+    case HWANGSAE_TS_SCAN_PES_START:
+      hwangsae_ts_segmenter_flush_pending (segmenter);
+      g_byte_array_append (segmenter->pending, p, HWANGSAE_TS_PACKET_SIZE);
+      segmenter->pending_active = TRUE;
+      return TRUE;
+
+    case HWANGSAE_TS_SCAN_KEYFRAME:
+      /* Split where the keyframe PES starts, i.e. either at the held back
+       * packets or at this one. */
+      if ((segmenter->pending_active || (p[1] & 0x40)) &&
+          hwangsae_ts_segmenter_split_due (segmenter, running_time)) {
+        hwangsae_ts_segmenter_close_fragment (segmenter, running_time);
+        if (!hwangsae_ts_segmenter_open_fragment (segmenter, running_time,
+                error)) {
+          return FALSE;
+        }
+      }
+      if (segmenter->file && (segmenter->pending_active || (p[1] & 0x40))) {
+        hwangsae_ts_segmenter_index_keyframe (segmenter,
+            segmenter->pending_active ? segmenter->pending->data : p,
+            running_time);
+      }
+      break;
+
+    case HWANGSAE_TS_SCAN_NONE:
+      if (segmenter->pending_active) {
+        g_byte_array_append (segmenter->pending, p, HWANGSAE_TS_PACKET_SIZE);
+        if (segmenter->pending->len >= MAX_PENDING_SIZE) {
+          hwangsae_ts_segmenter_flush_pending (segmenter);
+        }
+        return TRUE;
+      }
+      break;
+
+    case HWANGSAE_TS_SCAN_DELTA:
+      break;
+  }
+
+  hwangsae_ts_segmenter_flush_pending (segmenter);
+  hwangsae_ts_segmenter_write (segmenter, p, HWANGSAE_TS_PACKET_SIZE);
+
+  return TRUE;
+}
+
+/* @data doesn't need to be aligned to TS packets. */
+gboolean
+hwangsae_ts_segmenter_push (HwangsaeTsSegmenter * segmenter,
+    const guint8 * data, gsize size, guint64 running_time, GError ** error)
+{
+  const guint8 *end = data + size;
+
+  if (segmenter->base_time < 0) {
+    /* Unless told otherwise, the data is live. */
+    segmenter->base_time = g_get_real_time () - running_time / 1000;
+  }
+
+  if (segmenter->partial_len > 0) {
+    gsize missing = HWANGSAE_TS_PACKET_SIZE - segmenter->partial_len;
+
+    if (size < missing) {
+      memcpy (segmenter->partial + segmenter->partial_len, data, size);
+      segmenter->partial_len += size;
+      return TRUE;
+    }
+
+    memcpy (segmenter->partial + segmenter->partial_len, data, missing);
+    data += missing;
+    segmenter->partial_len = 0;
+
+    if (segmenter->partial[0] == HWANGSAE_TS_SYNC_BYTE &&
+        !hwangsae_ts_segmenter_push_packet (segmenter, segmenter->partial,
+            running_time, error)) {
+      return FALSE;
+    }
+  }
+
+  while (data + HWANGSAE_TS_PACKET_SIZE <= end) {
+    if (G_UNLIKELY (data[0] != HWANGSAE_TS_SYNC_BYTE)) {
+      const guint8 *sync = memchr (data + 1, HWANGSAE_TS_SYNC_BYTE,
+          end - data - 1);
+
+      if (!sync) {
+        return TRUE;
+      }
+      data = sync;
+      continue;
+    }
+
+    if (!hwangsae_ts_segmenter_push_packet (segmenter, data, running_time,
+            error)) {
+      return FALSE;
+    }
+    data += HWANGSAE_TS_PACKET_SIZE;
+  }
+
+  if (data < end && data[0] == HWANGSAE_TS_SYNC_BYTE) {
+    segmenter->partial_len = end - data;
+    memcpy (segmenter->partial, data, segmenter->partial_len);
+  }
+
+  return TRUE;
+}
+
+/* Writes out whatever is held back and closes the current fragment. Returns
+ * once all fragments have been reported closed, failing if writing any of
+ * them failed. */
+gboolean
+hwangsae_ts_segmenter_finish (HwangsaeTsSegmenter * segmenter,
+    guint64 running_time, GError ** error)
+{
+  hwangsae_ts_segmenter_flush_pending (segmenter);
+  hwangsae_ts_segmenter_close_fragment (segmenter, running_time);
+  hwangsae_ts_segmenter_wait_closed (segmenter);
+
+  if (segmenter->error) {
+    g_propagate_error (error, g_steal_pointer (&segmenter->error));
+    return FALSE;
+  }
+
+  return TRUE;
+}
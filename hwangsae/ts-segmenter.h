@@ -0,0 +1,66 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+#include <glib.h>
+
+/* Writes an MPEG-TS into a series of files as it is, splitting only at
+ * keyframes once the current file has reached its maximum duration or size.
+ * Each file starts with the latest PAT and PMT so that it can be played on
+ * its own. Files go through the segment writer. Not thread-safe. */
+typedef struct _HwangsaeTsSegmenter HwangsaeTsSegmenter;
+
+typedef enum
+{
+  HWANGSAE_TS_SEGMENTER_FRAGMENT_OPENED,
+  HWANGSAE_TS_SEGMENTER_FRAGMENT_CLOSED,
+} HwangsaeTsSegmenterEvent;
+
+/* @running_time is the one given to the push or finish call that caused the
+ * event, in nanoseconds. FRAGMENT_CLOSED comes from the segment writer
+ * thread once the file is on disk. */
+typedef void (*HwangsaeTsSegmenterFunc) (HwangsaeTsSegmenterEvent event,
+                                         const gchar *location,
+                                         guint64      running_time,
+                                         gpointer     user_data);
+
+/* @location is a printf pattern taking the fragment number, as the
+ * location of splitmuxsink. A zero maximum disables that limit. */
+HwangsaeTsSegmenter
+                *hwangsae_ts_segmenter_new     (const gchar         *location,
+                                                guint64              max_size_time,
+                                                guint64              max_size_bytes,
+                                                HwangsaeTsSegmenterFunc
+                                                                     func,
+                                                gpointer             user_data);
+
+void             hwangsae_ts_segmenter_free    (HwangsaeTsSegmenter *segmenter);
+
+/* Sets the wall clock time in microseconds that running time 0 stands for,
+ * which the keyframe indexes use. Without it, the first push is taken as
+ * happening live. */
+void             hwangsae_ts_segmenter_set_base_time
+                                               (HwangsaeTsSegmenter *segmenter,
+                                                gint64               base_time);
+
+gboolean         hwangsae_ts_segmenter_push    (HwangsaeTsSegmenter *segmenter,
+                                                const guint8        *data,
+                                                gsize                size,
+                                                guint64              running_time,
+                                                GError             **error);
+
+gboolean         hwangsae_ts_segmenter_finish  (HwangsaeTsSegmenter *segmenter,
+                                                guint64              running_time,
+                                                GError             **error);
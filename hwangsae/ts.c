@@ -0,0 +1,738 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "ts.h"
+
+#include <string.h>
+
+#define TS_PID_COUNT    0x2000
+#define TS_PID_PAT      0x0000
+#define TS_PID_NULL     0x1FFF
+#define TS_CC_UNSEEN    0xFF
+
+#define PCR_CLOCK_HZ    27000000
+
+#define PROBE_MAGIC     "HWPR"
+#define PROBE_MAGIC_LEN 4
+/* Magic and stamp count follow the 4 byte packet header. */
+#define PROBE_STAMPS_OFFSET (4 + PROBE_MAGIC_LEN + 1)
+
+/* Fills @packet with a probe that has only its origin stamp. */
+void
+hwangsae_ts_probe_write (guint8 * packet, guint8 cc, gint64 origin_us)
+{
+  memset (packet, 0xFF, HWANGSAE_TS_PACKET_SIZE);
+
+  packet[0] = HWANGSAE_TS_SYNC_BYTE;
+  packet[1] = 0x40 | (HWANGSAE_TS_PROBE_PID >> 8);
+  packet[2] = HWANGSAE_TS_PROBE_PID & 0xFF;
+  packet[3] = 0x10 | (cc & 0x0F);
+  memcpy (packet + 4, PROBE_MAGIC, PROBE_MAGIC_LEN);
+  packet[4 + PROBE_MAGIC_LEN] = 0;
+
+  hwangsae_ts_probe_stamp (packet, origin_us);
+}
+
+static gboolean
+_is_probe (const guint8 * packet)
+{
+  return packet[0] == HWANGSAE_TS_SYNC_BYTE &&
+      (((packet[1] & 0x1F) << 8) | packet[2]) == HWANGSAE_TS_PROBE_PID &&
+      memcmp (packet + 4, PROBE_MAGIC, PROBE_MAGIC_LEN) == 0 &&
+      packet[4 + PROBE_MAGIC_LEN] <= HWANGSAE_TS_PROBE_MAX_STAMPS;
+}
+
+/* Copies the stamps of a probe into @stamps, which must have room for
+ * HWANGSAE_TS_PROBE_MAX_STAMPS values. Returns their count, 0 when @packet
+ * isn't a probe. */
+guint
+hwangsae_ts_probe_parse (const guint8 * packet, gint64 * stamps)
+{
+  guint n_stamps;
+  guint i;
+
+  if (!_is_probe (packet)) {
+    return 0;
+  }
+
+  n_stamps = packet[4 + PROBE_MAGIC_LEN];
+
+  for (i = 0; i != n_stamps; ++i) {
+    guint64 stamp_be;
+
+    memcpy (&stamp_be, packet + PROBE_STAMPS_OFFSET + i * 8, 8);
+    stamps[i] = GUINT64_FROM_BE (stamp_be);
+  }
+
+  return n_stamps;
+}
+
+/* Appends @now_us to the stamps of a probe. Returns the stamp preceding it,
+ * or -1 when @packet isn't a probe or has no room left. */
+gint64
+hwangsae_ts_probe_stamp (guint8 * packet, gint64 now_us)
+{
+  guint n_stamps;
+  guint64 stamp_be;
+  gint64 previous = -1;
+
+  if (!_is_probe (packet)) {
+    return -1;
+  }
+
+  n_stamps = packet[4 + PROBE_MAGIC_LEN];
+  if (n_stamps == HWANGSAE_TS_PROBE_MAX_STAMPS) {
+    return -1;
+  }
+
+  if (n_stamps > 0) {
+    memcpy (&stamp_be, packet + PROBE_STAMPS_OFFSET + (n_stamps - 1) * 8, 8);
+    previous = GUINT64_FROM_BE (stamp_be);
+  }
+
+  stamp_be = GUINT64_TO_BE (now_us);
+  memcpy (packet + PROBE_STAMPS_OFFSET + n_stamps * 8, &stamp_be, 8);
+  packet[4 + PROBE_MAGIC_LEN] = n_stamps + 1;
+
+  return previous;
+}
+
+struct _HwangsaeTsAnalyzer
+{
+  guint8 last_cc[TS_PID_COUNT];
+
+  guint16 pmt_pid;
+  guint16 pcr_pid;
+  guint16 video_pid;
+
+  guint64 sync_errors;
+  guint64 cc_errors;
+
+  guint64 last_pcr;
+  gint64 last_pcr_arrival;
+  gdouble pcr_jitter_us;
+
+  gint64 last_keyframe_arrival;
+  gint64 keyframe_interval_us;
+
+  guint64 video_bytes;
+  gint64 video_bytes_since;
+  guint64 video_bitrate;
+};
+
+HwangsaeTsAnalyzer *
+hwangsae_ts_analyzer_new (void)
+{
+  HwangsaeTsAnalyzer *analyzer = g_new0 (HwangsaeTsAnalyzer, 1);
+
+  memset (analyzer->last_cc, TS_CC_UNSEEN, sizeof (analyzer->last_cc));
+  analyzer->pmt_pid = TS_PID_NULL;
+  analyzer->pcr_pid = TS_PID_NULL;
+  analyzer->video_pid = TS_PID_NULL;
+
+  return analyzer;
+}
+
+void
+hwangsae_ts_analyzer_free (HwangsaeTsAnalyzer * analyzer)
+{
+  g_free (analyzer);
+}
+
+/* Returns the section carried in the payload of a PUSI packet, or NULL when
+ * it doesn't fit into this packet. Longer sections aren't reassembled; PAT
+ * and the PMTs of the streams we relay are always short. */
+static const guint8 *
+_get_section (const guint8 * payload, gsize payload_len, guint8 table_id,
+    gsize * section_len)
+{
+  gsize pointer_field;
+  const guint8 *section;
+  gsize len;
+
+  if (payload_len < 1) {
+    return NULL;
+  }
+
+  pointer_field = payload[0];
+  if (1 + pointer_field + 3 > payload_len) {
+    return NULL;
+  }
+
+  section = payload + 1 + pointer_field;
+  if (section[0] != table_id) {
+    return NULL;
+  }
+
+  len = 3 + (((section[1] & 0x0F) << 8) | section[2]);
+  /* Header up to last_section_number plus CRC32. */
+  if (len < 12 || section + len > payload + payload_len) {
+    return NULL;
+  }
+
+  *section_len = len;
+
+  return section;
+}
+
+static void
+_parse_pat (const guint8 * payload, gsize payload_len, guint16 * pmt_pid)
+{
+  const guint8 *section;
+  gsize section_len;
+  gsize i;
+
+  section = _get_section (payload, payload_len, 0x00, &section_len);
+  if (!section) {
+    return;
+  }
+
+  for (i = 8; i + 4 <= section_len - 4; i += 4) {
+    guint16 program_number = (section[i] << 8) | section[i + 1];
+
+    /* Program 0 points to the network information table. */
+    if (program_number != 0) {
+      *pmt_pid = ((section[i + 2] & 0x1F) << 8) | section[i + 3];
+      break;
+    }
+  }
+}
+
+/* Finds the PCR PID and the first video stream of a program. */
+static void
+_parse_pmt (const guint8 * payload, gsize payload_len, guint16 * pcr_pid,
+    guint16 * video_pid, guint8 * video_stream_type)
+{
+  const guint8 *section;
+  gsize section_len;
+  gsize program_info_len;
+  gsize i;
+
+  section = _get_section (payload, payload_len, 0x02, &section_len);
+  if (!section) {
+    return;
+  }
+
+  *pcr_pid = ((section[8] & 0x1F) << 8) | section[9];
+  program_info_len = ((section[10] & 0x0F) << 8) | section[11];
+
+  for (i = 12 + program_info_len; i + 5 <= section_len - 4;) {
+    guint8 stream_type = section[i];
+    guint16 pid = ((section[i + 1] & 0x1F) << 8) | section[i + 2];
+    gsize es_info_len = ((section[i + 3] & 0x0F) << 8) | section[i + 4];
+
+    /* MPEG-2, H.264 or H.265 video. */
+    if (stream_type == 0x02 || stream_type == 0x1B || stream_type == 0x24) {
+      *video_pid = pid;
+      *video_stream_type = stream_type;
+      break;
+    }
+
+    i += 5 + es_info_len;
+  }
+}
+
+struct _HwangsaeTsRandomAccessFinder
+{
+  guint16 pmt_pid;
+  guint16 pcr_pid;
+  guint16 video_pid;
+  guint8 video_stream_type;
+};
+
+HwangsaeTsRandomAccessFinder *
+hwangsae_ts_random_access_finder_new (void)
+{
+  HwangsaeTsRandomAccessFinder *finder =
+      g_new0 (HwangsaeTsRandomAccessFinder, 1);
+
+  finder->pmt_pid = TS_PID_NULL;
+  finder->pcr_pid = TS_PID_NULL;
+  finder->video_pid = TS_PID_NULL;
+
+  return finder;
+}
+
+void
+hwangsae_ts_random_access_finder_free (HwangsaeTsRandomAccessFinder * finder)
+{
+  g_free (finder);
+}
+
+/* Returns the offset of the first TS packet in @data that starts a video PES
+ * with random_access_indicator set, or -1 when @data contains no such
+ * packet. All of @data is looked at for PAT and PMT; until the video PID is
+ * known, any PID will do. SRT live mode delivers whole TS packets, so @data
+ * is expected to be packet-aligned. */
+gssize
+hwangsae_ts_find_random_access (HwangsaeTsRandomAccessFinder * finder,
+    const guint8 * data, gsize size)
+{
+  gssize result = -1;
+  gsize offset;
+
+  for (offset = 0; offset + HWANGSAE_TS_PACKET_SIZE <= size;
+      offset += HWANGSAE_TS_PACKET_SIZE) {
+    const guint8 *p = data + offset;
+    guint16 pid;
+    gboolean pusi;
+    gboolean has_adaptation;
+    gsize adaptation_len = 0;
+
+    if (p[0] != HWANGSAE_TS_SYNC_BYTE) {
+      continue;
+    }
+
+    pusi = (p[1] & 0x40) != 0;
+    if (!pusi) {
+      continue;
+    }
+
+    pid = ((p[1] & 0x1F) << 8) | p[2];
+    has_adaptation = (p[3] & 0x20) != 0;
+
+    if (has_adaptation) {
+      adaptation_len = 1 + p[4];
+      if (4 + adaptation_len > HWANGSAE_TS_PACKET_SIZE) {
+        continue;
+      }
+    }
+
+    if (pid == TS_PID_PAT || pid == finder->pmt_pid) {
+      const guint8 *payload = p + 4 + adaptation_len;
+      gsize payload_len = HWANGSAE_TS_PACKET_SIZE - 4 - adaptation_len;
+
+      if (!(p[3] & 0x10)) {
+        continue;
+      }
+
+      if (pid == TS_PID_PAT) {
+        _parse_pat (payload, payload_len, &finder->pmt_pid);
+      } else {
+        _parse_pmt (payload, payload_len, &finder->pcr_pid,
+            &finder->video_pid, &finder->video_stream_type);
+      }
+      continue;
+    }
+
+    /* adaptation_field_length must cover at least the flags byte. */
+    if (result < 0 && has_adaptation && p[4] > 0 && (p[5] & 0x40) &&
+        (finder->video_pid == TS_PID_NULL || pid == finder->video_pid)) {
+      result = offset;
+    }
+  }
+
+  return result;
+}
+
+static void
+_check_pcr (HwangsaeTsAnalyzer * analyzer, const guint8 * p, gint64 arrival)
+{
+  guint64 base;
+  guint64 pcr;
+
+  base = ((guint64) p[6] << 25) | (p[7] << 17) | (p[8] << 9) | (p[9] << 1) |
+      (p[10] >> 7);
+  pcr = base * 300 + (((p[10] & 0x01) << 8) | p[11]);
+
+  if (analyzer->last_pcr_arrival != 0 && pcr > analyzer->last_pcr) {
+    gint64 pcr_delta_us =
+        (pcr - analyzer->last_pcr) * G_USEC_PER_SEC / PCR_CLOCK_HZ;
+    gint64 arrival_delta_us = arrival - analyzer->last_pcr_arrival;
+
+    /* Anything over a second apart is a discontinuity, not jitter. */
+    if (pcr_delta_us < G_USEC_PER_SEC) {
+      gint64 d = ABS (arrival_delta_us - pcr_delta_us);
+
+      /* Smoothed the same way as RFC 3550 interarrival jitter. */
+      analyzer->pcr_jitter_us += (d - analyzer->pcr_jitter_us) / 16;
+    }
+  }
+
+  analyzer->last_pcr = pcr;
+  analyzer->last_pcr_arrival = arrival;
+}
+
+static void
+_analyze_packet (HwangsaeTsAnalyzer * analyzer, const guint8 * p,
+    gint64 arrival)
+{
+  guint16 pid = ((p[1] & 0x1F) << 8) | p[2];
+  gboolean pusi = (p[1] & 0x40) != 0;
+  gboolean has_adaptation = (p[3] & 0x20) != 0;
+  gboolean has_payload = (p[3] & 0x10) != 0;
+  guint8 cc = p[3] & 0x0F;
+  gsize adaptation_len = 0;
+  gboolean discontinuity = FALSE;
+
+  if (pid == TS_PID_NULL) {
+    return;
+  }
+
+  if (has_adaptation) {
+    adaptation_len = 1 + p[4];
+    if (4 + adaptation_len > HWANGSAE_TS_PACKET_SIZE) {
+      return;
+    }
+
+    if (p[4] > 0) {
+      discontinuity = (p[5] & 0x80) != 0;
+
+      if (pid == analyzer->pcr_pid && (p[5] & 0x10) && p[4] >= 7) {
+        _check_pcr (analyzer, p, arrival);
+      }
+
+      if (pid == analyzer->video_pid && pusi && (p[5] & 0x40)) {
+        if (analyzer->last_keyframe_arrival != 0) {
+          analyzer->keyframe_interval_us =
+              arrival - analyzer->last_keyframe_arrival;
+        }
+        analyzer->last_keyframe_arrival = arrival;
+      }
+    }
+  }
+
+  /* The counter only advances on packets with payload and a single
+   * duplicate is allowed. */
+  if (has_payload) {
+    guint8 last_cc = analyzer->last_cc[pid];
+
+    if (last_cc != TS_CC_UNSEEN && !discontinuity && cc != last_cc &&
+        cc != ((last_cc + 1) & 0x0F)) {
+      ++analyzer->cc_errors;
+    }
+    analyzer->last_cc[pid] = cc;
+  }
+
+  if (pid == analyzer->video_pid) {
+    analyzer->video_bytes += HWANGSAE_TS_PACKET_SIZE;
+  }
+
+  if (has_payload && pusi) {
+    const guint8 *payload = p + 4 + adaptation_len;
+    gsize payload_len = HWANGSAE_TS_PACKET_SIZE - 4 - adaptation_len;
+
+    if (pid == TS_PID_PAT) {
+      _parse_pat (payload, payload_len, &analyzer->pmt_pid);
+    } else if (pid == analyzer->pmt_pid) {
+      guint8 video_stream_type;
+
+      _parse_pmt (payload, payload_len, &analyzer->pcr_pid,
+          &analyzer->video_pid, &video_stream_type);
+    }
+  }
+}
+
+void
+hwangsae_ts_analyzer_push (HwangsaeTsAnalyzer * analyzer, const guint8 * data,
+    gsize size, gint64 arrival_us)
+{
+  const guint8 *p = data;
+  const guint8 *end = data + size;
+
+  if (analyzer->video_bytes_since == 0) {
+    analyzer->video_bytes_since = arrival_us;
+  }
+
+  while (p + HWANGSAE_TS_PACKET_SIZE <= end) {
+    if (G_UNLIKELY (p[0] != HWANGSAE_TS_SYNC_BYTE)) {
+      const guint8 *sync;
+
+      ++analyzer->sync_errors;
+
+      /* Lost alignment; memchr() is vectorized in libc, so resyncing costs
+       * next to nothing compared to checking byte by byte. */
+      sync = memchr (p + 1, HWANGSAE_TS_SYNC_BYTE, end - p - 1);
+      if (!sync) {
+        break;
+      }
+      p = sync;
+      continue;
+    }
+
+    _analyze_packet (analyzer, p, arrival_us);
+    p += HWANGSAE_TS_PACKET_SIZE;
+  }
+}
+
+/* Returns a{sv} with the stream health since the analyzer was created. The
+ * video bitrate is averaged since the previous call. */
+GVariant *
+hwangsae_ts_analyzer_get_stats (HwangsaeTsAnalyzer * analyzer, gint64 now_us)
+{
+  GVariantDict dict;
+
+  if (analyzer->video_bytes_since != 0 &&
+      now_us > analyzer->video_bytes_since) {
+    analyzer->video_bitrate = analyzer->video_bytes * 8 * G_USEC_PER_SEC /
+        (now_us - analyzer->video_bytes_since);
+    analyzer->video_bytes = 0;
+    analyzer->video_bytes_since = now_us;
+  }
+
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "sync-errors", "t", analyzer->sync_errors);
+  g_variant_dict_insert (&dict, "cc-errors", "t", analyzer->cc_errors);
+  g_variant_dict_insert (&dict, "pcr-jitter", "u",
+      (guint32) analyzer->pcr_jitter_us);
+  g_variant_dict_insert (&dict, "keyframe-interval", "u",
+      (guint32) (analyzer->keyframe_interval_us / 1000));
+  g_variant_dict_insert (&dict, "video-bitrate", "t", analyzer->video_bitrate);
+
+  return g_variant_dict_end (&dict);
+}
+
+/* Reads the PTS, in 90 kHz units, of the PES that starts in @packet. */
+gboolean
+hwangsae_ts_get_pes_pts (const guint8 * packet, guint64 * pts)
+{
+  gsize offset = 4;
+  const guint8 *pes;
+
+  if (!(packet[1] & 0x40) || !(packet[3] & 0x10)) {
+    return FALSE;
+  }
+
+  if (packet[3] & 0x20) {
+    offset += 1 + packet[4];
+  }
+
+  if (offset + 14 > HWANGSAE_TS_PACKET_SIZE) {
+    return FALSE;
+  }
+
+  pes = packet + offset;
+  if (pes[0] != 0 || pes[1] != 0 || pes[2] != 1 || !(pes[7] & 0x80)) {
+    return FALSE;
+  }
+
+  *pts = ((guint64) (pes[9] & 0x0E) << 29) | (pes[10] << 22) |
+      ((pes[11] & 0xFE) << 14) | (pes[12] << 7) | (pes[13] >> 1);
+
+  return TRUE;
+}
+
+#define STREAM_TYPE_H264 0x1B
+#define STREAM_TYPE_H265 0x24
+
+struct _HwangsaeTsKeyframeScanner
+{
+  guint16 pmt_pid;
+  guint16 pcr_pid;
+  guint16 video_pid;
+  guint8 video_stream_type;
+
+  /* Latest PAT and PMT packets, in this order. */
+  guint8 psi[2 * HWANGSAE_TS_PACKET_SIZE];
+  gboolean have_pat;
+  gboolean have_pmt;
+
+  /* Start code search state, carried over between packets of a PES. */
+  gboolean pending;
+  guint zeros;
+  gboolean nal_header_next;
+};
+
+HwangsaeTsKeyframeScanner *
+hwangsae_ts_keyframe_scanner_new (void)
+{
+  HwangsaeTsKeyframeScanner *scanner = g_new0 (HwangsaeTsKeyframeScanner, 1);
+
+  scanner->pmt_pid = TS_PID_NULL;
+  scanner->pcr_pid = TS_PID_NULL;
+  scanner->video_pid = TS_PID_NULL;
+
+  return scanner;
+}
+
+void
+hwangsae_ts_keyframe_scanner_free (HwangsaeTsKeyframeScanner * scanner)
+{
+  g_free (scanner);
+}
+
+/* Classifies a NAL unit by its header byte. Returns NONE for units that
+ * don't carry a picture, such as parameter sets or SEI. */
+static HwangsaeTsScanResult
+_classify_nal (HwangsaeTsKeyframeScanner * scanner, guint8 header)
+{
+  if (scanner->video_stream_type == STREAM_TYPE_H265) {
+    guint8 type = (header >> 1) & 0x3F;
+
+    /* IRAP pictures, BLA to CRA. */
+    if (type >= 16 && type <= 21) {
+      return HWANGSAE_TS_SCAN_KEYFRAME;
+    }
+    return (type <= 9) ? HWANGSAE_TS_SCAN_DELTA : HWANGSAE_TS_SCAN_NONE;
+  } else {
+    guint8 type = header & 0x1F;
+
+    if (type == 5) {
+      return HWANGSAE_TS_SCAN_KEYFRAME;
+    }
+    return (type >= 1 && type <= 4) ? HWANGSAE_TS_SCAN_DELTA :
+        HWANGSAE_TS_SCAN_NONE;
+  }
+}
+
+/* Looks for the first picture NAL unit in a chunk of elementary stream. */
+static HwangsaeTsScanResult
+_scan_es (HwangsaeTsKeyframeScanner * scanner, const guint8 * es, gsize len)
+{
+  gsize i;
+
+  for (i = 0; i != len; ++i) {
+    guint8 b = es[i];
+
+    if (scanner->nal_header_next) {
+      HwangsaeTsScanResult result = _classify_nal (scanner, b);
+
+      scanner->nal_header_next = FALSE;
+      if (result != HWANGSAE_TS_SCAN_NONE) {
+        scanner->pending = FALSE;
+        return result;
+      }
+    }
+
+    if (b == 0) {
+      ++scanner->zeros;
+    } else {
+      scanner->nal_header_next = (b == 1 && scanner->zeros >= 2);
+      scanner->zeros = 0;
+    }
+  }
+
+  return HWANGSAE_TS_SCAN_NONE;
+}
+
+/* Feeds one TS packet to the scanner. A video PES whose first packet gives
+ * no clue about the picture type makes it return PES_START, then NONE until
+ * a later packet of that PES resolves it as KEYFRAME or DELTA. A new PES
+ * that starts before the previous one got resolved implies the previous one
+ * wasn't a keyframe. Only H.264 and H.265 are looked into; other streams,
+ * and all streams before the PMT is known, rely on the
+ * random_access_indicator alone. */
+HwangsaeTsScanResult
+hwangsae_ts_keyframe_scanner_push (HwangsaeTsKeyframeScanner * scanner,
+    const guint8 * p)
+{
+  guint16 pid = ((p[1] & 0x1F) << 8) | p[2];
+  gboolean pusi = (p[1] & 0x40) != 0;
+  gboolean has_adaptation = (p[3] & 0x20) != 0;
+  gboolean has_payload = (p[3] & 0x10) != 0;
+  gsize adaptation_len = 0;
+  const guint8 *payload;
+  gsize payload_len;
+
+  if (has_adaptation) {
+    adaptation_len = 1 + p[4];
+    if (4 + adaptation_len > HWANGSAE_TS_PACKET_SIZE) {
+      return HWANGSAE_TS_SCAN_NONE;
+    }
+  }
+
+  payload = p + 4 + adaptation_len;
+  payload_len = HWANGSAE_TS_PACKET_SIZE - 4 - adaptation_len;
+
+  if (has_payload && pusi) {
+    if (pid == TS_PID_PAT) {
+      _parse_pat (payload, payload_len, &scanner->pmt_pid);
+      memcpy (scanner->psi, p, HWANGSAE_TS_PACKET_SIZE);
+      scanner->have_pat = TRUE;
+      return HWANGSAE_TS_SCAN_NONE;
+    } else if (pid == scanner->pmt_pid) {
+      _parse_pmt (payload, payload_len, &scanner->pcr_pid,
+          &scanner->video_pid, &scanner->video_stream_type);
+      memcpy (scanner->psi + HWANGSAE_TS_PACKET_SIZE, p,
+          HWANGSAE_TS_PACKET_SIZE);
+      scanner->have_pmt = TRUE;
+      return HWANGSAE_TS_SCAN_NONE;
+    }
+  }
+
+  if (scanner->video_pid != TS_PID_NULL && pid != scanner->video_pid) {
+    return HWANGSAE_TS_SCAN_NONE;
+  }
+
+  if (pusi) {
+    scanner->pending = FALSE;
+
+    if (has_adaptation && p[4] > 0 && (p[5] & 0x40)) {
+      return HWANGSAE_TS_SCAN_KEYFRAME;
+    }
+
+    if (scanner->video_stream_type != STREAM_TYPE_H264 &&
+        scanner->video_stream_type != STREAM_TYPE_H265) {
+      return HWANGSAE_TS_SCAN_DELTA;
+    }
+
+    /* Skip the PES header. */
+    if (!has_payload || payload_len < 9 || payload[0] != 0 ||
+        payload[1] != 0 || payload[2] != 1 || 9 + payload[8] > payload_len) {
+      return HWANGSAE_TS_SCAN_DELTA;
+    }
+
+    scanner->pending = TRUE;
+    scanner->zeros = 0;
+    scanner->nal_header_next = FALSE;
+
+    switch (_scan_es (scanner, payload + 9 + payload[8],
+            payload_len - 9 - payload[8])) {
+      case HWANGSAE_TS_SCAN_KEYFRAME:
+        return HWANGSAE_TS_SCAN_KEYFRAME;
+      case HWANGSAE_TS_SCAN_DELTA:
+        return HWANGSAE_TS_SCAN_DELTA;
+      default:
+        return HWANGSAE_TS_SCAN_PES_START;
+    }
+  }
+
+  if (scanner->pending && has_payload) {
+    return _scan_es (scanner, payload, payload_len);
+  }
+
+  return HWANGSAE_TS_SCAN_NONE;
+}
+
+/* Returns the latest PAT and PMT packets to put at the start of a file that
+ * should be playable on its own, or NULL until both have been seen. */
+const guint8 *
+hwangsae_ts_keyframe_scanner_get_psi (HwangsaeTsKeyframeScanner * scanner,
+    gsize * size)
+{
+  if (!scanner->have_pat || !scanner->have_pmt) {
+    return NULL;
+  }
+
+  *size = sizeof (scanner->psi);
+
+  return scanner->psi;
+}
+
+/* Returns "h264" or "h265" once the PMT is known, NULL otherwise. */
+const gchar *
+hwangsae_ts_keyframe_scanner_get_codec (HwangsaeTsKeyframeScanner * scanner)
+{
+  switch (scanner->video_stream_type) {
+    case STREAM_TYPE_H264:
+      return "h264";
+    case STREAM_TYPE_H265:
+      return "h265";
+    default:
+      return NULL;
+  }
+}
@@ -0,0 +1,112 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+#include <glib.h>
+
+#define HWANGSAE_TS_PACKET_SIZE 188
+#define HWANGSAE_TS_SYNC_BYTE   0x47
+
+/* Latency probes are single TS packets on a private PID carrying the wall
+ * clock time at which they entered the stream, followed by the time each
+ * relay on the way has received them. */
+#define HWANGSAE_TS_PROBE_PID        0x1FF0
+#define HWANGSAE_TS_PROBE_MAX_STAMPS 22
+
+/* Finds the random access points of the video stream, which it learns
+ * from PAT and PMT, so that those muxers set on every audio frame don't
+ * count. Not thread-safe. */
+typedef struct _HwangsaeTsRandomAccessFinder HwangsaeTsRandomAccessFinder;
+
+HwangsaeTsRandomAccessFinder
+                *hwangsae_ts_random_access_finder_new
+                                               (void);
+
+void             hwangsae_ts_random_access_finder_free
+                                               (HwangsaeTsRandomAccessFinder
+                                                                   *finder);
+
+gssize           hwangsae_ts_find_random_access
+                                               (HwangsaeTsRandomAccessFinder
+                                                                   *finder,
+                                                const guint8       *data,
+                                                gsize               size);
+
+void             hwangsae_ts_probe_write       (guint8       *packet,
+                                                guint8        cc,
+                                                gint64        origin_us);
+
+guint            hwangsae_ts_probe_parse       (const guint8 *packet,
+                                                gint64       *stamps);
+
+gint64           hwangsae_ts_probe_stamp       (guint8       *packet,
+                                                gint64        now_us);
+
+gboolean         hwangsae_ts_get_pes_pts       (const guint8 *packet,
+                                                guint64      *pts);
+
+/* Cheap MPEG-TS health monitor that only looks at packet headers, PSI and
+ * adaptation fields, never at the elementary streams. Not thread-safe. */
+typedef struct _HwangsaeTsAnalyzer HwangsaeTsAnalyzer;
+
+HwangsaeTsAnalyzer
+                *hwangsae_ts_analyzer_new      (void);
+
+void             hwangsae_ts_analyzer_free     (HwangsaeTsAnalyzer *analyzer);
+
+void             hwangsae_ts_analyzer_push     (HwangsaeTsAnalyzer *analyzer,
+                                                const guint8       *data,
+                                                gsize               size,
+                                                gint64              arrival_us);
+
+GVariant        *hwangsae_ts_analyzer_get_stats
+                                               (HwangsaeTsAnalyzer *analyzer,
+                                                gint64              now_us);
+
+/* Finds keyframes in an MPEG-TS by looking into the NAL units at the start
+ * of each video PES, for streams whose muxer doesn't set the
+ * random_access_indicator. Not thread-safe. */
+typedef struct _HwangsaeTsKeyframeScanner HwangsaeTsKeyframeScanner;
+
+typedef enum
+{
+  HWANGSAE_TS_SCAN_NONE,
+  HWANGSAE_TS_SCAN_PES_START,
+  HWANGSAE_TS_SCAN_KEYFRAME,
+  HWANGSAE_TS_SCAN_DELTA,
+} HwangsaeTsScanResult;
+
+HwangsaeTsKeyframeScanner
+                *hwangsae_ts_keyframe_scanner_new
+                                               (void);
+
+void             hwangsae_ts_keyframe_scanner_free
+                                               (HwangsaeTsKeyframeScanner
+                                                                   *scanner);
+
+HwangsaeTsScanResult
+                 hwangsae_ts_keyframe_scanner_push
+                                               (HwangsaeTsKeyframeScanner
+                                                                   *scanner,
+                                                const guint8       *packet);
+
+const guint8    *hwangsae_ts_keyframe_scanner_get_psi
+                                               (HwangsaeTsKeyframeScanner
+                                                                   *scanner,
+                                                gsize              *size);
+
+const gchar     *hwangsae_ts_keyframe_scanner_get_codec
+                                               (HwangsaeTsKeyframeScanner
+                                                                   *scanner);
@@ -41,6 +41,7 @@ typedef enum {
 typedef enum {
   HWANGSAE_CONTAINER_MP4,
   HWANGSAE_CONTAINER_TS,
+  HWANGSAE_CONTAINER_FMP4,
 } HwangsaeContainer;
 
 #define HWANGSAE_RELAY_ERROR           (hwangsae_relay_error_quark ())
@@ -77,6 +78,22 @@ typedef enum {
   HWANGSAE_REJECT_REASON_NO_SUCH_SINK,
   HWANGSAE_REJECT_REASON_ENCRYPTION,
   HWANGSAE_REJECT_REASON_CANT_CONNECT_MASTER,
+  HWANGSAE_REJECT_REASON_EGRESS_LIMIT,
 } HwangsaeRejectReason;
 
+/**
+ * HwangsaeQosClass:
+ * @HWANGSAE_QOS_CLASS_PRIORITY: served first in every fan-out round and never
+ *   disconnected for being slow or to relieve overload, e.g. recorders
+ * @HWANGSAE_QOS_CLASS_STANDARD: the default class of sources
+ * @HWANGSAE_QOS_CLASS_BEST_EFFORT: shed first when the relay is overloaded
+ *
+ * Priority classes of relay sources, from the highest to the lowest.
+ */
+typedef enum {
+  HWANGSAE_QOS_CLASS_PRIORITY,
+  HWANGSAE_QOS_CLASS_STANDARD,
+  HWANGSAE_QOS_CLASS_BEST_EFFORT,
+} HwangsaeQosClass;
+
 #endif // __HWANGSAE_TYPES_H__
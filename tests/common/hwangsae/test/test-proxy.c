@@ -0,0 +1,482 @@
+/** 
+ *  tests/common
+ *
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "test-proxy.h"
+
+#include <gio/gio.h>
+#include <gst/gsturi.h>
+#include <string.h>
+
+#define PROXY_MTU                 1500
+#define PROXY_POLL_TIMEOUT_MS     5
+/* How much longer than the others a reordered packet gets held back. */
+#define PROXY_REORDER_DELAY_US    (10 * G_TIME_SPAN_MILLISECOND)
+
+typedef struct
+{
+  GSocketAddress *caller;
+  GSocket *upstream;
+
+  /* Per-direction state of the emulated link. */
+  gint64 last_release[2];
+  gint64 link_free_at[2];
+} Flow;
+
+typedef enum
+{
+  DIRECTION_TO_TARGET,
+  DIRECTION_TO_CALLER,
+} Direction;
+
+typedef struct
+{
+  gint64 release_time;
+  Flow *flow;
+  Direction direction;
+  gsize len;
+  guint8 data[];
+} Packet;
+
+struct _HwangsaeTestProxy
+{
+  GObject parent;
+
+  gchar *target_uri;
+  guint listen_port;
+  gchar *uri;
+
+  GMutex lock;
+  gdouble loss;
+  guint delay_ms;
+  guint jitter_ms;
+  gdouble reorder;
+  guint64 bandwidth;
+
+  GSocketAddress *target;
+  GSocket *listen_socket;
+  /* Caller address string to Flow. */
+  GHashTable *flows;
+  /* Packets waiting for their release time, in ascending order. */
+  GQueue packets;
+  GRand *rand;
+
+  gboolean running;
+  GThread *thread;
+};
+
+/* *INDENT-OFF* */
+G_DEFINE_TYPE (HwangsaeTestProxy, hwangsae_test_proxy, G_TYPE_OBJECT)
+/* *INDENT-ON* */
+
+enum
+{
+  PROP_LOSS = 1,
+  PROP_DELAY,
+  PROP_JITTER,
+  PROP_REORDER,
+  PROP_BANDWIDTH,
+  PROP_LAST
+};
+
+static void
+_flow_free (Flow * flow)
+{
+  g_clear_object (&flow->caller);
+  g_clear_object (&flow->upstream);
+  g_free (flow);
+}
+
+static gchar *
+_address_to_string (GSocketAddress * address)
+{
+  GInetSocketAddress *inet = G_INET_SOCKET_ADDRESS (address);
+  g_autofree gchar *ip =
+      g_inet_address_to_string (g_inet_socket_address_get_address (inet));
+
+  return g_strdup_printf ("%s:%u", ip, g_inet_socket_address_get_port (inet));
+}
+
+static gint
+_compare_release_time (gconstpointer a, gconstpointer b, gpointer unused)
+{
+  gint64 time_a = ((const Packet *) a)->release_time;
+  gint64 time_b = ((const Packet *) b)->release_time;
+
+  return time_a < time_b ? -1 : (time_a > time_b ? 1 : 0);
+}
+
+static void
+hwangsae_test_proxy_enqueue (HwangsaeTestProxy * self, Flow * flow,
+    Direction direction, const guint8 * data, gsize len)
+{
+  Packet *packet;
+  gint64 now = g_get_monotonic_time ();
+  gint64 release;
+  gboolean reordered;
+
+  g_mutex_lock (&self->lock);
+
+  if (g_rand_double (self->rand) < self->loss) {
+    g_mutex_unlock (&self->lock);
+    return;
+  }
+
+  release = now + self->delay_ms * G_TIME_SPAN_MILLISECOND;
+  if (self->jitter_ms > 0) {
+    release += g_rand_int_range (self->rand, -(gint32) self->jitter_ms,
+        self->jitter_ms + 1) * G_TIME_SPAN_MILLISECOND;
+  }
+
+  /* Serialize packets on a link of the given capacity. */
+  if (self->bandwidth > 0) {
+    release = MAX (release, flow->link_free_at[direction]);
+    flow->link_free_at[direction] = MAX (now, flow->link_free_at[direction]) +
+        len * 8 * G_USEC_PER_SEC / self->bandwidth;
+  }
+
+  reordered = g_rand_double (self->rand) < self->reorder;
+
+  g_mutex_unlock (&self->lock);
+
+  if (reordered) {
+    release += PROXY_REORDER_DELAY_US;
+  } else {
+    /* Jitter alone doesn't reorder packets, just like on a real link. */
+    release = MAX (release, flow->last_release[direction]);
+    flow->last_release[direction] = release;
+  }
+
+  packet = g_malloc (sizeof (Packet) + len);
+  packet->release_time = release;
+  packet->flow = flow;
+  packet->direction = direction;
+  packet->len = len;
+  memcpy (packet->data, data, len);
+
+  g_queue_insert_sorted (&self->packets, packet, _compare_release_time, NULL);
+}
+
+static void
+hwangsae_test_proxy_release (HwangsaeTestProxy * self)
+{
+  gint64 now = g_get_monotonic_time ();
+  Packet *packet;
+
+  while ((packet = g_queue_peek_head (&self->packets)) &&
+      packet->release_time <= now) {
+    g_queue_pop_head (&self->packets);
+
+    if (packet->direction == DIRECTION_TO_TARGET) {
+      g_socket_send (packet->flow->upstream, (const gchar *) packet->data,
+          packet->len, NULL, NULL);
+    } else {
+      g_socket_send_to (self->listen_socket, packet->flow->caller,
+          (const gchar *) packet->data, packet->len, NULL, NULL);
+    }
+
+    g_free (packet);
+  }
+}
+
+static Flow *
+hwangsae_test_proxy_get_flow (HwangsaeTestProxy * self,
+    GSocketAddress * caller)
+{
+  g_autofree gchar *key = _address_to_string (caller);
+  g_autoptr (GError) error = NULL;
+  Flow *flow;
+
+  flow = g_hash_table_lookup (self->flows, key);
+  if (flow) {
+    return flow;
+  }
+
+  flow = g_new0 (Flow, 1);
+  flow->caller = g_object_ref (caller);
+  flow->upstream = g_socket_new (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM,
+      G_SOCKET_PROTOCOL_UDP, &error);
+  g_assert_no_error (error);
+  g_socket_set_blocking (flow->upstream, FALSE);
+  g_socket_connect (flow->upstream, self->target, NULL, &error);
+  g_assert_no_error (error);
+
+  g_debug ("Proxying %s to %s", key, self->target_uri);
+
+  g_hash_table_insert (self->flows, g_steal_pointer (&key), flow);
+
+  return flow;
+}
+
+static gpointer
+hwangsae_test_proxy_thread_func (HwangsaeTestProxy * self)
+{
+  guint8 buf[PROXY_MTU];
+
+  while (self->running) {
+    g_autofree GPollFD *fds = NULL;
+    g_autofree Flow **fd_flows = NULL;
+    GHashTableIter it;
+    Flow *flow;
+    guint n_fds;
+    guint i = 0;
+
+    n_fds = g_hash_table_size (self->flows) + 1;
+    fds = g_new0 (GPollFD, n_fds);
+    fd_flows = g_new0 (Flow *, n_fds);
+
+    fds[i].fd = g_socket_get_fd (self->listen_socket);
+    fds[i++].events = G_IO_IN;
+
+    g_hash_table_iter_init (&it, self->flows);
+    while (g_hash_table_iter_next (&it, NULL, (gpointer *) & flow)) {
+      fds[i].fd = g_socket_get_fd (flow->upstream);
+      fds[i].events = G_IO_IN;
+      fd_flows[i++] = flow;
+    }
+
+    g_poll (fds, n_fds, PROXY_POLL_TIMEOUT_MS);
+
+    if (fds[0].revents & G_IO_IN) {
+      g_autoptr (GSocketAddress) caller = NULL;
+      gssize len;
+
+      while ((len = g_socket_receive_from (self->listen_socket, &caller,
+                  (gchar *) buf, sizeof (buf), NULL, NULL)) > 0) {
+        hwangsae_test_proxy_enqueue (self,
+            hwangsae_test_proxy_get_flow (self, caller), DIRECTION_TO_TARGET,
+            buf, len);
+        g_clear_object (&caller);
+      }
+    }
+
+    for (i = 1; i < n_fds; ++i) {
+      gssize len;
+
+      if (!(fds[i].revents & G_IO_IN)) {
+        continue;
+      }
+
+      while ((len = g_socket_receive (fd_flows[i]->upstream, (gchar *) buf,
+                  sizeof (buf), NULL, NULL)) > 0) {
+        hwangsae_test_proxy_enqueue (self, fd_flows[i], DIRECTION_TO_CALLER,
+            buf, len);
+      }
+    }
+
+    hwangsae_test_proxy_release (self);
+  }
+
+  return NULL;
+}
+
+const gchar *
+hwangsae_test_proxy_get_uri (HwangsaeTestProxy * self)
+{
+  return self->uri;
+}
+
+void
+hwangsae_test_proxy_start (HwangsaeTestProxy * self)
+{
+  g_autoptr (GstUri) uri = NULL;
+  g_autoptr (GSocketAddress) listen_address = NULL;
+  g_autoptr (GError) error = NULL;
+
+  g_assert_null (self->thread);
+
+  uri = gst_uri_from_string (self->target_uri);
+  g_assert_nonnull (uri);
+
+  g_clear_object (&self->target);
+  self->target = g_inet_socket_address_new_from_string (gst_uri_get_host (uri),
+      gst_uri_get_port (uri));
+  g_assert_nonnull (self->target);
+
+  self->listen_socket = g_socket_new (G_SOCKET_FAMILY_IPV4,
+      G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, &error);
+  g_assert_no_error (error);
+  g_socket_set_blocking (self->listen_socket, FALSE);
+
+  listen_address = g_inet_socket_address_new_from_string ("127.0.0.1",
+      self->listen_port);
+  g_socket_bind (self->listen_socket, listen_address, TRUE, &error);
+  g_assert_no_error (error);
+
+  self->running = TRUE;
+  self->thread = g_thread_new ("HwangsaeTestProxy",
+      (GThreadFunc) hwangsae_test_proxy_thread_func, self);
+}
+
+void
+hwangsae_test_proxy_stop (HwangsaeTestProxy * self)
+{
+  self->running = FALSE;
+  g_clear_pointer (&self->thread, g_thread_join);
+
+  g_queue_foreach (&self->packets, (GFunc) g_free, NULL);
+  g_queue_clear (&self->packets);
+  g_hash_table_remove_all (self->flows);
+  g_clear_object (&self->listen_socket);
+}
+
+static void
+hwangsae_test_proxy_init (HwangsaeTestProxy * self)
+{
+  g_mutex_init (&self->lock);
+  g_queue_init (&self->packets);
+  self->flows = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) _flow_free);
+  self->rand = g_rand_new ();
+}
+
+static void
+hwangsae_test_proxy_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  HwangsaeTestProxy *self = HWANGSAE_TEST_PROXY (object);
+
+  g_mutex_lock (&self->lock);
+
+  switch (prop_id) {
+    case PROP_LOSS:
+      g_value_set_double (value, self->loss);
+      break;
+    case PROP_DELAY:
+      g_value_set_uint (value, self->delay_ms);
+      break;
+    case PROP_JITTER:
+      g_value_set_uint (value, self->jitter_ms);
+      break;
+    case PROP_REORDER:
+      g_value_set_double (value, self->reorder);
+      break;
+    case PROP_BANDWIDTH:
+      g_value_set_uint64 (value, self->bandwidth);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  }
+
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+hwangsae_test_proxy_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  HwangsaeTestProxy *self = HWANGSAE_TEST_PROXY (object);
+
+  g_mutex_lock (&self->lock);
+
+  switch (prop_id) {
+    case PROP_LOSS:
+      self->loss = g_value_get_double (value);
+      break;
+    case PROP_DELAY:
+      self->delay_ms = g_value_get_uint (value);
+      break;
+    case PROP_JITTER:
+      self->jitter_ms = g_value_get_uint (value);
+      break;
+    case PROP_REORDER:
+      self->reorder = g_value_get_double (value);
+      break;
+    case PROP_BANDWIDTH:
+      self->bandwidth = g_value_get_uint64 (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  }
+
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+hwangsae_test_proxy_dispose (GObject * object)
+{
+  HwangsaeTestProxy *self = HWANGSAE_TEST_PROXY (object);
+
+  if (self->thread) {
+    hwangsae_test_proxy_stop (self);
+  }
+
+  g_clear_pointer (&self->flows, g_hash_table_destroy);
+  g_clear_pointer (&self->rand, g_rand_free);
+  g_clear_object (&self->target);
+  g_clear_pointer (&self->target_uri, g_free);
+  g_clear_pointer (&self->uri, g_free);
+
+  G_OBJECT_CLASS (hwangsae_test_proxy_parent_class)->dispose (object);
+}
+
+static void
+hwangsae_test_proxy_finalize (GObject * object)
+{
+  HwangsaeTestProxy *self = HWANGSAE_TEST_PROXY (object);
+
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (hwangsae_test_proxy_parent_class)->finalize (object);
+}
+
+static void
+hwangsae_test_proxy_class_init (HwangsaeTestProxyClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->get_property = hwangsae_test_proxy_get_property;
+  gobject_class->set_property = hwangsae_test_proxy_set_property;
+  gobject_class->dispose = hwangsae_test_proxy_dispose;
+  gobject_class->finalize = hwangsae_test_proxy_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_LOSS,
+      g_param_spec_double ("loss", "Packet loss", "Packet loss probability",
+          0, 1, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_DELAY,
+      g_param_spec_uint ("delay", "Delay", "One-way delay in milliseconds",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_JITTER,
+      g_param_spec_uint ("jitter", "Jitter",
+          "Maximum random deviation from the delay in milliseconds",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_REORDER,
+      g_param_spec_double ("reorder", "Reordering",
+          "Probability of a packet being delivered after later packets",
+          0, 1, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BANDWIDTH,
+      g_param_spec_uint64 ("bandwidth", "Bandwidth",
+          "Link capacity in bits per second (0 = unlimited)",
+          0, G_MAXUINT64, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+HwangsaeTestProxy *
+hwangsae_test_proxy_new (const gchar * target_uri, guint listen_port)
+{
+  HwangsaeTestProxy *self = g_object_new (HWANGSAE_TYPE_TEST_PROXY, NULL);
+
+  self->target_uri = g_strdup (target_uri);
+  self->listen_port = listen_port;
+  self->uri = g_strdup_printf ("srt://127.0.0.1:%u", listen_port);
+
+  return self;
+}
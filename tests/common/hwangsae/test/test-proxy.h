@@ -0,0 +1,41 @@
+/** 
+ *  tests/common
+ *
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __HWANGSAE_TEST_PROXY_H__
+#define __HWANGSAE_TEST_PROXY_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define HWANGSAE_TYPE_TEST_PROXY        (hwangsae_test_proxy_get_type ())
+G_DECLARE_FINAL_TYPE                    (HwangsaeTestProxy, hwangsae_test_proxy, HWANGSAE, TEST_PROXY, GObject)
+
+/* UDP proxy that forwards SRT traffic between its callers and target_uri
+ * over an impaired link. Impairments apply to both directions and can be
+ * changed while the proxy runs. */
+HwangsaeTestProxy    *hwangsae_test_proxy_new        (const gchar *target_uri,
+                                                      guint        listen_port);
+const gchar          *hwangsae_test_proxy_get_uri    (HwangsaeTestProxy * self);
+void                  hwangsae_test_proxy_start      (HwangsaeTestProxy * self);
+void                  hwangsae_test_proxy_stop       (HwangsaeTestProxy * self);
+
+G_END_DECLS
+
+#endif /* __HWANGSAE_TEST_PROXY_H__ */
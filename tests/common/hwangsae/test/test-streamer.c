@@ -20,7 +20,21 @@
 
 #include "test-streamer.h"
 
+#include "hwangsae/ts.h"
+
 #include <gst/gsturi.h>
+#include <srt/srt.h>
+#include <string.h>
+
+#define TS_PACKET_SIZE          188
+/* What fits into one SRT live mode payload. */
+#define TS_PACKETS_PER_SEND     7
+#define SEND_SIZE               (TS_PACKETS_PER_SEND * TS_PACKET_SIZE)
+
+#define SYNTHETIC_PMT_PID       0x1000
+#define SYNTHETIC_VIDEO_PID     0x0100
+#define SYNTHETIC_FPS           30
+#define SYNTHETIC_GOP_LENGTH    SYNTHETIC_FPS
 
 /* *INDENT-OFF* */
 G_DEFINE_TYPE (HwangsaeTestStreamer, hwangsae_test_streamer, G_TYPE_OBJECT)
@@ -30,6 +44,13 @@ enum
 {
   PROP_RESOLUTION = 1,
   PROP_USERNAME,
+  PROP_TS_FILE,
+  PROP_SYNTHETIC,
+  PROP_BITRATE,
+  PROP_PROBE_INTERVAL,
+  PROP_VIDEO_PID,
+  PROP_AUDIO_PID,
+  PROP_RANDOM_ACCESS,
   PROP_LAST
 };
 
@@ -85,6 +106,365 @@ hwangsae_test_streamer_thread_func (HwangsaeTestStreamer * self)
   return TRUE;
 }
 
+/* Synthetic stream ---------------------------------------------------------- */
+
+typedef struct
+{
+  guint8 pat_cc;
+  guint8 pmt_cc;
+  guint8 video_cc;
+  guint8 audio_cc;
+  guint16 video_pid;
+  /* 0 when the stream has no audio. */
+  guint16 audio_pid;
+  gboolean random_access;
+  guint64 frame;
+} SyntheticState;
+
+static guint32
+_mpeg_crc32 (const guint8 * data, gsize len)
+{
+  guint32 crc = 0xFFFFFFFF;
+  gsize i;
+
+  for (i = 0; i != len; ++i) {
+    gint bit;
+
+    crc ^= (guint32) data[i] << 24;
+    for (bit = 0; bit != 8; ++bit) {
+      crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+    }
+  }
+
+  return crc;
+}
+
+static void
+_write_psi_packet (GByteArray * out, guint16 pid, guint8 * cc,
+    guint8 * section, gsize section_len)
+{
+  guint8 packet[TS_PACKET_SIZE];
+  guint32 crc;
+
+  /* section_len includes the CRC to be filled in here. */
+  crc = _mpeg_crc32 (section, section_len - 4);
+  section[section_len - 4] = crc >> 24;
+  section[section_len - 3] = crc >> 16;
+  section[section_len - 2] = crc >> 8;
+  section[section_len - 1] = crc;
+
+  memset (packet, 0xFF, sizeof (packet));
+  packet[0] = 0x47;
+  packet[1] = 0x40 | (pid >> 8);
+  packet[2] = pid & 0xFF;
+  packet[3] = 0x10 | (*cc)++;
+  *cc &= 0x0F;
+  packet[4] = 0;                /* pointer_field */
+  memcpy (packet + 5, section, section_len);
+
+  g_byte_array_append (out, packet, sizeof (packet));
+}
+
+static void
+_write_psi (GByteArray * out, SyntheticState * state)
+{
+  guint8 pat[] = {
+    0x00, 0xB0, 0x0D, 0x00, 0x01, 0xC1, 0x00, 0x00,
+    0x00, 0x01, 0xE0 | (SYNTHETIC_PMT_PID >> 8), SYNTHETIC_PMT_PID & 0xFF,
+    0, 0, 0, 0
+  };
+  guint8 pmt[] = {
+    0x02, 0xB0, 0x12, 0x00, 0x01, 0xC1, 0x00, 0x00,
+    0xE0 | (state->video_pid >> 8), state->video_pid & 0xFF, 0xF0, 0x00,
+    0x1B, 0xE0 | (state->video_pid >> 8), state->video_pid & 0xFF,
+    0xF0, 0x00,
+    /* AAC audio, left out unless enabled. */
+    0x0F, 0xE0 | (state->audio_pid >> 8), state->audio_pid & 0xFF,
+    0xF0, 0x00,
+    0, 0, 0, 0
+  };
+  gsize pmt_len = sizeof (pmt);
+
+  if (state->audio_pid) {
+    pmt[2] += 5;
+  } else {
+    memmove (pmt + 17, pmt + 22, 4);
+    pmt_len -= 5;
+  }
+
+  _write_psi_packet (out, 0x0000, &state->pat_cc, pat, sizeof (pat));
+  _write_psi_packet (out, SYNTHETIC_PMT_PID, &state->pmt_cc, pmt, pmt_len);
+}
+
+/* Writes an audio frame of filler data in a single packet. Like mpegtsmux
+ * does, it sets the random_access_indicator, which has nothing to do with
+ * video keyframes. */
+static void
+_write_audio_frame (GByteArray * out, SyntheticState * state, guint64 pts)
+{
+  guint8 packet[TS_PACKET_SIZE];
+  guint8 header[] = {
+    0x00, 0x00, 0x01, 0xC0, 0x00, 0x18, 0x80, 0x80, 0x05,
+    0x21 | ((pts >> 29) & 0x0E), pts >> 22, 0x01 | ((pts >> 14) & 0xFE),
+    pts >> 7, 0x01 | ((pts << 1) & 0xFE),
+  };
+  /* PES header plus 16 bytes of payload. */
+  gsize payload_len = sizeof (header) + 16;
+  gsize af_len = TS_PACKET_SIZE - 4 - payload_len;
+
+  memset (packet, 0xFF, sizeof (packet));
+  packet[0] = 0x47;
+  packet[1] = 0x40 | (state->audio_pid >> 8);
+  packet[2] = state->audio_pid & 0xFF;
+  packet[3] = 0x30 | state->audio_cc;
+  state->audio_cc = (state->audio_cc + 1) & 0x0F;
+  packet[4] = af_len - 1;
+  packet[5] = 0x40;
+  memcpy (packet + 4 + af_len, header, sizeof (header));
+
+  g_byte_array_append (out, packet, sizeof (packet));
+}
+
+/* Packetizes one access unit of filler data that has valid PCR, PTS and,
+ * unless disabled, random access indication, so the stream looks right to
+ * anything that doesn't decode it. */
+static void
+_write_frame (GByteArray * out, SyntheticState * state, gsize frame_size)
+{
+  gboolean keyframe = (state->frame % SYNTHETIC_GOP_LENGTH) == 0;
+  /* 90 kHz clock; leave the decoder some headroom between PCR and PTS. */
+  guint64 pcr_base = state->frame * 90000 / SYNTHETIC_FPS;
+  guint64 pts = pcr_base + 90000 / 10;
+  g_autoptr (GByteArray) pes = g_byte_array_sized_new (frame_size + 32);
+  guint8 header[] = {
+    0x00, 0x00, 0x01, 0xE0, 0x00, 0x00, 0x80, 0x80, 0x05,
+    0x21 | ((pts >> 29) & 0x0E), pts >> 22, 0x01 | ((pts >> 14) & 0xFE),
+    pts >> 7, 0x01 | ((pts << 1) & 0xFE),
+    /* Access unit delimiter followed by an IDR or non-IDR slice NAL. */
+    0x00, 0x00, 0x00, 0x01, 0x09, 0xF0,
+    0x00, 0x00, 0x00, 0x01, keyframe ? 0x65 : 0x41
+  };
+  gsize offset = 0;
+
+  if (keyframe) {
+    _write_psi (out, state);
+  }
+
+  g_byte_array_append (pes, header, sizeof (header));
+  if (frame_size > pes->len) {
+    g_byte_array_set_size (pes, frame_size);
+    memset (pes->data + sizeof (header), 0xFF, frame_size - sizeof (header));
+  }
+
+  while (offset < pes->len) {
+    guint8 packet[TS_PACKET_SIZE];
+    gsize remaining = pes->len - offset;
+    gsize af_len = 0;           /* adaptation field incl. its length byte */
+    gsize payload_len;
+
+    packet[0] = 0x47;
+    packet[1] = (offset == 0 ? 0x40 : 0x00) | (state->video_pid >> 8);
+    packet[2] = state->video_pid & 0xFF;
+
+    if (offset == 0) {
+      guint64 pcr_ext = 0;
+
+      packet[5] = 0x10 | (keyframe && state->random_access ? 0x40 : 0x00);
+      packet[6] = pcr_base >> 25;
+      packet[7] = pcr_base >> 17;
+      packet[8] = pcr_base >> 9;
+      packet[9] = pcr_base >> 1;
+      packet[10] = ((pcr_base & 0x01) << 7) | 0x7E | (pcr_ext >> 8);
+      packet[11] = pcr_ext & 0xFF;
+      af_len = 8;
+    }
+
+    payload_len = MIN (remaining, TS_PACKET_SIZE - 4 - af_len);
+
+    /* Stuff the adaptation field to fill the last packet. */
+    if (payload_len < TS_PACKET_SIZE - 4 - af_len) {
+      gsize stuffing = TS_PACKET_SIZE - 4 - af_len - payload_len;
+
+      if (af_len == 0) {
+        if (stuffing > 1) {
+          packet[5] = 0x00;
+          memset (packet + 6, 0xFF, stuffing - 2);
+        }
+      } else {
+        memset (packet + 4 + af_len, 0xFF, stuffing);
+      }
+      af_len += stuffing;
+    }
+
+    packet[3] = (af_len ? 0x30 : 0x10) | state->video_cc;
+    state->video_cc = (state->video_cc + 1) & 0x0F;
+    if (af_len) {
+      packet[4] = af_len - 1;
+    }
+
+    memcpy (packet + 4 + af_len, pes->data + offset, payload_len);
+    offset += payload_len;
+
+    g_byte_array_append (out, packet, sizeof (packet));
+  }
+
+  if (state->audio_pid) {
+    _write_audio_frame (out, state, pts);
+  }
+
+  ++state->frame;
+}
+
+/* Direct SRT streaming ------------------------------------------------------ */
+
+static SRTSOCKET
+_open_srt_socket (HwangsaeTestStreamer * self)
+{
+  g_autoptr (GstUri) uri = NULL;
+  g_autoptr (GSocketAddress) addr = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *streamid = NULL;
+  const gchar *mode_str;
+  gboolean listener;
+  SRTSOCKET sock;
+  gpointer sa;
+  gsize sa_len;
+
+  uri = gst_uri_from_string (self->uri);
+  mode_str = gst_uri_get_query_value (uri, "mode");
+  listener = mode_str && g_str_equal (mode_str, "listener");
+
+  addr = g_inet_socket_address_new_from_string (gst_uri_get_host (uri),
+      gst_uri_get_port (uri));
+  g_assert_nonnull (addr);
+
+  sa_len = g_socket_address_get_native_size (addr);
+  sa = g_alloca (sa_len);
+  g_socket_address_to_native (addr, sa, sa_len, &error);
+  g_assert_no_error (error);
+
+  sock = srt_create_socket ();
+
+  if (!listener) {
+    if (self->username) {
+      streamid = g_strdup_printf ("#!::u=%s", self->username);
+      srt_setsockflag (sock, SRTO_STREAMID, streamid, strlen (streamid));
+    }
+
+    if (srt_connect (sock, sa, sa_len) == SRT_ERROR) {
+      g_warning ("Can't connect to %s: %s", self->uri,
+          srt_getlasterror_str ());
+      srt_close (sock);
+      return SRT_INVALID_SOCK;
+    }
+
+    return sock;
+  } else {
+    gboolean nonblocking = FALSE;
+    SRTSOCKET caller = SRT_INVALID_SOCK;
+
+    srt_setsockflag (sock, SRTO_RCVSYN, &nonblocking, sizeof (nonblocking));
+
+    if (srt_bind (sock, sa, sa_len) == SRT_ERROR ||
+        srt_listen (sock, 1) == SRT_ERROR) {
+      g_warning ("Can't listen on %s: %s", self->uri,
+          srt_getlasterror_str ());
+      srt_close (sock);
+      return SRT_INVALID_SOCK;
+    }
+
+    while (self->should_stream && caller == SRT_INVALID_SOCK) {
+      caller = srt_accept (sock, NULL, NULL);
+      if (caller == SRT_INVALID_SOCK) {
+        g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+      }
+    }
+
+    srt_close (sock);
+
+    return caller;
+  }
+}
+
+static gboolean
+hwangsae_test_streamer_direct_thread_func (HwangsaeTestStreamer * self)
+{
+  g_autoptr (GMappedFile) file = NULL;
+  g_autoptr (GByteArray) buffer = g_byte_array_new ();
+  g_autoptr (GError) error = NULL;
+  SyntheticState state = { 0 };
+  gsize file_offset = 0;
+  gsize frame_size = self->bitrate / 8 / SYNTHETIC_FPS;
+  gint64 send_interval_us =
+      (gint64) SEND_SIZE * 8 * G_USEC_PER_SEC / self->bitrate;
+  gint64 next_send;
+  gint64 next_probe;
+  guint8 probe_cc = 0;
+  SRTSOCKET sock;
+
+  state.video_pid = self->video_pid;
+  state.audio_pid = self->audio_pid;
+  state.random_access = self->random_access;
+
+  if (self->ts_file) {
+    file = g_mapped_file_new (self->ts_file, FALSE, &error);
+    g_assert_no_error (error);
+    g_assert_cmpuint (g_mapped_file_get_length (file), >=, SEND_SIZE);
+  }
+
+  sock = _open_srt_socket (self);
+  if (sock == SRT_INVALID_SOCK) {
+    return FALSE;
+  }
+
+  next_send = next_probe = g_get_monotonic_time ();
+
+  while (self->should_stream) {
+    gint64 now;
+
+    while (buffer->len < SEND_SIZE) {
+      if (file) {
+        const guint8 *data = (const guint8 *) g_mapped_file_get_contents (file);
+        gsize len = g_mapped_file_get_length (file);
+        gsize chunk = MIN (SEND_SIZE, len - file_offset);
+
+        /* Loop the file; timestamps jump back at the seam, which players
+         * handle as a discontinuity. */
+        g_byte_array_append (buffer, data + file_offset, chunk);
+        file_offset = (file_offset + chunk) % len;
+      } else {
+        _write_frame (buffer, &state, frame_size);
+      }
+    }
+
+    now = g_get_monotonic_time ();
+    if (now < next_send) {
+      g_usleep (next_send - now);
+    }
+    next_send += send_interval_us;
+
+    if (self->probe_interval > 0 && next_send >= next_probe) {
+      guint8 probe[TS_PACKET_SIZE];
+
+      /* Stamp right before sending so that only the path is measured. */
+      hwangsae_ts_probe_write (probe, probe_cc++, g_get_real_time ());
+      g_byte_array_prepend (buffer, probe, sizeof (probe));
+      next_probe += self->probe_interval * G_TIME_SPAN_MILLISECOND;
+    }
+
+    if (srt_send (sock, (const char *) buffer->data, SEND_SIZE) == SRT_ERROR) {
+      g_warning ("Send failed: %s", srt_getlasterror_str ());
+      break;
+    }
+
+    g_byte_array_remove_range (buffer, 0, SEND_SIZE);
+  }
+
+  srt_close (sock);
+
+  return TRUE;
+}
+
 void
 hwangsae_test_streamer_set_uri (HwangsaeTestStreamer * self, const gchar * uri)
 {
@@ -97,6 +477,13 @@ hwangsae_test_streamer_start (HwangsaeTestStreamer * self)
 {
   g_assert_null (self->streaming_thread);
 
+  if (self->ts_file || self->synthetic) {
+    self->should_stream = TRUE;
+    self->streaming_thread = g_thread_new ("streaming_thread_func",
+        (GThreadFunc) hwangsae_test_streamer_direct_thread_func, self);
+    return;
+  }
+
   if (!self->pipeline) {
     self->pipeline =
         gaeguli_pipeline_new_full (GAEGULI_VIDEO_SOURCE_VIDEOTESTSRC, NULL,
@@ -121,7 +508,9 @@ void
 hwangsae_test_streamer_stop (HwangsaeTestStreamer * self)
 {
   hwangsae_test_streamer_pause (self);
-  gaeguli_pipeline_stop (self->pipeline);
+  if (self->pipeline) {
+    gaeguli_pipeline_stop (self->pipeline);
+  }
 }
 
 static void
@@ -141,6 +530,27 @@ hwangsae_test_streamer_get_property (GObject * object, guint prop_id,
     case PROP_USERNAME:
       g_value_set_string (value, self->username);
       break;
+    case PROP_TS_FILE:
+      g_value_set_string (value, self->ts_file);
+      break;
+    case PROP_SYNTHETIC:
+      g_value_set_boolean (value, self->synthetic);
+      break;
+    case PROP_BITRATE:
+      g_value_set_uint (value, self->bitrate);
+      break;
+    case PROP_PROBE_INTERVAL:
+      g_value_set_uint (value, self->probe_interval);
+      break;
+    case PROP_VIDEO_PID:
+      g_value_set_uint (value, self->video_pid);
+      break;
+    case PROP_AUDIO_PID:
+      g_value_set_uint (value, self->audio_pid);
+      break;
+    case PROP_RANDOM_ACCESS:
+      g_value_set_boolean (value, self->random_access);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -160,6 +570,28 @@ hwangsae_test_streamer_set_property (GObject * object, guint prop_id,
       g_clear_pointer (&self->username, g_free);
       self->username = g_value_dup_string (value);
       break;
+    case PROP_TS_FILE:
+      g_clear_pointer (&self->ts_file, g_free);
+      self->ts_file = g_value_dup_string (value);
+      break;
+    case PROP_SYNTHETIC:
+      self->synthetic = g_value_get_boolean (value);
+      break;
+    case PROP_BITRATE:
+      self->bitrate = g_value_get_uint (value);
+      break;
+    case PROP_PROBE_INTERVAL:
+      self->probe_interval = g_value_get_uint (value);
+      break;
+    case PROP_VIDEO_PID:
+      self->video_pid = g_value_get_uint (value);
+      break;
+    case PROP_AUDIO_PID:
+      self->audio_pid = g_value_get_uint (value);
+      break;
+    case PROP_RANDOM_ACCESS:
+      self->random_access = g_value_get_boolean (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -176,6 +608,7 @@ hwangsae_test_streamer_dispose (GObject * object)
 
   g_clear_pointer (&self->uri, g_free);
   g_clear_pointer (&self->username, g_free);
+  g_clear_pointer (&self->ts_file, g_free);
   g_clear_object (&self->pipeline);
 
   G_OBJECT_CLASS (hwangsae_test_streamer_parent_class)->dispose (object);
@@ -198,6 +631,46 @@ hwangsae_test_streamer_class_init (HwangsaeTestStreamerClass * klass)
   g_object_class_install_property (gobject_class, PROP_USERNAME,
       g_param_spec_string ("username", "SRT username", "SRT username",
           NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_TS_FILE,
+      g_param_spec_string ("ts-file", "TS file",
+          "Pre-encoded MPEG-TS file to stream in a loop instead of encoding",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SYNTHETIC,
+      g_param_spec_boolean ("synthetic", "Synthetic stream",
+          "Stream generated MPEG-TS with valid timing but no real video "
+          "instead of encoding", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BITRATE,
+      g_param_spec_uint ("bitrate", "Bitrate",
+          "Bitrate of a TS file or synthetic stream in bits per second",
+          SEND_SIZE * 8, G_MAXUINT, 2048000,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PROBE_INTERVAL,
+      g_param_spec_uint ("probe-interval", "Latency probe interval",
+          "Milliseconds between latency probe packets inserted into a TS file "
+          "or synthetic stream (0 = disabled)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_VIDEO_PID,
+      g_param_spec_uint ("video-pid", "Video PID",
+          "PID of the video stream of a synthetic stream", 0x0010, 0x1FFE,
+          SYNTHETIC_VIDEO_PID,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_AUDIO_PID,
+      g_param_spec_uint ("audio-pid", "Audio PID",
+          "PID of the audio stream of a synthetic stream (0 = no audio)", 0,
+          0x1FFE, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_RANDOM_ACCESS,
+      g_param_spec_boolean ("random-access", "Random access indication",
+          "Whether keyframes of a synthetic stream set the "
+          "random_access_indicator", TRUE,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
 }
 
 HwangsaeTestStreamer *
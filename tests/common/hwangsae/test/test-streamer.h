@@ -38,6 +38,16 @@ struct _HwangsaeTestStreamer
   gchar *username;
   GaeguliVideoResolution resolution;
 
+  /* When either is set, pre-encoded TS goes straight into an SRT socket
+   * instead of through a gaeguli encoder. */
+  gchar *ts_file;
+  gboolean synthetic;
+  guint bitrate;
+  guint probe_interval;
+  guint video_pid;
+  guint audio_pid;
+  gboolean random_access;
+
   GaeguliPipeline *pipeline;
 
   gboolean should_stream;
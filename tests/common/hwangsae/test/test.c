@@ -20,6 +20,8 @@
 
 #include "test.h"
 
+#include "hwangsae/ts.h"
+
 #include <gst/pbutils/pbutils.h>
 
 GstClockTime
@@ -194,3 +196,66 @@ hwangsae_test_make_receiver (HwangsaeTestStreamer * streamer,
 
   return g_steal_pointer (&receiver);
 }
+
+static void
+probe_handoff_cb (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    GPtrArray * probes)
+{
+  gint64 now = g_get_real_time ();
+  GstMapInfo map;
+  gsize offset;
+
+  gst_buffer_map (buffer, &map, GST_MAP_READ);
+
+  for (offset = 0; offset + HWANGSAE_TS_PACKET_SIZE <= map.size;
+      offset += HWANGSAE_TS_PACKET_SIZE) {
+    gint64 stamps[HWANGSAE_TS_PROBE_MAX_STAMPS + 1];
+    guint n_stamps;
+    GArray *probe;
+
+    n_stamps = hwangsae_ts_probe_parse (map.data + offset, stamps);
+    if (n_stamps == 0) {
+      continue;
+    }
+
+    stamps[n_stamps++] = now;
+
+    probe = g_array_sized_new (FALSE, FALSE, sizeof (gint64), n_stamps);
+    g_array_append_vals (probe, stamps, n_stamps);
+    g_ptr_array_add (probes, probe);
+  }
+
+  gst_buffer_unmap (buffer, &map);
+}
+
+/* Receives from @source_uri for @duration and returns the latency probes
+ * found in the stream. Each is a GArray of wall clock times in microseconds:
+ * when the probe was sent, when each relay on the way received it, and when
+ * it arrived here. */
+GPtrArray *
+hwangsae_test_receive_latency_probes (const gchar * source_uri,
+    GstClockTime duration)
+{
+  g_autoptr (GstElement) pipeline = NULL;
+  g_autoptr (GstElement) sink = NULL;
+  g_autofree gchar *pipeline_str = NULL;
+  g_autoptr (GError) error = NULL;
+  GPtrArray *probes;
+
+  probes = g_ptr_array_new_with_free_func ((GDestroyNotify) g_array_unref);
+
+  pipeline_str = g_strdup_printf
+      ("srtsrc uri=%s ! fakesink name=sink signal-handoffs=true", source_uri);
+  pipeline = gst_parse_launch (pipeline_str, &error);
+  g_assert_no_error (error);
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  /* Handoffs come from the streaming thread while this one waits below. */
+  g_signal_connect (sink, "handoff", (GCallback) probe_handoff_cb, probes);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_usleep (GST_TIME_AS_USECONDS (duration));
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  return probes;
+}
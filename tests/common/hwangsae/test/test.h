@@ -23,6 +23,7 @@
 
 #include <gst/gst.h>
 #include <hwangsae/hwangsae.h>
+#include <hwangsae/test/test-proxy.h>
 #include <hwangsae/test/test-streamer.h>
 
 G_BEGIN_DECLS
@@ -38,6 +39,10 @@ GstElement           *hwangsae_test_make_receiver     (HwangsaeTestStreamer * st
                                                        HwangsaeRelay        * relay,
                                                        const gchar          * username);
 
+GPtrArray            *hwangsae_test_receive_latency_probes
+                                                      (const gchar          * source_uri,
+                                                       GstClockTime           duration);
+
 G_END_DECLS
 
 #endif /* __HWANGSAE_TEST_H__ */
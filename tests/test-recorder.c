@@ -20,8 +20,11 @@
 
 #include <gaeguli/gaeguli.h>
 #include <glib/gstdio.h>
+#include <string.h>
 
 #include "hwangsae/hwangsae.h"
+#include "hwangsae/keyframe-index.h"
+#include "hwangsae/ts.h"
 #include "hwangsae/test/test.h"
 #include "hwangsae/test/test-streamer.h"
 
@@ -89,6 +92,85 @@ file_created_cb (HwangsaeRecorder * recorder, RecorderTestData * data)
   data->got_file_created_signal = TRUE;
 }
 
+static void
+check_keyframe_index (const gchar * file_path)
+{
+  g_autofree gchar *index_path = NULL;
+  g_autoptr (GError) error = NULL;
+  const HwangsaeKeyframeIndexHeader *header;
+  const HwangsaeKeyframeIndexEntry *entries;
+  HwangsaeKeyframeIndex *index;
+  guint n_entries;
+  guint i;
+
+  index_path = g_strconcat (file_path, HWANGSAE_KEYFRAME_INDEX_SUFFIX, NULL);
+  index = hwangsae_keyframe_index_load (index_path, &error);
+  g_assert_no_error (error);
+
+  header = hwangsae_keyframe_index_get_header (index);
+  g_assert_cmpstr (header->codec, ==, "h264");
+  g_assert_cmpint (labs (GST_CLOCK_DIFF (header->duration, 5 * GST_SECOND)),
+      <=, GST_SECOND);
+
+  entries = hwangsae_keyframe_index_get_entries (index, &n_entries);
+  g_assert_cmpuint (n_entries, >, 0);
+
+  for (i = 1; i < n_entries; ++i) {
+    g_assert_cmpint (entries[i].time, >, entries[i - 1].time);
+    g_assert_true (hwangsae_keyframe_index_lookup (index,
+            entries[i].time) == &entries[i]);
+  }
+  g_assert_null (hwangsae_keyframe_index_lookup (index, entries[0].time - 1));
+
+  hwangsae_keyframe_index_free (index);
+  g_unlink (index_path);
+}
+
+/* Walks the top-level boxes of an MP4 file. Fragmented files have their
+ * moov up front, followed by a moof for each fragment. */
+static void
+check_fragmented_mp4 (const gchar * file_path)
+{
+  g_autoptr (GMappedFile) file = NULL;
+  g_autoptr (GError) error = NULL;
+  const guint8 *data;
+  gsize size;
+  gsize offset = 0;
+  gboolean have_moov = FALSE;
+  guint n_moof = 0;
+
+  file = g_mapped_file_new (file_path, FALSE, &error);
+  g_assert_no_error (error);
+
+  data = (const guint8 *) g_mapped_file_get_contents (file);
+  size = g_mapped_file_get_length (file);
+
+  while (offset + 8 <= size) {
+    guint64 box_size = GST_READ_UINT32_BE (data + offset);
+    const guint8 *type = data + offset + 4;
+
+    if (box_size == 1) {
+      g_assert_cmpuint (offset + 16, <=, size);
+      box_size = GST_READ_UINT64_BE (data + offset + 8);
+    } else if (box_size == 0) {
+      box_size = size - offset;
+    }
+    g_assert_cmpuint (box_size, >=, 8);
+
+    if (memcmp (type, "moov", 4) == 0) {
+      have_moov = TRUE;
+    } else if (memcmp (type, "moof", 4) == 0) {
+      g_assert_true (have_moov);
+      ++n_moof;
+    }
+
+    offset += box_size;
+  }
+
+  /* About 5 s in fragments of 1 s. */
+  g_assert_cmpuint (n_moof, >=, 3);
+}
+
 static void
 file_completed_cb (HwangsaeRecorder * recorder, const gchar * file_path,
     RecorderTestData * data)
@@ -101,6 +183,12 @@ file_completed_cb (HwangsaeRecorder * recorder, const gchar * file_path,
   g_assert_cmpint (labs (GST_CLOCK_DIFF (duration, 5 * GST_SECOND)), <=,
       GST_SECOND);
 
+  check_keyframe_index (file_path);
+
+  if (hwangsae_recorder_get_container (recorder) == HWANGSAE_CONTAINER_FMP4) {
+    check_fragmented_mp4 (file_path);
+  }
+
   g_assert_false (data->got_file_completed_signal);
   data->got_file_completed_signal = TRUE;
 }
@@ -145,6 +233,71 @@ test_recorder_record (TestFixture * fixture, gconstpointer data)
   g_assert_true (test_data.got_file_completed_signal);
 }
 
+// recorder-trick-play ---------------------------------------------------------
+
+static void
+trick_play_file_completed_cb (HwangsaeRecorder * recorder,
+    const gchar * file_path, RecorderTestData * data)
+{
+  g_autofree gchar *stem = NULL;
+  g_autofree gchar *trick_play_path = NULL;
+  GstClockTime duration;
+  GStatBuf st;
+  GStatBuf trick_play_st;
+
+  g_assert_true (g_str_has_suffix (file_path, ".ts"));
+
+  stem = g_strndup (file_path, strlen (file_path) - strlen (".ts"));
+  trick_play_path = g_strconcat (stem, ".iframes.ts", NULL);
+
+  g_assert_true (g_file_test (trick_play_path, G_FILE_TEST_EXISTS));
+
+  duration = hwangsae_test_get_file_duration (trick_play_path);
+
+  g_debug ("I-frame rendition %s, duration %" GST_TIME_FORMAT,
+      trick_play_path, GST_TIME_ARGS (duration));
+
+  g_assert_cmpuint (duration, >, 0);
+  g_assert_cmpuint (duration, <=, 6 * GST_SECOND);
+
+  g_assert_cmpint (g_stat (file_path, &st), ==, 0);
+  g_assert_cmpint (g_stat (trick_play_path, &trick_play_st), ==, 0);
+  g_assert_cmpint (trick_play_st.st_size, <, st.st_size);
+
+  g_unlink (trick_play_path);
+
+  file_completed_cb (recorder, file_path, data);
+}
+
+static void
+test_recorder_trick_play (TestFixture * fixture, gconstpointer data)
+{
+  RecorderTestData test_data = { 0 };
+
+  test_data.fixture = fixture;
+
+  hwangsae_recorder_set_container (fixture->recorder, HWANGSAE_CONTAINER_TS);
+  g_object_set (fixture->recorder, "trick-play", TRUE, NULL);
+
+  g_signal_connect (fixture->recorder, "stream-connected",
+      (GCallback) stream_connected_cb, fixture);
+  g_signal_connect (fixture->recorder, "file-created",
+      (GCallback) file_created_cb, &test_data);
+  g_signal_connect (fixture->recorder, "file-completed",
+      (GCallback) trick_play_file_completed_cb, &test_data);
+  g_signal_connect (fixture->recorder, "stream-disconnected",
+      (GCallback) stream_disconnected_cb, fixture);
+
+  hwangsae_test_streamer_start (fixture->streamer);
+
+  hwangsae_recorder_start_recording (fixture->recorder, "srt://127.0.0.1:8888");
+
+  g_main_loop_run (fixture->loop);
+
+  g_assert_true (test_data.got_file_created_signal);
+  g_assert_true (test_data.got_file_completed_signal);
+}
+
 // recorder-disconnect ---------------------------------------------------------
 
 const guint SEGMENT_LEN_SECONDS = 5;
@@ -345,6 +498,149 @@ test_recorder_split_bytes (TestFixture * fixture, gconstpointer unused)
   }
 }
 
+typedef struct
+{
+  const gchar *playlist_path;
+  guint target_duration;
+} PlaylistData;
+
+static guint
+_get_target_duration (const gchar * contents)
+{
+  const gchar *tag = strstr (contents, "#EXT-X-TARGETDURATION:");
+
+  g_assert_nonnull (tag);
+
+  return g_ascii_strtoull (tag + strlen ("#EXT-X-TARGETDURATION:"), NULL, 10);
+}
+
+static void
+playlist_file_completed_cb (HwangsaeRecorder * recorder,
+    const gchar * file_path, PlaylistData * data)
+{
+  g_autofree gchar *contents = NULL;
+  g_autoptr (GError) error = NULL;
+  guint target_duration;
+
+  /* The playlist gets the file before the signal is emitted. */
+  g_file_get_contents (data->playlist_path, &contents, NULL, &error);
+  g_assert_no_error (error);
+
+  target_duration = _get_target_duration (contents);
+  if (data->target_duration == 0) {
+    data->target_duration = target_duration;
+  }
+
+  /* Players don't expect it to change while the playlist grows. */
+  g_assert_cmpuint (target_duration, ==, data->target_duration);
+}
+
+static void
+test_recorder_hls_playlist (TestFixture * fixture, gconstpointer unused)
+{
+  g_autofree gchar *prefix = NULL;
+  g_autofree gchar *playlist_path = NULL;
+  g_autofree gchar *contents = NULL;
+  g_autoptr (GError) error = NULL;
+  g_auto (GStrv) extinfs = NULL;
+  PlaylistData data = { 0 };
+  GSList *filenames;
+  guint i;
+
+  hwangsae_recorder_set_container (fixture->recorder, HWANGSAE_CONTAINER_TS);
+  hwangsae_recorder_set_max_size_time (fixture->recorder, 2 * GST_SECOND);
+  g_object_set (fixture->recorder, "hls-playlist", TRUE, NULL);
+
+  prefix = hwangsae_recorder_get_filename_prefix (fixture->recorder);
+  data.playlist_path = playlist_path = g_strdup_printf ("/tmp/%s.m3u8", prefix);
+
+  g_signal_connect (fixture->recorder, "file-completed",
+      (GCallback) playlist_file_completed_cb, &data);
+
+  filenames = split_run_test (fixture);
+
+  g_file_get_contents (playlist_path, &contents, NULL, &error);
+  g_assert_no_error (error);
+
+  g_debug ("%s:\n%s", playlist_path, contents);
+
+  g_assert_true (g_str_has_prefix (contents, "#EXTM3U\n"));
+  g_assert_nonnull (strstr (contents, "#EXT-X-PLAYLIST-TYPE:VOD\n"));
+  g_assert_true (g_str_has_suffix (contents, "#EXT-X-ENDLIST\n"));
+
+  /* One entry per file, in the order they were completed. */
+  extinfs = g_strsplit (contents, "#EXTINF:", -1);
+  g_assert_cmpuint (g_strv_length (extinfs) - 1, ==,
+      g_slist_length (filenames));
+
+  g_assert_cmpuint (_get_target_duration (contents), ==,
+      data.target_duration);
+
+  for (i = 1; filenames; filenames = g_slist_delete_link (filenames,
+          filenames), ++i) {
+    g_autofree gchar *filename = filenames->data;
+    g_autofree gchar *basename = g_path_get_basename (filename);
+    g_autofree gchar *entry = g_strdup_printf (",\n%s\n", basename);
+    gdouble duration = g_ascii_strtod (extinfs[i], NULL);
+
+    g_assert_nonnull (strstr (extinfs[i], entry));
+    /* Rounded to the nearest integer, no file exceeds the target. */
+    g_assert_cmpuint ((guint) (duration + 0.5), <=, data.target_duration);
+  }
+
+  g_unlink (playlist_path);
+}
+
+static void
+test_recorder_hls_playlist_bytes (TestFixture * fixture, gconstpointer unused)
+{
+  g_autofree gchar *prefix = NULL;
+  g_autofree gchar *playlist_path = NULL;
+  GSList *filenames;
+
+  hwangsae_recorder_set_container (fixture->recorder, HWANGSAE_CONTAINER_TS);
+  hwangsae_recorder_set_max_size_bytes (fixture->recorder, 2e6);
+  g_object_set (fixture->recorder, "hls-playlist", TRUE, NULL);
+
+  filenames = split_run_test (fixture);
+  g_slist_free_full (filenames, g_free);
+
+  /* Without a time limit there is no target duration to announce. */
+  prefix = hwangsae_recorder_get_filename_prefix (fixture->recorder);
+  playlist_path = g_strdup_printf ("/tmp/%s.m3u8", prefix);
+  g_assert_false (g_file_test (playlist_path, G_FILE_TEST_EXISTS));
+}
+
+// recorder-passthrough --------------------------------------------------------
+
+static void
+test_recorder_record_passthrough (TestFixture * fixture, gconstpointer unused)
+{
+  g_object_set (fixture->recorder, "passthrough", TRUE, NULL);
+
+  test_recorder_record (fixture, GUINT_TO_POINTER (HWANGSAE_CONTAINER_TS));
+}
+
+static void
+test_recorder_split_time_passthrough (TestFixture * fixture,
+    gconstpointer unused)
+{
+  hwangsae_recorder_set_container (fixture->recorder, HWANGSAE_CONTAINER_TS);
+  g_object_set (fixture->recorder, "passthrough", TRUE, NULL);
+
+  test_recorder_split_time (fixture, unused);
+}
+
+static void
+test_recorder_record_shared_engine (TestFixture * fixture,
+    gconstpointer unused)
+{
+  g_object_set (fixture->recorder, "passthrough", TRUE, "shared-engine", TRUE,
+      NULL);
+
+  test_recorder_record (fixture, GUINT_TO_POINTER (HWANGSAE_CONTAINER_TS));
+}
+
 static gboolean
 stop_recording_no_streamer_cb (HwangsaeRecorder * recorder)
 {
@@ -368,6 +664,387 @@ test_recorder_stop_no_streamer (TestFixture * fixture, gconstpointer unused)
   g_main_loop_run (fixture->loop);
 }
 
+// recorder-reconnect ----------------------------------------------------------
+
+typedef struct
+{
+  TestFixture *fixture;
+  guint stream_connected_signal_count;
+  guint stream_disconnected_signal_count;
+  guint file_completed_signal_count;
+} ReconnectTestData;
+
+static gboolean
+reconnect_stop_recording_cb (TestFixture * fixture)
+{
+  hwangsae_recorder_stop_recording (fixture->recorder);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+reconnect_restart_streamer_cb (TestFixture * fixture)
+{
+  g_debug ("Restarting the streamer");
+  hwangsae_test_streamer_start (fixture->streamer);
+  g_timeout_add_seconds (3, (GSourceFunc) reconnect_stop_recording_cb,
+      fixture);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+reconnect_stop_streamer_cb (TestFixture * fixture)
+{
+  g_debug ("Stopping the streamer");
+  hwangsae_test_streamer_stop (fixture->streamer);
+  g_timeout_add_seconds (2, (GSourceFunc) reconnect_restart_streamer_cb,
+      fixture);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+reconnect_stream_connected_cb (HwangsaeRecorder * recorder,
+    ReconnectTestData * data)
+{
+  ++data->stream_connected_signal_count;
+  g_timeout_add_seconds (3, (GSourceFunc) reconnect_stop_streamer_cb,
+      data->fixture);
+}
+
+static void
+reconnect_file_completed_cb (HwangsaeRecorder * recorder,
+    const gchar * file_path, ReconnectTestData * data)
+{
+  g_debug ("Completed file %s", file_path);
+
+  ++data->file_completed_signal_count;
+}
+
+static void
+reconnect_stream_disconnected_cb (HwangsaeRecorder * recorder,
+    ReconnectTestData * data)
+{
+  ++data->stream_disconnected_signal_count;
+  stream_disconnected_cb (recorder, data->fixture);
+}
+
+static void
+run_reconnect_test (TestFixture * fixture)
+{
+  ReconnectTestData data = { 0 };
+
+  data.fixture = fixture;
+
+  hwangsae_recorder_set_container (fixture->recorder, HWANGSAE_CONTAINER_TS);
+  g_object_set (fixture->recorder, "reconnect-timeout", 10, NULL);
+
+  g_signal_connect (fixture->recorder, "stream-connected",
+      (GCallback) reconnect_stream_connected_cb, &data);
+  g_signal_connect (fixture->recorder, "file-completed",
+      (GCallback) reconnect_file_completed_cb, &data);
+  g_signal_connect (fixture->recorder, "stream-disconnected",
+      (GCallback) reconnect_stream_disconnected_cb, &data);
+
+  hwangsae_test_streamer_start (fixture->streamer);
+
+  hwangsae_recorder_start_recording (fixture->recorder, "srt://127.0.0.1:8888");
+
+  g_main_loop_run (fixture->loop);
+
+  /* One session, with a file before and one after the outage. */
+  g_assert_cmpuint (data.stream_connected_signal_count, ==, 1);
+  g_assert_cmpuint (data.stream_disconnected_signal_count, ==, 1);
+  g_assert_cmpuint (data.file_completed_signal_count, ==, 2);
+}
+
+static void
+test_recorder_reconnect (TestFixture * fixture, gconstpointer unused)
+{
+  g_object_set (fixture->recorder, "passthrough", TRUE, NULL);
+
+  run_reconnect_test (fixture);
+}
+
+static void
+test_recorder_reconnect_remuxed (TestFixture * fixture, gconstpointer unused)
+{
+  g_object_set (fixture->recorder, "passthrough", FALSE, NULL);
+
+  run_reconnect_test (fixture);
+}
+
+static void
+test_recorder_reconnect_shared_engine (TestFixture * fixture,
+    gconstpointer unused)
+{
+  g_object_set (fixture->recorder, "passthrough", TRUE, "shared-engine", TRUE,
+      NULL);
+
+  run_reconnect_test (fixture);
+}
+
+// recorder-arm ----------------------------------------------------------------
+
+const guint PRE_ROLL_SECONDS = 3;
+
+typedef struct
+{
+  TestFixture *fixture;
+  gboolean started;
+  gint64 start_time;
+  gboolean got_file_completed_signal;
+} ArmTestData;
+
+static gboolean
+arm_stop_recording_cb (TestFixture * fixture)
+{
+  hwangsae_recorder_stop_recording (fixture->recorder);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+arm_start_recording_cb (ArmTestData * data)
+{
+  data->started = TRUE;
+  data->start_time = g_get_real_time ();
+  hwangsae_recorder_start_recording (data->fixture->recorder,
+      "srt://127.0.0.1:8888");
+  g_timeout_add_seconds (2, (GSourceFunc) arm_stop_recording_cb,
+      data->fixture);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+arm_stream_connected_cb (HwangsaeRecorder * recorder, ArmTestData * data)
+{
+  /* Let the pre-roll fill up. */
+  g_timeout_add_seconds (PRE_ROLL_SECONDS + 2,
+      (GSourceFunc) arm_start_recording_cb, data);
+}
+
+static void
+arm_file_created_cb (HwangsaeRecorder * recorder, ArmTestData * data)
+{
+  g_assert_true (data->started);
+}
+
+/* The pre-roll keyframes have to keep the times they were received at,
+ * not the time the recording started. */
+static void
+arm_check_keyframe_index (const gchar * file_path, ArmTestData * data)
+{
+  g_autofree gchar *index_path = NULL;
+  g_autoptr (GError) error = NULL;
+  const HwangsaeKeyframeIndexHeader *header;
+  const HwangsaeKeyframeIndexEntry *entries;
+  HwangsaeKeyframeIndex *index;
+  guint n_entries;
+  guint i;
+
+  index_path = g_strconcat (file_path, HWANGSAE_KEYFRAME_INDEX_SUFFIX, NULL);
+  index = hwangsae_keyframe_index_load (index_path, &error);
+  g_assert_no_error (error);
+
+  header = hwangsae_keyframe_index_get_header (index);
+  g_assert_cmpint (header->start_time, <, data->start_time - G_USEC_PER_SEC);
+
+  entries = hwangsae_keyframe_index_get_entries (index, &n_entries);
+  g_assert_cmpuint (n_entries, >, 1);
+  g_assert_cmpint (entries[0].time, >=, header->start_time);
+  g_assert_cmpint (entries[0].time, <, data->start_time - G_USEC_PER_SEC);
+
+  for (i = 1; i < n_entries; ++i) {
+    g_assert_cmpint (entries[i].time, >, entries[i - 1].time);
+  }
+
+  hwangsae_keyframe_index_free (index);
+  g_unlink (index_path);
+}
+
+static void
+arm_file_completed_cb (HwangsaeRecorder * recorder, const gchar * file_path,
+    ArmTestData * data)
+{
+  GstClockTime duration = hwangsae_test_get_file_duration (file_path);
+
+  g_debug ("Finished recording %s, duration %" GST_TIME_FORMAT, file_path,
+      GST_TIME_ARGS (duration));
+
+  /* Two seconds recorded after the start, preceded by the pre-roll. */
+  g_assert_cmpint (duration, >, 3 * GST_SECOND);
+  g_assert_cmpint (duration, <=, (2 + PRE_ROLL_SECONDS + 1) * GST_SECOND);
+
+  arm_check_keyframe_index (file_path, data);
+
+  data->got_file_completed_signal = TRUE;
+}
+
+static void
+test_recorder_arm (TestFixture * fixture, gconstpointer unused)
+{
+  ArmTestData data = { 0 };
+
+  data.fixture = fixture;
+
+  hwangsae_recorder_set_container (fixture->recorder, HWANGSAE_CONTAINER_TS);
+  g_object_set (fixture->recorder, "pre-roll-time", PRE_ROLL_SECONDS, NULL);
+
+  g_signal_connect (fixture->recorder, "stream-connected",
+      (GCallback) arm_stream_connected_cb, &data);
+  g_signal_connect (fixture->recorder, "file-created",
+      (GCallback) arm_file_created_cb, &data);
+  g_signal_connect (fixture->recorder, "file-completed",
+      (GCallback) arm_file_completed_cb, &data);
+  g_signal_connect (fixture->recorder, "stream-disconnected",
+      (GCallback) stream_disconnected_cb, fixture);
+
+  hwangsae_test_streamer_start (fixture->streamer);
+
+  hwangsae_recorder_arm (fixture->recorder, "srt://127.0.0.1:8888");
+
+  g_main_loop_run (fixture->loop);
+
+  g_assert_true (data.got_file_completed_signal);
+}
+
+/* Returns the time between the first and the last video PTS of a recorded
+ * synthetic stream, which has to start with a keyframe. */
+static GstClockTime
+_get_synthetic_recording_span (const gchar * file_path)
+{
+  g_autoptr (GMappedFile) file = NULL;
+  g_autoptr (GError) error = NULL;
+  HwangsaeTsKeyframeScanner *scanner = hwangsae_ts_keyframe_scanner_new ();
+  const guint8 *data;
+  gsize size;
+  gsize offset;
+  gboolean first = TRUE;
+  guint64 first_pts = 0;
+  guint64 last_pts = 0;
+
+  file = g_mapped_file_new (file_path, FALSE, &error);
+  g_assert_no_error (error);
+
+  data = (const guint8 *) g_mapped_file_get_contents (file);
+  size = g_mapped_file_get_length (file);
+  g_assert_cmpuint (size % HWANGSAE_TS_PACKET_SIZE, ==, 0);
+
+  for (offset = 0; offset != size; offset += HWANGSAE_TS_PACKET_SIZE) {
+    const guint8 *p = data + offset;
+    HwangsaeTsScanResult result;
+
+    result = hwangsae_ts_keyframe_scanner_push (scanner, p);
+    if (result == HWANGSAE_TS_SCAN_NONE || !(p[1] & 0x40)) {
+      continue;
+    }
+
+    if (first) {
+      g_assert_cmpint (result, ==, HWANGSAE_TS_SCAN_KEYFRAME);
+      g_assert_true (hwangsae_ts_get_pes_pts (p, &first_pts));
+      first = FALSE;
+    }
+    g_assert_true (hwangsae_ts_get_pes_pts (p, &last_pts));
+  }
+
+  hwangsae_ts_keyframe_scanner_free (scanner);
+
+  g_assert_false (first);
+
+  /* From 90 kHz. */
+  return (last_pts - first_pts) * 100000 / 9;
+}
+
+static void
+arm_no_random_access_file_completed_cb (HwangsaeRecorder * recorder,
+    const gchar * file_path, ArmTestData * data)
+{
+  GstClockTime span = _get_synthetic_recording_span (file_path);
+
+  g_debug ("Finished recording %s, span %" GST_TIME_FORMAT, file_path,
+      GST_TIME_ARGS (span));
+
+  /* Without the random_access_indicator, the pre-roll must still find
+   * the keyframes to start from. */
+  g_assert_cmpint (span, >, 3 * GST_SECOND);
+  g_assert_cmpint (span, <=, (2 + PRE_ROLL_SECONDS + 1) * GST_SECOND);
+
+  data->got_file_completed_signal = TRUE;
+}
+
+static void
+test_recorder_arm_no_random_access (TestFixture * fixture,
+    gconstpointer unused)
+{
+  ArmTestData data = { 0 };
+
+  data.fixture = fixture;
+
+  g_object_set (fixture->streamer, "synthetic", TRUE, "random-access", FALSE,
+      NULL);
+
+  hwangsae_recorder_set_container (fixture->recorder, HWANGSAE_CONTAINER_TS);
+  g_object_set (fixture->recorder, "pre-roll-time", PRE_ROLL_SECONDS, NULL);
+
+  g_signal_connect (fixture->recorder, "stream-connected",
+      (GCallback) arm_stream_connected_cb, &data);
+  g_signal_connect (fixture->recorder, "file-created",
+      (GCallback) arm_file_created_cb, &data);
+  g_signal_connect (fixture->recorder, "file-completed",
+      (GCallback) arm_no_random_access_file_completed_cb, &data);
+  g_signal_connect (fixture->recorder, "stream-disconnected",
+      (GCallback) stream_disconnected_cb, fixture);
+
+  hwangsae_test_streamer_start (fixture->streamer);
+
+  hwangsae_recorder_arm (fixture->recorder, "srt://127.0.0.1:8888");
+
+  g_main_loop_run (fixture->loop);
+
+  g_assert_true (data.got_file_completed_signal);
+}
+
+// recorder-relay-tap ----------------------------------------------------------
+
+static void
+test_recorder_relay_tap (TestFixture * fixture, gconstpointer unused)
+{
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autofree gchar *username = NULL;
+  RecorderTestData test_data = { 0 };
+
+  test_data.fixture = fixture;
+
+  g_signal_connect (fixture->recorder, "stream-connected",
+      (GCallback) stream_connected_cb, fixture);
+  g_signal_connect (fixture->recorder, "file-created",
+      (GCallback) file_created_cb, &test_data);
+  g_signal_connect (fixture->recorder, "file-completed",
+      (GCallback) file_completed_cb, &test_data);
+  g_signal_connect (fixture->recorder, "stream-disconnected",
+      (GCallback) stream_disconnected_cb, fixture);
+
+  g_object_get (fixture->streamer, "username", &username, NULL);
+  hwangsae_test_streamer_set_uri (fixture->streamer,
+      hwangsae_relay_get_sink_uri (relay));
+
+  hwangsae_relay_start (relay);
+
+  /* The recorder taps the relay directly, no SRT source connects. */
+  hwangsae_recorder_start_recording_from_relay (fixture->recorder, relay,
+      username);
+
+  hwangsae_test_streamer_start (fixture->streamer);
+
+  g_main_loop_run (fixture->loop);
+
+  g_assert_true (test_data.got_file_created_signal);
+  g_assert_true (test_data.got_file_completed_signal);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -383,6 +1060,14 @@ main (int argc, char *argv[])
       TestFixture, GUINT_TO_POINTER (HWANGSAE_CONTAINER_TS), fixture_setup,
       test_recorder_record, fixture_teardown);
 
+  g_test_add ("/hwangsae/recorder-record-fmp4",
+      TestFixture, GUINT_TO_POINTER (HWANGSAE_CONTAINER_FMP4), fixture_setup,
+      test_recorder_record, fixture_teardown);
+
+  g_test_add ("/hwangsae/recorder-trick-play",
+      TestFixture, NULL, fixture_setup,
+      test_recorder_trick_play, fixture_teardown);
+
   g_test_add ("/hwangsae/recorder-disconnect",
       TestFixture, NULL, fixture_setup,
       test_recorder_disconnect, fixture_teardown);
@@ -395,9 +1080,53 @@ main (int argc, char *argv[])
       TestFixture, NULL, fixture_setup,
       test_recorder_split_bytes, fixture_teardown);
 
+  g_test_add ("/hwangsae/recorder-hls-playlist",
+      TestFixture, NULL, fixture_setup,
+      test_recorder_hls_playlist, fixture_teardown);
+
+  g_test_add ("/hwangsae/recorder-hls-playlist-bytes",
+      TestFixture, NULL, fixture_setup,
+      test_recorder_hls_playlist_bytes, fixture_teardown);
+
+  g_test_add ("/hwangsae/recorder-record-ts-passthrough",
+      TestFixture, NULL, fixture_setup,
+      test_recorder_record_passthrough, fixture_teardown);
+
+  g_test_add ("/hwangsae/recorder-split-time-passthrough",
+      TestFixture, NULL, fixture_setup,
+      test_recorder_split_time_passthrough, fixture_teardown);
+
+  g_test_add ("/hwangsae/recorder-record-ts-shared-engine",
+      TestFixture, NULL, fixture_setup,
+      test_recorder_record_shared_engine, fixture_teardown);
+
   g_test_add ("/hwangsae/recorder-stop-no-streamer",
       TestFixture, NULL, fixture_setup,
       test_recorder_stop_no_streamer, fixture_teardown);
 
+  g_test_add ("/hwangsae/recorder-reconnect",
+      TestFixture, NULL, fixture_setup,
+      test_recorder_reconnect, fixture_teardown);
+
+  g_test_add ("/hwangsae/recorder-reconnect-remuxed",
+      TestFixture, NULL, fixture_setup,
+      test_recorder_reconnect_remuxed, fixture_teardown);
+
+  g_test_add ("/hwangsae/recorder-reconnect-shared-engine",
+      TestFixture, NULL, fixture_setup,
+      test_recorder_reconnect_shared_engine, fixture_teardown);
+
+  g_test_add ("/hwangsae/recorder-arm",
+      TestFixture, NULL, fixture_setup,
+      test_recorder_arm, fixture_teardown);
+
+  g_test_add ("/hwangsae/recorder-arm-no-random-access",
+      TestFixture, NULL, fixture_setup,
+      test_recorder_arm_no_random_access, fixture_teardown);
+
+  g_test_add ("/hwangsae/recorder-relay-tap",
+      TestFixture, NULL, fixture_setup,
+      test_recorder_relay_tap, fixture_teardown);
+
   return g_test_run ();
 }
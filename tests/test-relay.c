@@ -18,12 +18,16 @@
  *
  */
 
+#include "hwangsae/capture.h"
 #include "hwangsae/common.h"
+#include "hwangsae/histogram.h"
+#include "hwangsae/metrics.h"
 #include "hwangsae/hwangsae.h"
 #include "hwangsae/test/test.h"
 
 #include <gaeguli/gaeguli.h>
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 #include <gst/pbutils/gstdiscoverer.h>
 
 static void
@@ -627,6 +631,1446 @@ test_slave (void)
   gst_element_set_state (receiver, GST_STATE_NULL);
 }
 
+#define RENDITION_GROUP "edge1"
+
+static void
+_rendition_accepted (HwangsaeRelay * relay, gint id,
+    HwangsaeCallerDirection direction, GInetSocketAddress * addr,
+    const gchar * username, const gchar * resource, guint * accepted_sinks)
+{
+  if (direction == HWANGSAE_CALLER_DIRECTION_SINK) {
+    g_assert_true (g_str_has_prefix (username, RENDITION_GROUP "/"));
+    ++*accepted_sinks;
+  }
+}
+
+static void
+test_renditions (void)
+{
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream_lo = hwangsae_test_streamer_new ();
+  g_autoptr (HwangsaeTestStreamer) stream_hi = hwangsae_test_streamer_new ();
+  g_autofree gchar *streamid = NULL;
+  g_autofree gchar *source_uri = NULL;
+  RelayTestData data = { 0 };
+  guint accepted_sinks = 0;
+
+  g_object_set (relay, "authentication", TRUE, NULL);
+  g_signal_connect (relay, "caller-accepted", (GCallback) _rendition_accepted,
+      &accepted_sinks);
+
+  g_object_set (stream_lo, "username", RENDITION_GROUP "/lo", NULL);
+  g_object_set (stream_hi, "username", RENDITION_GROUP "/hi", NULL);
+  hwangsae_test_streamer_set_uri (stream_lo,
+      hwangsae_relay_get_sink_uri (relay));
+  hwangsae_test_streamer_set_uri (stream_hi,
+      hwangsae_relay_get_sink_uri (relay));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_streamer_start (stream_lo);
+  hwangsae_test_streamer_start (stream_hi);
+
+  while (accepted_sinks != 2) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  /* Subscribe to the rendition group rather than to a particular sink. */
+  streamid = g_uri_escape_string ("#!::u=" RECEIVER_USERNAME ",r="
+      RENDITION_GROUP, NULL, FALSE);
+  data.source_uri = source_uri = g_strdup_printf ("%s?streamid=%s",
+      hwangsae_relay_get_source_uri (relay), streamid);
+  data.resolution = GAEGULI_VIDEO_RESOLUTION_640X480;
+
+  g_idle_add ((GSourceFunc) validate_stream, &data);
+
+  while (!data.done) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+}
+
+#define RENDITION_LO_PID 0x0100
+#define RENDITION_HI_PID 0x0101
+
+typedef struct
+{
+  GMutex lock;
+  /* Video PIDs in the order the viewer has received them. */
+  GArray *pids;
+  gboolean bad_switch;
+} RenditionSwitchData;
+
+static GstPadProbeReturn
+_rendition_switch_probe (GstPad * pad, GstPadProbeInfo * info,
+    RenditionSwitchData * data)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstMapInfo map;
+  gsize offset;
+
+  gst_buffer_map (buffer, &map, GST_MAP_READ);
+
+  g_mutex_lock (&data->lock);
+
+  for (offset = 0; offset + 188 <= map.size; offset += 188) {
+    const guint8 *p = map.data + offset;
+    guint16 pid = ((p[1] & 0x1F) << 8) | p[2];
+    guint16 current_pid = data->pids->len ?
+        g_array_index (data->pids, guint16, data->pids->len - 1) : 0;
+
+    if ((pid != RENDITION_LO_PID && pid != RENDITION_HI_PID) ||
+        pid == current_pid) {
+      continue;
+    }
+
+    /* A rendition must start with a PES carrying a random access point. */
+    if (!(p[1] & 0x40) || !(p[3] & 0x20) || p[4] == 0 || !(p[5] & 0x40)) {
+      g_warning ("Switched to PID 0x%04x without a random access point", pid);
+      data->bad_switch = TRUE;
+    }
+
+    g_array_append_val (data->pids, pid);
+  }
+
+  g_mutex_unlock (&data->lock);
+
+  gst_buffer_unmap (buffer, &map);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+_wait_for_rendition (RenditionSwitchData * data, guint16 pid)
+{
+  gint64 deadline = g_get_monotonic_time () + 30 * G_USEC_PER_SEC;
+
+  while (TRUE) {
+    guint16 current_pid = 0;
+
+    g_mutex_lock (&data->lock);
+    if (data->pids->len) {
+      current_pid = g_array_index (data->pids, guint16, data->pids->len - 1);
+    }
+    g_mutex_unlock (&data->lock);
+
+    if (current_pid == pid) {
+      break;
+    }
+
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_main_context_iteration (NULL, FALSE);
+  }
+}
+
+/* Audio frames carry random access points as well, which must not be
+ * taken for video keyframes. */
+#define RENDITION_AUDIO_PID 0x0102
+
+static void
+_run_rendition_switching (guint audio_pid)
+{
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream_lo = hwangsae_test_streamer_new ();
+  g_autoptr (HwangsaeTestStreamer) stream_hi = hwangsae_test_streamer_new ();
+  g_autoptr (HwangsaeTestProxy) downlink = NULL;
+  g_autoptr (GstElement) receiver = NULL;
+  g_autoptr (GstElement) srtsrc = NULL;
+  g_autoptr (GstPad) pad = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *streamid = NULL;
+  g_autofree gchar *pipeline_str = NULL;
+  RenditionSwitchData data = { 0 };
+  const guint16 expected_pids[] = {
+    RENDITION_LO_PID, RENDITION_HI_PID, RENDITION_LO_PID, RENDITION_HI_PID
+  };
+  guint accepted_sinks = 0;
+  gint64 sorted_time;
+
+  g_mutex_init (&data.lock);
+  data.pids = g_array_new (FALSE, FALSE, sizeof (guint16));
+
+  g_object_set (relay, "authentication", TRUE, NULL);
+  g_signal_connect (relay, "caller-accepted", (GCallback) _rendition_accepted,
+      &accepted_sinks);
+
+  g_object_set (stream_lo, "username", RENDITION_GROUP "/lo", "synthetic",
+      TRUE, "bitrate", 1000000, "video-pid", RENDITION_LO_PID, "audio-pid",
+      audio_pid, NULL);
+  g_object_set (stream_hi, "username", RENDITION_GROUP "/hi", "synthetic",
+      TRUE, "bitrate", 4000000, "video-pid", RENDITION_HI_PID, "audio-pid",
+      audio_pid, NULL);
+  hwangsae_test_streamer_set_uri (stream_lo,
+      hwangsae_relay_get_sink_uri (relay));
+  hwangsae_test_streamer_set_uri (stream_hi,
+      hwangsae_relay_get_sink_uri (relay));
+
+  downlink = hwangsae_test_proxy_new (hwangsae_relay_get_source_uri (relay),
+      9998);
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_proxy_start (downlink);
+  hwangsae_test_streamer_start (stream_lo);
+  hwangsae_test_streamer_start (stream_hi);
+
+  while (accepted_sinks != 2) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  /* Let the relay measure and order the renditions by their bitrate. */
+  sorted_time = g_get_monotonic_time () + 3 * G_USEC_PER_SEC;
+  while (g_get_monotonic_time () < sorted_time) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  /* A large latency keeps the delayed link from dropping packets. */
+  streamid = g_uri_escape_string ("#!::u=" RECEIVER_USERNAME ",r="
+      RENDITION_GROUP, NULL, FALSE);
+  pipeline_str = g_strdup_printf ("srtsrc name=src uri=%s?streamid=%s "
+      "latency=2000 ! fakesink", hwangsae_test_proxy_get_uri (downlink),
+      streamid);
+  receiver = gst_parse_launch (pipeline_str, &error);
+  g_assert_no_error (error);
+
+  srtsrc = gst_bin_get_by_name (GST_BIN (receiver), "src");
+  pad = gst_element_get_static_pad (srtsrc, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) _rendition_switch_probe, &data, NULL);
+
+  gst_element_set_state (receiver, GST_STATE_PLAYING);
+
+  /* Viewers start on the lowest rendition and step up on a healthy link. */
+  _wait_for_rendition (&data, RENDITION_LO_PID);
+  _wait_for_rendition (&data, RENDITION_HI_PID);
+
+  /* Too much RTT makes the viewer step down... */
+  g_object_set (downlink, "delay", 250, NULL);
+  _wait_for_rendition (&data, RENDITION_LO_PID);
+
+  /* ...and back up once the link recovers. */
+  g_object_set (downlink, "delay", 0, NULL);
+  _wait_for_rendition (&data, RENDITION_HI_PID);
+
+  gst_element_set_state (receiver, GST_STATE_NULL);
+
+  g_assert_false (data.bad_switch);
+  g_assert_cmpmem (data.pids->data, data.pids->len * sizeof (guint16),
+      expected_pids, sizeof (expected_pids));
+
+  hwangsae_test_streamer_stop (stream_lo);
+  hwangsae_test_streamer_stop (stream_hi);
+  hwangsae_test_proxy_stop (downlink);
+
+  g_array_unref (data.pids);
+  g_mutex_clear (&data.lock);
+}
+
+static void
+test_rendition_switching (void)
+{
+  _run_rendition_switching (0);
+}
+
+static void
+test_rendition_switching_audio (void)
+{
+  _run_rendition_switching (RENDITION_AUDIO_PID);
+}
+
+#define RECORDER_USERNAME "MyRecorder"
+
+static HwangsaeQosClass
+_qos_class_asked (HwangsaeRelay * relay, GSocketAddress * addr,
+    const gchar * username, const gchar * resource, gpointer data)
+{
+  return g_strcmp0 (username, RECORDER_USERNAME) == 0 ?
+      HWANGSAE_QOS_CLASS_PRIORITY : HWANGSAE_QOS_CLASS_BEST_EFFORT;
+}
+
+static guint64
+_get_class_counter (HwangsaeRelay * relay, const gchar * class_nick,
+    const gchar * counter)
+{
+  g_autoptr (GVariant) stats = hwangsae_relay_get_stats (relay);
+  g_autoptr (GVariant) classes = NULL;
+  g_autoptr (GVariant) class_stats = NULL;
+  guint64 value = 0;
+
+  classes = g_variant_lookup_value (stats, "qos-classes",
+      G_VARIANT_TYPE_VARDICT);
+  g_assert_nonnull (classes);
+  class_stats = g_variant_lookup_value (classes, class_nick,
+      G_VARIANT_TYPE_VARDICT);
+  g_assert_nonnull (class_stats);
+
+  g_assert_true (g_variant_lookup (class_stats, counter, "t", &value));
+
+  return value;
+}
+
+static guint
+_get_class_sources (HwangsaeRelay * relay, const gchar * class_nick)
+{
+  g_autoptr (GVariant) stats = hwangsae_relay_get_stats (relay);
+  g_autoptr (GVariant) classes = NULL;
+  g_autoptr (GVariant) class_stats = NULL;
+  guint sources = 0;
+
+  classes = g_variant_lookup_value (stats, "qos-classes",
+      G_VARIANT_TYPE_VARDICT);
+  g_assert_nonnull (classes);
+  class_stats = g_variant_lookup_value (classes, class_nick,
+      G_VARIANT_TYPE_VARDICT);
+  g_assert_nonnull (class_stats);
+
+  g_assert_true (g_variant_lookup (class_stats, "sources", "u", &sources));
+
+  return sources;
+}
+
+static void
+test_qos_classes (void)
+{
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autoptr (GstElement) recorder = NULL;
+  g_autoptr (GstElement) viewer = NULL;
+  gboolean sink_accepted = FALSE;
+
+  g_object_set (relay, "authentication", TRUE, NULL);
+  g_signal_connect (relay, "on-qos-class-asked", (GCallback) _qos_class_asked,
+      NULL);
+  g_signal_connect_swapped (relay, "caller-accepted", (GCallback) _flip_flag,
+      &sink_accepted);
+
+  hwangsae_test_streamer_set_uri (stream, hwangsae_relay_get_sink_uri (relay));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_streamer_start (stream);
+
+  while (!sink_accepted) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  recorder = hwangsae_test_make_receiver (stream, relay, RECORDER_USERNAME);
+  viewer = hwangsae_test_make_receiver (stream, relay, RECEIVER_USERNAME);
+
+  while (_get_class_sources (relay, "priority") != 1 ||
+      _get_class_sources (relay, "best-effort") != 1) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  g_assert_cmpuint (_get_class_sources (relay, "standard"), ==, 0);
+
+  gst_element_set_state (recorder, GST_STATE_NULL);
+  gst_element_set_state (viewer, GST_STATE_NULL);
+}
+
+static void
+test_qos_default_class (void)
+{
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autoptr (GstElement) recorder = NULL;
+  g_autoptr (GstElement) viewer = NULL;
+  const gchar *priority_usernames[] = { RECORDER_USERNAME, NULL };
+  gboolean sink_accepted = FALSE;
+
+  /* No "on-qos-class-asked" handler. */
+  g_object_set (relay, "authentication", TRUE, "priority-usernames",
+      priority_usernames, NULL);
+  g_signal_connect_swapped (relay, "caller-accepted", (GCallback) _flip_flag,
+      &sink_accepted);
+
+  hwangsae_test_streamer_set_uri (stream, hwangsae_relay_get_sink_uri (relay));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_streamer_start (stream);
+
+  while (!sink_accepted) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  viewer = hwangsae_test_make_receiver (stream, relay, RECEIVER_USERNAME);
+
+  while (_get_class_sources (relay, "standard") != 1) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  g_assert_cmpuint (_get_class_sources (relay, "priority"), ==, 0);
+  g_assert_cmpuint (_get_class_sources (relay, "best-effort"), ==, 0);
+
+  recorder = hwangsae_test_make_receiver (stream, relay, RECORDER_USERNAME);
+
+  while (_get_class_sources (relay, "priority") != 1) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  g_assert_cmpuint (_get_class_sources (relay, "standard"), ==, 1);
+
+  gst_element_set_state (recorder, GST_STATE_NULL);
+  gst_element_set_state (viewer, GST_STATE_NULL);
+}
+
+static GstElement *
+_make_delayed_receiver (HwangsaeTestStreamer * streamer,
+    HwangsaeTestProxy * proxy, const gchar * username)
+{
+  g_autofree gchar *streamid_tmp = g_strdup_printf ("#!::u=%s,r=%s",
+      username, streamer->username);
+  g_autofree gchar *streamid = NULL;
+  g_autofree gchar *pipeline_str = NULL;
+  g_autoptr (GstElement) receiver = NULL;
+  g_autoptr (GError) error = NULL;
+
+  /* A large latency keeps SRT from dropping what the link can't carry
+   * before the relay sees the send buffer grow. */
+  streamid = g_uri_escape_string (streamid_tmp, NULL, FALSE);
+  pipeline_str = g_strdup_printf ("srtsrc uri=%s?streamid=%s latency=8000 ! "
+      "fakesink", hwangsae_test_proxy_get_uri (proxy), streamid);
+  receiver = gst_parse_launch (pipeline_str, &error);
+  g_assert_no_error (error);
+
+  gst_element_set_state (receiver, GST_STATE_PLAYING);
+
+  return g_steal_pointer (&receiver);
+}
+
+static void
+test_qos_shedding (void)
+{
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autoptr (HwangsaeTestProxy) downlink = NULL;
+  g_autoptr (GstElement) recorder = NULL;
+  g_autoptr (GstElement) viewer = NULL;
+  gboolean sink_accepted = FALSE;
+  gint64 deadline;
+
+  g_object_set (relay, "authentication", TRUE, NULL);
+  g_signal_connect (relay, "on-qos-class-asked", (GCallback) _qos_class_asked,
+      NULL);
+  g_signal_connect_swapped (relay, "caller-accepted", (GCallback) _flip_flag,
+      &sink_accepted);
+
+  g_object_set (stream, "synthetic", TRUE, "bitrate", 4000000, NULL);
+  hwangsae_test_streamer_set_uri (stream, hwangsae_relay_get_sink_uri (relay));
+
+  /* Each receiver gets a link of a quarter of the stream bitrate, so the
+   * send buffers of both keep growing. */
+  downlink = hwangsae_test_proxy_new (hwangsae_relay_get_source_uri (relay),
+      9998);
+  g_object_set (downlink, "bandwidth", (guint64) 1000000, NULL);
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_proxy_start (downlink);
+  hwangsae_test_streamer_start (stream);
+
+  while (!sink_accepted) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  recorder = _make_delayed_receiver (stream, downlink, RECORDER_USERNAME);
+  viewer = _make_delayed_receiver (stream, downlink, RECEIVER_USERNAME);
+
+  while (_get_class_sources (relay, "priority") != 1 ||
+      _get_class_sources (relay, "best-effort") != 1) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  deadline = g_get_monotonic_time () + 30 * G_USEC_PER_SEC;
+  while (_get_class_counter (relay, "best-effort", "sources-shed") == 0) {
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  /* The slow viewer is gone, the equally slow recorder stays. */
+  g_assert_cmpuint (_get_class_sources (relay, "best-effort"), ==, 0);
+  g_assert_cmpuint (_get_class_sources (relay, "priority"), ==, 1);
+  g_assert_cmpuint (_get_class_counter (relay, "priority", "sources-shed"), ==, 0);
+
+  gst_element_set_state (recorder, GST_STATE_NULL);
+  gst_element_set_state (viewer, GST_STATE_NULL);
+
+  hwangsae_test_streamer_stop (stream);
+  hwangsae_test_proxy_stop (downlink);
+}
+
+static void
+_egress_rejected (HwangsaeRelay * relay, gint id,
+    HwangsaeCallerDirection direction, GInetSocketAddress * addr,
+    const gchar * username, const gchar * resource, HwangsaeRejectReason reason,
+    gboolean * rejected)
+{
+  g_assert_cmpint (direction, ==, HWANGSAE_CALLER_DIRECTION_SRC);
+  g_assert_cmpstr (username, ==, REJECTED_SRC);
+  g_assert_cmpint (reason, ==, HWANGSAE_REJECT_REASON_EGRESS_LIMIT);
+
+  *rejected = TRUE;
+}
+
+static void
+test_egress_limit (void)
+{
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autoptr (GstElement) receiver1 = NULL;
+  g_autoptr (GstElement) receiver2 = NULL;
+  gboolean sink_accepted = FALSE;
+  gboolean rejected = FALSE;
+
+  g_object_set (relay, "authentication", TRUE, "max-sources", 1, NULL);
+  g_signal_connect_swapped (relay, "caller-accepted", (GCallback) _flip_flag,
+      &sink_accepted);
+  g_signal_connect (relay, "caller-rejected", (GCallback) _egress_rejected,
+      &rejected);
+
+  hwangsae_test_streamer_set_uri (stream, hwangsae_relay_get_sink_uri (relay));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_streamer_start (stream);
+
+  while (!sink_accepted) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  receiver1 = hwangsae_test_make_receiver (stream, relay, ACCEPTED_SRC);
+
+  while (_get_class_sources (relay, "standard") != 1) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  receiver2 = hwangsae_test_make_receiver (stream, relay, REJECTED_SRC);
+
+  while (!rejected) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  gst_element_set_state (receiver1, GST_STATE_NULL);
+  gst_element_set_state (receiver2, GST_STATE_NULL);
+}
+
+static gboolean
+_quit_loop (GMainLoop * loop)
+{
+  g_main_loop_quit (loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+test_egress_bitrate_limit (void)
+{
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autoptr (GstElement) receiver1 = NULL;
+  g_autoptr (GstElement) receiver2 = NULL;
+  gboolean sink_accepted = FALSE;
+  gboolean rejected = FALSE;
+
+  /* Room for one copy of the stream, but not for two. */
+  g_object_set (relay, "authentication", TRUE, "max-egress-bitrate",
+      (guint64) 3000000, NULL);
+  g_signal_connect_swapped (relay, "caller-accepted", (GCallback) _flip_flag,
+      &sink_accepted);
+  g_signal_connect (relay, "caller-rejected", (GCallback) _egress_rejected,
+      &rejected);
+
+  g_object_set (stream, "synthetic", TRUE, "bitrate", 2000000, NULL);
+  hwangsae_test_streamer_set_uri (stream, hwangsae_relay_get_sink_uri (relay));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_streamer_start (stream);
+
+  while (!sink_accepted) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  /* Both receivers connect before the relay's first statistics pass, so the
+   * sink bitrate must already be accounted for. */
+  receiver1 = hwangsae_test_make_receiver (stream, relay, ACCEPTED_SRC);
+
+  while (_get_class_sources (relay, "standard") != 1) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  receiver2 = hwangsae_test_make_receiver (stream, relay, REJECTED_SRC);
+
+  while (!rejected) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  g_assert_cmpuint (_get_class_sources (relay, "standard"), ==, 1);
+
+  gst_element_set_state (receiver1, GST_STATE_NULL);
+  gst_element_set_state (receiver2, GST_STATE_NULL);
+
+  hwangsae_test_streamer_stop (stream);
+}
+
+static guint64
+_get_rate_limited (HwangsaeRelay * relay, const gchar * username)
+{
+  g_autoptr (GVariant) stats = hwangsae_relay_get_stats (relay);
+  g_autoptr (GVariant) rate_limited = NULL;
+  guint64 dropped = 0;
+
+  rate_limited = g_variant_lookup_value (stats, "rate-limited",
+      G_VARIANT_TYPE_VARDICT);
+  g_assert_nonnull (rate_limited);
+
+  g_variant_lookup (rate_limited, username, "t", &dropped);
+
+  return dropped;
+}
+
+static void
+test_source_rate_limit (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autoptr (GstElement) receiver = NULL;
+  const guint64 rate_limit = 1000000;
+  const guint window = 3;
+  gboolean sink_accepted = FALSE;
+  guint64 bytes_sent;
+
+  g_object_set (relay, "authentication", TRUE, "source-rate-limit",
+      rate_limit, NULL);
+  g_signal_connect_swapped (relay, "caller-accepted", (GCallback) _flip_flag,
+      &sink_accepted);
+
+  g_object_set (stream, "synthetic", TRUE, "bitrate", 2000000, NULL);
+  hwangsae_test_streamer_set_uri (stream, hwangsae_relay_get_sink_uri (relay));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_streamer_start (stream);
+
+  while (!sink_accepted) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  receiver = hwangsae_test_make_receiver (stream, relay, RECEIVER_USERNAME);
+
+  while (_get_class_sources (relay, "standard") != 1) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  /* Let the initial burst of the bucket drain. */
+  g_timeout_add_seconds (1, (GSourceFunc) _quit_loop, loop);
+  g_main_loop_run (loop);
+
+  bytes_sent = _get_class_counter (relay, "standard", "bytes-sent");
+
+  g_timeout_add_seconds (window, (GSourceFunc) _quit_loop, loop);
+  g_main_loop_run (loop);
+
+  /* The source gets no more than the limit plus one bucket of burst. */
+  bytes_sent = _get_class_counter (relay, "standard", "bytes-sent") -
+      bytes_sent;
+  g_assert_cmpuint (bytes_sent * 8, <=, rate_limit * (window + 1) * 1.1);
+
+  g_assert_cmpuint (_get_rate_limited (relay, RECEIVER_USERNAME), >, 0);
+  g_assert_cmpuint (_get_class_counter (relay, "standard", "packets-dropped"),
+      >, 0);
+
+  gst_element_set_state (receiver, GST_STATE_NULL);
+
+  hwangsae_test_streamer_stop (stream);
+}
+
+static gchar *
+_build_timeshift_uri (HwangsaeTestStreamer * stream, HwangsaeRelay * relay,
+    const gchar * start, const gchar * speed)
+{
+  g_autofree gchar *streamid = NULL;
+  g_autofree gchar *escaped_streamid = NULL;
+  g_autofree gchar *stream_username = NULL;
+
+  g_object_get (stream, "username", &stream_username, NULL);
+  streamid = g_strdup_printf ("#!::u=%s,r=%s,start=%s,speed=%s",
+      RECEIVER_USERNAME, stream_username, start, speed);
+  escaped_streamid = g_uri_escape_string (streamid, NULL, FALSE);
+
+  return g_strdup_printf ("%s?streamid=%s",
+      hwangsae_relay_get_source_uri (relay), escaped_streamid);
+}
+
+/* How long after it was sent the @i-th probe arrived at the receiver. */
+static gint64
+_get_probe_lag (GPtrArray * probes, guint i)
+{
+  GArray *stamps = probes->pdata[i];
+
+  return g_array_index (stamps, gint64, stamps->len - 1) -
+      g_array_index (stamps, gint64, 0);
+}
+
+static gint64
+_get_probe_arrival (GPtrArray * probes, guint i)
+{
+  GArray *stamps = probes->pdata[i];
+
+  return g_array_index (stamps, gint64, stamps->len - 1);
+}
+
+static void
+test_timeshift (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autofree gchar *source_uri = NULL;
+  RelayTestData data = { 0 };
+
+  g_object_set (relay, "authentication", TRUE, "timeshift-window", 10, NULL);
+
+  hwangsae_test_streamer_set_uri (stream, hwangsae_relay_get_sink_uri (relay));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_streamer_start (stream);
+
+  /* Let the relay collect a few seconds of the stream. */
+  g_timeout_add_seconds (5, (GSourceFunc) _quit_loop, loop);
+  g_main_loop_run (loop);
+
+  data.source_uri = source_uri =
+      _build_timeshift_uri (stream, relay, "-4s", "2");
+  data.resolution = GAEGULI_VIDEO_RESOLUTION_640X480;
+
+  g_idle_add ((GSourceFunc) validate_stream, &data);
+
+  while (!data.done) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+}
+
+static void
+test_timeshift_catch_up (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autoptr (GPtrArray) probes = NULL;
+  g_autofree gchar *source_uri = NULL;
+  gint64 start_lag;
+  gint64 catch_up = -1;
+  guint i;
+
+  g_object_set (relay, "authentication", TRUE, "timeshift-window", 10, NULL);
+
+  /* Probes carry the time they were sent, so their lag on arrival tells how
+   * far behind live the receiver is. */
+  g_object_set (stream, "synthetic", TRUE, "probe-interval", 100, NULL);
+  hwangsae_test_streamer_set_uri (stream, hwangsae_relay_get_sink_uri (relay));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_streamer_start (stream);
+
+  g_timeout_add_seconds (6, (GSourceFunc) _quit_loop, loop);
+  g_main_loop_run (loop);
+
+  source_uri = _build_timeshift_uri (stream, relay, "-4s", "2");
+  probes = hwangsae_test_receive_latency_probes (source_uri, 8 * GST_SECOND);
+  g_assert_cmpuint (probes->len, >, 0);
+
+  /* Replay starts at the last keyframe at least 4 s old, and keyframes are
+   * a second apart. */
+  start_lag = _get_probe_lag (probes, 0);
+  g_assert_cmpint (start_lag, >=, 4 * G_USEC_PER_SEC - 200000);
+  g_assert_cmpint (start_lag, <=, 6 * G_USEC_PER_SEC);
+
+  /* At double speed the receiver gains a second every second until it
+   * reaches the live edge. */
+  for (i = 1; i != probes->len; ++i) {
+    if (_get_probe_lag (probes, i) < G_USEC_PER_SEC / 2) {
+      catch_up = _get_probe_arrival (probes, i) -
+          _get_probe_arrival (probes, 0);
+      break;
+    }
+  }
+
+  g_debug ("Timeshift started %" G_GINT64_FORMAT " ms behind live, caught up "
+      "in %" G_GINT64_FORMAT " ms", start_lag / 1000, catch_up / 1000);
+
+  g_assert_cmpint (catch_up, >=, start_lag / 2);
+  g_assert_cmpint (catch_up, <=, start_lag + G_USEC_PER_SEC);
+  g_assert_cmpint (_get_probe_lag (probes, probes->len - 1), <,
+      G_USEC_PER_SEC / 2);
+
+  hwangsae_test_streamer_stop (stream);
+}
+
+static void
+test_timeshift_memory_bound (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autoptr (GPtrArray) probes = NULL;
+  g_autofree gchar *source_uri = NULL;
+
+  /* 512 KiB hold about two seconds of a 2 Mbps stream, a fraction of the
+   * time window. */
+  g_object_set (relay, "authentication", TRUE, "timeshift-window", 10,
+      "timeshift-max-bytes", (guint64) 512 * 1024, NULL);
+
+  g_object_set (stream, "synthetic", TRUE, "bitrate", 2000000,
+      "probe-interval", 100, NULL);
+  hwangsae_test_streamer_set_uri (stream, hwangsae_relay_get_sink_uri (relay));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_streamer_start (stream);
+
+  g_timeout_add_seconds (8, (GSourceFunc) _quit_loop, loop);
+  g_main_loop_run (loop);
+
+  source_uri = _build_timeshift_uri (stream, relay, "-6s", "1");
+  probes = hwangsae_test_receive_latency_probes (source_uri, 2 * GST_SECOND);
+  g_assert_cmpuint (probes->len, >, 0);
+
+  /* Asked for 6 s, replay starts at the oldest data the memory limit kept. */
+  g_assert_cmpint (_get_probe_lag (probes, 0), <, 3 * G_USEC_PER_SEC);
+
+  hwangsae_test_streamer_stop (stream);
+}
+
+static void
+test_stream_analysis (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autoptr (GVariant) stats = NULL;
+  g_autoptr (GVariant) streams = NULL;
+  g_autoptr (GVariant) analysis = NULL;
+  g_autofree gchar *stream_username = NULL;
+  guint64 value;
+
+  g_object_set (relay, "stream-analysis", TRUE, NULL);
+
+  hwangsae_test_streamer_set_uri (stream, hwangsae_relay_get_sink_uri (relay));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_streamer_start (stream);
+
+  /* Give the relay a few statistics intervals. */
+  g_timeout_add_seconds (5, (GSourceFunc) _quit_loop, loop);
+  g_main_loop_run (loop);
+
+  g_object_get (stream, "username", &stream_username, NULL);
+
+  stats = g_variant_ref_sink (hwangsae_relay_get_stats (relay));
+  streams = g_variant_lookup_value (stats, "streams", G_VARIANT_TYPE_VARDICT);
+  g_assert_nonnull (streams);
+  analysis = g_variant_lookup_value (streams, stream_username,
+      G_VARIANT_TYPE_VARDICT);
+  g_assert_nonnull (analysis);
+
+  g_assert_true (g_variant_lookup (analysis, "sync-errors", "t", &value));
+  g_assert_cmpuint (value, ==, 0);
+  g_assert_true (g_variant_lookup (analysis, "cc-errors", "t", &value));
+  g_assert_cmpuint (value, ==, 0);
+  g_assert_true (g_variant_lookup (analysis, "video-bitrate", "t", &value));
+  g_assert_cmpuint (value, >, 0);
+
+  hwangsae_test_streamer_stop (stream);
+}
+
+static void
+test_capture (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autofree gchar *capture_file = NULL;
+  g_autofree gchar *stream_username = NULL;
+  HwangsaeRelay *relay = hwangsae_relay_new (NULL, 8888, 9999);
+  HwangsaeCaptureReader *reader;
+  const HwangsaeCaptureRecord *record;
+  const guint8 *data;
+  g_autoptr (GError) error = NULL;
+  guint sinks_connected = 0;
+  guint packets = 0;
+  gint64 last_timestamp = 0;
+
+  capture_file = g_build_filename (g_get_tmp_dir (),
+      "hwangsae-test-capture", NULL);
+
+  g_object_set (relay, "capture-file", capture_file, "capture-size",
+      (guint64) 16 * 1024 * 1024, NULL);
+
+  hwangsae_test_streamer_set_uri (stream, hwangsae_relay_get_sink_uri (relay));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_streamer_start (stream);
+
+  g_timeout_add_seconds (3, (GSourceFunc) _quit_loop, loop);
+  g_main_loop_run (loop);
+
+  hwangsae_test_streamer_stop (stream);
+  g_object_unref (relay);
+
+  g_object_get (stream, "username", &stream_username, NULL);
+
+  reader = hwangsae_capture_reader_new (capture_file, &error);
+  g_assert_no_error (error);
+
+  while (hwangsae_capture_reader_next (reader, &record, &data)) {
+    g_assert_cmpint (record->timestamp, >=, last_timestamp);
+    last_timestamp = record->timestamp;
+
+    switch (record->type) {
+      case HWANGSAE_CAPTURE_RECORD_SINK_CONNECTED:
+        g_assert_cmpmem (data, record->size, stream_username,
+            strlen (stream_username));
+        ++sinks_connected;
+        break;
+      case HWANGSAE_CAPTURE_RECORD_PACKET:
+        g_assert_cmpuint (sinks_connected, ==, 1);
+        g_assert_cmpuint (record->size % 188, ==, 0);
+        ++packets;
+        break;
+      default:
+        break;
+    }
+  }
+
+  g_assert_cmpuint (sinks_connected, ==, 1);
+  g_assert_cmpuint (packets, >, 0);
+
+  hwangsae_capture_reader_free (reader);
+  g_unlink (capture_file);
+}
+
+static guint
+_count_captured_packets (const gchar * capture_file, gchar ** username)
+{
+  HwangsaeCaptureReader *reader;
+  const HwangsaeCaptureRecord *record;
+  const guint8 *data;
+  g_autoptr (GError) error = NULL;
+  guint packets = 0;
+
+  reader = hwangsae_capture_reader_new (capture_file, &error);
+  g_assert_no_error (error);
+
+  while (hwangsae_capture_reader_next (reader, &record, &data)) {
+    switch (record->type) {
+      case HWANGSAE_CAPTURE_RECORD_SINK_CONNECTED:
+        g_assert_null (*username);
+        *username = g_strndup ((const gchar *) data, record->size);
+        break;
+      case HWANGSAE_CAPTURE_RECORD_PACKET:
+        ++packets;
+        break;
+      default:
+        break;
+    }
+  }
+
+  hwangsae_capture_reader_free (reader);
+
+  return packets;
+}
+
+static void
+_replay_finished (GSubprocess * replay, GAsyncResult * result, GMainLoop * loop)
+{
+  g_autoptr (GError) error = NULL;
+
+  g_subprocess_wait_check_finish (replay, result, &error);
+  g_assert_no_error (error);
+
+  g_main_loop_quit (loop);
+}
+
+static void
+test_replay (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autoptr (GSubprocess) replay = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *capture_file = NULL;
+  g_autofree gchar *replay_capture_file = NULL;
+  g_autofree gchar *captured_username = NULL;
+  g_autofree gchar *replayed_username = NULL;
+  const gchar *replay_tool = g_getenv ("HWANGSAE_RELAY_REPLAY");
+  HwangsaeRelay *relay;
+  guint captured_packets;
+  guint replayed_packets;
+
+  if (!replay_tool) {
+    g_test_skip ("HWANGSAE_RELAY_REPLAY isn't set");
+    return;
+  }
+
+  capture_file = g_build_filename (g_get_tmp_dir (),
+      "hwangsae-test-replay-capture", NULL);
+  replay_capture_file = g_build_filename (g_get_tmp_dir (),
+      "hwangsae-test-replay-result", NULL);
+
+  /* Capture a short session... */
+  relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_object_set (relay, "capture-file", capture_file, "capture-size",
+      (guint64) 16 * 1024 * 1024, NULL);
+  g_object_set (stream, "synthetic", TRUE, NULL);
+
+  hwangsae_test_streamer_set_uri (stream, hwangsae_relay_get_sink_uri (relay));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_streamer_start (stream);
+
+  g_timeout_add_seconds (3, (GSourceFunc) _quit_loop, loop);
+  g_main_loop_run (loop);
+
+  hwangsae_test_streamer_stop (stream);
+  g_object_unref (relay);
+
+  captured_packets = _count_captured_packets (capture_file,
+      &captured_username);
+  g_assert_nonnull (captured_username);
+  g_assert_cmpuint (captured_packets, >, 0);
+
+  /* ...and replay it into a fresh relay, which captures what it receives. */
+  relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_object_set (relay, "capture-file", replay_capture_file, "capture-size",
+      (guint64) 16 * 1024 * 1024, NULL);
+  hwangsae_relay_start (relay);
+
+  replay = g_subprocess_new (G_SUBPROCESS_FLAGS_NONE, &error, replay_tool,
+      "--sink-uri", hwangsae_relay_get_sink_uri (relay),
+      "--source-uri", hwangsae_relay_get_source_uri (relay),
+      "--speed", "2", capture_file, NULL);
+  g_assert_no_error (error);
+
+  g_subprocess_wait_check_async (replay, NULL,
+      (GAsyncReadyCallback) _replay_finished, loop);
+  g_main_loop_run (loop);
+
+  /* Let the last packets reach the relay before it goes away. */
+  g_timeout_add_seconds (1, (GSourceFunc) _quit_loop, loop);
+  g_main_loop_run (loop);
+
+  g_object_unref (relay);
+
+  replayed_packets = _count_captured_packets (replay_capture_file,
+      &replayed_username);
+  g_assert_cmpstr (replayed_username, ==, captured_username);
+  g_assert_cmpuint (replayed_packets, >=, captured_packets * 9 / 10);
+  g_assert_cmpuint (replayed_packets, <=, captured_packets);
+
+  g_unlink (capture_file);
+  g_unlink (replay_capture_file);
+}
+
+static void
+test_impaired_link (void)
+{
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autoptr (HwangsaeTestProxy) uplink = NULL;
+  g_autoptr (HwangsaeTestProxy) downlink = NULL;
+  g_autofree gchar *source_uri = NULL;
+  g_autofree gchar *relay_source_uri = NULL;
+  RelayTestData data = { 0 };
+
+  g_object_set (relay, "authentication", TRUE, NULL);
+
+  uplink = hwangsae_test_proxy_new (hwangsae_relay_get_sink_uri (relay), 8889);
+  g_object_set (uplink, "loss", 0.02, "delay", 20, "jitter", 5, "reorder",
+      0.01, NULL);
+
+  downlink = hwangsae_test_proxy_new (hwangsae_relay_get_source_uri (relay),
+      9998);
+  g_object_set (downlink, "loss", 0.01, "delay", 10, "bandwidth",
+      (guint64) 10000000, NULL);
+
+  /* Make the receiver connect through the downlink proxy. */
+  relay_source_uri = hwangsae_test_build_source_uri (stream, relay,
+      RECEIVER_USERNAME);
+  source_uri = g_strconcat (hwangsae_test_proxy_get_uri (downlink),
+      strchr (relay_source_uri, '?'), NULL);
+
+  data.source_uri = source_uri;
+  data.resolution = GAEGULI_VIDEO_RESOLUTION_640X480;
+
+  hwangsae_test_streamer_set_uri (stream, hwangsae_test_proxy_get_uri (uplink));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_proxy_start (uplink);
+  hwangsae_test_proxy_start (downlink);
+  hwangsae_test_streamer_start (stream);
+
+  g_idle_add ((GSourceFunc) validate_stream, &data);
+
+  while (!data.done) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  hwangsae_test_streamer_stop (stream);
+}
+
+typedef struct
+{
+  HwangsaeRelay *relay;
+  GMutex lock;
+  guint lowest_bitrate;
+  guint last_bitrate;
+} BitrateTestData;
+
+static void
+_bitrate_suggested (HwangsaeRelay * relay, gint id, const gchar * username,
+    guint bitrate, BitrateTestData * data)
+{
+  g_autoptr (GVariant) stats = NULL;
+
+  g_debug ("Suggested bitrate %u for %s", bitrate, username);
+
+  /* Handlers may call back into the relay. */
+  stats = g_variant_ref_sink (hwangsae_relay_get_stats (data->relay));
+  g_assert_nonnull (stats);
+
+  g_mutex_lock (&data->lock);
+  if (data->lowest_bitrate == 0 || bitrate < data->lowest_bitrate) {
+    data->lowest_bitrate = bitrate;
+  }
+  data->last_bitrate = bitrate;
+  g_mutex_unlock (&data->lock);
+}
+
+static void
+test_bitrate_control (void)
+{
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autoptr (HwangsaeTestProxy) uplink = NULL;
+  BitrateTestData data = { 0 };
+  gboolean sink_accepted = FALSE;
+  gint64 deadline;
+
+  data.relay = relay;
+  g_mutex_init (&data.lock);
+
+  g_object_set (relay, "bitrate-control", TRUE, NULL);
+  g_signal_connect (relay, "bitrate-suggested",
+      (GCallback) _bitrate_suggested, &data);
+  g_signal_connect_swapped (relay, "caller-accepted", (GCallback) _flip_flag,
+      &sink_accepted);
+
+  uplink = hwangsae_test_proxy_new (hwangsae_relay_get_sink_uri (relay), 8889);
+
+  g_object_set (stream, "synthetic", TRUE, NULL);
+  hwangsae_test_streamer_set_uri (stream, hwangsae_test_proxy_get_uri (uplink));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_proxy_start (uplink);
+  hwangsae_test_streamer_start (stream);
+
+  while (!sink_accepted) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  /* A lossy uplink gets a lower bitrate suggested... */
+  g_object_set (uplink, "loss", 0.1, NULL);
+
+  deadline = g_get_monotonic_time () + 30 * G_USEC_PER_SEC;
+  while (TRUE) {
+    guint lowest_bitrate;
+
+    g_mutex_lock (&data.lock);
+    lowest_bitrate = data.lowest_bitrate;
+    g_mutex_unlock (&data.lock);
+
+    if (lowest_bitrate != 0) {
+      break;
+    }
+
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  /* ...which climbs back once the impairment goes away. */
+  g_object_set (uplink, "loss", 0.0, NULL);
+
+  deadline = g_get_monotonic_time () + 60 * G_USEC_PER_SEC;
+  while (TRUE) {
+    gboolean recovered;
+
+    g_mutex_lock (&data.lock);
+    recovered = data.last_bitrate > data.lowest_bitrate;
+    g_mutex_unlock (&data.lock);
+
+    if (recovered) {
+      break;
+    }
+
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  hwangsae_test_streamer_stop (stream);
+  hwangsae_test_proxy_stop (uplink);
+
+  g_mutex_clear (&data.lock);
+}
+
+static void
+test_synthetic_load (void)
+{
+  const guint N_STREAMERS = 10;
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (GPtrArray) streamers = g_ptr_array_new_with_free_func
+      (g_object_unref);
+  g_autoptr (GVariant) stats = NULL;
+  g_autoptr (GVariant) streams = NULL;
+  guint sinks;
+  guint i;
+
+  g_object_set (relay, "stream-analysis", TRUE, NULL);
+
+  hwangsae_relay_start (relay);
+
+  for (i = 0; i != N_STREAMERS; ++i) {
+    HwangsaeTestStreamer *streamer = hwangsae_test_streamer_new ();
+
+    g_object_set (streamer, "synthetic", TRUE, "bitrate", 4000000, NULL);
+    hwangsae_test_streamer_set_uri (streamer,
+        hwangsae_relay_get_sink_uri (relay));
+    hwangsae_test_streamer_start (streamer);
+
+    g_ptr_array_add (streamers, streamer);
+  }
+
+  g_timeout_add_seconds (5, (GSourceFunc) _quit_loop, loop);
+  g_main_loop_run (loop);
+
+  stats = g_variant_ref_sink (hwangsae_relay_get_stats (relay));
+  g_assert_true (g_variant_lookup (stats, "sinks", "u", &sinks));
+  g_assert_cmpuint (sinks, ==, N_STREAMERS);
+
+  streams = g_variant_lookup_value (stats, "streams", G_VARIANT_TYPE_VARDICT);
+  g_assert_cmpuint (g_variant_n_children (streams), ==, N_STREAMERS);
+
+  for (i = 0; i != N_STREAMERS; ++i) {
+    g_autofree gchar *username = NULL;
+    g_autoptr (GVariant) analysis = NULL;
+    guint64 cc_errors;
+    guint keyframe_interval;
+
+    g_object_get (streamers->pdata[i], "username", &username, NULL);
+    analysis = g_variant_lookup_value (streams, username,
+        G_VARIANT_TYPE_VARDICT);
+    g_assert_nonnull (analysis);
+
+    /* Generated streams must look sane to the analyzer. */
+    g_variant_lookup (analysis, "cc-errors", "t", &cc_errors);
+    g_assert_cmpuint (cc_errors, ==, 0);
+    g_variant_lookup (analysis, "keyframe-interval", "u", &keyframe_interval);
+    g_assert_cmpuint (keyframe_interval, >=, 900);
+    g_assert_cmpuint (keyframe_interval, <=, 1100);
+
+    hwangsae_test_streamer_stop (streamers->pdata[i]);
+  }
+}
+
+static void
+test_latency_probes (void)
+{
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autoptr (GPtrArray) probes = NULL;
+  g_autoptr (GVariant) stats = NULL;
+  g_autoptr (GVariant) latency = NULL;
+  g_autoptr (GVariant) sink_latency = NULL;
+  g_autofree gchar *source_uri = NULL;
+  g_autofree gchar *stream_username = NULL;
+  HwangsaeHistogram end_to_end;
+  HwangsaeHistogram hops[2];
+  gboolean sink_accepted = FALSE;
+  guint64 relay_probes;
+  guint i;
+
+  g_object_set (relay, "authentication", TRUE, "latency-probes", TRUE, NULL);
+  g_signal_connect_swapped (relay, "caller-accepted", (GCallback) _flip_flag,
+      &sink_accepted);
+
+  g_object_set (stream, "synthetic", TRUE, "probe-interval", 20, NULL);
+  hwangsae_test_streamer_set_uri (stream, hwangsae_relay_get_sink_uri (relay));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_streamer_start (stream);
+
+  while (!sink_accepted) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  source_uri = hwangsae_test_build_source_uri (stream, relay,
+      RECEIVER_USERNAME);
+  probes = hwangsae_test_receive_latency_probes (source_uri, 3 * GST_SECOND);
+
+  g_assert_cmpuint (probes->len, >, 0);
+
+  hwangsae_histogram_reset (&end_to_end);
+  hwangsae_histogram_reset (&hops[0]);
+  hwangsae_histogram_reset (&hops[1]);
+
+  for (i = 0; i != probes->len; ++i) {
+    GArray *stamps = probes->pdata[i];
+    guint hop;
+
+    /* Streamer, relay and receiver. */
+    g_assert_cmpuint (stamps->len, ==, 3);
+
+    for (hop = 0; hop != G_N_ELEMENTS (hops); ++hop) {
+      hwangsae_histogram_add (&hops[hop],
+          g_array_index (stamps, gint64, hop + 1) -
+          g_array_index (stamps, gint64, hop));
+    }
+    hwangsae_histogram_add (&end_to_end,
+        g_array_index (stamps, gint64, 2) - g_array_index (stamps, gint64, 0));
+  }
+
+  g_debug ("End-to-end latency p50 %" G_GINT64_FORMAT " p99 %" G_GINT64_FORMAT
+      " p999 %" G_GINT64_FORMAT " us",
+      hwangsae_histogram_percentile (&end_to_end, 50),
+      hwangsae_histogram_percentile (&end_to_end, 99),
+      hwangsae_histogram_percentile (&end_to_end, 99.9));
+  g_debug ("Relay hop latency p50 %" G_GINT64_FORMAT " p99 %" G_GINT64_FORMAT
+      " us", hwangsae_histogram_percentile (&hops[1], 50),
+      hwangsae_histogram_percentile (&hops[1], 99));
+
+  g_object_get (stream, "username", &stream_username, NULL);
+  stats = g_variant_ref_sink (hwangsae_relay_get_stats (relay));
+  latency = g_variant_lookup_value (stats, "latency", G_VARIANT_TYPE_VARDICT);
+  sink_latency = g_variant_lookup_value (latency, stream_username,
+      G_VARIANT_TYPE_VARDICT);
+  g_assert_nonnull (sink_latency);
+  g_assert_true (g_variant_lookup (sink_latency, "probes", "t",
+          &relay_probes));
+  g_assert_cmpuint (relay_probes, >=, probes->len);
+
+  hwangsae_test_streamer_stop (stream);
+}
+
+static void
+test_history (void)
+{
+  const guint WINDOW = 3;
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autoptr (GVariant) history = NULL;
+  g_autoptr (GVariant) recent = NULL;
+  g_autofree gchar *stream_username = NULL;
+  gint64 previous_timestamp = 0;
+  gint64 timestamp;
+  guint64 bitrate;
+  gdouble loss_ratio;
+  gdouble rtt_ms;
+  guint sources;
+  gsize i;
+
+  g_object_set (relay, "history-window", WINDOW, NULL);
+  g_object_set (stream, "synthetic", TRUE, NULL);
+
+  hwangsae_test_streamer_set_uri (stream, hwangsae_relay_get_sink_uri (relay));
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_streamer_start (stream);
+
+  /* Run for longer than the window, so that the ring wraps around. */
+  g_timeout_add_seconds (WINDOW + 2, (GSourceFunc) _quit_loop, loop);
+  g_main_loop_run (loop);
+
+  g_object_get (stream, "username", &stream_username, NULL);
+
+  history = g_variant_ref_sink (hwangsae_relay_get_history (relay,
+          stream_username, 0));
+  g_assert_cmpuint (g_variant_n_children (history), ==, WINDOW);
+
+  for (i = 0; i != WINDOW; ++i) {
+    g_variant_get_child (history, i, "(xtddu)", &timestamp, &bitrate,
+        &loss_ratio, &rtt_ms, &sources);
+
+    g_assert_cmpint (timestamp, >, previous_timestamp);
+    g_assert_cmpuint (sources, ==, 0);
+    previous_timestamp = timestamp;
+  }
+  g_assert_cmpuint (bitrate, >, 0);
+
+  recent = g_variant_ref_sink (hwangsae_relay_get_history (relay,
+          stream_username, timestamp));
+  g_assert_cmpuint (g_variant_n_children (recent), ==, 1);
+
+  g_clear_pointer (&history, g_variant_unref);
+  history = g_variant_ref_sink (hwangsae_relay_get_history (relay, "unknown",
+          0));
+  g_assert_cmpuint (g_variant_n_children (history), ==, 0);
+
+  hwangsae_test_streamer_stop (stream);
+}
+
+static guint64
+_get_metric_counter (GVariant * metrics, const gchar * name)
+{
+  guint64 value = 0;
+
+  g_variant_lookup (metrics, name, "t", &value);
+
+  return value;
+}
+
+static void
+test_metrics (void)
+{
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new (NULL, 8888, 9999);
+  g_autoptr (HwangsaeTestStreamer) stream = hwangsae_test_streamer_new ();
+  g_autoptr (GPtrArray) probes = NULL;
+  g_autoptr (GVariant) before = NULL;
+  g_autoptr (GVariant) after = NULL;
+  g_autoptr (GVariant) latency = NULL;
+  g_autofree gchar *source_uri = NULL;
+  gboolean sink_accepted = FALSE;
+  gint64 sinks;
+
+  g_object_set (relay, "authentication", TRUE, NULL);
+  g_signal_connect_swapped (relay, "caller-accepted", (GCallback) _flip_flag,
+      &sink_accepted);
+
+  g_object_set (stream, "synthetic", TRUE, NULL);
+  hwangsae_test_streamer_set_uri (stream, hwangsae_relay_get_sink_uri (relay));
+
+  before = g_variant_ref_sink (hwangsae_metrics_snapshot ());
+
+  hwangsae_relay_start (relay);
+  hwangsae_test_streamer_start (stream);
+
+  while (!sink_accepted) {
+    g_main_context_iteration (NULL, FALSE);
+  }
+
+  source_uri = hwangsae_test_build_source_uri (stream, relay,
+      RECEIVER_USERNAME);
+  probes = hwangsae_test_receive_latency_probes (source_uri, GST_SECOND);
+
+  after = g_variant_ref_sink (hwangsae_metrics_snapshot ());
+
+  g_assert_true (g_variant_lookup (after, "relay.sinks", "x", &sinks));
+  g_assert_cmpint (sinks, >=, 1);
+  g_assert_cmpuint (_get_metric_counter (after, "relay.packets-received"), >,
+      _get_metric_counter (before, "relay.packets-received"));
+  g_assert_cmpuint (_get_metric_counter (after, "relay.bytes-sent"), >,
+      _get_metric_counter (before, "relay.bytes-sent"));
+
+  /* Registered even though the relay doesn't stamp probes. */
+  latency = g_variant_lookup_value (after, "relay.probe-latency",
+      G_VARIANT_TYPE_VARDICT);
+  g_assert_nonnull (latency);
+
+  hwangsae_test_streamer_stop (stream);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -644,6 +2088,34 @@ main (int argc, char *argv[])
   g_test_add_func ("/hwangsae/relay-authentication", test_authentication);
   g_test_add_func ("/hwangsae/relay-no-auth", test_no_auth);
   g_test_add_func ("/hwangsae/relay-slave", test_slave);
+  g_test_add_func ("/hwangsae/relay-renditions", test_renditions);
+  g_test_add_func ("/hwangsae/relay-rendition-switching",
+      test_rendition_switching);
+  g_test_add_func ("/hwangsae/relay-rendition-switching-audio",
+      test_rendition_switching_audio);
+  g_test_add_func ("/hwangsae/relay-qos-classes", test_qos_classes);
+  g_test_add_func ("/hwangsae/relay-qos-default-class",
+      test_qos_default_class);
+  g_test_add_func ("/hwangsae/relay-qos-shedding", test_qos_shedding);
+  g_test_add_func ("/hwangsae/relay-egress-limit", test_egress_limit);
+  g_test_add_func ("/hwangsae/relay-egress-bitrate-limit",
+      test_egress_bitrate_limit);
+  g_test_add_func ("/hwangsae/relay-source-rate-limit",
+      test_source_rate_limit);
+  g_test_add_func ("/hwangsae/relay-timeshift", test_timeshift);
+  g_test_add_func ("/hwangsae/relay-timeshift-catch-up",
+      test_timeshift_catch_up);
+  g_test_add_func ("/hwangsae/relay-timeshift-memory-bound",
+      test_timeshift_memory_bound);
+  g_test_add_func ("/hwangsae/relay-stream-analysis", test_stream_analysis);
+  g_test_add_func ("/hwangsae/relay-capture", test_capture);
+  g_test_add_func ("/hwangsae/relay-replay", test_replay);
+  g_test_add_func ("/hwangsae/relay-impaired-link", test_impaired_link);
+  g_test_add_func ("/hwangsae/relay-bitrate-control", test_bitrate_control);
+  g_test_add_func ("/hwangsae/relay-synthetic-load", test_synthetic_load);
+  g_test_add_func ("/hwangsae/relay-latency-probes", test_latency_probes);
+  g_test_add_func ("/hwangsae/relay-metrics", test_metrics);
+  g_test_add_func ("/hwangsae/relay-history", test_history);
 
   return g_test_run ();
 }
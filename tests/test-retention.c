@@ -0,0 +1,665 @@
+/**
+ *  tests/test-retention
+ *
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "hwangsae/retention.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#define FILE_SIZE 1000
+
+/* Long enough for the retention thread to act on anything it should. */
+#define SETTLE_TIME_US (500 * 1000)
+
+typedef struct
+{
+  gchar *dir;
+  gchar *archive_dir;
+  HwangsaeRetention *retention;
+} TestFixture;
+
+static void
+fixture_setup (TestFixture * fixture, gconstpointer unused)
+{
+  g_autoptr (GError) error = NULL;
+
+  fixture->dir = g_dir_make_tmp ("hwangsae-test-retention-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  fixture->archive_dir =
+      g_dir_make_tmp ("hwangsae-test-retention-archive-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  fixture->retention = hwangsae_retention_new ();
+}
+
+static void
+_remove_recursive (const gchar * path)
+{
+  g_autoptr (GDir) dir = g_dir_open (path, 0, NULL);
+
+  if (dir) {
+    const gchar *name;
+
+    while ((name = g_dir_read_name (dir))) {
+      g_autofree gchar *child = g_build_filename (path, name, NULL);
+
+      _remove_recursive (child);
+    }
+  }
+
+  g_remove (path);
+}
+
+static void
+fixture_teardown (TestFixture * fixture, gconstpointer unused)
+{
+  g_clear_object (&fixture->retention);
+  _remove_recursive (fixture->dir);
+  _remove_recursive (fixture->archive_dir);
+  g_clear_pointer (&fixture->dir, g_free);
+  g_clear_pointer (&fixture->archive_dir, g_free);
+}
+
+static void
+_write_file (const gchar * path, gsize size, gint64 age)
+{
+  g_autoptr (GFile) file = g_file_new_for_path (path);
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *contents = g_malloc0 (size);
+
+  g_file_set_contents (path, contents, size, &error);
+  g_assert_no_error (error);
+
+  g_file_set_attribute_uint64 (file, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+      g_get_real_time () / G_USEC_PER_SEC - age, G_FILE_QUERY_INFO_NONE, NULL,
+      &error);
+  g_assert_no_error (error);
+}
+
+/* Creates a recording of FILE_SIZE bytes that is @age seconds old, along
+ * with its keyframe index, and returns its path. */
+static gchar *
+_make_recording (const gchar * root, const gchar * edge_id, guint n,
+    gint64 age)
+{
+  g_autofree gchar *edge_dir = g_build_filename (root, edge_id, NULL);
+  g_autofree gchar *filename = NULL;
+  g_autofree gchar *index_path = NULL;
+  gchar *path;
+
+  g_assert_cmpint (g_mkdir_with_parents (edge_dir, 0750), ==, 0);
+
+  filename = g_strdup_printf ("hwangsae-recording-%s-%u-%u.ts", edge_id, n,
+      n + 1);
+  path = g_build_filename (edge_dir, filename, NULL);
+  index_path = g_strconcat (path, ".idx", NULL);
+
+  _write_file (path, FILE_SIZE, age);
+  _write_file (index_path, 0, age);
+
+  return path;
+}
+
+static gboolean
+_exists (const gchar * path)
+{
+  return g_file_test (path, G_FILE_TEST_EXISTS);
+}
+
+static void
+_wait_for_unlink (const gchar * path)
+{
+  gint64 deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+
+  while (_exists (path)) {
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_usleep (10 * 1000);
+  }
+}
+
+static void
+_assert_unlinked (const gchar * path)
+{
+  g_autofree gchar *index_path = g_strconcat (path, ".idx", NULL);
+
+  _wait_for_unlink (path);
+  g_assert_false (_exists (index_path));
+}
+
+// retention-max-bytes ---------------------------------------------------------
+
+static void
+test_max_bytes (TestFixture * fixture, gconstpointer unused)
+{
+  g_autofree gchar *a1 = _make_recording (fixture->dir, "a", 1, 600);
+  g_autofree gchar *b1 = _make_recording (fixture->dir, "b", 1, 500);
+  g_autofree gchar *a2 = _make_recording (fixture->dir, "a", 2, 400);
+  g_autofree gchar *b2 = _make_recording (fixture->dir, "b", 2, 300);
+  g_autofree gchar *a3 = _make_recording (fixture->dir, "a", 3, 200);
+
+  /* The oldest files of all edges go first. */
+  g_object_set (fixture->retention, "max-bytes", (guint64) 3 * FILE_SIZE,
+      "recording-dir", fixture->dir, NULL);
+
+  _assert_unlinked (a1);
+  _assert_unlinked (b1);
+
+  g_usleep (SETTLE_TIME_US);
+  g_assert_true (_exists (a2));
+  g_assert_true (_exists (b2));
+  g_assert_true (_exists (a3));
+}
+
+// retention-max-age -----------------------------------------------------------
+
+static void
+test_max_age (TestFixture * fixture, gconstpointer unused)
+{
+  g_autofree gchar *a1 = _make_recording (fixture->dir, "a", 1, 1000);
+  g_autofree gchar *b1 = _make_recording (fixture->dir, "b", 1, 100);
+  g_autofree gchar *a2 = _make_recording (fixture->dir, "a", 2, 10);
+
+  g_object_set (fixture->retention, "max-age", 50, "recording-dir",
+      fixture->dir, NULL);
+
+  _assert_unlinked (a1);
+  _assert_unlinked (b1);
+
+  g_usleep (SETTLE_TIME_US);
+  g_assert_true (_exists (a2));
+}
+
+// retention-edge-max-bytes ----------------------------------------------------
+
+static void
+test_edge_max_bytes (TestFixture * fixture, gconstpointer unused)
+{
+  g_autofree gchar *b1 = _make_recording (fixture->dir, "b", 1, 1000);
+  g_autofree gchar *a1 = _make_recording (fixture->dir, "a", 1, 300);
+  g_autofree gchar *a2 = _make_recording (fixture->dir, "a", 2, 200);
+  g_autofree gchar *a3 = _make_recording (fixture->dir, "a", 3, 100);
+
+  /* Only edge "a" is over its limit, even though "b" has the oldest file. */
+  g_object_set (fixture->retention, "edge-max-bytes", (guint64) 2 * FILE_SIZE,
+      "recording-dir", fixture->dir, NULL);
+
+  _assert_unlinked (a1);
+
+  g_usleep (SETTLE_TIME_US);
+  g_assert_true (_exists (b1));
+  g_assert_true (_exists (a2));
+  g_assert_true (_exists (a3));
+}
+
+// retention-edge-max-age ------------------------------------------------------
+
+static void
+test_edge_max_age (TestFixture * fixture, gconstpointer unused)
+{
+  g_autofree gchar *a1 = _make_recording (fixture->dir, "a", 1, 1000);
+  g_autofree gchar *a2 = _make_recording (fixture->dir, "a", 2, 10);
+  g_autofree gchar *b1 = _make_recording (fixture->dir, "b", 1, 20);
+
+  g_object_set (fixture->retention, "edge-max-age", 100, "recording-dir",
+      fixture->dir, NULL);
+
+  _assert_unlinked (a1);
+
+  g_usleep (SETTLE_TIME_US);
+  g_assert_true (_exists (a2));
+  g_assert_true (_exists (b1));
+}
+
+// retention-unlink-rate -------------------------------------------------------
+
+#define UNLINK_RATE 5
+#define N_PACED_FILES 6
+
+static void
+test_unlink_rate (TestFixture * fixture, gconstpointer unused)
+{
+  gchar *paths[N_PACED_FILES];
+  gint64 start;
+  gint64 elapsed;
+  guint i;
+
+  for (i = 0; i != N_PACED_FILES; ++i) {
+    paths[i] = _make_recording (fixture->dir, "a", i, 1000 - i);
+  }
+
+  start = g_get_monotonic_time ();
+  g_object_set (fixture->retention, "unlink-rate", UNLINK_RATE, "max-age", 1,
+      "recording-dir", fixture->dir, NULL);
+
+  for (i = 0; i != N_PACED_FILES; ++i) {
+    /* Oldest first. */
+    _assert_unlinked (paths[i]);
+    g_free (paths[i]);
+  }
+
+  elapsed = g_get_monotonic_time () - start;
+
+  /* There is a pause after each deletion but the last. */
+  g_assert_cmpint (elapsed, >=,
+      (N_PACED_FILES - 1) * G_USEC_PER_SEC / UNLINK_RATE);
+}
+
+// retention-add-remove --------------------------------------------------------
+
+static void
+test_add_remove (TestFixture * fixture, gconstpointer unused)
+{
+  g_autofree gchar *a1 = NULL;
+  g_autofree gchar *a2 = NULL;
+  g_autofree gchar *a3 = NULL;
+  g_autofree gchar *a4 = NULL;
+  g_autofree gchar *edge_dir = g_build_filename (fixture->dir, "a", NULL);
+
+  g_assert_cmpint (g_mkdir_with_parents (edge_dir, 0750), ==, 0);
+
+  g_object_set (fixture->retention, "max-bytes",
+      (guint64) 5 * FILE_SIZE / 2, "recording-dir", fixture->dir, NULL);
+  g_usleep (SETTLE_TIME_US);
+
+  /* Recordings are reported as they complete. */
+  a1 = _make_recording (fixture->dir, "a", 1, 40);
+  hwangsae_retention_add_file (fixture->retention, a1);
+  a2 = _make_recording (fixture->dir, "a", 2, 30);
+  hwangsae_retention_add_file (fixture->retention, a2);
+
+  g_usleep (SETTLE_TIME_US);
+  g_assert_true (_exists (a1));
+
+  /* Deleted by someone else, so it no longer counts. */
+  hwangsae_retention_remove_file (fixture->retention, a1);
+
+  a3 = _make_recording (fixture->dir, "a", 3, 20);
+  hwangsae_retention_add_file (fixture->retention, a3);
+
+  g_usleep (SETTLE_TIME_US);
+  g_assert_true (_exists (a1));
+  g_assert_true (_exists (a2));
+
+  a4 = _make_recording (fixture->dir, "a", 4, 10);
+  hwangsae_retention_add_file (fixture->retention, a4);
+
+  /* The oldest file still known. */
+  _assert_unlinked (a2);
+
+  g_usleep (SETTLE_TIME_US);
+  g_assert_true (_exists (a1));
+  g_assert_true (_exists (a3));
+  g_assert_true (_exists (a4));
+}
+
+// retention-rescan ------------------------------------------------------------
+
+static void
+test_rescan (TestFixture * fixture, gconstpointer unused)
+{
+  g_autofree gchar *a1 = _make_recording (fixture->dir, "a", 1, 300);
+  g_autofree gchar *a2 = _make_recording (fixture->dir, "a", 2, 200);
+  g_autofree gchar *b1 = _make_recording (fixture->dir, "b", 1, 100);
+  g_autofree gchar *b2 = NULL;
+  g_autofree gchar *other_dir = NULL;
+
+  g_object_set (fixture->retention, "max-bytes", (guint64) 3 * FILE_SIZE,
+      "recording-dir", fixture->dir, NULL);
+
+  /* Reported while the scan may be running; they must not count twice. */
+  hwangsae_retention_add_file (fixture->retention, a1);
+  hwangsae_retention_add_file (fixture->retention, a2);
+  hwangsae_retention_add_file (fixture->retention, b1);
+
+  g_usleep (SETTLE_TIME_US);
+  g_assert_true (_exists (a1));
+  g_assert_true (_exists (a2));
+  g_assert_true (_exists (b1));
+
+  /* Going away and back forgets everything and scans again. */
+  other_dir = g_build_filename (fixture->dir, "a", NULL);
+  g_object_set (fixture->retention, "recording-dir", other_dir, NULL);
+  g_object_set (fixture->retention, "recording-dir", fixture->dir, NULL);
+
+  g_usleep (SETTLE_TIME_US);
+  g_assert_true (_exists (a1));
+  g_assert_true (_exists (a2));
+  g_assert_true (_exists (b1));
+
+  b2 = _make_recording (fixture->dir, "b", 2, 0);
+  hwangsae_retention_add_file (fixture->retention, b2);
+
+  _assert_unlinked (a1);
+
+  g_usleep (SETTLE_TIME_US);
+  g_assert_true (_exists (a2));
+  g_assert_true (_exists (b1));
+  g_assert_true (_exists (b2));
+}
+
+// retention-unlink-recording --------------------------------------------------
+
+static void
+test_unlink_recording (TestFixture * fixture, gconstpointer unused)
+{
+  g_autofree gchar *a1 = _make_recording (fixture->dir, "a", 1, 0);
+  g_autofree gchar *a2 = _make_recording (fixture->dir, "a", 2, 0);
+  g_autofree gchar *trick_play = NULL;
+  g_autofree gchar *playlist = NULL;
+
+  trick_play = g_build_filename (fixture->dir, "a",
+      "hwangsae-recording-a-1-2.iframes.ts", NULL);
+  _write_file (trick_play, FILE_SIZE, 0);
+  playlist = g_build_filename (fixture->dir, "a",
+      "hwangsae-recording-a.m3u8", NULL);
+  _write_file (playlist, FILE_SIZE, 0);
+
+  hwangsae_retention_unlink_recording (a1);
+
+  _assert_unlinked (a1);
+  g_assert_false (_exists (trick_play));
+  g_assert_true (_exists (a2));
+  /* Still lists a file that is there. */
+  g_assert_true (_exists (playlist));
+
+  hwangsae_retention_unlink_recording (a2);
+
+  _assert_unlinked (a2);
+  g_assert_false (_exists (playlist));
+}
+
+// retention-playlist ----------------------------------------------------------
+
+static void
+test_playlist (TestFixture * fixture, gconstpointer unused)
+{
+  g_autofree gchar *a1 = _make_recording (fixture->dir, "a", 1, 300);
+  g_autofree gchar *a2 = _make_recording (fixture->dir, "a", 2, 200);
+  g_autofree gchar *playlist = NULL;
+  g_autofree gchar *other = NULL;
+  g_autofree gchar *other_playlist = NULL;
+
+  playlist = g_build_filename (fixture->dir, "a",
+      "hwangsae-recording-a.m3u8", NULL);
+  _write_file (playlist, FILE_SIZE, 300);
+
+  /* Another recording of the same edge, with a prefix that begins alike. */
+  other = g_build_filename (fixture->dir, "a",
+      "hwangsae-recording-a-live-3-4.ts", NULL);
+  _write_file (other, FILE_SIZE, 10);
+  other_playlist = g_build_filename (fixture->dir, "a",
+      "hwangsae-recording-a-live.m3u8", NULL);
+  _write_file (other_playlist, FILE_SIZE, 10);
+
+  g_object_set (fixture->retention, "max-age", 100, "recording-dir",
+      fixture->dir, NULL);
+
+  _assert_unlinked (a1);
+  _assert_unlinked (a2);
+  _wait_for_unlink (playlist);
+
+  g_usleep (SETTLE_TIME_US);
+  g_assert_true (_exists (other));
+  g_assert_true (_exists (other_playlist));
+}
+
+// retention-archive -----------------------------------------------------------
+
+static guint64
+_get_mtime (const gchar * path)
+{
+  g_autoptr (GFile) file = g_file_new_for_path (path);
+  g_autoptr (GFileInfo) info = NULL;
+  g_autoptr (GError) error = NULL;
+
+  info = g_file_query_info (file, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+      G_FILE_QUERY_INFO_NONE, NULL, &error);
+  g_assert_no_error (error);
+
+  return g_file_info_get_attribute_uint64 (info,
+      G_FILE_ATTRIBUTE_TIME_MODIFIED);
+}
+
+/* Fills @path with @size bytes that aren't all alike, so that a corrupted
+ * copy would show, and keeps its modification time. */
+static void
+_fill_file (const gchar * path, gsize size)
+{
+  g_autoptr (GFile) file = g_file_new_for_path (path);
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *contents = g_malloc (size);
+  guint64 mtime = _get_mtime (path);
+  gsize i;
+
+  for (i = 0; i < size; ++i) {
+    contents[i] = i % 251;
+  }
+
+  g_file_set_contents (path, contents, size, &error);
+  g_assert_no_error (error);
+
+  g_file_set_attribute_uint64 (file, G_FILE_ATTRIBUTE_TIME_MODIFIED, mtime,
+      G_FILE_QUERY_INFO_NONE, NULL, &error);
+  g_assert_no_error (error);
+}
+
+static gchar *
+_get_archive_path (TestFixture * fixture, const gchar * path)
+{
+  g_autofree gchar *dir = g_path_get_dirname (path);
+  g_autofree gchar *edge_id = g_path_get_basename (dir);
+  g_autofree gchar *filename = g_path_get_basename (path);
+
+  return g_build_filename (fixture->archive_dir, edge_id, filename, NULL);
+}
+
+static void
+_wait_for_file (const gchar * path)
+{
+  gint64 deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+
+  while (!_exists (path)) {
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_usleep (10 * 1000);
+  }
+}
+
+static void
+test_archive (TestFixture * fixture, gconstpointer unused)
+{
+  g_autofree gchar *a1 = _make_recording (fixture->dir, "a", 1, 100);
+  g_autofree gchar *a2 = _make_recording (fixture->dir, "a", 2, 0);
+  g_autofree gchar *a1_trick_play = NULL;
+  g_autofree gchar *archived = _get_archive_path (fixture, a1);
+  g_autofree gchar *archived_index = g_strconcat (archived, ".idx", NULL);
+  g_autofree gchar *archived_trick_play = NULL;
+  g_autofree gchar *archived_part = g_strconcat (archived, ".part", NULL);
+  g_autofree gchar *a2_archived = _get_archive_path (fixture, a2);
+  g_autofree gchar *contents = NULL;
+  g_autofree gchar *archived_contents = NULL;
+  gsize contents_len;
+  gsize archived_contents_len;
+  guint64 mtime;
+
+  a1_trick_play = g_build_filename (fixture->dir, "a",
+      "hwangsae-recording-a-1-2.iframes.ts", NULL);
+  archived_trick_play = g_build_filename (fixture->archive_dir, "a",
+      "hwangsae-recording-a-1-2.iframes.ts", NULL);
+
+  _fill_file (a1, 10 * FILE_SIZE);
+  _write_file (a1_trick_play, FILE_SIZE, 100);
+  mtime = _get_mtime (a1);
+  g_assert_true (g_file_get_contents (a1, &contents, &contents_len, NULL));
+
+  g_object_set (fixture->retention, "archive-dir", fixture->archive_dir,
+      "archive-age", 50, "recording-dir", fixture->dir, NULL);
+
+  /* The original goes only once its copy is complete. */
+  _assert_unlinked (a1);
+  g_assert_false (_exists (a1_trick_play));
+
+  g_assert_true (g_file_get_contents (archived, &archived_contents,
+          &archived_contents_len, NULL));
+  g_assert_cmpmem (archived_contents, archived_contents_len, contents,
+      contents_len);
+  g_assert_cmpuint (_get_mtime (archived), ==, mtime);
+  g_assert_true (_exists (archived_index));
+  g_assert_true (_exists (archived_trick_play));
+  g_assert_false (_exists (archived_part));
+
+  /* Too young to archive. */
+  g_usleep (SETTLE_TIME_US);
+  g_assert_true (_exists (a2));
+  g_assert_false (_exists (a2_archived));
+}
+
+static void
+test_archive_playlist (TestFixture * fixture, gconstpointer unused)
+{
+  g_autofree gchar *a1 = _make_recording (fixture->dir, "a", 1, 200);
+  g_autofree gchar *a2 = _make_recording (fixture->dir, "a", 2, 100);
+  g_autofree gchar *a2_archived = _get_archive_path (fixture, a2);
+  g_autofree gchar *playlist = NULL;
+  g_autofree gchar *playlist_archived = NULL;
+  g_autofree gchar *contents = NULL;
+  g_autofree gchar *archived_contents = NULL;
+
+  playlist = g_build_filename (fixture->dir, "a",
+      "hwangsae-recording-a.m3u8", NULL);
+  playlist_archived = _get_archive_path (fixture, playlist);
+  contents = g_strdup ("#EXTM3U\n"
+      "#EXTINF:1.000,\nhwangsae-recording-a-1-2.ts\n"
+      "#EXTINF:1.000,\nhwangsae-recording-a-2-3.ts\n");
+  g_assert_true (g_file_set_contents (playlist, contents, -1, NULL));
+
+  g_object_set (fixture->retention, "archive-dir", fixture->archive_dir,
+      "archive-age", 50, "recording-dir", fixture->dir, NULL);
+
+  _assert_unlinked (a1);
+  _assert_unlinked (a2);
+  g_assert_true (_exists (a2_archived));
+
+  /* The playlist follows the last file of the recording. */
+  _wait_for_file (playlist_archived);
+  g_assert_false (_exists (playlist));
+  g_assert_true (g_file_get_contents (playlist_archived, &archived_contents,
+          NULL, NULL));
+  g_assert_cmpstr (archived_contents, ==, contents);
+}
+
+/* Starts archiving a recording slowly enough to interrupt it and waits until
+ * the copy is under way. Returns the path of the recording. */
+static gchar *
+_start_slow_archive (TestFixture * fixture)
+{
+  gchar *path = _make_recording (fixture->dir, "a", 1, 100);
+  g_autofree gchar *archived = _get_archive_path (fixture, path);
+  g_autofree gchar *archived_part = g_strconcat (archived, ".part", NULL);
+
+  /* Takes two seconds to copy. */
+  _fill_file (path, 4 * FILE_SIZE);
+
+  g_object_set (fixture->retention, "archive-dir", fixture->archive_dir,
+      "archive-age", 50, "archive-bandwidth", (guint64) 2 * FILE_SIZE,
+      "recording-dir", fixture->dir, NULL);
+
+  _wait_for_file (archived_part);
+
+  return path;
+}
+
+/* Waits for an interrupted copy of @path to be cleaned up. */
+static void
+_assert_archive_discarded (TestFixture * fixture, const gchar * path)
+{
+  g_autofree gchar *archived = _get_archive_path (fixture, path);
+  g_autofree gchar *archived_part = g_strconcat (archived, ".part", NULL);
+  gint64 deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+
+  /* Until the copy completes the .part is there, then the copy itself. */
+  while (_exists (archived_part) || _exists (archived)) {
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_usleep (10 * 1000);
+  }
+
+  _assert_unlinked (archived);
+}
+
+static void
+test_archive_dir_changed (TestFixture * fixture, gconstpointer unused)
+{
+  g_autofree gchar *a1 = _start_slow_archive (fixture);
+  g_autofree gchar *a1_index = g_strconcat (a1, ".idx", NULL);
+
+  g_object_set (fixture->retention, "archive-dir", NULL, NULL);
+
+  _assert_archive_discarded (fixture, a1);
+
+  g_usleep (SETTLE_TIME_US);
+  g_assert_true (_exists (a1));
+  g_assert_true (_exists (a1_index));
+}
+
+static void
+test_archive_deleted (TestFixture * fixture, gconstpointer unused)
+{
+  g_autofree gchar *a1 = _start_slow_archive (fixture);
+
+  /* As the Delete method of the agent does. */
+  hwangsae_retention_remove_file (fixture->retention, a1);
+  hwangsae_retention_unlink_recording (a1);
+
+  _assert_archive_discarded (fixture, a1);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/hwangsae/retention-max-bytes", TestFixture, NULL,
+      fixture_setup, test_max_bytes, fixture_teardown);
+  g_test_add ("/hwangsae/retention-max-age", TestFixture, NULL,
+      fixture_setup, test_max_age, fixture_teardown);
+  g_test_add ("/hwangsae/retention-edge-max-bytes", TestFixture, NULL,
+      fixture_setup, test_edge_max_bytes, fixture_teardown);
+  g_test_add ("/hwangsae/retention-edge-max-age", TestFixture, NULL,
+      fixture_setup, test_edge_max_age, fixture_teardown);
+  g_test_add ("/hwangsae/retention-unlink-rate", TestFixture, NULL,
+      fixture_setup, test_unlink_rate, fixture_teardown);
+  g_test_add ("/hwangsae/retention-add-remove", TestFixture, NULL,
+      fixture_setup, test_add_remove, fixture_teardown);
+  g_test_add ("/hwangsae/retention-rescan", TestFixture, NULL,
+      fixture_setup, test_rescan, fixture_teardown);
+  g_test_add ("/hwangsae/retention-unlink-recording", TestFixture, NULL,
+      fixture_setup, test_unlink_recording, fixture_teardown);
+  g_test_add ("/hwangsae/retention-playlist", TestFixture, NULL,
+      fixture_setup, test_playlist, fixture_teardown);
+  g_test_add ("/hwangsae/retention-archive", TestFixture, NULL,
+      fixture_setup, test_archive, fixture_teardown);
+  g_test_add ("/hwangsae/retention-archive-playlist", TestFixture, NULL,
+      fixture_setup, test_archive_playlist, fixture_teardown);
+  g_test_add ("/hwangsae/retention-archive-dir-changed", TestFixture, NULL,
+      fixture_setup, test_archive_dir_changed, fixture_teardown);
+  g_test_add ("/hwangsae/retention-archive-deleted", TestFixture, NULL,
+      fixture_setup, test_archive_deleted, fixture_teardown);
+
+  return g_test_run ();
+}
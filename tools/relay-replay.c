@@ -0,0 +1,309 @@
+/**
+ *  Copyright 2020 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "hwangsae/capture.h"
+#include "hwangsae/common.h"
+#include "hwangsae/relay.h"
+
+#include <string.h>
+#include <srt/srt.h>
+#include <gio/gio.h>
+
+/* Sources aren't consumers we care about, only their load on the relay. */
+#define DRAIN_BUFFER_SIZE 1500
+
+typedef struct
+{
+  gchar *sink_uri;
+  gchar *source_uri;
+  gdouble speed;
+} ReplayOptions;
+
+typedef struct
+{
+  gchar *sink_host;
+  guint sink_port;
+  gchar *source_host;
+  guint source_port;
+
+  /* Trace socket IDs to our SRT sockets. */
+  GHashTable *sinks;
+  GHashTable *sources;
+} ReplayContext;
+
+static SRTSOCKET
+_connect (const gchar * host, guint port, const gchar * streamid)
+{
+  g_autoptr (GSocketAddress) addr = NULL;
+  g_autoptr (GError) error = NULL;
+  SRTSOCKET sock;
+  gpointer sa;
+  gsize sa_len;
+
+  addr = g_inet_socket_address_new_from_string (host, port);
+  if (!addr) {
+    g_printerr ("Invalid relay address %s:%u\n", host, port);
+    return SRT_INVALID_SOCK;
+  }
+
+  sa_len = g_socket_address_get_native_size (addr);
+  sa = g_alloca (sa_len);
+
+  if (!g_socket_address_to_native (addr, sa, sa_len, &error)) {
+    g_printerr ("%s\n", error->message);
+    return SRT_INVALID_SOCK;
+  }
+
+  sock = srt_create_socket ();
+
+  if (streamid) {
+    srt_setsockflag (sock, SRTO_STREAMID, streamid, strlen (streamid));
+  }
+
+  if (srt_connect (sock, sa, sa_len) == SRT_ERROR) {
+    g_printerr ("Can't connect to %s:%u: %s\n", host, port,
+        srt_getlasterror_str ());
+    srt_close (sock);
+    return SRT_INVALID_SOCK;
+  }
+
+  return sock;
+}
+
+static void
+_close_socket (gpointer sock)
+{
+  srt_close (GPOINTER_TO_INT (sock));
+}
+
+static void
+_sink_connected (ReplayContext * ctx, const HwangsaeCaptureRecord * record,
+    const guint8 * data)
+{
+  g_autofree gchar *username = g_strndup ((const gchar *) data, record->size);
+  g_autofree gchar *streamid = NULL;
+  SRTSOCKET sock;
+
+  if (*username) {
+    streamid = g_strdup_printf ("#!::u=%s", username);
+  }
+
+  sock = _connect (ctx->sink_host, ctx->sink_port, streamid);
+  if (sock != SRT_INVALID_SOCK) {
+    g_hash_table_insert (ctx->sinks, GINT_TO_POINTER (record->socket),
+        GINT_TO_POINTER (sock));
+  }
+}
+
+static void
+_source_connected (ReplayContext * ctx, const HwangsaeCaptureRecord * record,
+    const guint8 * data)
+{
+  g_autofree gchar *username = g_strndup ((const gchar *) data, record->size);
+  g_autofree gchar *resource = NULL;
+  g_autofree gchar *streamid = NULL;
+  gsize username_len = strlen (username);
+  SRTSOCKET sock;
+  gboolean nonblocking = FALSE;
+
+  if (username_len < record->size) {
+    resource = g_strndup ((const gchar *) data + username_len + 1,
+        record->size - username_len - 1);
+  }
+
+  streamid = g_strdup_printf ("#!::u=%s,r=%s", username,
+      resource ? resource : "");
+
+  sock = _connect (ctx->source_host, ctx->source_port, streamid);
+  if (sock != SRT_INVALID_SOCK) {
+    srt_setsockflag (sock, SRTO_RCVSYN, &nonblocking, sizeof (nonblocking));
+    g_hash_table_insert (ctx->sources, GINT_TO_POINTER (record->socket),
+        GINT_TO_POINTER (sock));
+  }
+}
+
+static void
+_send_packet (ReplayContext * ctx, const HwangsaeCaptureRecord * record,
+    const guint8 * data)
+{
+  gpointer sock;
+
+  if (!g_hash_table_lookup_extended (ctx->sinks,
+          GINT_TO_POINTER (record->socket), NULL, &sock)) {
+    /* Connected before the oldest record kept in the ring. */
+    return;
+  }
+
+  if (srt_send (GPOINTER_TO_INT (sock), (const char *) data,
+          record->size) == SRT_ERROR) {
+    g_printerr ("Send failed: %s\n", srt_getlasterror_str ());
+  }
+}
+
+static void
+_drain_sources (ReplayContext * ctx)
+{
+  GHashTableIter it;
+  gpointer sock;
+  char buf[DRAIN_BUFFER_SIZE];
+
+  g_hash_table_iter_init (&it, ctx->sources);
+  while (g_hash_table_iter_next (&it, NULL, &sock)) {
+    while (srt_recv (GPOINTER_TO_INT (sock), buf, sizeof (buf)) > 0) {
+      /* Discard. */
+    }
+  }
+}
+
+static void
+replay (ReplayContext * ctx, HwangsaeCaptureReader * reader, gdouble speed)
+{
+  const HwangsaeCaptureRecord *record;
+  const guint8 *data;
+  gint64 first_timestamp = -1;
+  gint64 start = g_get_monotonic_time ();
+  guint64 packets = 0;
+
+  while (hwangsae_capture_reader_next (reader, &record, &data)) {
+    gint64 due;
+
+    if (first_timestamp < 0) {
+      first_timestamp = record->timestamp;
+    }
+
+    /* Keep the original spacing of records, compressed by speed. */
+    due = start + (record->timestamp - first_timestamp) / speed;
+    while (g_get_monotonic_time () < due) {
+      _drain_sources (ctx);
+      g_usleep (MIN (1000, due - g_get_monotonic_time ()));
+    }
+
+    switch (record->type) {
+      case HWANGSAE_CAPTURE_RECORD_SINK_CONNECTED:
+        _sink_connected (ctx, record, data);
+        break;
+      case HWANGSAE_CAPTURE_RECORD_SINK_DISCONNECTED:
+        g_hash_table_remove (ctx->sinks, GINT_TO_POINTER (record->socket));
+        break;
+      case HWANGSAE_CAPTURE_RECORD_SOURCE_CONNECTED:
+        _source_connected (ctx, record, data);
+        break;
+      case HWANGSAE_CAPTURE_RECORD_SOURCE_DISCONNECTED:
+        g_hash_table_remove (ctx->sources, GINT_TO_POINTER (record->socket));
+        break;
+      case HWANGSAE_CAPTURE_RECORD_PACKET:
+        _send_packet (ctx, record, data);
+        ++packets;
+        break;
+      default:
+        g_printerr ("Skipping record of unknown type %u\n", record->type);
+        break;
+    }
+  }
+
+  g_print ("Replayed %" G_GUINT64_FORMAT " packets in %.1f s\n", packets,
+      (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC);
+}
+
+int
+main (int argc, char *argv[])
+{
+  ReplayOptions options = { NULL, NULL, 1.0 };
+  ReplayContext ctx = { 0 };
+
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GOptionContext) context = NULL;
+  g_autoptr (HwangsaeRelay) relay = NULL;
+  HwangsaeCaptureReader *reader;
+  GOptionEntry entries[] = {
+    {"sink-uri", 0, 0, G_OPTION_ARG_STRING, &options.sink_uri,
+        "Sink URI of the relay to replay against", "URI"},
+    {"source-uri", 0, 0, G_OPTION_ARG_STRING, &options.source_uri,
+        "Source URI of the relay to replay against", "URI"},
+    {"speed", 0, 0, G_OPTION_ARG_DOUBLE, &options.speed,
+        "Replay speed multiplier (default: 1.0)", "SPEED"},
+    {NULL}
+  };
+
+  context = g_option_context_new ("TRACE-FILE");
+  g_option_context_set_summary (context,
+      "Replays traffic captured by a relay with \"capture-file\" set. "
+      "Without relay URIs, an in-process relay listening on ports 8888 and "
+      "9999 is started.");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    return -1;
+  }
+
+  if (argc != 2) {
+    g_printerr ("You must specify a trace file to replay\n");
+    return 1;
+  }
+
+  if (options.speed <= 0) {
+    g_printerr ("Speed must be positive\n");
+    return 1;
+  }
+
+  reader = hwangsae_capture_reader_new (argv[1], &error);
+  if (!reader) {
+    g_printerr ("%s\n", error->message);
+    return 1;
+  }
+
+  srt_startup ();
+
+  if (!options.sink_uri || !options.source_uri) {
+    relay = hwangsae_relay_new (NULL, 8888, 9999);
+    g_object_set (relay, "authentication", TRUE, NULL);
+    hwangsae_relay_start (relay);
+
+    if (!options.sink_uri) {
+      options.sink_uri = g_strdup (hwangsae_relay_get_sink_uri (relay));
+    }
+    if (!options.source_uri) {
+      options.source_uri = g_strdup (hwangsae_relay_get_source_uri (relay));
+    }
+  }
+
+  if (!hwangsae_common_parse_srt_uri (options.sink_uri, &ctx.sink_host,
+          &ctx.sink_port) ||
+      !hwangsae_common_parse_srt_uri (options.source_uri, &ctx.source_host,
+          &ctx.source_port)) {
+    g_printerr ("Invalid relay URI\n");
+    return 1;
+  }
+
+  ctx.sinks = g_hash_table_new_full (NULL, NULL, NULL, _close_socket);
+  ctx.sources = g_hash_table_new_full (NULL, NULL, NULL, _close_socket);
+
+  replay (&ctx, reader, options.speed);
+
+  g_hash_table_destroy (ctx.sources);
+  g_hash_table_destroy (ctx.sinks);
+  g_free (ctx.sink_host);
+  g_free (ctx.source_host);
+  g_free (options.sink_uri);
+  g_free (options.source_uri);
+  hwangsae_capture_reader_free (reader);
+
+  g_clear_object (&relay);
+  srt_cleanup ();
+
+  return 0;
+}